@@ -4,43 +4,119 @@
 #include <Arduino.h>
 #include <Wire.h>
 #include <SensirionI2CScd4x.h>
-#include "Display.h"  // For SensorData struct
+#include "SensorData.h"
+#include "I2CScheduler.h"
+#include "I2CDevices.h"
+#include "WarmupDetector.h"
+
+// How often each recovery level has been needed since boot
+struct RecoveryStats {
+  uint32_t busRecoveries;        // Stuck SDA clocked free and Wire restarted
+  uint32_t measurementRestarts;  // Periodic measurement stopped and restarted
+  uint32_t fullReinits;          // Full reset() -> begin() sequence
+};
 
 class CO2Sensor {
 public:
-  // Constructor
-  CO2Sensor(int co2AlarmThreshold);
+  // Constructor; readings are polled through the bus scheduler, setup and
+  // recovery talk to the sensor directly while holding it
+  CO2Sensor(I2CScheduler& scheduler, int co2AlarmThreshold, uint8_t sdaPin = SDA, uint8_t sclPin = SCL);
   
   // Initialize the sensor
   bool begin();
   
-  // Update sensor data (returns true if data was updated)
+  // Pick up a sensor that kept measuring while the ESP32 reset, skipping
+  // the stop/start of begin() and, if it had finished, the warmup. Falls
+  // back to begin() when the sensor doesn't answer. A sensor left idle in single shot mode is put
+  // back into periodic measurement until the mode is set again.
+  bool resume(bool warmedUp, bool lowPowerMode, bool singleShot);
+  
+  // Take the newest reading the scheduler collected (returns true if data was updated)
   bool update();
   
+  // The last update() brought a new CO2 value, not only temperature and
+  // humidity with the previous CO2 held
+  bool isCo2Fresh() const;
+  
   // Get the current sensor data
   SensorData getData() const;
   
   // Check if the sensor is connected
   bool isConnected() const;
   
-  // Get the number of valid readings since initialization
-  uint8_t getValidReadingCount() const;
+  // The readings since begin() have settled, or the warmup timed out
+  bool isWarmedUp() const;
+  
+  // The last update() ended the warmup, and the level the readings settled at
+  bool hasFinishedWarmup() const;
+  uint16_t getSettledCo2() const;
+  
+  // Time between CO2 readings in the current mode (ms): 5 s periodic, 30 s
+  // low power, the shot interval in single shot mode
+  unsigned long getCo2Interval() const;
   
   // Reset the sensor
   bool reset();
   
+  // Try to get the sensor back after a bus error, cheapest level first:
+  // bus recovery, then measurement restart, then a full reinit
+  bool recover();
+  
+  // Get the recovery counters
+  RecoveryStats getRecoveryStats() const;
+  
+  // Switch between periodic (5 s) and low power periodic (30 s) measurement
+  bool setLowPowerMode(bool enabled);
+  bool isLowPowerMode() const;
+  
+  // Leave the sensor idle and take a CO2 single shot every co2IntervalMs
+  // instead (0 goes back to periodic measurement), with temperature and
+  // humidity only shots every rhtIntervalMs in between: 50 ms instead of
+  // 5 s each. Within 20 % of the alarm threshold CO2 is measured at the RHT
+  // interval too. Single shots need an SCD41; an SCD40 stays in periodic
+  // measurement.
+  bool setSingleShotMode(unsigned long co2IntervalMs, unsigned long rhtIntervalMs);
+  bool isSingleShotMode() const;
+  
+  // The sensor takes single shots (SCD41); known once single shot mode has
+  // been asked for
+  bool hasSingleShot() const;
+  
 private:
   SensirionI2CScd4x _scd4x;
+  I2CScheduler& _scheduler;
+  Scd4xDevice _device;
   SensorData _currentData;
   bool _connected;
-  uint8_t _validReadingCount;
+  WarmupDetector _warmup;
   int _co2AlarmThreshold;
+  uint8_t _sdaPin;
+  uint8_t _sclPin;
+  unsigned long _lastReadingTime;
+  RecoveryStats _recoveryStats;
+  bool _lowPowerMode;
+  bool _co2Fresh;
+  bool _warmupDone;
+  unsigned long _co2Interval;   // Single shot mode, 0 when periodic
+  unsigned long _rhtInterval;
+  bool _probed;                 // Whether single shots work is known
+  bool _hasSingleShot;
+  bool _nearAlarm;              // CO2 shots at the RHT interval
+  
+  // Without a new reading for this long the measurement is assumed stopped
+  static const unsigned long MEASUREMENT_STALE_MS = 120000;
   
   // Internal methods
   bool checkConnection();
   void scanI2CBus();
   bool stopMeasurement();
   bool startMeasurement();
+  bool restartMeasurement();
+  void updateWarmupInterval();
+  bool recoverBus(bool& freed);
+  bool probeSensor();
+  bool probeSingleShot();
+  void applyShotIntervals();
 };
 
 #endif // CO2SENSOR_H 
\ No newline at end of file
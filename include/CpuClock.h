@@ -0,0 +1,76 @@
+#ifndef CPUCLOCK_H
+#define CPUCLOCK_H
+
+#include <Arduino.h>
+
+// CPU clock policy: the lowest clock while the loop idles or waits on the
+// sensor and the panel, full speed only while something is CPU bound
+// (rendering, the frame upload over SPI, I2C transactions). Boosts are
+// reference counted, so nested ones (an upload inside a render) switch the
+// clock once.
+//
+// Only the PLL clocks are used (80, 160 and 240 MHz): they all keep the APB
+// bus at 80 MHz, so SPI, I2C and UART timing and WiFi are unaffected by a
+// switch. The time spent at each clock and the render time at each boost
+// clock are kept for the summary; on the host the switch is only recorded.
+class CpuClock {
+public:
+  CpuClock();
+
+  // Start at the idle clock; boosts switch to the boost clock
+  void begin(uint32_t idleMhz, uint32_t boostMhz);
+
+  // Run at the boost clock until the matching release()
+  void acquire();
+  void release();
+
+  // Boost clock, and the next one of the three, to compare render times
+  void setBoostFrequency(uint32_t mhz);
+  uint32_t cycleBoostFrequency();
+
+  // Current clock (MHz)
+  uint32_t getFrequency() const;
+
+  // Time spent at a clock (ms) since begin()
+  uint32_t getTimeAt(uint32_t mhz);
+
+  // One frame rendered in the given time (us), at the current clock
+  void recordRender(uint32_t micros);
+
+  // Time at each clock, boosts, and render time per clock
+  void printSummary(Print& out);
+
+  static const uint8_t LEVELS = 3;
+
+private:
+  struct RenderStats {
+    uint32_t count;
+    uint32_t total;      // us
+    uint32_t max;        // us
+  };
+
+  uint32_t _idleMhz;
+  uint32_t _boostMhz;
+  uint32_t _frequency;
+  uint8_t _holds;
+  uint32_t _boosts;
+  unsigned long _since;          // micros() of the last switch or account
+  uint64_t _timeAt[LEVELS];      // us
+  RenderStats _renders[LEVELS];
+
+  void set(uint32_t mhz);
+  void account();
+  static int8_t level(uint32_t mhz);
+};
+
+// Shared clock policy used by the display, the bus and the main loop
+extern CpuClock cpuClock;
+
+// Boost for the lifetime of a scope
+class ClockBoost {
+public:
+  ClockBoost() { cpuClock.acquire(); }
+  ~ClockBoost() { cpuClock.release(); }
+};
+
+#endif // CPUCLOCK_H
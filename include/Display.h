@@ -4,9 +4,22 @@
 #include <Arduino.h>
 #include <SPI.h>
 #include <Adafruit_GFX.h>
+#ifdef PACKED_FONTS
+// Generated by tools/pack_fonts.py at the start of the build, from the GFX
+// fonts PlatformIO downloads; same names, same pixels
+#include "packed/FreeMonoBold24pt7b.h"
+#include "packed/FreeMonoBold18pt7b.h"
+#include "packed/FreeMonoBold12pt7b.h"
+#else
 #include <Fonts/FreeMonoBold24pt7b.h>
 #include <Fonts/FreeMonoBold18pt7b.h>
 #include <Fonts/FreeMonoBold12pt7b.h>
+#endif
+#include "EPaperPanel.h"
+#include "FrameCache.h"
+#include "GlyphCache.h"
+#include "SensorData.h"
+#include "VentilationEstimator.h"
 
 // Define display colors enum
 enum DisplayColor {
@@ -20,15 +33,12 @@ enum AirQualityStatus {
     AIR_GOOD,         // 600-800 ppm
     AIR_FAIR,         // 800-1000 ppm
     AIR_POOR,         // 1000-1500 ppm
-    AIR_UNHEALTHY     // Above 1500 ppm
+    AIR_UNHEALTHY,    // Above 1500 ppm
+    AIR_STATUS_COUNT  // Number of levels
 };
 
-// Structure to hold sensor data
-struct SensorData {
-  uint16_t co2;
-  float temperature;
-  float humidity;
-};
+// Air quality level of a CO2 reading
+AirQualityStatus classifyAirQuality(uint16_t co2Value);
 
 // Structure to hold historical data for mini charts
 struct HistoricalData {
@@ -39,24 +49,52 @@ struct HistoricalData {
   int index;           // Current index in circular buffer
 };
 
+// Time spent in each air quality level over a period
+struct ExposureSummary {
+  uint32_t ms[AIR_STATUS_COUNT];
+};
+
+// History chart built from aggregates of the stored history, oldest bar first
+struct ChartData {
+  static const uint8_t MAX_BARS = 48;
+  uint16_t average[MAX_BARS];   // Bar height, 0 when the bar has no records
+  uint16_t peak[MAX_BARS];      // Highest reading, marks bars that hit the alarm
+  uint8_t count;                // Number of bars, at least 1
+  uint16_t min;                 // Lowest and highest reading in the window
+  uint16_t max;
+  char title[24];
+};
+
+// Renders the monitor screens into a 1bpp buffer. The raster part has no
+// pin or SPI dependencies; frames only reach a panel when one is attached.
 class Display : public Adafruit_GFX {
 public:
   // Constructor with all pin definitions
   Display(uint8_t busy_pin, uint8_t cs_pin, uint8_t rst_pin, uint8_t dc_pin, 
           int co2_alarm_threshold, uint8_t data_history_size);
   
+  // Constructor without a panel, for rendering frames off the device
+  Display(int co2_alarm_threshold, uint8_t data_history_size);
+  
   // Destructor
   ~Display();
           
   // Initialize the display
   bool begin();
   
-  // Update the full display with sensor data
+  // Update the full display with sensor data; the exposure bars are drawn
+  // when day and week summaries are given, the air change rate when a
+  // valid ventilation estimate is. The history chart shows chart when
+  // given, otherwise the co2History ring. force refreshes the panel even
+  // when it already shows the frame (see update()).
   void updateFull(const SensorData& data, const uint16_t* co2History, 
-                 int historyIndex, bool sensorConnected);
+                 int historyIndex, const HistoricalData& miniHistory,
+                 bool sensorConnected, const ExposureSummary* day = nullptr,
+                 const ExposureSummary* week = nullptr, const ChartData* chart = nullptr,
+                 const VentilationEstimate* ventilation = nullptr, bool force = false);
   
   // Update just the chart area
-  void updateChart(const uint16_t* co2History, int historyIndex);
+  void updateChart(const uint16_t* co2History, int historyIndex, bool force = false);
   
   // Display connection instructions when sensor is not connected
   void showConnectionInstructions();
@@ -64,6 +102,11 @@ public:
   // Display loading screen during device startup
   void showLoadingScreen();
   
+  // Set the mounting orientation (0-3, quarter turns clockwise like Adafruit_GFX).
+  // Drawing happens in a logical buffer of the rotated size; the rotation is
+  // applied tile by tile while the buffer is streamed to the panel.
+  void setRotation(uint8_t rotation);
+  
   // GFX drawing functions
   void drawPixel(int16_t x, int16_t y, uint16_t color);
   void fillScreen(uint16_t color);
@@ -71,21 +114,40 @@ public:
   void drawFastHLine(int16_t x, int16_t y, int16_t w, uint16_t color);
   void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color);
   void drawRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color);
+  size_t write(uint8_t c);
   
-  // Display control
-  void update();
+  // Display control. update() sends the frame and starts the refresh, or
+  // does nothing when the panel already shows the same frame, unless
+  // forced: a periodic refresh of an unchanged frame clears ghosting.
+  // poll() advances the refresh and returns true while the panel is still
+  // busy.
+  void update(bool force = false);
+  bool poll();
   void sleep();
   
+  // Rendered frame in logical orientation, 1 bit per pixel, 1 = white
+  const uint8_t* getBuffer() const;
+  uint32_t getBufferSize() const;
+  
+  // Write the rendered frame as a binary PBM image
+  void writePBM(Print& out) const;
+  
+  // Decoded glyphs of the packed fonts, for hit statistics
+  const GlyphCache& getGlyphCache() const;
+  
   // Constants for the display
   static const uint16_t WIDTH = 648;
   static const uint16_t HEIGHT = 480;
 
 private:
-  // Display pins
-  uint8_t _busy_pin;
-  uint8_t _cs_pin;
-  uint8_t _rst_pin;
-  uint8_t _dc_pin;
+  // Attached panel, nullptr when rendering off the device
+  EPaperPanel* _panel;
+  
+  // Text state; a packed font, when set, takes over from the GFX font
+  const GFXfont* _currentFont;
+  const PackedFont* _packedFont;
+  uint16_t _textColor;
+  GlyphCache _glyphs;
   
   // Other parameters
   int _co2_alarm_threshold;
@@ -94,22 +156,50 @@ private:
   // Display buffer
   uint8_t* _buffer;
   
-  // Low-level communication functions
-  void sendCommand(uint8_t command);
-  void sendData(uint8_t data);
-  void waitUntilIdle();
+  // Sample shown by the frame being drawn and by the frame being
+  // refreshed, for latency tracing
+  uint32_t _frameSampleId;
+  uint32_t _refreshSampleId;
+  
+  // Packed frames: static pages, and the frame the panel is showing. The
+  // shown frame also goes to flash once its refresh is done, so it is
+  // still known after a reboot.
+  FrameCache _frames;
+  FrameStore* _store;      // nullptr when rendering off the device
+  uint32_t _shownKey;      // Cache key of the frame on the panel
+  bool _shownUnsaved;      // Shown frame not written to flash yet
+  
+  // The "Last update" footer of the main page. Its minutes change every
+  // minute, so it only goes into the buffer for the upload: the frame
+  // comparison and the cached copy leave it out, and a new minute alone
+  // does not make a new frame.
+  bool _showFooter;
+  unsigned long _footerMinutes;
+  
+  // Cache key of a page in the current rotation
+  uint32_t frameKey(uint8_t page) const;
+  void saveShownFrame();
+  void drawFooter();
+  
+  // Stream the buffer to the panel, rotating 8x8 tiles on the way out
+  void sendRotatedBuffer();
+  void readPanelTile(uint16_t panelY, uint16_t panelByteX, uint8_t* tile);
+  
+  // Draw one custom-font glyph with its top-left corner at (x, y)
+  void drawGlyph(const GFXglyph* glyph, int16_t x, int16_t y, uint16_t color);
   
-  // EPD initialization
-  void reset();
-  void initDisplay();
+  // Same for a packed-font glyph: rows of whole bytes from the glyph cache
+  size_t writePacked(uint8_t c);
+  void drawGlyphRows(const uint8_t* rows, uint16_t w, uint16_t h, int16_t x, int16_t y, uint16_t color);
   
   // Helper methods
-  void drawBarChart(const uint16_t* co2History, int historyIndex);
+  void drawBarChart(const uint16_t* co2History, int historyIndex, const ChartData* chart = nullptr);
   void drawMiniChart(int x, int y, int width, int height, const float* data, int count, int index, float min, float max, uint16_t color);
   void drawCO2MiniChart(int x, int y, int width, int height, const uint16_t* data, int count, int index, uint16_t color);
   void drawCO2Value(uint16_t co2Value, int x, int y);
   void drawTemperatureValue(float temperature, int x, int y);
   void drawHumidityValue(float humidity, int x, int y);
+  void drawExposureBar(int x, int y, int width, int height, const ExposureSummary& summary);
   const char* getAirQualityMessage(uint16_t co2Value);
   
   // Draw large digit at x,y position with given width and height
@@ -122,6 +212,8 @@ private:
   void setCursor(int16_t x, int16_t y);
   void setTextColor(uint16_t color);
   void setFont(const GFXfont* font);
+  void setFont(const PackedFont* font);
+  void getTextBounds(const char* text, int16_t x, int16_t y, int16_t* x1, int16_t* y1, uint16_t* w, uint16_t* h);
   void print(const char* text);
   void print(int value);
   void print(float value, int precision);
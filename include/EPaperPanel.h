@@ -0,0 +1,91 @@
+#ifndef EPAPERPANEL_H
+#define EPAPERPANEL_H
+
+#include <Arduino.h>
+#include <SPI.h>
+#include "EventTracer.h"
+
+// What a sequence step does
+enum PanelStepType {
+  STEP_COMMAND,      // Command byte followed by its data bytes
+  STEP_RESOLUTION,   // Command byte followed by the panel width and height
+  STEP_RESET_LOW,    // Pull RST low
+  STEP_RESET_HIGH,   // Release RST
+  STEP_WAIT,         // Nothing sent, only the wait
+  STEP_END
+};
+
+// One step of a controller sequence, and what to wait for before the next
+// one: at least waitMs, then (if waitBusy) until the controller releases BUSY
+struct PanelStep {
+  uint8_t type;
+  uint8_t command;
+  uint8_t length;
+  uint8_t data[4];
+  uint8_t waitMs;
+  bool waitBusy;
+};
+
+// Pin and SPI layer for the GDEY0583T81 controller. Knows the command
+// sequences but nothing about what is drawn; Display renders into its own
+// buffer and hands the bytes over here.
+//
+// Init, refresh and sleep are tables of steps run by a cooperative
+// sequencer: poll() sends whatever is due and returns instead of waiting,
+// so the caller keeps working while the panel resets or refreshes.
+class EPaperPanel {
+public:
+  EPaperPanel(uint8_t busy_pin, uint8_t cs_pin, uint8_t rst_pin, uint8_t dc_pin,
+              uint16_t width, uint16_t height);
+
+  // Set up the pins and start the init sequence
+  void begin();
+
+  // Frame upload: beginFrame(), sendPixels() any number of times until the
+  // whole black plane is sent, then endFrame() and refresh(). beginFrame()
+  // first finishes whatever sequence is still running.
+  void beginFrame();
+  void sendPixels(const uint8_t* data, uint32_t length);
+  void endFrame();
+
+  // Start the refresh sequence; poll() until it is done
+  void refresh();
+
+  // Power off and enter deep sleep (waits for it)
+  void sleep();
+
+  // Advance the running sequence; true while it is still running
+  bool poll();
+
+  // Run the current sequence to the end
+  void finish();
+
+private:
+  uint8_t _busy_pin;
+  uint8_t _cs_pin;
+  uint8_t _rst_pin;
+  uint8_t _dc_pin;
+  uint16_t _width;
+  uint16_t _height;
+
+  // Bytes sent since beginFrame(), for pacing
+  uint32_t _framePosition;
+
+  // Sequencer state: the running table, the next step, and the wait left
+  // over from the previous one
+  const PanelStep* _sequence;
+  TraceEvent _sequenceEvent;  // Span the running sequence is traced as
+  uint8_t _step;
+  unsigned long _stepTime;
+  uint8_t _waitMs;
+  bool _waitBusy;
+
+  // Low-level communication functions
+  void sendCommand(uint8_t command);
+  void sendData(uint8_t data);
+
+  void start(const PanelStep* sequence, TraceEvent event);
+  void execute(const PanelStep& step);
+};
+
+#endif // EPAPERPANEL_H
@@ -0,0 +1,92 @@
+#ifndef ENERGYGOVERNOR_H
+#define ENERGYGOVERNOR_H
+
+#include <Arduino.h>
+
+// Power levels, from USB power down to an almost empty pack
+enum PowerLevel {
+  POWER_EXTERNAL,  // No pack voltage on the divider, running from USB
+  POWER_NORMAL,    // Battery above 50 %
+  POWER_SAVING,    // Battery between 20 % and 50 %
+  POWER_CRITICAL   // Battery below 20 %
+};
+
+// What the rest of the firmware may spend at the current power level
+struct EnergyPolicy {
+  PowerLevel level;
+  bool lowPowerSensor;            // SCD4x low power periodic mode (30 s instead of 5 s)
+  unsigned long co2ShotInterval;  // SCD41 single shot CO2 instead (ms), 0 = periodic
+  unsigned long pollInterval;     // Time between sensor polls (ms)
+  unsigned long historyInterval;  // Time covered by one history entry (ms)
+  uint8_t refreshesPerHour;       // Display refresh budget, 0 = unlimited
+};
+
+// Reads the battery voltage, estimates the remaining charge and scales the
+// sensor mode, polling, history cadence and display refreshes down as the
+// pack drains. Alarms are never delayed: close to the alarm threshold the
+// sensor is polled at the normal rate and alarm state changes always get a
+// refresh.
+class EnergyGovernor {
+public:
+  EnergyGovernor(uint8_t adcPin, float dividerRatio, int co2AlarmThreshold,
+                 unsigned long basePollInterval, unsigned long baseHistoryInterval);
+
+  // Configure the ADC and take the first reading
+  void begin();
+
+  // Measure the battery and re-evaluate the level. Returns true when the
+  // policy changed.
+  bool update(unsigned long now);
+
+  // Same with a voltage measured elsewhere, e.g. a simulated discharge
+  bool update(uint16_t millivolts, unsigned long now);
+
+  // Current policy
+  const EnergyPolicy& getPolicy() const;
+
+  // Poll interval to use while CO2 is at the given level
+  unsigned long getPollInterval(uint16_t co2) const;
+
+  // Take one refresh from the hourly budget. Urgent refreshes (the alarm
+  // state changed) are always allowed and don't use the budget.
+  bool allowRefresh(bool urgent, unsigned long now);
+
+  // Battery state
+  uint16_t getMillivolts() const;
+  uint8_t getChargePercent() const;
+
+  // Remaining charge of a resting single-cell LiPo at the given voltage
+  static uint8_t chargeFromMillivolts(uint16_t millivolts);
+
+  static const char* getLevelName(PowerLevel level);
+
+private:
+  uint8_t _adcPin;
+  float _dividerRatio;
+  int _co2AlarmThreshold;
+  unsigned long _basePollInterval;
+  unsigned long _baseHistoryInterval;
+
+  EnergyPolicy _policy;
+  uint16_t _millivolts;       // Smoothed battery voltage
+  uint8_t _chargePercent;
+  bool _primed;
+
+  // Refresh budget as a token bucket
+  float _refreshTokens;
+  unsigned long _lastRefill;
+
+  // Below this the divider sees no pack; above it the charger is feeding
+  // the cell, which is as good as external power
+  static const uint16_t NO_BATTERY_MV = 2500;
+  static const uint16_t CHARGING_MV = 4300;
+
+  // A level is only left upwards once the charge is this far past the boundary
+  static const uint8_t HYSTERESIS_PERCENT = 5;
+
+  uint16_t readMillivolts() const;
+  PowerLevel levelFor(uint16_t millivolts, uint8_t percent) const;
+  EnergyPolicy policyFor(PowerLevel level) const;
+};
+
+#endif // ENERGYGOVERNOR_H
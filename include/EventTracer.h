@@ -0,0 +1,91 @@
+#ifndef EVENTTRACER_H
+#define EVENTTRACER_H
+
+#include <Arduino.h>
+
+// Events on the timeline. Spans have a begin and an end, the others are
+// instants. Add new ones at the end and give them a name in EventTracer.cpp.
+enum TraceEvent {
+  EVENT_SENSOR_UPDATE,     // CO2Sensor::update()
+  EVENT_SENSOR_RECOVER,    // CO2Sensor::recover()
+  EVENT_I2C,               // Bus transaction started (arg: address)
+  EVENT_DATA_READY,        // SCD4x has a new measurement
+  EVENT_PIPELINE,          // One pass of the sample pipeline
+  EVENT_HISTORY_TICK,      // History entry written (arg: CO2)
+  EVENT_ALARM,             // Buzzer switched on (arg: CO2)
+  EVENT_RENDER,            // Frame drawn into the buffer
+  EVENT_FRAME_COMPARE,     // Frame checked against the one on the panel
+  EVENT_REFRESH_SKIPPED,   // Panel already showed the frame
+  EVENT_UPLOAD,            // Frame sent to the panel over SPI
+  EVENT_PANEL_WAIT,        // Blocked until the panel sequence finished
+  EVENT_PANEL_INIT,        // Panel init sequence running
+  EVENT_PANEL_REFRESH,     // Panel refresh running
+  EVENT_PANEL_SLEEP,       // Panel power off sequence running
+  EVENT_FRAME_SAVE,        // Shown frame written to flash
+  EVENT_CHECKPOINT,        // State saved to RTC memory
+  EVENT_CPU_CLOCK,         // CPU clock switched (arg: MHz)
+  EVENT_COUNT
+};
+
+// Timeline of what the firmware did, for seeing how things interact (a
+// refresh holding up a sensor poll, say) where the histograms only show
+// totals. Events are 8 bytes in a fixed RAM ring; the oldest are
+// overwritten. dump() prints the ring as hex lines that
+// tools/trace2json.cpp turns into Chrome trace-event JSON for Perfetto.
+// Built for the host, the same code prints the same format.
+class EventTracer {
+public:
+  EventTracer();
+
+  // Start and end a span; spans of one track must nest
+  void begin(TraceEvent event, uint16_t arg = 0);
+  void end(TraceEvent event, uint16_t arg = 0);
+
+  // A point event
+  void instant(TraceEvent event, uint16_t arg = 0);
+
+  // Forget all events
+  void clear();
+
+  // Events held in the ring, and events lost to overwriting
+  uint32_t getCount() const;
+  uint32_t getDropped() const;
+
+  // Print the ring, oldest event first, with the table of event names
+  void dump(Print& out) const;
+
+  // Name of an event, and the timeline track it is drawn on
+  static const char* getEventName(TraceEvent event);
+  static uint8_t getEventTrack(TraceEvent event);
+
+  static const uint16_t CAPACITY = 1024;
+
+private:
+  struct Event {
+    uint32_t time;     // micros()
+    uint8_t phase;     // 'B', 'E' or 'I'
+    uint8_t event;
+    uint16_t arg;
+  };
+
+  Event _events[CAPACITY];
+  uint16_t _next;      // Slot the next event goes to
+  uint32_t _total;     // Events recorded since clear()
+
+  void record(uint8_t phase, TraceEvent event, uint16_t arg);
+};
+
+// Shared tracer used by the sensor, the bus, the display and the main loop
+extern EventTracer eventTracer;
+
+// Span for the lifetime of a scope, so early returns still end it
+class TraceSpan {
+public:
+  TraceSpan(TraceEvent event) : _event(event) { eventTracer.begin(event); }
+  ~TraceSpan() { eventTracer.end(_event); }
+
+private:
+  TraceEvent _event;
+};
+
+#endif // EVENTTRACER_H
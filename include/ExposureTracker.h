@@ -0,0 +1,59 @@
+#ifndef EXPOSURETRACKER_H
+#define EXPOSURETRACKER_H
+
+#include <Arduino.h>
+#include "Display.h"          // For AirQualityStatus and ExposureSummary
+#include "SensorPipeline.h"   // For PipelineSample
+
+// Time spent in each air quality level, today and over the last seven days.
+// Each reading holds until the next one, and the time in between is added
+// to the level of the earlier reading. A sample costs O(1): the week total
+// is kept as a running sum, and the day that drops out of it is subtracted
+// at rollover. There is no wall clock, so a "day" is 24 hours of running
+// time since tracking started.
+//
+// Plain data, so the tracker can be checkpointed with memcpy.
+class ExposureTracker {
+public:
+  ExposureTracker();
+  
+  // Account for a new CO2 reading taken at `now` (millis)
+  void addSample(uint16_t co2, unsigned long now);
+  
+  // Pipeline stage
+  bool process(PipelineSample& sample) {
+    addSample(sample.data.co2, sample.time);
+    return true;
+  }
+  
+  // Forget the previous reading's time, e.g. after millis() restarted
+  void resetClock();
+  
+  // Time per level since the current day started, and over the current
+  // day plus the six before it
+  const ExposureSummary& getDay() const;
+  const ExposureSummary& getWeek() const;
+  
+  // Print the day and week split in percent
+  void printSummary(Print& out) const;
+  
+private:
+  static const uint8_t DAYS = 7;
+  static const uint32_t DAY_MS = 86400000UL;
+  
+  // Longer gaps between readings (sensor lost, device off) only count this much
+  static const uint32_t MAX_GAP_MS = 300000UL;
+  
+  ExposureSummary _days[DAYS];
+  ExposureSummary _week;
+  uint8_t _today;
+  uint32_t _dayElapsed;        // ms into the current day
+  uint8_t _lastStatus;
+  unsigned long _lastTime;
+  bool _hasLast;
+  
+  void add(uint8_t status, uint32_t ms);
+  void rollover();
+};
+
+#endif // EXPOSURETRACKER_H
@@ -0,0 +1,103 @@
+#ifndef FLASHHISTORY_H
+#define FLASHHISTORY_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef ARDUINO_ARCH_ESP32
+#include <esp_partition.h>
+#endif
+
+// One history sample as stored in flash
+struct HistoryRecord {
+  uint32_t sequence;     // Increasing across reboots, 0xFFFFFFFF when erased
+  uint32_t runTime;      // Seconds of running time, carried across reboots
+  uint16_t co2;          // ppm
+  int16_t temperature;   // 0.01 °C
+  uint16_t humidity;     // 0.01 %RH
+  uint16_t checksum;     // Over all fields above
+  
+  float getTemperature() const { return temperature / 100.0f; }
+  float getHumidity() const { return humidity / 100.0f; }
+};
+
+// Walks records straight out of the flash mapping, oldest first. No copies:
+// the returned pointers stay valid as long as the FlashHistory is open.
+class HistoryCursor {
+public:
+  HistoryCursor(const HistoryRecord* records, uint32_t capacity, uint32_t start, uint32_t count);
+  
+  // Next valid record, or nullptr when done
+  const HistoryRecord* next();
+  
+private:
+  const HistoryRecord* _records;
+  uint32_t _capacity;
+  uint32_t _position;
+  uint32_t _remaining;
+};
+
+// Append-only ring log of history records in a raw data partition.
+// Writes go through the flash API, reads come from a read-only memory
+// mapping (esp_partition_mmap on the device, POSIX mmap over an image file
+// on the host), so chart rendering and export never copy records into RAM.
+class FlashHistory {
+public:
+  // On the device name is the partition label, on the host an image file path
+  FlashHistory(const char* name);
+  ~FlashHistory();
+  
+  // Map the partition and find the newest record
+  bool begin();
+  
+  // Append a sample, erasing the next sector when the ring wraps into it.
+  // uptime (s since boot) is stored on top of the newest record's run
+  // time at begin(), so record times keep increasing across reboots.
+  bool append(uint16_t co2, float temperature, float humidity, uint32_t uptime);
+  
+  // Iterate over all records, oldest first
+  HistoryCursor records() const;
+  
+  // Iterate over the newest count records, oldest first
+  HistoryCursor newest(uint32_t count) const;
+  
+  // Number of record slots in the partition
+  uint32_t capacity() const;
+  
+  // All slots in ring order, erased ones included; for indexing
+  const HistoryRecord* data() const;
+  
+  // Slot the next record goes to
+  uint32_t head() const;
+  
+  // Whether the partition is mapped
+  bool isOpen() const;
+  
+  static const uint32_t SECTOR_SIZE = 4096;
+  static const uint32_t RECORDS_PER_SECTOR = SECTOR_SIZE / sizeof(HistoryRecord);
+  
+  static bool isValid(const HistoryRecord& record);
+  static uint16_t computeChecksum(const HistoryRecord& record);
+  
+private:
+  const char* _name;
+  const HistoryRecord* _records;
+  uint32_t _capacity;
+  uint32_t _head;          // Next slot to write
+  uint32_t _nextSequence;
+  uint32_t _runTimeBase;   // Run time of the newest record at begin()
+  uint32_t _lastRunTime;
+  
+#ifdef ARDUINO_ARCH_ESP32
+  const esp_partition_t* _partition;
+  spi_flash_mmap_handle_t _mapHandle;
+#else
+  int _fd;
+  size_t _mapSize;
+#endif
+  
+  bool eraseSector(uint32_t sector);
+  bool writeRecord(uint32_t slot, const HistoryRecord& record);
+};
+
+#endif // FLASHHISTORY_H
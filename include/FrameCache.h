@@ -0,0 +1,107 @@
+#ifndef FRAMECACHE_H
+#define FRAMECACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef ARDUINO_ARCH_ESP32
+#include <esp_partition.h>
+#endif
+
+// Rendered frames kept PackBits-packed in RAM under a caller-chosen key.
+// Restoring a cached frame is a decode into the frame buffer instead of a
+// full re-render; changedPixels() compares a frame with a cached one
+// without unpacking it in full.
+class FrameCache {
+public:
+  FrameCache();
+  ~FrameCache();
+
+  // Pack a frame into the slot for key, replacing what was there. The
+  // least recently used slot makes room when all are taken.
+  bool store(uint32_t key, const uint8_t* frame, uint32_t length);
+
+  // Take over already packed data, e.g. a frame read back from flash
+  bool load(uint32_t key, const uint8_t* packed, uint32_t size);
+
+  // Unpack the frame for key into frame; false if there is none
+  bool restore(uint32_t key, uint8_t* frame, uint32_t length);
+
+  // Number of pixels in which frame differs from the one for key,
+  // NOT_CACHED if there is none or it has another size
+  uint32_t changedPixels(uint32_t key, const uint8_t* frame, uint32_t length) const;
+
+  // Packed data for key, nullptr if there is none
+  const uint8_t* find(uint32_t key, uint32_t& size) const;
+
+  void remove(uint32_t key);
+
+  static const uint8_t MAX_SLOTS = 4;
+  static const uint32_t NOT_CACHED = 0xFFFFFFFF;
+
+private:
+  struct Slot {
+    uint32_t key;
+    uint8_t* data;      // nullptr when the slot is free
+    uint32_t size;
+    uint32_t lastUse;
+  };
+
+  Slot _slots[MAX_SLOTS];
+  uint32_t _useCounter;
+
+  Slot* findSlot(uint32_t key) const;
+  Slot* allocate(uint32_t key, uint32_t size);
+};
+
+// The last frame sent to the panel, kept packed in a raw data partition so
+// that after a reboot the driver knows what the panel is still showing.
+// Frames are written one after another, each starting on a sector boundary,
+// and the ring wraps to the start of the partition; the newest valid record
+// wins. Reads come from a memory mapping, as in FlashHistory.
+class FrameStore {
+public:
+  // On the device name is the partition label, on the host an image file path
+  FrameStore(const char* name);
+  ~FrameStore();
+
+  // Map the partition and find the newest frame
+  bool begin();
+
+  // Newest frame's packed data in the mapping, nullptr if there is none
+  const uint8_t* newest(uint32_t& key, uint32_t& size) const;
+
+  // Append a packed frame
+  bool save(uint32_t key, const uint8_t* packed, uint32_t size);
+
+  static const uint32_t SECTOR_SIZE = 4096;
+
+private:
+  struct Header {
+    uint32_t magic;
+    uint32_t sequence;
+    uint32_t key;
+    uint32_t size;
+    uint32_t crc;       // Over key, size and data
+  };
+
+  const char* _name;
+  const uint8_t* _data;
+  uint32_t _capacity;
+  uint32_t _newest;        // Offset of the newest record, _capacity if none
+  uint32_t _head;          // Sector-aligned offset for the next record
+  uint32_t _nextSequence;
+
+#ifdef ARDUINO_ARCH_ESP32
+  const esp_partition_t* _partition;
+  spi_flash_mmap_handle_t _mapHandle;
+#else
+  int _fd;
+#endif
+
+  bool isValid(uint32_t offset) const;
+  bool erase(uint32_t offset, uint32_t size);
+  bool write(uint32_t offset, const void* data, uint32_t size);
+};
+
+#endif // FRAMECACHE_H
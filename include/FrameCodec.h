@@ -0,0 +1,42 @@
+#ifndef FRAMECODEC_H
+#define FRAMECODEC_H
+
+#include <stdint.h>
+
+// PackBits compression for 1bpp frames. A header byte n in 0..127 is
+// followed by n + 1 literal bytes; n in 129..255 repeats the next byte
+// 257 - n times; 128 is skipped. The screens are mostly background, so a
+// 38880-byte frame packs into a few kilobytes.
+
+// Largest possible packed size of length bytes
+uint32_t packBitsBound(uint32_t length);
+
+// Pack length bytes into dst, which must hold packBitsBound(length) bytes.
+// With dst == nullptr only the packed size is computed.
+uint32_t packBitsEncode(const uint8_t* src, uint32_t length, uint8_t* dst);
+
+// Unpack into exactly length bytes; false if the data is short or too long
+bool packBitsDecode(const uint8_t* src, uint32_t size, uint8_t* dst, uint32_t length);
+
+// Incremental decoder: expands the packed data a chunk at a time, so a frame
+// can be compared or streamed out without a full-size buffer
+class PackBitsReader {
+public:
+  PackBitsReader(const uint8_t* data, uint32_t size);
+
+  // Expand up to length bytes into dst; returns how many were written,
+  // fewer than length only at the end of the data
+  uint32_t read(uint8_t* dst, uint32_t length);
+
+  // All packed data consumed
+  bool atEnd() const;
+
+private:
+  const uint8_t* _next;
+  const uint8_t* _end;
+  uint32_t _left;      // Bytes left in the current packet
+  bool _repeat;
+  uint8_t _value;
+};
+
+#endif // FRAMECODEC_H
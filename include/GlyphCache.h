@@ -0,0 +1,54 @@
+#ifndef GLYPHCACHE_H
+#define GLYPHCACHE_H
+
+#include <stdint.h>
+#include "PackedFont.h"
+
+// Decoded glyphs of packed fonts, so the characters drawn on every frame
+// (digits, "ppm", the labels) are unpacked once instead of per draw. A
+// frame uses about sixty different glyphs of three sizes, so they are kept
+// back to back in one pool rather than in fixed slots sized for the
+// largest; the least recently used ones make room, and the pool is
+// compacted when they go. The pool is allocated on first use. fontpack
+// refuses fonts with a glyph larger than MAX_GLYPH_BYTES.
+class GlyphCache {
+public:
+  GlyphCache();
+  ~GlyphCache();
+
+  // Rows of character c, as packedGlyphDecode writes them, valid until the
+  // next get(); nullptr if the font does not have it, it does not decode or
+  // the pool cannot be allocated
+  const uint8_t* get(const PackedFont* font, uint16_t c);
+
+  // Forget all glyphs, e.g. to measure drawing without the cache
+  void clear();
+
+  uint32_t getHits() const;
+  uint32_t getMisses() const;
+
+  static const uint8_t MAX_ENTRIES = 96;
+  static const uint16_t POOL_BYTES = 6144;
+  static const uint16_t MAX_GLYPH_BYTES = 256;
+
+private:
+  struct Entry {
+    const PackedFont* font;
+    uint16_t c;
+    uint16_t offset;            // In the pool; entries are in pool order
+    uint16_t size;
+    uint32_t lastUse;
+  };
+
+  Entry _entries[MAX_ENTRIES];
+  uint8_t _count;
+  uint16_t _used;               // Pool bytes taken, from the start
+  uint8_t* _pool;
+  uint32_t _useCounter;
+  uint32_t _hits;
+  uint32_t _misses;
+
+  void evictOldest();
+};
+
+#endif // GLYPHCACHE_H
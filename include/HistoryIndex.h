@@ -0,0 +1,68 @@
+#ifndef HISTORYINDEX_H
+#define HISTORYINDEX_H
+
+#include <stdint.h>
+#include "FlashHistory.h"
+
+// CO2 min/max/sum over a set of history records
+struct HistoryAggregate {
+  uint16_t min;
+  uint16_t max;
+  uint32_t sum;
+  uint32_t count;
+
+  void clear();
+  void add(uint16_t co2);
+  void merge(const HistoryAggregate& other);
+
+  // Mean CO2, 0 when there are no records
+  uint16_t average() const;
+};
+
+// Segment tree over the slots of the history ring, giving the aggregate of
+// any range of records in O(log n). Leaves cover blocks of BLOCK_SIZE slots
+// so the tree stays small enough for RAM (about 12 KB for the 128 KB
+// partition); the partial blocks at the ends of a range are scanned.
+// Erased and corrupt slots count as empty.
+class HistoryIndex {
+public:
+  HistoryIndex();
+  ~HistoryIndex();
+
+  // Build the tree over a ring of records, or over the history partition
+  bool begin(const HistoryRecord* records, uint32_t capacity);
+  bool begin(const FlashHistory& history);
+
+  // Re-aggregate slots after they were written or erased
+  void invalidate(uint32_t first, uint32_t count);
+
+  // Catch up with FlashHistory::append(): the new record, and the sector
+  // erased after it when the ring wrapped into it
+  void appended(const FlashHistory& history);
+
+  // Aggregate of count slots from first on, wrapping around the ring
+  HistoryAggregate query(uint32_t first, uint32_t count) const;
+
+  // Aggregate of count slots ending skip slots before head (the next slot
+  // to be written), i.e. the records from skip + count back to skip back
+  HistoryAggregate queryNewest(uint32_t head, uint32_t skip, uint32_t count) const;
+
+  // The same aggregate by scanning every record, for checks and benchmarks
+  static HistoryAggregate scan(const HistoryRecord* records, uint32_t capacity,
+                               uint32_t first, uint32_t count);
+
+  bool isReady() const;
+
+  static const uint32_t BLOCK_SIZE = 16;
+
+private:
+  const HistoryRecord* _records;
+  uint32_t _capacity;
+  uint32_t _blocks;
+  HistoryAggregate* _nodes;   // 2 * _blocks nodes, leaves from _blocks on
+
+  void rebuildBlock(uint32_t block);
+  HistoryAggregate queryLinear(uint32_t first, uint32_t end) const;
+};
+
+#endif // HISTORYINDEX_H
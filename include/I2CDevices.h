@@ -0,0 +1,127 @@
+#ifndef I2CDEVICES_H
+#define I2CDEVICES_H
+
+#include <Arduino.h>
+#include "I2CScheduler.h"
+#include "SampleQueue.h"
+#include "Scd4xSchedule.h"
+#include "SensorData.h"
+
+// Raw SGP41 signals; the VOC/NOx index algorithms run on these
+struct GasSample {
+  uint16_t vocRaw;
+  uint16_t noxRaw;
+  unsigned long time;    // millis()
+};
+
+struct PressureSample {
+  float pressure;        // hPa
+  float temperature;     // C, board temperature at the sensor
+  unsigned long time;    // millis()
+};
+
+// SCD4x on the scheduled bus: in periodic measurement it polls
+// get_data_ready_status and reads the measurement once the sensor has one;
+// in single shot mode it triggers the measurements itself (Scd4xSchedule).
+// Starting and stopping the periodic measurement stays with CO2Sensor,
+// which holds the device while it does.
+class Scd4xDevice : public I2CDevice {
+public:
+  Scd4xDevice(uint8_t address = 0x62);
+
+  const char* getName() const { return "SCD4x"; }
+  unsigned long getDueTime() const { return _failed ? _dueAt : _schedule.getDueTime(); }
+  bool nextCommand(unsigned long now, I2CCommand& command);
+  void complete(const I2CCommand& command, const uint8_t* response, bool ok, unsigned long now);
+
+  // Readings; temperature and humidity only readings have a CO2 of 0
+  SampleQueue<SensorData, 4>& samples() { return _samples; }
+
+  // Measurement mode, to match what the sensor was told; takes effect at
+  // the next reset()
+  void setPeriodic() { _schedule.setPeriodic(); }
+  void setSingleShot(uint32_t co2IntervalMs, uint32_t rhtIntervalMs) {
+    _schedule.setSingleShot(co2IntervalMs, rhtIntervalMs);
+  }
+  void setIntervals(uint32_t co2IntervalMs, uint32_t rhtIntervalMs) {
+    _schedule.setIntervals(co2IntervalMs, rhtIntervalMs);
+  }
+  bool isSingleShot() const { return _schedule.isSingleShot(); }
+
+  // Set after a NACK or CRC error; polling stops until reset()
+  bool hasFailed() const { return _failed; }
+  void reset();
+
+private:
+  uint8_t _address;
+  unsigned long _dueAt;  // While failed
+  bool _failed;
+  uint32_t _sampleId;
+  Scd4xSchedule _schedule;
+  SampleQueue<SensorData, 4> _samples;
+};
+
+// SGP41 VOC/NOx sensor sampled at 1 Hz, as its index algorithms expect.
+// The first 10 s run the conditioning command instead of a measurement.
+class Sgp41Device : public I2CDevice {
+public:
+  Sgp41Device(uint8_t address = 0x59);
+
+  const char* getName() const { return "SGP41"; }
+  unsigned long getDueTime() const { return _dueAt; }
+  bool nextCommand(unsigned long now, I2CCommand& command);
+  void complete(const I2CCommand& command, const uint8_t* response, bool ok, unsigned long now);
+
+  // Humidity compensation from the SCD4x
+  void setCompensation(float temperature, float humidity);
+
+  SampleQueue<GasSample, 8>& samples() { return _samples; }
+  bool isPresent() const { return !_absent; }
+
+private:
+  uint8_t _address;
+  unsigned long _dueAt;
+  uint8_t _conditioningLeft;
+  uint8_t _failures;
+  bool _seen;
+  bool _absent;
+  uint16_t _temperatureTicks;
+  uint16_t _humidityTicks;
+  SampleQueue<GasSample, 8> _samples;
+};
+
+// BMP280 (or the P/T part of a BME280) in forced mode: trigger a
+// conversion, let it run, read the result registers
+class Bmp280Device : public I2CDevice {
+public:
+  Bmp280Device(uint8_t address = 0x76, unsigned long intervalMs = 10000);
+
+  const char* getName() const { return "BMP280"; }
+  unsigned long getDueTime() const { return _dueAt; }
+  bool nextCommand(unsigned long now, I2CCommand& command);
+  void complete(const I2CCommand& command, const uint8_t* response, bool ok, unsigned long now);
+
+  SampleQueue<PressureSample, 4>& samples() { return _samples; }
+  bool isPresent() const { return !_absent; }
+
+private:
+  enum Step { READ_CALIBRATION, TRIGGER, READ_RESULT };
+
+  uint8_t _address;
+  unsigned long _interval;   // micros
+  unsigned long _dueAt;
+  Step _step;
+  uint8_t _failures;
+  bool _absent;
+  SampleQueue<PressureSample, 4> _samples;
+
+  // Factory calibration, registers 0x88..0x9F
+  uint16_t _t1;
+  int16_t _t2, _t3;
+  uint16_t _p1;
+  int16_t _p2, _p3, _p4, _p5, _p6, _p7, _p8, _p9;
+
+  void compensate(int32_t rawTemperature, int32_t rawPressure);
+};
+
+#endif // I2CDEVICES_H
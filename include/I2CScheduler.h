@@ -0,0 +1,100 @@
+#ifndef I2CSCHEDULER_H
+#define I2CSCHEDULER_H
+
+#include <Arduino.h>
+#include <Wire.h>
+
+// One bus transaction: write `tx`, give the device `execMicros` to execute
+// the command, then read `rxLength` bytes (nothing when 0). The device is
+// not sent anything else until the execution time has passed.
+struct I2CCommand {
+  uint8_t address;
+  uint8_t tx[8];
+  uint8_t txLength;
+  uint8_t rxLength;
+  uint32_t execMicros;
+  uint8_t tag;            // Driver's own id for the command
+};
+
+// A device driver on the scheduled bus. Drivers never touch Wire or wait;
+// they describe their next command and get its response back.
+class I2CDevice {
+public:
+  virtual ~I2CDevice() {}
+
+  virtual const char* getName() const = 0;
+
+  // micros() time at which the driver wants to send its next command
+  virtual unsigned long getDueTime() const = 0;
+
+  // Fill in the command to send now. A driver with nothing to do returns
+  // false and moves its due time into the future.
+  virtual bool nextCommand(unsigned long now, I2CCommand& command) = 0;
+
+  // Response to the command; `ok` is false when the device NACKed or sent
+  // less data than asked for
+  virtual void complete(const I2CCommand& command, const uint8_t* response, bool ok, unsigned long now) = 0;
+};
+
+// Owns the Wire bus and interleaves the devices on it: while one device is
+// busy executing a command, the others are written to and read from.
+// Transactions themselves are short and run back to back from poll().
+class I2CScheduler {
+public:
+  static const uint8_t MAX_DEVICES = 6;
+  static const uint8_t MAX_RESPONSE = 32;
+
+  I2CScheduler(TwoWire& wire);
+
+  // Register a device; false when all slots are taken
+  bool addDevice(I2CDevice* device);
+
+  // Read back finished commands and start the ones that are due. Never waits.
+  void poll();
+
+  // Microseconds until poll() has work to do, at most `limit`
+  unsigned long getIdleTime(unsigned long limit) const;
+
+  // Finish the device's command in flight and stop scheduling it, so its
+  // driver can talk to it directly (setup, recovery). Holds nest.
+  void hold(I2CDevice* device);
+  void release(I2CDevice* device);
+
+  // Transactions and failed transactions since boot
+  uint32_t getTransactionCount() const;
+  uint32_t getErrorCount() const;
+
+private:
+  struct Slot {
+    I2CDevice* device;
+    I2CCommand command;
+    unsigned long readyAt;  // micros() when the command has executed
+    bool busy;              // Command written, response not read yet
+    uint8_t holds;
+  };
+
+  TwoWire& _wire;
+  Slot _slots[MAX_DEVICES];
+  uint8_t _count;
+  uint32_t _transactions;
+  uint32_t _errors;
+
+  Slot* findSlot(I2CDevice* device);
+  void start(Slot& slot);
+  void finish(Slot& slot);
+};
+
+// Holds a device on the scheduler for the lifetime of the guard
+class I2CHold {
+public:
+  I2CHold(I2CScheduler& scheduler, I2CDevice* device) : _scheduler(scheduler), _device(device) {
+    _scheduler.hold(_device);
+  }
+  ~I2CHold() { _scheduler.release(_device); }
+
+private:
+  I2CScheduler& _scheduler;
+  I2CDevice* _device;
+};
+
+#endif // I2CSCHEDULER_H
@@ -0,0 +1,66 @@
+#ifndef LATENCYTRACER_H
+#define LATENCYTRACER_H
+
+#include <Arduino.h>
+#include "LogHistogram.h"
+
+// Stages a sample passes through on its way to the panel
+enum TraceStage {
+  STAGE_DATA_READY,      // SCD4x reported data ready (first time we saw it)
+  STAGE_SAMPLE_READ,     // Measurement read over I2C
+  STAGE_SENSOR_UPDATED,  // CO2Sensor::update() finished
+  STAGE_CHANGE_CHECKED,  // significantChange() decided
+  STAGE_RENDERED,        // Frame rasterised into the display buffer
+  STAGE_UPLOADED,        // Frame sent to the panel over SPI
+  STAGE_REFRESHED,       // Panel refresh finished, new pixels visible
+  STAGE_COUNT
+};
+
+// Follows each sample from the sensor to the glass. Every sample gets a
+// monotonically increasing ID; each stage is timestamped and the time since
+// the previous stage goes into a per-stage histogram (microseconds). A few
+// samples can be in flight at once, since the next reading comes in while
+// the panel is still refreshing the previous one.
+class LatencyTracer {
+public:
+  LatencyTracer();
+  
+  // Start tracing a new sample, returns its ID (never 0)
+  uint32_t beginSample();
+  
+  // Timestamp a stage for the given sample. Ignored for samples that are no
+  // longer in flight (MAX_IN_FLIGHT newer ones started since), so frames
+  // showing older data don't skew the numbers.
+  void mark(uint32_t sampleId, TraceStage stage);
+  
+  // Latency histogram of a stage, measured from the previous stage
+  const LogHistogram& getStageHistogram(TraceStage stage) const;
+  
+  // Latency histogram from data ready to refreshed panel
+  const LogHistogram& getEndToEndHistogram() const;
+  
+  // Print all histograms
+  void printSummary(Print& out) const;
+  
+  // Name of a stage for logs
+  static const char* getStageName(TraceStage stage);
+  
+private:
+  static const uint8_t MAX_IN_FLIGHT = 4;
+  
+  struct Trace {
+    uint32_t id;
+    int8_t lastStage;
+    unsigned long stageTimes[STAGE_COUNT];
+  };
+  
+  uint32_t _nextId;
+  Trace _traces[MAX_IN_FLIGHT];   // Indexed by ID modulo MAX_IN_FLIGHT
+  LogHistogram _stageHistograms[STAGE_COUNT];
+  LogHistogram _endToEnd;
+};
+
+// Shared tracer used by the sensor, the display and the main loop
+extern LatencyTracer latencyTracer;
+
+#endif // LATENCYTRACER_H
@@ -0,0 +1,117 @@
+#ifndef LIVEFEED_H
+#define LIVEFEED_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// One reading as sent to live subscribers. Temperature and humidity are in
+// hundredths, as in HistoryRecord.
+struct LiveSample {
+  uint32_t sequence;     // Per stream; a gap means frames were dropped
+  uint32_t time;         // millis() on the device
+  uint16_t co2;
+  int16_t temperature;
+  uint16_t humidity;
+};
+
+// The two streams of the feed: every new reading, and every history entry
+enum LiveFrameType {
+  LIVE_SAMPLE = 0,
+  LIVE_TICK = 1
+};
+
+// Delta state of one stream at one end of the link. Sender and receiver
+// keep identical copies; the first frame of a stream is sent against a
+// zeroed baseline and marked as a keyframe.
+struct LiveBaseline {
+  LiveSample last;
+  uint32_t timeStep;     // Interval between the last two frames
+  bool valid;
+
+  void reset();
+};
+
+// Frame layout: a header byte (bit 7 keyframe, bit 5 stream, bits 0-4 which
+// fields follow), then a zigzag varint per field. Sequence is sent as the
+// error against last + 1, time as the error against the last interval, CO2,
+// temperature and humidity as the change; fields that are zero are left
+// out. A steady stream costs 3 to 6 bytes a frame instead of 14.
+static const uint8_t LIVE_FRAME_MAX = 1 + 5 * 5;
+
+// Encode sample against base and advance it; returns the frame length
+uint8_t liveEncode(LiveBaseline& base, LiveFrameType type, const LiveSample& sample, uint8_t* out);
+
+// Decode a frame against the baselines of both streams (indexed by type)
+// and advance the one it belongs to; false for a malformed frame or a delta
+// frame without a baseline
+bool liveDecode(LiveBaseline* bases, const uint8_t* data, size_t length,
+                LiveFrameType& type, LiveSample& sample);
+
+// Where LiveFeed sends its frames: the WebSocket server on the device, a
+// socket loop in the host load test
+class LiveTransport {
+public:
+  virtual ~LiveTransport() {}
+
+  // Room for another frame to the client without blocking
+  virtual bool canSend(uint16_t client) = 0;
+
+  // Send one binary frame; false if it was not sent
+  virtual bool send(uint16_t client, const uint8_t* data, size_t length) = 0;
+};
+
+struct LiveFeedStats {
+  uint32_t framesSent;
+  uint32_t bytesSent;
+  uint32_t samplesDropped;   // Superseded by a newer sample before sending
+  uint32_t ticksDropped;     // Pushed out of a full tick queue
+};
+
+// Fans readings out to subscribers. Each client holds at most one pending
+// sample, replaced by the next one if it was not sent in time, and a short
+// queue of history ticks, so a slow client costs a fixed amount of RAM and
+// never holds up the loop or the other clients. Frames are encoded when
+// sent, against what that client last received.
+class LiveFeed {
+public:
+  // Client ids are 0 .. maxClients - 1, e.g. the WebSocket client number
+  LiveFeed(uint16_t maxClients);
+  ~LiveFeed();
+
+  // Start or stop sending to a client; a new client starts with keyframes
+  bool addClient(uint16_t client);
+  void removeClient(uint16_t client);
+  uint16_t getClientCount() const;
+
+  // Queue a reading for every client; the feed numbers them
+  void publishSample(const LiveSample& sample);
+  void publishTick(const LiveSample& tick);
+
+  // Send what the transport has room for, ticks first; returns frames sent
+  uint32_t flush(LiveTransport& transport);
+
+  LiveFeedStats getStats() const;
+
+  static const uint8_t TICK_QUEUE = 8;
+
+private:
+  struct Client {
+    bool active;
+    bool samplePending;
+    LiveSample sample;
+    LiveSample ticks[TICK_QUEUE];
+    uint8_t tickHead;        // Oldest queued tick
+    uint8_t tickCount;
+    LiveBaseline bases[2];   // Indexed by LiveFrameType
+  };
+
+  Client* _clients;
+  uint16_t _maxClients;
+  uint16_t _clientCount;
+  uint32_t _sequences[2];
+  LiveFeedStats _stats;
+
+  bool sendNext(Client& client, uint16_t id, LiveTransport& transport);
+};
+
+#endif // LIVEFEED_H
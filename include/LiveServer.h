@@ -0,0 +1,51 @@
+#ifndef LIVESERVER_H
+#define LIVESERVER_H
+
+#include <Arduino.h>
+#include "Display.h"
+#include "LiveFeed.h"
+
+#ifdef ARDUINO_ARCH_ESP32
+#include <WebSocketsServer.h>
+#endif
+
+// WebSocket endpoint that pushes every new reading and history entry to
+// dashboards as LiveFeed binary frames, instead of them polling over HTTP.
+// Clients only listen; anything they send is ignored. Only built for the
+// device; elsewhere begin() reports it is not available.
+class LiveServer : public LiveTransport {
+public:
+  LiveServer(uint16_t port);
+
+  // Join the network and open the port; does nothing without an SSID
+  bool begin(const char* ssid, const char* password);
+
+  // Serve handshakes and pings and send what is queued. Call every loop.
+  void loop();
+
+  // Queue a reading, or a history entry, for every subscriber and send it
+  void publishSample(const SensorData& data, unsigned long time);
+  void publishTick(const SensorData& average, unsigned long time);
+
+  bool isEnabled() const;
+
+  // A reading in the feed's fixed-point form
+  static LiveSample toLiveSample(const SensorData& data, unsigned long time);
+
+  // Subscribers, frames sent and dropped
+  void printSummary(Print& out) const;
+
+  // LiveTransport
+  bool canSend(uint16_t client);
+  bool send(uint16_t client, const uint8_t* data, size_t length);
+
+private:
+#ifdef ARDUINO_ARCH_ESP32
+  WebSocketsServer _server;
+#endif
+  LiveFeed _feed;
+  bool _enabled;
+  bool _online;        // Address announced since the last association
+};
+
+#endif // LIVESERVER_H
@@ -0,0 +1,32 @@
+#ifndef LOGHISTOGRAM_H
+#define LOGHISTOGRAM_H
+
+#include <Arduino.h>
+
+// Histogram with power-of-two buckets: bucket i holds values in [2^(i-1), 2^i),
+// bucket 0 holds zeros. Fixed size, so it can live in RTC memory as well.
+struct LogHistogram {
+  static const uint8_t BUCKETS = 32;
+  
+  uint32_t counts[BUCKETS];
+  uint32_t total;
+  uint32_t maxValue;
+  uint64_t sum;
+  
+  // Clear all buckets
+  void reset();
+  
+  // Record one value
+  void add(uint32_t value);
+  
+  // Upper bound of the bucket containing the given percentile (0-100)
+  uint32_t percentile(uint8_t percent) const;
+  
+  // Mean of all recorded values
+  uint32_t average() const;
+  
+  // Print "count avg p50 p95 max" on one line
+  void printSummary(Print& out) const;
+};
+
+#endif // LOGHISTOGRAM_H
@@ -0,0 +1,65 @@
+#ifndef LOOPMONITOR_H
+#define LOOPMONITOR_H
+
+#include <Arduino.h>
+#include "LogHistogram.h"
+
+// Parts of setup() and loop() the monitor tells apart
+enum LoopPhase {
+  PHASE_SETUP,        // setup() before the first loop
+  PHASE_BUS,          // I2CScheduler::poll()
+  PHASE_SENSOR,       // Sensor update, reconnect and recovery
+  PHASE_PIPELINE,     // Sample pipeline and energy policy
+  PHASE_RENDER,       // Frame render and upload, waiting out the last refresh
+  PHASE_PANEL,        // Panel sequencer poll
+  PHASE_CHECKPOINT,   // RTC state checkpoint
+  PHASE_IDLE,         // Sleeping until the next bus transaction
+  PHASE_NETWORK,      // WebSocket server and live push
+  PHASE_COUNT
+};
+
+// Guards the loop task with the task watchdog and measures how close it
+// gets to stalling. Every phase change feeds the watchdog, so the timeout
+// is a budget per phase rather than per iteration.
+//
+// The iteration histogram (microseconds, idle time excluded), the longest
+// run of each phase and the phase in progress live in RTC memory. They
+// survive a panic or watchdog reset, so the next boot can tell which phase
+// hung; a cold start clears them.
+class LoopMonitor {
+public:
+  LoopMonitor(uint32_t timeoutSeconds);
+
+  // Restore or clear the RTC record, report a crash in the previous run and
+  // subscribe the calling task to the watchdog. Call first thing in setup().
+  void begin();
+
+  // Mark the start and end of one loop() iteration
+  void beginIteration();
+  void endIteration();
+
+  // Switch to another phase; also feeds the watchdog
+  void enter(LoopPhase phase);
+
+  // Loop iteration time histogram (us) since the last cold start
+  const LogHistogram& getIterationHistogram() const;
+
+  // Longest run of a phase (us) since the last cold start
+  uint32_t getPhaseMax(LoopPhase phase) const;
+
+  // Panic and watchdog resets since the last cold start
+  uint32_t getCrashCount() const;
+
+  // Print the iteration histogram and the per-phase maxima
+  void printSummary(Print& out) const;
+
+  // Name of a phase for logs
+  static const char* getPhaseName(LoopPhase phase);
+
+private:
+  uint32_t _timeoutSeconds;
+  unsigned long _iterationStart;   // micros()
+  unsigned long _phaseStart;       // micros()
+};
+
+#endif // LOOPMONITOR_H
@@ -0,0 +1,139 @@
+#ifndef NETWORKUPLINK_H
+#define NETWORKUPLINK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "LiveFeed.h"
+
+// Association details from the last successful join, so the next one can
+// go straight to the access point on its channel and reuse the address
+// instead of scanning and waiting for DHCP
+struct UplinkCache {
+  uint8_t bssid[6];
+  uint8_t channel;
+  uint32_t ip;
+  uint32_t gateway;
+  uint32_t subnet;
+  uint32_t dns;
+  bool valid;
+};
+
+// The radio and the upload connection, as NetworkUplink drives them: WiFi
+// on the device, a simulated network in tools/uplink_sim.cpp. Calls must
+// not block for long; the uplink polls until things are done.
+class NetworkStack {
+public:
+  virtual ~NetworkStack() {}
+
+  // Power the radio up and start joining, with a cache if there is one
+  virtual void begin(const UplinkCache* cache) = 0;
+
+  // Joined, with an address
+  virtual bool isJoined() = 0;
+
+  // Details of the current association
+  virtual bool getCache(UplinkCache& cache) = 0;
+
+  // Open the upload connection; true once it is open
+  virtual bool connect() = 0;
+
+  // Send bytes; returns how many were taken
+  virtual size_t write(const uint8_t* data, size_t length) = 0;
+
+  // Close the connection and power the radio down
+  virtual void end() = 0;
+};
+
+enum UplinkState {
+  UPLINK_IDLE,         // Radio off, buffering
+  UPLINK_JOINING,      // Associating and getting an address
+  UPLINK_CONNECTING,   // Opening the upload connection
+  UPLINK_SENDING       // Sending the backlog
+};
+
+struct UplinkStats {
+  uint32_t bursts;
+  uint32_t fastJoins;        // Joins that used the cache
+  uint32_t failures;
+  uint32_t samplesSent;
+  uint32_t samplesDropped;   // Pushed out of a full backlog
+};
+
+// Keeps the radio off and buffers readings, then joins, sends the backlog
+// to the collector (tools/collector.cpp) in one burst and powers the radio
+// down again. Bursts run every interval, early when the backlog is three
+// quarters full, and right away on request (an alarm). Readings go out as
+// the collector's sample lines with their age, so they keep the time they
+// were taken.
+class NetworkUplink {
+public:
+  NetworkUplink(NetworkStack& stack, const char* deviceName, unsigned long interval);
+
+  // Buffer a reading for the next burst; time is millis() when it was taken
+  void add(const LiveSample& sample);
+
+  // Send the backlog as soon as possible
+  void requestBurst();
+
+  // Run the burst; true while the radio is on
+  bool update(unsigned long now);
+
+  // Join with the cached association (on by default)
+  void setFastReconnect(bool enabled);
+
+  UplinkState getState() const;
+  uint16_t getBacklog() const;
+  const UplinkStats& getStats() const;
+
+  // Radio-on time (ms) and bursts in the current and the previous day of
+  // running time
+  uint32_t getRadioOnToday() const;
+  uint32_t getRadioOnYesterday() const;
+  uint16_t getBurstsToday() const;
+
+  static const uint16_t BACKLOG = 256;
+  static const unsigned long JOIN_TIMEOUT_MS = 10000;
+  static const unsigned long CONNECT_TIMEOUT_MS = 5000;
+  static const unsigned long SEND_TIMEOUT_MS = 10000;
+  static const unsigned long RETRY_MS = 300000;
+
+private:
+  NetworkStack& _stack;
+  const char* _deviceName;
+  unsigned long _interval;
+  bool _fastReconnect;
+  UplinkCache _cache;
+
+  LiveSample _backlog[BACKLOG];
+  uint16_t _head;            // Oldest buffered reading
+  uint16_t _count;
+
+  UplinkState _state;
+  bool _requested;
+  bool _usedCache;
+  unsigned long _nextBurst;
+  unsigned long _burstStart;
+  unsigned long _stateTime;
+  unsigned long _lastUpdate;
+
+  // Line being written, and how much of it is out
+  char _line[96];
+  uint8_t _lineLength;
+  uint8_t _lineSent;
+  bool _lineIsSample;      // Sent line takes a reading off the backlog
+  bool _headerSent;
+
+  UplinkStats _stats;
+  uint32_t _day;
+  uint32_t _radioToday;
+  uint32_t _radioYesterday;
+  uint16_t _burstsToday;
+
+  void startBurst(unsigned long now);
+  void send(unsigned long now);
+  void finish(unsigned long now, bool ok);
+  void account(unsigned long now);
+  void setState(UplinkState state, unsigned long now);
+};
+
+#endif // NETWORKUPLINK_H
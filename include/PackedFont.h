@@ -0,0 +1,53 @@
+#ifndef PACKEDFONT_H
+#define PACKEDFONT_H
+
+#include <stdint.h>
+
+// Run-length packed bitmap fonts, a drop-in for Adafruit GFX fonts that
+// takes about half the flash at the larger sizes. Glyph metrics are the
+// same as GFXglyph; only the bitmaps are packed, one stream per glyph so
+// any glyph decodes on its own.
+//
+// A glyph stream is a sequence of nibbles, high nibble first. Numbers are
+// varints of 3-bit groups, most significant first, with bit 3 set on every
+// nibble but the last. The stream holds:
+//   - the number of row groups, then per group the index of its first row
+//     among the rows left after grouping (relative to the previous group)
+//     and how many more copies of that row follow, minus one
+//   - the runs of the remaining rows read as one bit stream, alternating
+//     background and ink and starting with background: the first run as
+//     is (it may be empty), the others minus one, the last one left out
+// Vertical strokes make many consecutive rows identical, and runs span
+// rows, so a row of a stem costs a nibble or two. A stream ending in an odd
+// nibble is padded with 0x8, an unfinished varint.
+
+struct PackedGlyph {
+  uint16_t offset;      // Of the glyph stream in PackedFont::data
+  uint8_t width;
+  uint8_t height;
+  uint8_t xAdvance;
+  int8_t xOffset;       // From the cursor to the top-left corner
+  int8_t yOffset;
+};
+
+struct PackedFont {
+  const uint8_t* data;
+  uint32_t size;        // Of data
+  const PackedGlyph* glyph;
+  uint16_t first;
+  uint16_t last;
+  uint8_t yAdvance;
+};
+
+// Glyph of character c, nullptr if the font does not have it
+const PackedGlyph* packedFontGlyph(const PackedFont& font, uint16_t c);
+
+// Decode a glyph into rows of (width + 7) / 8 bytes, MSB the leftmost
+// pixel and 1 ink; false if its stream is malformed
+bool packedGlyphDecode(const PackedFont& font, const PackedGlyph& glyph, uint8_t* dst);
+
+// Pack a GFX glyph bitmap (rows of width bits, continuous) into dst;
+// returns the packed size. With dst == nullptr only the size is computed.
+uint32_t packedGlyphEncode(const uint8_t* bitmap, uint8_t width, uint8_t height, uint8_t* dst);
+
+#endif // PACKEDFONT_H
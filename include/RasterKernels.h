@@ -0,0 +1,28 @@
+#ifndef RASTERKERNELS_H
+#define RASTERKERNELS_H
+
+#include <stdint.h>
+
+// Bit-level kernels for the 1bpp framebuffer (MSB is the leftmost pixel,
+// 1 is white). The kernels pick the fastest implementation for the CPU on
+// first use: SSE2/AVX2 when built for an x86 host, 32-bit scalar code on
+// the ESP32. All implementations produce bit-identical results.
+
+// Set (white) or clear (black) pixels [x0, x1) of one row
+void rasterFillSpan(uint8_t* row, int16_t x0, int16_t x1, bool white);
+
+// OR (white) or AND-NOT (black) a packed row of `width` source bits into a
+// row at pixel x. Source bits that are 0 leave the destination untouched.
+void rasterBlitRow(uint8_t* row, int16_t x, const uint8_t* bits, uint16_t width, bool white);
+
+// Number of pixels that differ between two frames
+uint32_t rasterCountChanged(const uint8_t* a, const uint8_t* b, uint32_t length);
+
+// Name of the selected implementation ("scalar", "sse2", "avx2")
+const char* rasterKernelName();
+
+// Switch to the named implementation, e.g. to check it against scalar;
+// false if it is not built in or the CPU lacks it
+bool rasterUseKernel(const char* name);
+
+#endif // RASTERKERNELS_H
@@ -0,0 +1,32 @@
+#ifndef RTCSNAPSHOT_H
+#define RTCSNAPSHOT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// A checkpoint of application state in RTC memory. The memory is not
+// initialized at boot, so it survives software resets, panics and watchdog
+// resets, but not power loss or brownouts. The checkpoint is protected by a
+// CRC and tagged with a layout version, so a new firmware or a cold boot
+// never restores garbage.
+
+// Largest state that fits in the checkpoint
+static const size_t RTC_SNAPSHOT_CAPACITY = 1024;
+
+// Store a checkpoint of `size` bytes; false when it doesn't fit
+bool rtcSnapshotSave(const void* state, size_t size, uint32_t version);
+
+// Copy the checkpoint into `state` if it is intact and was saved with the
+// same size and version
+bool rtcSnapshotRestore(void* state, size_t size, uint32_t version);
+
+// Drop the checkpoint
+void rtcSnapshotInvalidate();
+
+// True when the last reset kept RTC memory (software reset, panic, watchdog)
+bool isWarmReset();
+
+// Name of the last reset reason, for the log
+const char* resetReasonName();
+
+#endif // RTCSNAPSHOT_H
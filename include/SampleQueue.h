@@ -0,0 +1,55 @@
+#ifndef SAMPLEQUEUE_H
+#define SAMPLEQUEUE_H
+
+#include <stdint.h>
+
+// Fixed-size FIFO of samples between a bus driver and its consumer. When
+// the consumer falls behind the oldest sample is dropped, so the queue
+// always holds the most recent readings.
+template <typename T, uint8_t N>
+class SampleQueue {
+public:
+  SampleQueue() : _head(0), _count(0), _dropped(0) {}
+
+  void push(const T& sample) {
+    if (_count == N) {
+      _head = (_head + 1) % N;
+      _count--;
+      _dropped++;
+    }
+    _items[(_head + _count) % N] = sample;
+    _count++;
+  }
+
+  bool pop(T& sample) {
+    if (_count == 0) {
+      return false;
+    }
+    sample = _items[_head];
+    _head = (_head + 1) % N;
+    _count--;
+    return true;
+  }
+
+  // Pop everything and keep only the newest sample
+  bool popLatest(T& sample) {
+    bool any = false;
+    while (pop(sample)) {
+      any = true;
+    }
+    return any;
+  }
+
+  void clear() { _head = 0; _count = 0; }
+  bool isEmpty() const { return _count == 0; }
+  uint8_t size() const { return _count; }
+  uint32_t getDropped() const { return _dropped; }
+
+private:
+  T _items[N];
+  uint8_t _head;
+  uint8_t _count;
+  uint32_t _dropped;
+};
+
+#endif // SAMPLEQUEUE_H
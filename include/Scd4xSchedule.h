@@ -0,0 +1,98 @@
+#ifndef SCD4XSCHEDULE_H
+#define SCD4XSCHEDULE_H
+
+#include <stdint.h>
+
+// SCD4x command codes used on the scheduled bus
+enum Scd4xCode {
+  SCD4X_GET_DATA_READY = 0xE4B8,
+  SCD4X_READ_MEASUREMENT = 0xEC05,
+  SCD4X_START_PERIODIC = 0x21B1,
+  SCD4X_START_LOW_POWER_PERIODIC = 0x21AC,
+  SCD4X_STOP_PERIODIC = 0x3F86,
+  SCD4X_MEASURE_SINGLE_SHOT = 0x219D,
+  SCD4X_MEASURE_SINGLE_SHOT_RHT_ONLY = 0x2196    // SCD41 only
+};
+
+// Next command for the sensor: its code, how many response words to read
+// and how long it takes to execute
+struct Scd4xStep {
+  uint16_t code;
+  uint8_t rxWords;
+  uint32_t execMicros;
+};
+
+// What a finished command produced
+enum Scd4xEvent {
+  SCD4X_NOTHING,
+  SCD4X_MEASUREMENT_READY,  // The next read returns a new measurement
+  SCD4X_CO2_READING,        // A full measurement was read
+  SCD4X_RHT_READING         // Temperature and humidity only; its CO2 word is 0
+};
+
+// Decides which command the SCD4x gets next, so the timing rules live in
+// one place that the host mock can check without a bus.
+//
+// In periodic mode the sensor measures on its own and the data ready flag
+// is polled once a second. In single shot mode the sensor idles between a
+// CO2 measurement every co2 interval (5 s of execution) and, on the SCD41,
+// temperature and humidity only measurements every rht interval in
+// between (50 ms). An RHT shot that would still be running when the next
+// CO2 shot is due is left out, and the RHT cadence restarts from every CO2
+// shot, which brings temperature and humidity too.
+//
+// Times are micros(); intervals are given in ms.
+class Scd4xSchedule {
+public:
+  Scd4xSchedule();
+
+  // Sensor in (low power) periodic measurement, started by its owner
+  void setPeriodic();
+
+  // Sensor idle, measured by single shots; rhtIntervalMs 0 for none
+  void setSingleShot(uint32_t co2IntervalMs, uint32_t rhtIntervalMs);
+
+  // Change the single shot intervals without restarting the cycle
+  void setIntervals(uint32_t co2IntervalMs, uint32_t rhtIntervalMs);
+
+  bool isSingleShot() const;
+
+  // Start the cycle over at `now` (nothing in flight): single shot mode
+  // takes a CO2 measurement right away
+  void restart(unsigned long now);
+
+  // When the next command is due
+  unsigned long getDueTime() const;
+
+  // The command to send at `now`; false with the due time moved on when
+  // nothing is due yet
+  bool next(unsigned long now, Scd4xStep& step);
+
+  // The command from next() has executed and `words` holds its response
+  Scd4xEvent complete(const uint16_t* words, unsigned long now);
+
+  // Execution times from the datasheet
+  static const uint32_t COMMAND_US = 1000;
+  static const uint32_t SINGLE_SHOT_US = 5000000;
+  static const uint32_t RHT_ONLY_US = 50000;
+
+  // How often to ask whether a new periodic measurement is ready
+  static const uint32_t CHECK_INTERVAL_US = 1000000;
+
+private:
+  enum Pending { PENDING_NONE, PENDING_CO2, PENDING_RHT };
+
+  bool _singleShot;
+  uint32_t _co2Interval;       // micros
+  uint32_t _rhtInterval;       // micros, 0 for none
+  unsigned long _dueAt;
+  unsigned long _lastCo2;      // Start of the last CO2 shot
+  unsigned long _lastRht;      // Start of the last RHT shot
+  uint16_t _sent;              // Code of the command in flight
+  Pending _pending;            // Measurement the next read returns
+
+  unsigned long nextShot(unsigned long now) const;
+  bool rhtFits(unsigned long now) const;
+};
+
+#endif // SCD4XSCHEDULE_H
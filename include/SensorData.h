@@ -0,0 +1,16 @@
+#ifndef SENSORDATA_H
+#define SENSORDATA_H
+
+#include <stdint.h>
+
+// Structure to hold sensor data
+struct SensorData {
+  uint16_t co2;
+  float temperature;
+  float humidity;
+  uint32_t sampleId;   // Latency trace ID, 0 if not traced
+  uint16_t vocRaw;     // SGP41 raw VOC signal, 0 if not fitted
+  float pressure;      // BMP280 pressure (hPa), 0 if not fitted
+};
+
+#endif // SENSORDATA_H
@@ -0,0 +1,109 @@
+#ifndef SENSORPIPELINE_H
+#define SENSORPIPELINE_H
+
+#include <Arduino.h>
+#include "SensorData.h"
+
+// One reading on its way through the pipeline. Stages read and annotate it.
+struct PipelineSample {
+  SensorData data;        // The reading (stages may adjust it)
+  unsigned long time;     // millis() when the reading was taken
+  SensorData average;     // Window average, valid when windowClosed is set
+  bool windowClosed;      // This reading closed an aggregation window
+  bool historyTick;       // The window average was written to history
+  bool displayDirty;      // The display needs a refresh
+  bool co2Fresh;          // CO2 was measured, not held from an earlier reading
+  uint16_t settledCo2;    // The reading ended the sensor warmup at this level, else 0
+  
+  PipelineSample(const SensorData& reading, unsigned long now)
+    : data(reading), time(now), average(reading),
+      windowClosed(false), historyTick(false), displayDirty(false), co2Fresh(true), settledCo2(0) {}
+};
+
+// A pipeline of stages composed at compile time. A stage is any class with
+//   bool process(PipelineSample& sample);
+// Returning false drops the sample for the remaining stages. All calls are
+// resolved statically and the pipeline only holds references, so there are
+// no virtual calls and no allocations. Adding a stage means adding its type
+// to the template argument list.
+template <typename... Stages>
+class SensorPipeline;
+
+template <>
+class SensorPipeline<> {
+public:
+  bool process(PipelineSample&) { return true; }
+};
+
+template <typename Head, typename... Tail>
+class SensorPipeline<Head, Tail...> {
+public:
+  SensorPipeline(Head& head, Tail&... tail) : _head(head), _tail(tail...) {}
+  
+  bool process(PipelineSample& sample) {
+    return _head.process(sample) && _tail.process(sample);
+  }
+  
+private:
+  Head& _head;
+  SensorPipeline<Tail...> _tail;
+};
+
+// Drops readings outside the SCD4x output range
+class ValidateStage {
+public:
+  bool process(PipelineSample& sample);
+};
+
+// Exponential smoothing of temperature and humidity. A weight of 1.0 passes
+// readings through unchanged, smaller weights smooth more.
+class FilterStage {
+public:
+  FilterStage(float weight);
+  bool process(PipelineSample& sample);
+  
+private:
+  float _weight;
+  bool _primed;
+  float _temperature;
+  float _humidity;
+};
+
+// Averages readings over fixed windows and publishes the average on the
+// reading that closes each window
+class AggregateStage {
+public:
+  AggregateStage(unsigned long windowMs);
+  bool process(PipelineSample& sample);
+  
+  // Change the window length; the running window closes at the new length
+  void setWindow(unsigned long windowMs);
+  
+private:
+  unsigned long _windowMs;
+  unsigned long _windowStart;
+  uint32_t _co2Sum;
+  float _temperatureSum;
+  float _humiditySum;
+  uint16_t _count;
+};
+
+// CO2 statistics since boot
+class StatsStage {
+public:
+  StatsStage();
+  bool process(PipelineSample& sample);
+  
+  uint16_t getMinCO2() const;
+  uint16_t getMaxCO2() const;
+  uint16_t getAverageCO2() const;
+  uint32_t getSampleCount() const;
+  
+private:
+  uint16_t _minCO2;
+  uint16_t _maxCO2;
+  uint64_t _co2Sum;
+  uint32_t _count;
+};
+
+#endif // SENSORPIPELINE_H
@@ -0,0 +1,90 @@
+#ifndef VENTILATIONESTIMATOR_H
+#define VENTILATIONESTIMATOR_H
+
+#include <stdint.h>
+
+// Air change rate measured from the last CO2 decay
+struct VentilationEstimate {
+  float ach;            // Air changes per hour
+  float r2;             // Fit of the decay to an exponential, 0..1
+  float error;          // Relative standard error of ach (0.1 = +-10%)
+  uint16_t points;      // Readings in the decay
+  uint32_t duration;    // Length of the decay (s)
+  bool valid;
+};
+
+// Estimates the air change rate from the way CO2 falls once the source is
+// gone (the door opens, the car leaves): the excess over outdoor air decays
+// as excess(t) = excess(0) * exp(-ach * t), so ln(excess) is a straight line
+// in t with slope -ach. Decays are picked out of the readings as they come
+// in and fitted with a running weighted least squares, so a decay of any
+// length costs the same few sums. Weights are excess^2, which evens out the
+// noise that the log blows up near outdoor level.
+//
+// A decay starts at a reading well above outdoor air, is confirmed once
+// CO2 has fallen clearly below the readings since, and ends when CO2 rises
+// again (beyond sensor noise), gets too close to outdoor air or readings
+// stop. The estimate is updated on every reading of a decay that fits well
+// enough, and kept after it ends. Its error is the standard error of the
+// slope, relative; it does not cover a wrong outdoor level.
+//
+// Platform neutral (the host tools replay logs through it) and plain data,
+// so it can be checkpointed with memcpy.
+class VentilationEstimator {
+public:
+  VentilationEstimator(uint16_t outdoorCo2 = 420);
+
+  // Account for a CO2 reading taken at `now` (millis); true when it ended
+  // a decay that gave an estimate
+  bool addSample(uint16_t co2, unsigned long now);
+
+  // End the decay in progress, e.g. after millis() restarted
+  void resetClock();
+
+  // Latest estimate; not valid until a decay has been measured
+  const VentilationEstimate& getEstimate() const;
+
+  // A confirmed decay is being followed
+  bool isInDecay() const;
+
+  // Readings above outdoor air by at least this much can start a decay
+  static const uint16_t MIN_START_EXCESS = 300;
+
+  // Fall below the average so far that confirms a decay (plus 3% of the
+  // excess), and how long it may take
+  static const uint16_t START_DROP = 30;
+  static const uint32_t CONFIRM_MS = 1200000UL;
+
+  // Decays end this close to outdoor air, or after a gap this long
+  static const uint16_t MIN_EXCESS = 50;
+  static const uint32_t MAX_GAP_MS = 300000UL;
+
+private:
+  // Running sums of the weighted fit of ln(excess) against t (hours)
+  struct Fit {
+    double w, wt, wy, wtt, wty, wyy, ww;
+    uint16_t points;
+  };
+
+  uint16_t _outdoor;
+  bool _active;               // Following a candidate decay
+  bool _confirmed;            // It has fallen far enough to count
+  bool _below;               // Last reading was clearly below the average
+  bool _spike;                // Last reading was above the decay, left out
+  uint16_t _first;            // Reading the decay started at
+  uint16_t _lowest;
+  uint32_t _sum;              // Of the readings, for their average
+  uint16_t _previous;         // Last reading before confirmation, and its time
+  unsigned long _previousTime;
+  unsigned long _startTime;
+  unsigned long _lastTime;
+  Fit _fit;
+  VentilationEstimate _estimate;
+
+  void start(uint16_t co2, unsigned long now);
+  void add(uint16_t co2, unsigned long now);
+  bool finish();
+  bool evaluate(VentilationEstimate& estimate) const;
+};
+
+#endif // VENTILATIONESTIMATOR_H
@@ -0,0 +1,84 @@
+#ifndef WARMUPDETECTOR_H
+#define WARMUPDETECTOR_H
+
+#include <stdint.h>
+
+// Decides when the CO2 readings after a cold start can be trusted. The
+// sensor's first readings drift towards the real level as it warms up,
+// roughly exponentially; what is left of the offset is the drift rate
+// times the time constant. So the sensor is ready once a straight line
+// through the last WINDOW readings drifts by no more than the tolerance
+// over HORIZON_MS, the longest time constant expected, and no reading
+// strays further than the tolerance from the line. Readings that never
+// settle (CO2 really changing) are accepted after maxWarmupMs.
+//
+// maxWarmupMs and WINDOW are meant for a reading every 5 s. When the
+// readings come further apart (low power or single shot measurement) the
+// fit takes fewer of them, never less than MIN_WINDOW, and the time out
+// grows with the time it takes to fill that window: it allows as many
+// windows as maxWarmupMs does at 5 s, so slow readings can settle too.
+//
+// Platform neutral, so the host tools can replay cold starts through it.
+class WarmupDetector {
+public:
+  WarmupDetector(uint16_t tolerancePpm = 20, uint8_t tolerancePercent = 2, uint32_t maxWarmupMs = 180000);
+
+  // The sensor started measuring at `now` (millis)
+  void restart(unsigned long now);
+
+  // Account for a CO2 reading; true when it ended the warmup
+  bool addReading(uint16_t co2, unsigned long now);
+
+  // Readings can be trusted
+  bool isReady() const;
+
+  // Ready because maxWarmupMs passed, not because the readings settled
+  bool isTimedOut() const;
+
+  // Time from restart() to ready (ms)
+  unsigned long getWarmupTime() const;
+
+  // The level the readings settled at: the line through the window at the
+  // reading that ended the warmup, less noisy than that reading (the
+  // reading itself after a time out)
+  uint16_t getSettledCo2() const;
+
+  // Mark a sensor that was already warm, e.g. after a reset of the ESP32
+  void setReady();
+
+  // Time between CO2 readings (ms). A change during the warmup starts the
+  // window over, the warmup time keeps running.
+  void setInterval(unsigned long intervalMs);
+
+  // Readings the fit is made over and the time out, for the interval
+  uint8_t getWindow() const;
+  unsigned long getMaxWarmup() const;
+
+  // Readings the fit is made over at BASE_INTERVAL_MS; that is a minute
+  static const uint8_t WINDOW = 12;
+  static const uint8_t MIN_WINDOW = 4;
+  static const uint32_t BASE_INTERVAL_MS = 5000;
+
+  // Drift allowed: the tolerance over this long
+  static const uint32_t HORIZON_MS = 120000;
+
+private:
+  uint16_t _tolerancePpm;
+  uint8_t _tolerancePercent;
+  uint32_t _maxWarmup;
+  unsigned long _interval;
+  uint8_t _window;            // Readings the fit is made over
+  unsigned long _startTime;
+  unsigned long _warmupTime;
+  bool _ready;
+  bool _timedOut;
+  uint16_t _settled;
+  uint8_t _count;             // Readings in the window
+  uint8_t _next;              // Slot for the next reading
+  uint16_t _co2[WINDOW];
+  unsigned long _time[WINDOW];
+
+  bool settled();
+};
+
+#endif // WARMUPDETECTOR_H
@@ -0,0 +1,36 @@
+#ifndef WIFISTACK_H
+#define WIFISTACK_H
+
+#include <Arduino.h>
+#include "NetworkUplink.h"
+
+#ifdef ARDUINO_ARCH_ESP32
+#include <WiFi.h>
+#endif
+
+// NetworkUplink's radio on the ESP32: a station join (straight to the
+// cached access point and address when given), a TCP connection to the
+// collector, and the radio switched fully off in between. Only built for
+// the device; elsewhere it never joins.
+class WiFiStack : public NetworkStack {
+public:
+  WiFiStack(const char* ssid, const char* password, const char* host, uint16_t port);
+
+  void begin(const UplinkCache* cache);
+  bool isJoined();
+  bool getCache(UplinkCache& cache);
+  bool connect();
+  size_t write(const uint8_t* data, size_t length);
+  void end();
+
+private:
+  const char* _ssid;
+  const char* _password;
+  const char* _host;
+  uint16_t _port;
+#ifdef ARDUINO_ARCH_ESP32
+  WiFiClient _client;
+#endif
+};
+
+#endif // WIFISTACK_H
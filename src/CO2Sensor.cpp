@@ -1,16 +1,35 @@
 #include "CO2Sensor.h"
+#include "EventTracer.h"
+#include "LatencyTracer.h"
 
-CO2Sensor::CO2Sensor(int co2AlarmThreshold)
-  : _connected(false),
-    _validReadingCount(0),
-    _co2AlarmThreshold(co2AlarmThreshold) {
+CO2Sensor::CO2Sensor(I2CScheduler& scheduler, int co2AlarmThreshold, uint8_t sdaPin, uint8_t sclPin)
+  : _scheduler(scheduler),
+    _connected(false),
+    _co2AlarmThreshold(co2AlarmThreshold),
+    _sdaPin(sdaPin),
+    _sclPin(sclPin),
+    _lastReadingTime(0),
+    _lowPowerMode(false),
+    _co2Fresh(false),
+    _warmupDone(false),
+    _co2Interval(0),
+    _rhtInterval(0),
+    _probed(false),
+    _hasSingleShot(false),
+    _nearAlarm(false) {
+  memset(&_recoveryStats, 0, sizeof(_recoveryStats));
+  
   // Initialize default sensor data
   _currentData.co2 = 400;         // Default CO2 level (outdoor fresh air)
   _currentData.temperature = 20.0; // Default temperature
   _currentData.humidity = 50.0;    // Default humidity
+  _currentData.sampleId = 0;       // Not traced
+  
+  _scheduler.addDevice(&_device);
 }
 
 bool CO2Sensor::begin() {
+  I2CHold hold(_scheduler, &_device);
   Serial.println("Initializing CO2 sensor...");
   
   // Initialize the sensor
@@ -43,87 +62,147 @@ bool CO2Sensor::begin() {
     return false;
   }
   
-  // Allow time for the sensor to initialize and take first measurements
-  Serial.println("Waiting for sensor to initialize (7 seconds)...");
-  for (int i = 0; i < 7; i++) {
-    Serial.print(".");
-    delay(1000);
+  // No waiting for the first measurements: they come in through the
+  // scheduler, and the warmup detector decides when they can be trusted
+  _connected = true;
+  _warmup.restart(millis());
+  _lastReadingTime = millis();
+  _device.reset();
+  
+  Serial.println("CO2 sensor initialized successfully");
+  return true;
+}
+
+bool CO2Sensor::resume(bool warmedUp, bool lowPowerMode, bool singleShot) {
+  I2CHold hold(_scheduler, &_device);
+  Serial.println("Resuming CO2 sensor...");
+  _scd4x.begin(Wire);
+  _lowPowerMode = lowPowerMode;
+  
+  // get_serial_number is refused while measuring, the data ready flag isn't
+  if (!probeSensor()) {
+    Serial.println("Sensor did not answer, initializing from scratch");
+    return begin();
+  }
+  
+  // In single shot mode the sensor was left idle; it measures periodically
+  // until the energy policy asks for single shots again
+  if (singleShot && !startMeasurement()) {
+    return begin();
   }
-  Serial.println();
   
   _connected = true;
-  _validReadingCount = 0;
+  updateWarmupInterval();
+  _warmup.restart(millis());
+  if (warmedUp) {
+    _warmup.setReady();
+  }
+  _lastReadingTime = millis();
+  _device.reset();
   
-  Serial.println("CO2 sensor initialized successfully");
+  Serial.println("CO2 sensor resumed");
   return true;
 }
 
 bool CO2Sensor::update() {
+  TraceSpan span(EVENT_SENSOR_UPDATE);
+  
   if (!_connected) {
     Serial.println("Sensor not connected, skipping update");
     return false;
   }
   
-  bool isDataReady = false;
-  uint16_t error = _scd4x.getDataReadyFlag(isDataReady);
-  
-  if (error) {
-    Serial.print("ERROR: Failed to check data ready flag. Error code: ");
-    Serial.println(error);
+  // The scheduler stops polling after a NACK or CRC error
+  if (_device.hasFailed()) {
+    Serial.println("ERROR: Failed to read measurement from the bus");
     _connected = false;
-    _validReadingCount = 0;
     return false;
   }
   
-  if (!isDataReady) {
-    Serial.println("Data not ready yet, waiting...");
-    return false;
+  // Older readings still queued are superseded by the newest one. In
+  // single shot mode RHT only readings have a CO2 of 0 and don't replace
+  // the CO2 of an earlier reading.
+  bool singleShot = _device.isSingleShot();
+  SensorData reading;
+  uint16_t co2 = 0;
+  bool any = false;
+  while (_device.samples().pop(reading)) {
+    any = true;
+    if (reading.co2 != 0 || !singleShot) {
+      co2 = reading.co2;
+    }
   }
   
-  // Read measurement
-  uint16_t co2;
-  float temperature;
-  float humidity;
-  
-  error = _scd4x.readMeasurement(co2, temperature, humidity);
-  if (error) {
-    Serial.print("ERROR: Failed to read measurement. Error code: ");
-    Serial.println(error);
-    _connected = false;
-    _validReadingCount = 0;
+  if (!any) {
+    Serial.println("Data not ready yet, waiting...");
+    
+    // The sensor answers but has stopped producing readings, e.g. after it
+    // browned out and came back idle
+    if (millis() - _lastReadingTime >= MEASUREMENT_STALE_MS + (singleShot ? _co2Interval : 0)) {
+      Serial.println("No new readings for too long, restarting measurement");
+      _recoveryStats.measurementRestarts++;
+      I2CHold hold(_scheduler, &_device);
+      restartMeasurement();
+      _lastReadingTime = millis();
+    }
     return false;
   }
   
+  uint32_t sampleId = reading.sampleId;
+  
   // Validate readings
-  if (co2 == 0) {
+  if (co2 == 0 && !singleShot) {
     Serial.println("ERROR: Invalid CO2 reading (value = 0)");
     return false;
   }
   
-  // Store the readings
-  _currentData.co2 = co2;
-  _currentData.temperature = temperature;
-  _currentData.humidity = humidity;
+  // Store the readings; only temperature and humidity when no CO2 shot
+  // finished since the last update
+  _co2Fresh = co2 != 0;
+  _lastReadingTime = millis();
+  if (_co2Fresh) {
+    _currentData.co2 = co2;
+  }
+  _currentData.temperature = reading.temperature;
+  _currentData.humidity = reading.humidity;
+  _currentData.sampleId = sampleId;
   
-  // Increment valid reading count up to max of 5
-  if (_validReadingCount < 5) {
-    _validReadingCount++;
-    Serial.print("Valid reading count: ");
-    Serial.println(_validReadingCount);
+  if (_co2Fresh) {
+    // Close to the alarm CO2 can't wait for the long shot interval
+    bool nearAlarm = co2 >= _co2AlarmThreshold * 8 / 10;
+    if (nearAlarm != _nearAlarm) {
+      _nearAlarm = nearAlarm;
+      applyShotIntervals();
+    }
+  }
+  
+  // Readings are trusted once they stop drifting
+  _warmupDone = _co2Fresh && _warmup.addReading(co2, millis());
+  if (_warmupDone) {
+    Serial.print("Sensor warmed up in ");
+    Serial.print(_warmup.getWarmupTime() / 1000);
+    Serial.print(_warmup.isTimedOut() ? " s (timed out), at " : " s, settled at ");
+    Serial.print(_warmup.getSettledCo2());
+    Serial.println(" ppm");
   }
   
   // Debug output
   Serial.print("CO2: ");
   Serial.print(_currentData.co2);
-  Serial.print(" ppm, Temp: ");
+  Serial.print(_co2Fresh ? " ppm, Temp: " : " ppm (held), Temp: ");
   Serial.print(_currentData.temperature);
   Serial.print(" C, Humidity: ");
   Serial.print(_currentData.humidity);
   Serial.println("%");
   
+  latencyTracer.mark(sampleId, STAGE_SENSOR_UPDATED);
   return true;
 }
 
+bool CO2Sensor::isCo2Fresh() const {
+  return _co2Fresh;
+}
+
 SensorData CO2Sensor::getData() const {
   return _currentData;
 }
@@ -132,11 +211,32 @@ bool CO2Sensor::isConnected() const {
   return _connected;
 }
 
-uint8_t CO2Sensor::getValidReadingCount() const {
-  return _validReadingCount;
+bool CO2Sensor::isWarmedUp() const {
+  return _warmup.isReady();
+}
+
+bool CO2Sensor::hasFinishedWarmup() const {
+  return _warmupDone;
+}
+
+uint16_t CO2Sensor::getSettledCo2() const {
+  return _warmup.getSettledCo2();
+}
+
+unsigned long CO2Sensor::getCo2Interval() const {
+  if (_device.isSingleShot()) {
+    return _nearAlarm && _rhtInterval > 0 ? _rhtInterval : _co2Interval;
+  }
+  return _lowPowerMode ? 30000 : 5000;
+}
+
+void CO2Sensor::updateWarmupInterval() {
+  _warmup.setInterval(getCo2Interval());
 }
 
 bool CO2Sensor::reset() {
+  I2CHold hold(_scheduler, &_device);
+  
   // Stop ongoing measurements
   if (!stopMeasurement()) {
     return false;
@@ -149,6 +249,185 @@ bool CO2Sensor::reset() {
   return begin();
 }
 
+bool CO2Sensor::recover() {
+  TraceSpan span(EVENT_SENSOR_RECOVER);
+  I2CHold hold(_scheduler, &_device);
+  
+  // Level 1: free a stuck bus; the sensor normally keeps measuring. Only
+  // counted when SDA was actually held low and came free.
+  bool freed = false;
+  bool busFree = recoverBus(freed);
+  if (freed) {
+    _recoveryStats.busRecoveries++;
+  }
+  if (busFree && probeSensor()) {
+    Serial.println("Sensor recovered after I2C bus recovery");
+    _connected = true;
+    _device.reset();
+    return true;
+  }
+  
+  // Level 2: the sensor answers again but may have lost its measurement mode
+  if (probeSensor()) {
+    _recoveryStats.measurementRestarts++;
+    if (restartMeasurement()) {
+      Serial.println("Sensor recovered after measurement restart");
+      _connected = true;
+      _lastReadingTime = millis();
+      _device.reset();
+      return true;
+    }
+  }
+  
+  // Level 3: full reinitialization
+  _recoveryStats.fullReinits++;
+  return reset();
+}
+
+RecoveryStats CO2Sensor::getRecoveryStats() const {
+  return _recoveryStats;
+}
+
+bool CO2Sensor::setLowPowerMode(bool enabled) {
+  if (enabled == _lowPowerMode) {
+    return true;
+  }
+  _lowPowerMode = enabled;
+  
+  // Takes effect on the next start when the sensor isn't measuring
+  // periodically
+  if (!_connected || _device.isSingleShot()) {
+    return true;
+  }
+  _lastReadingTime = millis();
+  I2CHold hold(_scheduler, &_device);
+  return restartMeasurement();
+}
+
+bool CO2Sensor::isLowPowerMode() const {
+  return _lowPowerMode;
+}
+
+bool CO2Sensor::setSingleShotMode(unsigned long co2IntervalMs, unsigned long rhtIntervalMs) {
+  bool modeChanged = (co2IntervalMs > 0) != (_co2Interval > 0);
+  _co2Interval = co2IntervalMs;
+  _rhtInterval = rhtIntervalMs;
+  
+  // New intervals take effect at the next shot; an SCD40 has nothing to
+  // switch to
+  if (!modeChanged || !_connected || (co2IntervalMs > 0 && _probed && !_hasSingleShot)) {
+    applyShotIntervals();
+    return true;
+  }
+  _lastReadingTime = millis();
+  I2CHold hold(_scheduler, &_device);
+  return restartMeasurement();
+}
+
+bool CO2Sensor::isSingleShotMode() const {
+  return _device.isSingleShot();
+}
+
+bool CO2Sensor::hasSingleShot() const {
+  return _hasSingleShot;
+}
+
+void CO2Sensor::applyShotIntervals() {
+  if (_device.isSingleShot()) {
+    _device.setIntervals(_nearAlarm && _rhtInterval > 0 ? _rhtInterval : _co2Interval, _rhtInterval);
+    updateWarmupInterval();
+  }
+}
+
+bool CO2Sensor::recoverBus(bool& freed) {
+  Serial.println("Recovering I2C bus...");
+  unsigned long startTime = micros();
+  
+  Wire.end();
+  
+  // Take the pins over as open-drain GPIOs: INPUT_PULLUP releases a line,
+  // OUTPUT + LOW pulls it down
+  pinMode(_sdaPin, INPUT_PULLUP);
+  pinMode(_sclPin, INPUT_PULLUP);
+  delayMicroseconds(5);
+  bool stuck = digitalRead(_sdaPin) == LOW;
+  
+  // A slave stuck mid-byte holds SDA low until it has clocked out the rest
+  // of its byte, so up to 9 SCL pulses release it
+  for (int i = 0; i < 9 && digitalRead(_sdaPin) == LOW; i++) {
+    pinMode(_sclPin, OUTPUT);
+    digitalWrite(_sclPin, LOW);
+    delayMicroseconds(5);
+    pinMode(_sclPin, INPUT_PULLUP);
+    delayMicroseconds(5);
+    
+    // Honour clock stretching, but don't wait forever
+    for (int wait = 0; wait < 1000 && digitalRead(_sclPin) == LOW; wait++) {
+      delayMicroseconds(1);
+    }
+  }
+  
+  // Issue a STOP condition: SDA rises while SCL is high
+  pinMode(_sdaPin, OUTPUT);
+  digitalWrite(_sdaPin, LOW);
+  delayMicroseconds(5);
+  pinMode(_sclPin, INPUT_PULLUP);
+  delayMicroseconds(5);
+  pinMode(_sdaPin, INPUT_PULLUP);
+  delayMicroseconds(5);
+  
+  bool busFree = digitalRead(_sdaPin) == HIGH && digitalRead(_sclPin) == HIGH;
+  freed = stuck && busFree;
+  
+  Wire.begin(_sdaPin, _sclPin);
+  
+  Serial.print("I2C bus recovery ");
+  Serial.print(busFree ? (stuck ? "freed SDA" : "found the bus free") : "failed");
+  Serial.print(" in ");
+  Serial.print(micros() - startTime);
+  Serial.println(" us");
+  return busFree;
+}
+
+bool CO2Sensor::probeSensor() {
+  // get_data_ready_status is accepted both while idle and while measuring
+  bool isDataReady = false;
+  uint16_t error = _scd4x.getDataReadyFlag(isDataReady);
+  
+  if (error) {
+    Serial.print("Sensor probe failed. Error code: ");
+    Serial.println(error);
+    return false;
+  }
+  return true;
+}
+
+bool CO2Sensor::probeSingleShot() {
+  // Only the SCD41 has the single shot commands; the RHT only one is the
+  // cheap one to try, and its reading has a CO2 of 0
+  uint16_t error = _scd4x.measureSingleShotRhtOnly();
+  if (!error) {
+    uint16_t co2;
+    float temperature;
+    float humidity;
+    error = _scd4x.readMeasurement(co2, temperature, humidity);
+  }
+  
+  Serial.println(error ? "Sensor has no single shot measurement (SCD40)"
+                       : "Sensor supports single shot measurement (SCD41)");
+  return !error;
+}
+
+bool CO2Sensor::restartMeasurement() {
+  if (!stopMeasurement()) {
+    return false;
+  }
+  
+  // stop_periodic_measurement needs 500 ms before the next command
+  delay(500);
+  return startMeasurement();
+}
+
 bool CO2Sensor::checkConnection() {
   Serial.println("Checking sensor connection...");
   
@@ -224,8 +503,22 @@ bool CO2Sensor::stopMeasurement() {
 }
 
 bool CO2Sensor::startMeasurement() {
-  Serial.println("Starting periodic measurements...");
-  uint16_t error = _scd4x.startPeriodicMeasurement();
+  // The sensor is idle after a stop, so single shots can be tried once
+  if (_co2Interval > 0 && !_probed) {
+    _hasSingleShot = probeSingleShot();
+    _probed = true;
+  }
+  
+  if (_co2Interval > 0 && _hasSingleShot) {
+    Serial.println("Starting single shot measurements...");
+    _device.setSingleShot(_co2Interval, _rhtInterval);
+    applyShotIntervals();
+    _device.reset();
+    return true;
+  }
+  
+  Serial.println(_lowPowerMode ? "Starting low power periodic measurements..." : "Starting periodic measurements...");
+  uint16_t error = _lowPowerMode ? _scd4x.startLowPowerPeriodicMeasurement() : _scd4x.startPeriodicMeasurement();
   
   if (error) {
     Serial.print("ERROR: Failed to start measurement. Error code: ");
@@ -233,6 +526,9 @@ bool CO2Sensor::startMeasurement() {
     return false;
   }
   
+  _device.setPeriodic();
+  _device.reset();
+  updateWarmupInterval();
   Serial.println("Successfully started periodic measurements");
   return true;
 } 
\ No newline at end of file
@@ -0,0 +1,148 @@
+#include "CpuClock.h"
+#include "EventTracer.h"
+#include <string.h>
+
+CpuClock cpuClock;
+
+static const uint32_t FREQUENCIES[CpuClock::LEVELS] = { 80, 160, 240 };
+
+CpuClock::CpuClock()
+  : _idleMhz(240),
+    _boostMhz(240),
+    _frequency(240),
+    _holds(0),
+    _boosts(0),
+    _since(0) {
+  memset(_timeAt, 0, sizeof(_timeAt));
+  memset(_renders, 0, sizeof(_renders));
+}
+
+void CpuClock::begin(uint32_t idleMhz, uint32_t boostMhz) {
+  _idleMhz = level(idleMhz) >= 0 ? idleMhz : 80;
+  _boostMhz = level(boostMhz) >= 0 ? boostMhz : 240;
+#ifdef ARDUINO_ARCH_ESP32
+  _frequency = getCpuFrequencyMhz();
+#endif
+  _since = micros();
+  set(_holds > 0 ? _boostMhz : _idleMhz);
+}
+
+void CpuClock::acquire() {
+  if (_holds++ == 0) {
+    _boosts++;
+    set(_boostMhz);
+  }
+}
+
+void CpuClock::release() {
+  if (_holds > 0 && --_holds == 0) {
+    set(_idleMhz);
+  }
+}
+
+void CpuClock::setBoostFrequency(uint32_t mhz) {
+  if (level(mhz) < 0) {
+    return;
+  }
+  _boostMhz = mhz;
+  if (_holds > 0) {
+    set(_boostMhz);
+  }
+}
+
+uint32_t CpuClock::cycleBoostFrequency() {
+  setBoostFrequency(FREQUENCIES[(level(_boostMhz) + 1) % LEVELS]);
+  return _boostMhz;
+}
+
+uint32_t CpuClock::getFrequency() const {
+  return _frequency;
+}
+
+uint32_t CpuClock::getTimeAt(uint32_t mhz) {
+  int8_t index = level(mhz);
+  if (index < 0) {
+    return 0;
+  }
+  account();
+  return _timeAt[index] / 1000;
+}
+
+void CpuClock::recordRender(uint32_t micros) {
+  int8_t index = level(_frequency);
+  if (index < 0) {
+    return;
+  }
+  RenderStats& stats = _renders[index];
+  stats.count++;
+  stats.total += micros;
+  if (micros > stats.max) {
+    stats.max = micros;
+  }
+}
+
+void CpuClock::printSummary(Print& out) {
+  account();
+  uint64_t total = 0;
+  for (uint8_t i = 0; i < LEVELS; i++) {
+    total += _timeAt[i];
+  }
+
+  out.print("CPU clock: idle ");
+  out.print(_idleMhz);
+  out.print(" MHz, boost ");
+  out.print(_boostMhz);
+  out.print(" MHz, ");
+  out.print(_boosts);
+  out.println(" boosts");
+  for (uint8_t i = 0; i < LEVELS; i++) {
+    const RenderStats& stats = _renders[i];
+    out.print("  ");
+    out.print(FREQUENCIES[i]);
+    out.print(" MHz: ");
+    out.print((uint32_t)(_timeAt[i] / 1000000));
+    out.print(" s (");
+    out.print(total ? 100.0f * _timeAt[i] / total : 0.0f, 2);
+    out.print("%)");
+    if (stats.count) {
+      out.print(", render avg ");
+      out.print(stats.total / stats.count);
+      out.print(" us, max ");
+      out.print(stats.max);
+      out.print(" us over ");
+      out.print(stats.count);
+      out.print(" frames");
+    }
+    out.println();
+  }
+}
+
+void CpuClock::set(uint32_t mhz) {
+  if (mhz == _frequency) {
+    return;
+  }
+  account();
+#ifdef ARDUINO_ARCH_ESP32
+  setCpuFrequencyMhz(mhz);
+#endif
+  _frequency = mhz;
+  eventTracer.instant(EVENT_CPU_CLOCK, mhz);
+}
+
+void CpuClock::account() {
+  unsigned long now = micros();
+  int8_t index = level(_frequency);
+  if (index >= 0) {
+    _timeAt[index] += now - _since;
+  }
+  _since = now;
+}
+
+int8_t CpuClock::level(uint32_t mhz) {
+  for (uint8_t i = 0; i < LEVELS; i++) {
+    if (FREQUENCIES[i] == mhz) {
+      return i;
+    }
+  }
+  return -1;
+}
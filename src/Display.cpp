@@ -1,12 +1,10 @@
 #include "Display.h"
+#include "CpuClock.h"
+#include "EventTracer.h"
+#include "LatencyTracer.h"
+#include "RasterKernels.h"
 #include <math.h>
 
-// Font for text rendering
-const GFXfont* currentFont = nullptr;
-int16_t cursor_x = 0;
-int16_t cursor_y = 0;
-uint16_t textColor = COLOR_BLACK;
-
 // Helper functions for min and max since the Arduino ones are causing linter errors
 template <typename T>
 T getMin(T a, T b) {
@@ -18,11 +16,58 @@ T getMax(T a, T b) {
     return (a > b) ? a : b;
 }
 
+// Pages kept in the frame cache
+enum FramePage {
+    FRAME_SHOWN,           // Whatever the panel shows
+    FRAME_INSTRUCTIONS     // Sensor connection instructions
+};
+
+// _shownKey while the panel contents are unknown
+static const uint32_t NO_FRAME = 0xFFFFFFFF;
+
+// Transpose an 8x8 bit matrix (one byte per row, MSB is column 0).
+// Works on two 32-bit halves so it stays cheap on the ESP32.
+static void transpose8x8(const uint8_t* in, uint8_t* out) {
+    uint32_t x = ((uint32_t)in[0] << 24) | ((uint32_t)in[1] << 16) | ((uint32_t)in[2] << 8) | in[3];
+    uint32_t y = ((uint32_t)in[4] << 24) | ((uint32_t)in[5] << 16) | ((uint32_t)in[6] << 8) | in[7];
+    uint32_t t;
+    
+    // Swap single bits, then bit pairs, inside each 4x4 quadrant
+    t = (x ^ (x >> 7)) & 0x00AA00AA;  x = x ^ t ^ (t << 7);
+    t = (y ^ (y >> 7)) & 0x00AA00AA;  y = y ^ t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000CCCC; x = x ^ t ^ (t << 14);
+    t = (y ^ (y >> 14)) & 0x0000CCCC; y = y ^ t ^ (t << 14);
+    
+    // Swap the off-diagonal 4x4 quadrants
+    t = (x & 0xF0F0F0F0) | ((y >> 4) & 0x0F0F0F0F);
+    y = ((x << 4) & 0xF0F0F0F0) | (y & 0x0F0F0F0F);
+    x = t;
+    
+    out[0] = x >> 24; out[1] = x >> 16; out[2] = x >> 8; out[3] = x;
+    out[4] = y >> 24; out[5] = y >> 16; out[6] = y >> 8; out[7] = y;
+}
+
+static uint8_t reverseBits(uint8_t b) {
+    b = (b & 0xF0) >> 4 | (b & 0x0F) << 4;
+    b = (b & 0xCC) >> 2 | (b & 0x33) << 2;
+    b = (b & 0xAA) >> 1 | (b & 0x55) << 1;
+    return b;
+}
+
 Display::Display(uint8_t busy_pin, uint8_t cs_pin, uint8_t rst_pin, uint8_t dc_pin,
                 int co2_alarm_threshold, uint8_t data_history_size) 
+  : Display(co2_alarm_threshold, data_history_size) {
+    _panel = new EPaperPanel(busy_pin, cs_pin, rst_pin, dc_pin, WIDTH, HEIGHT);
+    _store = new FrameStore("frame");
+}
+
+Display::Display(int co2_alarm_threshold, uint8_t data_history_size)
   : Adafruit_GFX(WIDTH, HEIGHT),
-    _busy_pin(busy_pin), _cs_pin(cs_pin), _rst_pin(rst_pin), _dc_pin(dc_pin),
-    _co2_alarm_threshold(co2_alarm_threshold), _data_history_size(data_history_size) {
+    _panel(nullptr), _currentFont(nullptr), _packedFont(nullptr), _textColor(COLOR_BLACK),
+    _co2_alarm_threshold(co2_alarm_threshold), _data_history_size(data_history_size),
+    _frameSampleId(0), _refreshSampleId(0),
+    _store(nullptr), _shownKey(NO_FRAME), _shownUnsaved(false),
+    _showFooter(false), _footerMinutes(0) {
     
     // Allocate buffer for display
     _buffer = new uint8_t[WIDTH * HEIGHT / 8];
@@ -35,176 +80,311 @@ Display::~Display() {
     if (_buffer) {
         delete[] _buffer;
     }
+    if (_panel) {
+        delete _panel;
+    }
+    if (_store) {
+        delete _store;
+    }
 }
 
 bool Display::begin() {
     Serial.println("Display: Initializing...");
     
-    // Setup pins
-    pinMode(_busy_pin, INPUT);
-    pinMode(_rst_pin, OUTPUT);
-    pinMode(_dc_pin, OUTPUT);
-    pinMode(_cs_pin, OUTPUT);
+    if (_panel) {
+        _panel->begin();
+    }
     
-    digitalWrite(_cs_pin, HIGH);
-    digitalWrite(_dc_pin, HIGH);
-    digitalWrite(_rst_pin, HIGH);
+    // E-paper keeps its image without power: what was last sent is still on
+    // the glass, and sending the same frame again can be skipped
+    if (_store && _store->begin()) {
+        uint32_t key;
+        uint32_t size;
+        const uint8_t* packed = _store->newest(key, size);
+        if (packed && _frames.load(key, packed, size)) {
+            _shownKey = key;
+            Serial.print("Display: Panel shows the last saved frame (");
+            Serial.print(size);
+            Serial.println(" bytes packed)");
+        }
+    }
     
-    // Initialize display
-    initDisplay();
+    // Instead of clearing the display during initialization,
+    // just prepare the buffer for later use but don't send to display
+    fillScreen(COLOR_BLACK);
     
-    // Don't clear or update the display yet - wait for actual content
+    // Set flag to indicate we have not actually updated the display yet
+    // This will be done by the first content rendering
+    Serial.println("Display: Display initialized (buffer prepared, no refresh yet)");
     
     Serial.println("Display: Initialization complete");
     return true;
 }
 
-void Display::reset() {
-    Serial.println("Display: Resetting...");
-    digitalWrite(_rst_pin, LOW);
-    delay(10);
-    digitalWrite(_rst_pin, HIGH);
-    delay(10);
-}
-
-void Display::initDisplay() {
-    Serial.println("Display: Sending init commands...");
-    
-    // Reset the display first
-    reset();
-    delay(100);  // Give it more time after reset
-    
-    // Based on the working example's initialization sequence for GDEY0583T81
-    sendCommand(0x06);   // Booster Soft Start
-    sendData(0x17);      // A
-    sendData(0x17);      // B
-    sendData(0x28);      // C
-    sendData(0x17);      // D
-    
-    delay(10);  // Add small delay between commands
+void Display::setRotation(uint8_t rotation) {
+    Adafruit_GFX::setRotation(rotation);
     
-    sendCommand(0x04);   // POWER ON
-    delay(100);          // Give more time for power-on
-    waitUntilIdle();
+    // The logical geometry changed, so the old contents are meaningless
+    fillScreen(COLOR_BLACK);
     
-    sendCommand(0x00);   // PANEL SETTING
-    sendData(0x0F);      // KW-3f KWR-2F BWROTP 0f BWOTP 1f
+    Serial.print("Display: Rotation set to ");
+    Serial.print(getRotation() * 90);
+    Serial.println(" degrees");
+}
+
+// Gather the 8 panel bytes of the tile at panel row panelY (multiple of 8) and
+// byte column panelByteX, in panel scan order. Every panel tile maps onto one
+// aligned 8x8 tile of the logical buffer, so a transpose plus a row or bit
+// reversal is all that is needed.
+void Display::readPanelTile(uint16_t panelY, uint16_t panelByteX, uint8_t* tile) {
+    const uint16_t stride = _width / 8;
+    uint8_t rows[8];
+    
+    switch (getRotation()) {
+        case 1: {
+            // Panel x runs up the logical rows, panel y runs along logical x
+            uint16_t logicalY = _height - 8 - panelByteX * 8;
+            const uint8_t* src = _buffer + (uint32_t)logicalY * stride + panelY / 8;
+            for (int i = 0; i < 8; i++) {
+                rows[i] = src[(7 - i) * stride];
+            }
+            transpose8x8(rows, tile);
+            break;
+        }
+        case 2: {
+            const uint8_t* src = _buffer + (uint32_t)(_height - 1 - panelY) * stride + (stride - 1 - panelByteX);
+            for (int i = 0; i < 8; i++) {
+                tile[i] = reverseBits(src[-(int32_t)i * stride]);
+            }
+            break;
+        }
+        case 3: {
+            // Panel x runs down the logical rows, panel y runs back along logical x
+            uint16_t logicalY = panelByteX * 8;
+            const uint8_t* src = _buffer + (uint32_t)logicalY * stride + (_width - 8 - panelY) / 8;
+            uint8_t transposed[8];
+            for (int i = 0; i < 8; i++) {
+                rows[i] = src[i * stride];
+            }
+            transpose8x8(rows, transposed);
+            for (int i = 0; i < 8; i++) {
+                tile[i] = transposed[7 - i];
+            }
+            break;
+        }
+        default: {
+            const uint8_t* src = _buffer + (uint32_t)panelY * stride + panelByteX;
+            for (int i = 0; i < 8; i++) {
+                tile[i] = src[i * stride];
+            }
+            break;
+        }
+    }
+}
+
+void Display::sendRotatedBuffer() {
+    const uint16_t panelStride = WIDTH / 8;
+    uint8_t band[8 * (WIDTH / 8)];  // 8 panel rows
+    uint8_t tile[8];
+    unsigned long rotateTime = 0;
+    
+    for (uint16_t panelY = 0; panelY < HEIGHT; panelY += 8) {
+        // Rotate one band of tiles, then stream it out in panel row order
+        unsigned long start = micros();
+        for (uint16_t bx = 0; bx < panelStride; bx++) {
+            readPanelTile(panelY, bx, tile);
+            for (int row = 0; row < 8; row++) {
+                band[row * panelStride + bx] = tile[row];
+            }
+        }
+        rotateTime += micros() - start;
+        
+        _panel->sendPixels(band, sizeof(band));
+    }
     
-    delay(10);  // Add small delay between commands
+    Serial.print("Display: Rotated frame in ");
+    Serial.print(rotateTime);
+    Serial.println(" us");
+}
+
+void Display::update(bool force) {
+    if (!_panel) {
+        // Nothing to push to; the frame stays in the buffer
+        drawFooter();
+        _frameSampleId = 0;
+        return;
+    }
     
-    sendCommand(0x50);   // VCOM AND DATA INTERVAL SETTING
-    sendData(0x20);      // Default value for this display
-    sendData(0x07);
+    // Nothing changed on screen, so the upload and the flashing refresh
+    // would only cost time and power. A forced refresh is wanted for the
+    // flashing itself.
+    uint32_t key = frameKey(FRAME_SHOWN);
+    uint32_t changed = FrameCache::NOT_CACHED;
+    if (!force) {
+        ClockBoost boost;
+        eventTracer.begin(EVENT_FRAME_COMPARE);
+        changed = _frames.changedPixels(key, _buffer, getBufferSize());
+        eventTracer.end(EVENT_FRAME_COMPARE);
+    }
+    if (changed == 0) {
+        eventTracer.instant(EVENT_REFRESH_SKIPPED);
+        latencyTracer.mark(_frameSampleId, STAGE_UPLOADED);
+        latencyTracer.mark(_frameSampleId, STAGE_REFRESHED);
+        _frameSampleId = 0;
+        Serial.println("Display: Frame unchanged, refresh skipped");
+        return;
+    }
     
-    delay(10);  // Add small delay between commands
+    if (changed == FrameCache::NOT_CACHED) {
+        Serial.println("Display: Updating display...");
+    } else {
+        Serial.print("Display: Updating display, ");
+        Serial.print(changed);
+        Serial.println(" pixels changed...");
+    }
     
-    sendCommand(0x61);   // Resolution Setting
-    sendData(WIDTH >> 8); // High byte of width
-    sendData(WIDTH & 0xFF); // Low byte of width
-    sendData(HEIGHT >> 8); // High byte of height
-    sendData(HEIGHT & 0xFF); // Low byte of height
+    // Let the previous refresh finish, so its latency mark lands
+    if (poll()) {
+        eventTracer.begin(EVENT_PANEL_WAIT);
+        while (poll()) {
+            delay(1);
+        }
+        eventTracer.end(EVENT_PANEL_WAIT);
+    }
     
-    delay(10);  // Add small delay between commands
+    // Remember what the panel will show, without the footer; flash waits
+    // for the refresh
+    if (_shownKey != key) {
+        _frames.remove(_shownKey);
+    }
+    if (_frames.store(key, _buffer, getBufferSize())) {
+        _shownKey = key;
+        _shownUnsaved = _store != nullptr;
+    } else {
+        _shownKey = NO_FRAME;
+    }
+    drawFooter();
+    
+    // Send black buffer data; at full clock the SPI FIFO is kept fed
+    {
+        ClockBoost boost;
+        eventTracer.begin(EVENT_UPLOAD);
+        _panel->beginFrame();
+        if (getRotation() != 0) {
+            sendRotatedBuffer();
+        } else {
+            _panel->sendPixels(_buffer, WIDTH * HEIGHT / 8);
+        }
+        _panel->endFrame();
+        eventTracer.end(EVENT_UPLOAD);
+    }
+    latencyTracer.mark(_frameSampleId, STAGE_UPLOADED);
     
-    Serial.println("Display: Init commands sent");
+    // The refresh runs on its own; poll() picks up the end of it
+    _panel->refresh();
+    _refreshSampleId = _frameSampleId;
+    _frameSampleId = 0;
     
-    // Instead of clearing the display during initialization,
-    // just prepare the buffer for later use but don't send to display
-    fillScreen(COLOR_BLACK);
+    // Take the footer out again, so the buffer is the cached frame that
+    // the next comparison starts from
+    if (_showFooter && _shownKey == key) {
+        _frames.restore(key, _buffer, getBufferSize());
+    }
     
-    // Set flag to indicate we have not actually updated the display yet
-    // This will be done by the first content rendering
-    Serial.println("Display: Display initialized (buffer prepared, no refresh yet)");
+    uint32_t size = 0;
+    if (_frames.find(key, size)) {
+        Serial.print("Display: Frame sent, refreshing (packed to ");
+        Serial.print(size);
+        Serial.println(" bytes)");
+    } else {
+        Serial.println("Display: Frame sent, refreshing");
+    }
 }
 
-void Display::sendCommand(uint8_t command) {
-    digitalWrite(_dc_pin, LOW);   // Command mode
-    digitalWrite(_cs_pin, LOW);
-    SPI.transfer(command);
-    digitalWrite(_cs_pin, HIGH);
+bool Display::poll() {
+    if (!_panel) {
+        return false;
+    }
+    if (_panel->poll()) {
+        return true;
+    }
+    
+    if (_refreshSampleId) {
+        latencyTracer.mark(_refreshSampleId, STAGE_REFRESHED);
+        _refreshSampleId = 0;
+    }
+    saveShownFrame();
+    return false;
 }
 
-void Display::sendData(uint8_t data) {
-    digitalWrite(_dc_pin, HIGH);  // Data mode
-    digitalWrite(_cs_pin, LOW);
-    SPI.transfer(data);
-    digitalWrite(_cs_pin, HIGH);
+void Display::sleep() {
+    if (_panel) {
+        _panel->sleep();
+        saveShownFrame();
+    }
 }
 
-void Display::waitUntilIdle() {
-    Serial.println("Display: Waiting for display to be idle...");
-    
-    // Add a timeout to prevent getting stuck in a loop
-    unsigned long startTime = millis();
-    const unsigned long timeout = 5000; // 5 second timeout
-    
-    while(digitalRead(_busy_pin) == HIGH) {
-        delay(10);
-        
-        // Check for timeout
-        if (millis() - startTime > timeout) {
-            Serial.println("Display: BUSY timeout - forcing continue");
-            break;
-        }
+void Display::drawFooter() {
+    if (!_showFooter) {
+        return;
     }
     
-    Serial.println("Display: Display is idle now");
+    setFont(&FreeMonoBold12pt7b);
+    setTextColor(COLOR_WHITE);
+    setCursor(20, height() - 20);
+    print("Last update: ");
+    print((int)_footerMinutes);
+    print(" min ago");
 }
 
-void Display::update() {
-    Serial.println("Display: Updating display...");
-    
-    // Send black buffer data
-    sendCommand(0x10);
-    delay(10);  // Add a small delay after command
-    
-    // Send black buffer data
-    for (uint32_t i = 0; i < WIDTH * HEIGHT / 8; i++) {
-        sendData(_buffer[i]);
-        
-        // Add a tiny delay every 1024 bytes to prevent overrunning the display controller
-        if ((i % 1024) == 0) {
-            delayMicroseconds(100);
-        }
+uint32_t Display::frameKey(uint8_t page) const {
+    return (uint32_t)page << 2 | getRotation();
+}
+
+void Display::saveShownFrame() {
+    if (!_shownUnsaved) {
+        return;
     }
+    _shownUnsaved = false;
     
-    delay(10);  // Add a small delay after data transfer
-    
-    // Send red buffer data (we're using B/W display so just send 0s)
-    sendCommand(0x13);
-    delay(10);  // Add a small delay after command
+    uint32_t size;
+    const uint8_t* packed = _frames.find(_shownKey, size);
+    if (!packed) {
+        return;
+    }
     
-    // Send red buffer data (all zeros)
-    for (uint32_t i = 0; i < WIDTH * HEIGHT / 8; i++) {
-        sendData(0x00);
-        
-        // Add a tiny delay every 1024 bytes to prevent overrunning the display controller
-        if ((i % 1024) == 0) {
-            delayMicroseconds(100);
+    TraceSpan span(EVENT_FRAME_SAVE);
+    if (!_store->save(_shownKey, packed, size)) {
+        Serial.println("Display: ERROR - could not save the frame to flash");
+    }
+}
+
+const uint8_t* Display::getBuffer() const {
+    return _buffer;
+}
+
+uint32_t Display::getBufferSize() const {
+    return WIDTH * HEIGHT / 8;
+}
+
+void Display::writePBM(Print& out) const {
+    // PBM uses 1 for black, the buffer uses 1 for white
+    char header[24];
+    snprintf(header, sizeof(header), "P4\n%d %d\n", width(), height());
+    out.print(header);
+    
+    uint8_t row[WIDTH / 8];
+    const uint16_t stride = width() / 8;
+    for (int16_t y = 0; y < height(); y++) {
+        for (uint16_t i = 0; i < stride; i++) {
+            row[i] = ~_buffer[(uint32_t)y * stride + i];
         }
+        out.write(row, stride);
     }
-    
-    delay(10);  // Add a small delay after data transfer
-    
-    // Refresh display
-    sendCommand(0x12);
-    delay(100);  // Increased delay to give more time before asking for busy status
-    waitUntilIdle();
-    
-    // Add an additional delay after the update to ensure the display has time to stabilize
-    delay(100);
-    
-    Serial.println("Display: Update complete");
 }
 
-void Display::sleep() {
-    Serial.println("Display: Going to sleep...");
-    sendCommand(0x02);  // Power off
-    waitUntilIdle();
-    delay(100);
-    sendCommand(0x07);  // Deep sleep
-    sendData(0xA5);
-    Serial.println("Display: Now sleeping");
+const GlyphCache& Display::getGlyphCache() const {
+    return _glyphs;
 }
 
 void Display::fillScreen(uint16_t color) {
@@ -214,10 +394,11 @@ void Display::fillScreen(uint16_t color) {
 }
 
 void Display::drawPixel(int16_t x, int16_t y, uint16_t color) {
-    if (x < 0 || x >= WIDTH || y < 0 || y >= HEIGHT) return;
+    // Coordinates are logical; the buffer is laid out in the rotated geometry
+    if (x < 0 || x >= _width || y < 0 || y >= _height) return;
     
-    uint32_t byte_idx = (y * WIDTH + x) / 8;
-    uint8_t bit_pos = 7 - ((y * WIDTH + x) % 8);
+    uint32_t byte_idx = ((uint32_t)y * _width + x) / 8;
+    uint8_t bit_pos = 7 - (x % 8);
     
     if (color == COLOR_WHITE) {
         _buffer[byte_idx] |= (1 << bit_pos);  // Set bit (white)
@@ -227,22 +408,157 @@ void Display::drawPixel(int16_t x, int16_t y, uint16_t color) {
 }
 
 void Display::drawFastVLine(int16_t x, int16_t y, int16_t h, uint16_t color) {
-    for (int16_t i = y; i < y + h; i++) {
-        drawPixel(x, i, color);
+    if (x < 0 || x >= _width) return;
+    int16_t y0 = y < 0 ? 0 : y;
+    int16_t y1 = y + h > _height ? _height : y + h;
+    
+    uint16_t stride = _width / 8;
+    uint8_t mask = 0x80 >> (x & 7);
+    uint8_t* p = _buffer + (uint32_t)y0 * stride + x / 8;
+    for (int16_t j = y0; j < y1; j++, p += stride) {
+        if (color == COLOR_WHITE) {
+            *p |= mask;
+        } else {
+            *p &= ~mask;
+        }
     }
 }
 
 void Display::drawFastHLine(int16_t x, int16_t y, int16_t w, uint16_t color) {
-    for (int16_t i = x; i < x + w; i++) {
-        drawPixel(i, y, color);
-    }
+    if (y < 0 || y >= _height) return;
+    int16_t x0 = x < 0 ? 0 : x;
+    int16_t x1 = x + w > _width ? _width : x + w;
+    if (x0 >= x1) return;
+    
+    rasterFillSpan(_buffer + (uint32_t)y * (_width / 8), x0, x1, color == COLOR_WHITE);
 }
 
 void Display::fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) {
-    for (int16_t i = x; i < x + w; i++) {
-        for (int16_t j = y; j < y + h; j++) {
-            drawPixel(i, j, color);
+    // Clip once, then fill whole bytes per row instead of pixel by pixel
+    int16_t x0 = x < 0 ? 0 : x;
+    int16_t x1 = x + w > _width ? _width : x + w;
+    int16_t y0 = y < 0 ? 0 : y;
+    int16_t y1 = y + h > _height ? _height : y + h;
+    if (x0 >= x1 || y0 >= y1) return;
+    
+    uint16_t stride = _width / 8;
+    uint8_t* row = _buffer + (uint32_t)y0 * stride;
+    for (int16_t j = y0; j < y1; j++, row += stride) {
+        rasterFillSpan(row, x0, x1, color == COLOR_WHITE);
+    }
+}
+
+size_t Display::write(uint8_t c) {
+    // Same cursor handling as Adafruit_GFX for custom fonts, but glyph rows
+    // are blitted into the buffer instead of drawn one pixel at a time
+    if (_packedFont) {
+        return writePacked(c);
+    }
+    if (!gfxFont || textsize_x != 1 || textsize_y != 1) {
+        return Adafruit_GFX::write(c);
+    }
+    
+    if (c == '\n') {
+        cursor_x = 0;
+        cursor_y += gfxFont->yAdvance;
+        return 1;
+    }
+    if (c == '\r' || c < gfxFont->first || c > gfxFont->last) {
+        return 1;
+    }
+    
+    const GFXglyph* glyph = &gfxFont->glyph[c - gfxFont->first];
+    if (glyph->width > 0 && glyph->height > 0) {
+        if (wrap && cursor_x + glyph->xOffset + glyph->width > _width) {
+            cursor_x = 0;
+            cursor_y += gfxFont->yAdvance;
+        }
+        drawGlyph(glyph, cursor_x + glyph->xOffset, cursor_y + glyph->yOffset, textcolor);
+    }
+    cursor_x += glyph->xAdvance;
+    return 1;
+}
+
+void Display::drawGlyph(const GFXglyph* glyph, int16_t x, int16_t y, uint16_t color) {
+    // Glyph bitmaps are packed continuously, so each row starts at an
+    // arbitrary bit offset; realign it into whole bytes before blitting
+    const uint8_t* bitmap = gfxFont->bitmap + glyph->bitmapOffset;
+    uint16_t w = glyph->width;
+    uint32_t end = ((uint32_t)w * glyph->height + 7) / 8;
+    uint16_t stride = _width / 8;
+    bool inside = x >= 0 && x + w <= _width;
+    uint8_t bits[32];
+    
+    for (uint16_t yy = 0; yy < glyph->height; yy++) {
+        int16_t py = y + yy;
+        if (py < 0 || py >= _height) continue;
+        
+        uint32_t bit = (uint32_t)yy * w;
+        uint32_t idx = bit / 8;
+        uint8_t shift = bit % 8;
+        
+        if (!inside || w > sizeof(bits) * 8) {
+            for (uint16_t xx = 0; xx < w; xx++, bit++) {
+                if (bitmap[bit / 8] & (0x80 >> (bit % 8))) {
+                    drawPixel(x + xx, py, color);
+                }
+            }
+            continue;
         }
+        
+        for (uint16_t i = 0; i < (w + 7) / 8; i++, idx++) {
+            uint8_t next = (shift && idx + 1 < end) ? bitmap[idx + 1] : 0;
+            bits[i] = shift ? (uint8_t)((bitmap[idx] << shift) | (next >> (8 - shift))) : bitmap[idx];
+        }
+        rasterBlitRow(_buffer + (uint32_t)py * stride, x, bits, w, color == COLOR_WHITE);
+    }
+}
+
+size_t Display::writePacked(uint8_t c) {
+    // Packed fonts are drawn at size 1 only
+    if (c == '\n') {
+        cursor_x = 0;
+        cursor_y += _packedFont->yAdvance;
+        return 1;
+    }
+    const PackedGlyph* glyph = packedFontGlyph(*_packedFont, c);
+    if (c == '\r' || !glyph) {
+        return 1;
+    }
+    
+    if (glyph->width > 0 && glyph->height > 0) {
+        if (wrap && cursor_x + glyph->xOffset + glyph->width > _width) {
+            cursor_x = 0;
+            cursor_y += _packedFont->yAdvance;
+        }
+        const uint8_t* rows = _glyphs.get(_packedFont, c);
+        if (rows) {
+            drawGlyphRows(rows, glyph->width, glyph->height,
+                          cursor_x + glyph->xOffset, cursor_y + glyph->yOffset, textcolor);
+        }
+    }
+    cursor_x += glyph->xAdvance;
+    return 1;
+}
+
+void Display::drawGlyphRows(const uint8_t* rows, uint16_t w, uint16_t h, int16_t x, int16_t y, uint16_t color) {
+    uint16_t rowBytes = (w + 7) / 8;
+    uint16_t stride = _width / 8;
+    bool inside = x >= 0 && x + w <= _width;
+    
+    for (uint16_t yy = 0; yy < h; yy++, rows += rowBytes) {
+        int16_t py = y + yy;
+        if (py < 0 || py >= _height) continue;
+        
+        if (!inside) {
+            for (uint16_t xx = 0; xx < w; xx++) {
+                if (rows[xx / 8] & (0x80 >> (xx % 8))) {
+                    drawPixel(x + xx, py, color);
+                }
+            }
+            continue;
+        }
+        rasterBlitRow(_buffer + (uint32_t)py * stride, x, rows, w, color == COLOR_WHITE);
     }
 }
 
@@ -262,54 +578,127 @@ void Display::setCursor(int16_t x, int16_t y) {
 }
 
 void Display::setTextColor(uint16_t color) {
-    textColor = color;
+    _textColor = color;
 }
 
 void Display::setFont(const GFXfont* font) {
-    currentFont = font;
+    _currentFont = font;
+    _packedFont = nullptr;
     Adafruit_GFX::setFont(font);
 }
 
+void Display::setFont(const PackedFont* font) {
+    _packedFont = font;
+}
+
+void Display::getTextBounds(const char* text, int16_t x, int16_t y,
+                            int16_t* x1, int16_t* y1, uint16_t* w, uint16_t* h) {
+    if (!_packedFont) {
+        Adafruit_GFX::getTextBounds(text, x, y, x1, y1, w, h);
+        return;
+    }
+    
+    // As Adafruit_GFX measures custom fonts, at size 1
+    int16_t minx = 0x7FFF, miny = 0x7FFF, maxx = -1, maxy = -1;
+    *x1 = x;
+    *y1 = y;
+    *w = *h = 0;
+    for (const char* p = text; *p; p++) {
+        uint8_t c = *p;
+        if (c == '\n') {
+            x = 0;
+            y += _packedFont->yAdvance;
+            continue;
+        }
+        const PackedGlyph* glyph = packedFontGlyph(*_packedFont, c);
+        if (c == '\r' || !glyph) continue;
+        if (wrap && x + glyph->xOffset + glyph->width > _width) {
+            x = 0;
+            y += _packedFont->yAdvance;
+        }
+        int16_t gx1 = x + glyph->xOffset, gy1 = y + glyph->yOffset;
+        int16_t gx2 = gx1 + glyph->width - 1, gy2 = gy1 + glyph->height - 1;
+        if (gx1 < minx) minx = gx1;
+        if (gy1 < miny) miny = gy1;
+        if (gx2 > maxx) maxx = gx2;
+        if (gy2 > maxy) maxy = gy2;
+        x += glyph->xAdvance;
+    }
+    if (maxx >= minx) {
+        *x1 = minx;
+        *w = maxx - minx + 1;
+    }
+    if (maxy >= miny) {
+        *y1 = miny;
+        *h = maxy - miny + 1;
+    }
+}
+
 void Display::print(const char* text) {
     setCursor(cursor_x, cursor_y);
-    Adafruit_GFX::setTextColor(textColor);
+    Adafruit_GFX::setTextColor(_textColor);
     Adafruit_GFX::print(text);
 }
 
 void Display::print(int value) {
     setCursor(cursor_x, cursor_y);
-    Adafruit_GFX::setTextColor(textColor);
+    Adafruit_GFX::setTextColor(_textColor);
     Adafruit_GFX::print(value);
 }
 
 void Display::print(float value, int precision) {
     setCursor(cursor_x, cursor_y);
-    Adafruit_GFX::setTextColor(textColor);
+    Adafruit_GFX::setTextColor(_textColor);
     Adafruit_GFX::print(value, precision);
 }
 
 void Display::updateFull(const SensorData& data, const uint16_t* co2History, 
-                       int historyIndex, bool sensorConnected) {
+                       int historyIndex, const HistoricalData& miniHistory,
+                       bool sensorConnected, const ExposureSummary* day,
+                       const ExposureSummary* week, const ChartData* chart,
+                       const VentilationEstimate* ventilation, bool force) {
     Serial.println("Display: Performing full update");
+    cpuClock.acquire();
+    eventTracer.begin(EVENT_RENDER);
+    unsigned long renderStart = micros();
+    _frameSampleId = sensorConnected ? data.sampleId : 0;
+    
+    // The connection instructions never change, so after the first time
+    // they are unpacked from the cache instead of drawn
+    bool restored = !sensorConnected &&
+                    _frames.restore(frameKey(FRAME_INSTRUCTIONS), _buffer, getBufferSize());
+    _showFooter = false;
     
     // Clear display
-    fillScreen(COLOR_BLACK);
+    if (!restored) {
+        fillScreen(COLOR_BLACK);
+    }
     
-    if (!sensorConnected) {
+    if (restored) {
+        Serial.println("Display: Connection instructions restored from cache");
+    } else if (!sensorConnected) {
         // Display connection instructions if sensor is not connected
         showConnectionInstructions();
+        _frames.store(frameKey(FRAME_INSTRUCTIONS), _buffer, getBufferSize());
     } else {
+        // In portrait there is no room for three panels side by side, so the
+        // CO2 panel moves below the temperature and humidity panels
+        const bool portrait = height() > width();
         const int leftPanelX = 20;
-        const int centerPanelX = WIDTH / 2;
-        const int rightPanelX = WIDTH - 180;
+        const int centerPanelX = width() / 2;
+        const int rightPanelX = width() - 180;
         const int topY = 80;
-        const int middleY = 240;
+        const int co2TopY = portrait ? 380 : topY;
         const int miniChartHeight = 100;
         const int miniChartWidth = 160;
         
         // Draw panel borders
         drawRect(leftPanelX - 10, topY - 70, 180, 290, COLOR_WHITE);  // Temperature panel
-        drawRect(centerPanelX - 120, topY - 70, 240, 290, COLOR_WHITE);  // CO2 panel
+        if (portrait) {
+            drawRect(centerPanelX - 120, co2TopY - 70, 240, 130, COLOR_WHITE);  // CO2 panel
+        } else {
+            drawRect(centerPanelX - 120, co2TopY - 70, 240, 290, COLOR_WHITE);  // CO2 panel
+        }
         drawRect(rightPanelX - 10, topY - 70, 180, 290, COLOR_WHITE);  // Humidity panel
         
         // Center panel - CO2 value
@@ -317,30 +706,49 @@ void Display::updateFull(const SensorData& data, const uint16_t* co2History,
         setTextColor(COLOR_WHITE);
         
         // Draw air quality message
-        setCursor(centerPanelX - 100, topY - 30);
+        setCursor(centerPanelX - 100, co2TopY - 30);
         print(getAirQualityMessage(data.co2));
         
         // Draw CO2 value
-        drawCO2Value(data.co2, centerPanelX, topY);
+        drawCO2Value(data.co2, centerPanelX, co2TopY);
+        
+        // Time spent in each air quality level today and this week, between
+        // the value and the mini chart (no room for it in portrait)
+        if (!portrait && day && week) {
+            setFont(&FreeMonoBold12pt7b);
+            setCursor(centerPanelX - 110, co2TopY + 74);
+            print("Day");
+            drawExposureBar(centerPanelX - 50, co2TopY + 60, 160, 16, *day);
+            setCursor(centerPanelX - 110, co2TopY + 104);
+            print("Week");
+            drawExposureBar(centerPanelX - 50, co2TopY + 90, 160, 16, *week);
+        }
+        
+        // Air changes per hour from the last CO2 decay, with its error
+        if (!portrait && ventilation && ventilation->valid) {
+            setFont(&FreeMonoBold12pt7b);
+            setCursor(centerPanelX - 110, co2TopY + 140);
+            print("ACH ");
+            print(ventilation->ach, 1);
+            print(" +-");
+            print((int)(ventilation->error * 100 + 0.5f));
+            print("%");
+        }
         
-        // Draw mini CO2 chart below
-        drawCO2MiniChart(centerPanelX - 100, topY + 180, 200, miniChartHeight, co2History, 12, historyIndex, COLOR_WHITE);
+        // Draw mini CO2 chart below (the 24h chart covers it in portrait)
+        if (!portrait) {
+            drawCO2MiniChart(centerPanelX - 100, co2TopY + 180, 200, miniChartHeight, co2History, 12, historyIndex, COLOR_WHITE);
+        }
         
         // Left panel - Temperature
         drawTemperatureValue(data.temperature, leftPanelX + 80, topY);
         
-        // Get temperature history from the main program
-        // We access it via external reference
-        extern float temperatureHistory[12];
-        extern int miniHistoryIndex;
-        extern int miniHistoryCount;
-        
         // Calculate min/max temperature for scaling
         float minTemp = data.temperature;
         float maxTemp = data.temperature;
-        for (int i = 0; i < miniHistoryCount; i++) {
-            minTemp = getMin(minTemp, temperatureHistory[i]);
-            maxTemp = getMax(maxTemp, temperatureHistory[i]);
+        for (int i = 0; i < miniHistory.count; i++) {
+            minTemp = getMin(minTemp, miniHistory.temp[i]);
+            maxTemp = getMax(maxTemp, miniHistory.temp[i]);
         }
         
         // Add some margins
@@ -354,21 +762,18 @@ void Display::updateFull(const SensorData& data, const uint16_t* co2History,
         
         // Draw temperature mini chart
         drawMiniChart(leftPanelX, topY + 80, miniChartWidth, miniChartHeight, 
-                     temperatureHistory, miniHistoryCount, miniHistoryIndex, 
+                     miniHistory.temp, miniHistory.count, miniHistory.index, 
                      minTemp, maxTemp, COLOR_WHITE);
         
         // Right panel - Humidity
         drawHumidityValue(data.humidity, rightPanelX + 80, topY);
         
-        // Get humidity history from the main program
-        extern float humidityHistory[12];
-        
         // Calculate min/max humidity for scaling
         float minHum = data.humidity;
         float maxHum = data.humidity;
-        for (int i = 0; i < miniHistoryCount; i++) {
-            minHum = getMin(minHum, humidityHistory[i]);
-            maxHum = getMax(maxHum, humidityHistory[i]);
+        for (int i = 0; i < miniHistory.count; i++) {
+            minHum = getMin(minHum, miniHistory.humidity[i]);
+            maxHum = getMax(maxHum, miniHistory.humidity[i]);
         }
         
         // Add some margins
@@ -382,37 +787,38 @@ void Display::updateFull(const SensorData& data, const uint16_t* co2History,
         
         // Draw humidity mini chart
         drawMiniChart(rightPanelX, topY + 80, miniChartWidth, miniChartHeight, 
-                     humidityHistory, miniHistoryCount, miniHistoryIndex, 
+                     miniHistory.humidity, miniHistory.count, miniHistory.index, 
                      minHum, maxHum, COLOR_WHITE);
         
         // Draw main CO2 history chart at the bottom
-        drawBarChart(co2History, historyIndex);
+        drawBarChart(co2History, historyIndex, chart);
         
-        // Show update time
-        setFont(&FreeMonoBold12pt7b);
-        setTextColor(COLOR_WHITE);
-        setCursor(20, HEIGHT - 20);
-        unsigned long uptime = millis() / 1000 / 60;  // Minutes
-        print("Last update: ");
-        print((int)uptime);
-        print(" min ago");
+        // Show update time; update() draws it after the comparison
+        _footerMinutes = millis() / 1000 / 60;
+        _showFooter = true;
+    }
+    latencyTracer.mark(_frameSampleId, STAGE_RENDERED);
+    eventTracer.end(EVENT_RENDER);
+    if (!restored) {
+        cpuClock.recordRender(micros() - renderStart);
     }
+    cpuClock.release();
     
     // Send to display
-    update();
+    update(force);
 }
 
-void Display::updateChart(const uint16_t* co2History, int historyIndex) {
+void Display::updateChart(const uint16_t* co2History, int historyIndex, bool force) {
     Serial.println("Display: Updating chart area");
     
     // Clear only the chart area
-    fillRect(0, 200, WIDTH, 100, COLOR_BLACK);
+    fillRect(0, 200, width(), 100, COLOR_BLACK);
     
     // Draw the chart
     drawBarChart(co2History, historyIndex);
     
     // Update display
-    update();
+    update(force);
 }
 
 void Display::showConnectionInstructions() {
@@ -440,11 +846,11 @@ void Display::showConnectionInstructions() {
     print("reconnect when sensor is available");
 }
 
-void Display::drawBarChart(const uint16_t* co2History, int historyIndex) {
+void Display::drawBarChart(const uint16_t* co2History, int historyIndex, const ChartData* chart) {
     int chartX = 70;
-    int chartY = 320;
-    int chartWidth = WIDTH - 100;
     int chartHeight = 160;
+    int chartY = height() - chartHeight;
+    int chartWidth = width() - 100;
     
     // Draw chart border
     for (int i = 0; i < chartWidth; i++) {
@@ -461,12 +867,21 @@ void Display::drawBarChart(const uint16_t* co2History, int historyIndex) {
     uint16_t maxCO2 = 0;
     bool hasValidData = false;
     
-    for (int i = 0; i < _data_history_size; i++) {
-        if (co2History[i] > 0) {  // Only consider valid readings
-            minCO2 = getMin(minCO2, co2History[i]);
-            maxCO2 = getMax(maxCO2, co2History[i]);
+    if (chart) {
+        // Already aggregated over the window
+        if (chart->max > 0) {
+            minCO2 = chart->min;
+            maxCO2 = chart->max;
             hasValidData = true;
         }
+    } else {
+        for (int i = 0; i < _data_history_size; i++) {
+            if (co2History[i] > 0) {  // Only consider valid readings
+                minCO2 = getMin(minCO2, co2History[i]);
+                maxCO2 = getMax(maxCO2, co2History[i]);
+                hasValidData = true;
+            }
+        }
     }
     
     // Handle case where no valid data exists
@@ -495,14 +910,15 @@ void Display::drawBarChart(const uint16_t* co2History, int historyIndex) {
     maxCO2 = ((maxCO2 + 99) / 100) * 100;
     
     // Draw bars
-    int barWidth = (chartWidth - 10) / _data_history_size;
+    int barCount = chart ? chart->count : _data_history_size;
+    int barWidth = (chartWidth - 10) / barCount;
     barWidth = getMax(barWidth, 1);
     
     // Draw the title
     setFont(&FreeMonoBold12pt7b);
     setTextColor(COLOR_WHITE);
     setCursor(chartX, chartY - 5);
-    print("CO2 History (24h)");
+    print(chart ? chart->title : "CO2 History (24h)");
     
     // Draw left-side scale labels (y-axis)
     int labelWidth = 60;
@@ -540,15 +956,17 @@ void Display::drawBarChart(const uint16_t* co2History, int historyIndex) {
         }
     }
     
-    // Draw bars from newest to oldest
-    for (int i = 0; i < _data_history_size; i++) {
+    // Draw bars from newest to oldest (aggregated charts oldest first)
+    for (int i = 0; i < barCount; i++) {
         int idx = (historyIndex - i + _data_history_size) % _data_history_size;
+        uint16_t value = chart ? chart->average[i] : co2History[idx];
+        uint16_t peak = chart ? chart->peak[i] : co2History[idx];
         
-        if (co2History[idx] > 0) {
-            int barHeight = map(co2History[idx], minCO2, maxCO2, 5, chartHeight - 10);
+        if (value > 0) {
+            int barHeight = map(value, minCO2, maxCO2, 5, chartHeight - 10);
             barHeight = constrain(barHeight, 5, chartHeight - 10);
             
-            if (co2History[idx] >= _co2_alarm_threshold) {
+            if (peak >= _co2_alarm_threshold) {
                 // Draw as a hollow bar for high CO2 levels
                 for (int j = 0; j < barHeight; j++) {
                     drawPixel(chartX + 5 + i * barWidth, chartY + chartHeight - 5 - j, COLOR_WHITE);
@@ -716,6 +1134,9 @@ void Display::drawCO2MiniChart(int x, int y, int width, int height, const uint16
 }
 
 void Display::drawMiniChart(int x, int y, int width, int height, const float* data, int count, int index, float min, float max, uint16_t color) {
+    // Bars are drawn in array order, the ring position is not needed
+    (void)index;
+    
     // Draw chart border
     drawRect(x, y, width, height, color);
     
@@ -749,25 +1170,80 @@ void Display::drawMiniChart(int x, int y, int width, int height, const float* da
     }
 }
 
-const char* Display::getAirQualityMessage(uint16_t co2Value) {
+// Stacked bar of the time spent in each air quality level, left to right
+// from excellent to unhealthy. Worse levels get denser fill patterns.
+void Display::drawExposureBar(int x, int y, int width, int height, const ExposureSummary& summary) {
+    drawRect(x, y, width, height, COLOR_WHITE);
+    
+    uint64_t total = 0;
+    for (int level = 0; level < AIR_STATUS_COUNT; level++) {
+        total += summary.ms[level];
+    }
+    if (total == 0) {
+        return;
+    }
+    
+    int innerX = x + 1;
+    int innerWidth = width - 2;
+    uint64_t elapsed = 0;
+    int segmentStart = innerX;
+    
+    for (int level = 0; level < AIR_STATUS_COUNT; level++) {
+        // Round the cumulative time so the segments always fill the bar
+        elapsed += summary.ms[level];
+        int segmentEnd = innerX + (int)((elapsed * innerWidth + total / 2) / total);
+        
+        for (int py = y + 1; py < y + height - 1; py++) {
+            for (int px = segmentStart; px < segmentEnd; px++) {
+                bool set;
+                switch (level) {
+                    case AIR_EXCELLENT: set = false; break;
+                    case AIR_GOOD:      set = px % 4 == 0 && py % 4 == 0; break;
+                    case AIR_FAIR:      set = (px + py) % 4 == 0; break;
+                    case AIR_POOR:      set = (px + py) % 2 == 0; break;
+                    default:            set = true; break;
+                }
+                if (set) {
+                    drawPixel(px, py, COLOR_WHITE);
+                }
+            }
+        }
+        
+        // Separate non-empty segments from the next one
+        if (segmentEnd > segmentStart && segmentEnd < innerX + innerWidth) {
+            drawFastVLine(segmentEnd, y, height, COLOR_WHITE);
+        }
+        segmentStart = segmentEnd;
+    }
+}
+
+AirQualityStatus classifyAirQuality(uint16_t co2Value) {
     if (co2Value < 600) {
-        return "EXCELLENT";
+        return AIR_EXCELLENT;
     } else if (co2Value < 800) {
-        return "GOOD";
+        return AIR_GOOD;
     } else if (co2Value < 1000) {
-        return "FAIR";
+        return AIR_FAIR;
     } else if (co2Value < 1500) {
-        return "POOR";
+        return AIR_POOR;
     } else {
-        return "UNHEALTHY";
+        return AIR_UNHEALTHY;
     }
 }
 
+const char* Display::getAirQualityMessage(uint16_t co2Value) {
+    static const char* const messages[AIR_STATUS_COUNT] = {
+        "EXCELLENT", "GOOD", "FAIR", "POOR", "UNHEALTHY"
+    };
+    return messages[classifyAirQuality(co2Value)];
+}
+
 void Display::showLoadingScreen() {
     Serial.println("Display: Showing loading screen");
     
     // Clear display
     fillScreen(COLOR_BLACK);
+    _showFooter = false;
     
     // Draw title
     setFont(&FreeMonoBold24pt7b);
@@ -781,9 +1257,9 @@ void Display::showLoadingScreen() {
     print("Initializing System...");
     
     // Draw loading bar - already complete
-    int barWidth = 500;
+    int barWidth = getMin(500, width() - 40);
     int barHeight = 40;
-    int barX = (WIDTH - barWidth) / 2;
+    int barX = (width() - barWidth) / 2;
     int barY = 200;
     
     // Draw border and fill completely
@@ -0,0 +1,197 @@
+#include "EPaperPanel.h"
+
+// Give up waiting for BUSY after this long
+static const unsigned long BUSY_TIMEOUT_MS = 5000;
+
+// Controller sequences for the GDEY0583T81. BUSY is asserted within a few
+// hundred microseconds of a command, hence the 1 ms before it is sampled.
+// The fixed waits after reset, power on, refresh and power off are those of
+// the blocking code and stay the floor of each step: the BUSY level alone
+// is not relied on to cover the settle times.
+static const PanelStep INIT_SEQUENCE[] = {
+    { STEP_RESET_LOW,  0,    0, {},                       10,  false },
+    { STEP_RESET_HIGH, 0,    0, {},                       110, true  },
+    { STEP_COMMAND,    0x06, 4, {0x17, 0x17, 0x28, 0x17}, 10,  false },  // Booster soft start A, B, C, D
+    { STEP_COMMAND,    0x04, 0, {},                       100, true  },  // Power on
+    { STEP_COMMAND,    0x00, 1, {0x0F},                   10,  false },  // Panel setting: KW-3f KWR-2F BWROTP 0f BWOTP 1f
+    { STEP_COMMAND,    0x50, 2, {0x20, 0x07},             10,  false },  // VCOM and data interval setting
+    { STEP_RESOLUTION, 0x61, 0, {},                       10,  false },  // Resolution setting
+    { STEP_END,        0,    0, {},                       0,   false }
+};
+
+static const PanelStep REFRESH_SEQUENCE[] = {
+    { STEP_COMMAND,    0x12, 0, {},                       100, true  },  // Display refresh
+    { STEP_WAIT,       0,    0, {},                       100, false },  // Settle
+    { STEP_END,        0,    0, {},                       0,   false }
+};
+
+static const PanelStep SLEEP_SEQUENCE[] = {
+    { STEP_COMMAND,    0x02, 0, {},                       1,   true  },  // Power off
+    { STEP_WAIT,       0,    0, {},                       100, false },
+    { STEP_COMMAND,    0x07, 1, {0xA5},                   0,   false },  // Deep sleep
+    { STEP_END,        0,    0, {},                       0,   false }
+};
+
+EPaperPanel::EPaperPanel(uint8_t busy_pin, uint8_t cs_pin, uint8_t rst_pin, uint8_t dc_pin,
+                         uint16_t width, uint16_t height)
+  : _busy_pin(busy_pin), _cs_pin(cs_pin), _rst_pin(rst_pin), _dc_pin(dc_pin),
+    _width(width), _height(height), _framePosition(0),
+    _sequence(nullptr), _sequenceEvent(EVENT_PANEL_INIT), _step(0), _stepTime(0), _waitMs(0), _waitBusy(false) {
+}
+
+void EPaperPanel::begin() {
+    // Setup pins
+    pinMode(_busy_pin, INPUT);
+    pinMode(_rst_pin, OUTPUT);
+    pinMode(_dc_pin, OUTPUT);
+    pinMode(_cs_pin, OUTPUT);
+    
+    digitalWrite(_cs_pin, HIGH);
+    digitalWrite(_dc_pin, HIGH);
+    digitalWrite(_rst_pin, HIGH);
+    
+    // Runs while the caller gets on with other setup; the first frame
+    // waits for whatever is left of it
+    Serial.println("Display: Sending init commands...");
+    start(INIT_SEQUENCE, EVENT_PANEL_INIT);
+    poll();
+}
+
+void EPaperPanel::start(const PanelStep* sequence, TraceEvent event) {
+    finish();
+    _sequence = sequence;
+    _sequenceEvent = event;
+    eventTracer.begin(event);
+    _step = 0;
+    _waitMs = 0;
+    _waitBusy = false;
+}
+
+bool EPaperPanel::poll() {
+    while (_sequence) {
+        // Wait left over from the previous step
+        unsigned long elapsed = millis() - _stepTime;
+        if (elapsed < _waitMs) {
+            return true;
+        }
+        if (_waitBusy && digitalRead(_busy_pin) == HIGH) {
+            if (elapsed <= BUSY_TIMEOUT_MS) {
+                return true;
+            }
+            Serial.println("Display: BUSY timeout - forcing continue");
+        }
+        
+        const PanelStep& step = _sequence[_step];
+        if (step.type == STEP_END) {
+            _sequence = nullptr;
+            eventTracer.end(_sequenceEvent);
+            break;
+        }
+        
+        execute(step);
+        _step++;
+        _stepTime = millis();
+        _waitMs = step.waitMs;
+        _waitBusy = step.waitBusy;
+    }
+    return false;
+}
+
+void EPaperPanel::finish() {
+    if (!poll()) {
+        return;
+    }
+    
+    // delay() lets the other FreeRTOS tasks run while we wait
+    eventTracer.begin(EVENT_PANEL_WAIT);
+    while (poll()) {
+        delay(1);
+    }
+    eventTracer.end(EVENT_PANEL_WAIT);
+}
+
+void EPaperPanel::execute(const PanelStep& step) {
+    switch (step.type) {
+        case STEP_RESET_LOW:
+            digitalWrite(_rst_pin, LOW);
+            break;
+        case STEP_RESET_HIGH:
+            digitalWrite(_rst_pin, HIGH);
+            break;
+        case STEP_WAIT:
+            break;
+        case STEP_RESOLUTION:
+            sendCommand(step.command);
+            sendData(_width >> 8);    // High byte of width
+            sendData(_width & 0xFF);  // Low byte of width
+            sendData(_height >> 8);   // High byte of height
+            sendData(_height & 0xFF); // Low byte of height
+            break;
+        default:
+            sendCommand(step.command);
+            for (uint8_t i = 0; i < step.length; i++) {
+                sendData(step.data[i]);
+            }
+            break;
+    }
+}
+
+void EPaperPanel::sendCommand(uint8_t command) {
+    digitalWrite(_dc_pin, LOW);   // Command mode
+    digitalWrite(_cs_pin, LOW);
+    SPI.transfer(command);
+    digitalWrite(_cs_pin, HIGH);
+}
+
+void EPaperPanel::sendData(uint8_t data) {
+    digitalWrite(_dc_pin, HIGH);  // Data mode
+    digitalWrite(_cs_pin, LOW);
+    SPI.transfer(data);
+    digitalWrite(_cs_pin, HIGH);
+}
+
+void EPaperPanel::beginFrame() {
+    // The controller must be done with init or the previous refresh
+    finish();
+    
+    // Send black buffer data
+    sendCommand(0x10);
+    _framePosition = 0;
+}
+
+void EPaperPanel::sendPixels(const uint8_t* data, uint32_t length) {
+    for (uint32_t i = 0; i < length; i++, _framePosition++) {
+        sendData(data[i]);
+        
+        // Add a tiny delay every 1024 bytes to prevent overrunning the display controller
+        if ((_framePosition % 1024) == 0) {
+            delayMicroseconds(100);
+        }
+    }
+}
+
+void EPaperPanel::endFrame() {
+    // Send red buffer data (we're using B/W display so just send 0s)
+    sendCommand(0x13);
+    
+    for (uint32_t i = 0; i < (uint32_t)_width * _height / 8; i++) {
+        sendData(0x00);
+        
+        // Add a tiny delay every 1024 bytes to prevent overrunning the display controller
+        if ((i % 1024) == 0) {
+            delayMicroseconds(100);
+        }
+    }
+}
+
+void EPaperPanel::refresh() {
+    start(REFRESH_SEQUENCE, EVENT_PANEL_REFRESH);
+    poll();
+}
+
+void EPaperPanel::sleep() {
+    Serial.println("Display: Going to sleep...");
+    start(SLEEP_SEQUENCE, EVENT_PANEL_SLEEP);
+    finish();
+    Serial.println("Display: Now sleeping");
+}
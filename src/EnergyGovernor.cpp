@@ -0,0 +1,202 @@
+#include "EnergyGovernor.h"
+
+// Resting voltage of a single LiPo cell against remaining charge
+struct ChargePoint {
+  uint16_t millivolts;
+  uint8_t percent;
+};
+
+static const ChargePoint DISCHARGE_CURVE[] = {
+  {4200, 100}, {4100, 90}, {4000, 79}, {3900, 66}, {3800, 52}, {3750, 42},
+  {3700, 30}, {3650, 20}, {3600, 12}, {3500, 5}, {3400, 2}, {3300, 0}
+};
+
+EnergyGovernor::EnergyGovernor(uint8_t adcPin, float dividerRatio, int co2AlarmThreshold,
+                               unsigned long basePollInterval, unsigned long baseHistoryInterval)
+  : _adcPin(adcPin),
+    _dividerRatio(dividerRatio),
+    _co2AlarmThreshold(co2AlarmThreshold),
+    _basePollInterval(basePollInterval),
+    _baseHistoryInterval(baseHistoryInterval),
+    _millivolts(0),
+    _chargePercent(100),
+    _primed(false),
+    _refreshTokens(0),
+    _lastRefill(0) {
+  _policy = policyFor(POWER_EXTERNAL);
+}
+
+void EnergyGovernor::begin() {
+  // 11 dB attenuation covers the divided pack voltage (up to ~2.1 V)
+  analogSetPinAttenuation(_adcPin, ADC_11db);
+  update(millis());
+
+  Serial.print("Battery: ");
+  Serial.print(_millivolts);
+  Serial.print(" mV, ");
+  Serial.print(_chargePercent);
+  Serial.print("%, power level ");
+  Serial.println(getLevelName(_policy.level));
+}
+
+bool EnergyGovernor::update(unsigned long now) {
+  return update(readMillivolts(), now);
+}
+
+bool EnergyGovernor::update(uint16_t millivolts, unsigned long now) {
+  // Smooth out the voltage dips of e-paper refreshes and radio bursts
+  if (!_primed || millivolts < NO_BATTERY_MV || _millivolts < NO_BATTERY_MV) {
+    _millivolts = millivolts;
+    _primed = true;
+  } else {
+    _millivolts = (_millivolts * 3 + millivolts + 2) / 4;
+  }
+  _chargePercent = chargeFromMillivolts(_millivolts);
+
+  PowerLevel level = levelFor(_millivolts, _chargePercent);
+  if (level == _policy.level) {
+    return false;
+  }
+
+  _policy = policyFor(level);
+  _refreshTokens = _policy.refreshesPerHour;
+  _lastRefill = now;
+
+  Serial.print("Power level changed to ");
+  Serial.print(getLevelName(level));
+  Serial.print(" (");
+  Serial.print(_millivolts);
+  Serial.print(" mV, ");
+  Serial.print(_chargePercent);
+  Serial.println("%)");
+  return true;
+}
+
+const EnergyPolicy& EnergyGovernor::getPolicy() const {
+  return _policy;
+}
+
+unsigned long EnergyGovernor::getPollInterval(uint16_t co2) const {
+  // Within 20 % of the alarm threshold the reading must not wait for a
+  // stretched poll interval
+  if (co2 >= _co2AlarmThreshold * 8 / 10 && _policy.pollInterval > _basePollInterval) {
+    return _basePollInterval;
+  }
+  return _policy.pollInterval;
+}
+
+bool EnergyGovernor::allowRefresh(bool urgent, unsigned long now) {
+  if (urgent || _policy.refreshesPerHour == 0) {
+    return true;
+  }
+
+  _refreshTokens += (now - _lastRefill) * (_policy.refreshesPerHour / 3600000.0f);
+  if (_refreshTokens > _policy.refreshesPerHour) {
+    _refreshTokens = _policy.refreshesPerHour;
+  }
+  _lastRefill = now;
+
+  if (_refreshTokens < 1.0f) {
+    return false;
+  }
+  _refreshTokens -= 1.0f;
+  return true;
+}
+
+uint16_t EnergyGovernor::getMillivolts() const {
+  return _millivolts;
+}
+
+uint8_t EnergyGovernor::getChargePercent() const {
+  return _chargePercent;
+}
+
+uint8_t EnergyGovernor::chargeFromMillivolts(uint16_t millivolts) {
+  const size_t points = sizeof(DISCHARGE_CURVE) / sizeof(DISCHARGE_CURVE[0]);
+  if (millivolts >= DISCHARGE_CURVE[0].millivolts) {
+    return 100;
+  }
+
+  // Linear between the points of the curve
+  for (size_t i = 1; i < points; i++) {
+    const ChargePoint& upper = DISCHARGE_CURVE[i - 1];
+    const ChargePoint& lower = DISCHARGE_CURVE[i];
+    if (millivolts >= lower.millivolts) {
+      return lower.percent + (uint32_t)(millivolts - lower.millivolts) * (upper.percent - lower.percent) /
+                             (upper.millivolts - lower.millivolts);
+    }
+  }
+  return 0;
+}
+
+const char* EnergyGovernor::getLevelName(PowerLevel level) {
+  switch (level) {
+    case POWER_EXTERNAL: return "external";
+    case POWER_NORMAL:   return "normal";
+    case POWER_SAVING:   return "saving";
+    case POWER_CRITICAL: return "critical";
+  }
+  return "?";
+}
+
+uint16_t EnergyGovernor::readMillivolts() const {
+  // Average a few calibrated readings; the ADC is noisy at the top of its range
+  uint32_t sum = 0;
+  for (int i = 0; i < 16; i++) {
+    sum += analogReadMilliVolts(_adcPin);
+  }
+  return (uint16_t)(sum / 16 * _dividerRatio);
+}
+
+PowerLevel EnergyGovernor::levelFor(uint16_t millivolts, uint8_t percent) const {
+  if (millivolts < NO_BATTERY_MV || millivolts > CHARGING_MV) {
+    return POWER_EXTERNAL;
+  }
+
+  // Leaving a level downwards happens at the boundary, upwards only once the
+  // charge is clearly past it, so a pack sitting on a boundary doesn't flap
+  bool saving = _policy.level == POWER_SAVING;
+  bool critical = _policy.level == POWER_CRITICAL;
+  if (percent >= 50 + (saving || critical ? HYSTERESIS_PERCENT : 0)) {
+    return POWER_NORMAL;
+  }
+  if (percent >= 20 + (critical ? HYSTERESIS_PERCENT : 0)) {
+    return POWER_SAVING;
+  }
+  return POWER_CRITICAL;
+}
+
+EnergyPolicy EnergyGovernor::policyFor(PowerLevel level) const {
+  EnergyPolicy policy;
+  policy.level = level;
+  switch (level) {
+    case POWER_EXTERNAL:
+    case POWER_NORMAL:
+      policy.lowPowerSensor = false;
+      policy.co2ShotInterval = 0;
+      policy.pollInterval = _basePollInterval;
+      policy.historyInterval = _baseHistoryInterval;
+      policy.refreshesPerHour = 0;
+      break;
+    case POWER_SAVING:
+      policy.lowPowerSensor = true;
+      policy.co2ShotInterval = 0;
+      policy.pollInterval = _basePollInterval * 2;
+      policy.historyInterval = _baseHistoryInterval * 2;
+      policy.refreshesPerHour = 6;
+      break;
+    case POWER_CRITICAL:
+      // Polling stays at 2x, with temperature and humidity from RHT only
+      // shots on an SCD41. CO2 single shots every 2 min; within 20 % of the
+      // threshold they follow the polls, so a rise still alarms within
+      // about a minute and a jump straight past it within two. The savings
+      // come from the sensor mode and the refreshes.
+      policy.lowPowerSensor = true;
+      policy.co2ShotInterval = 120000;
+      policy.pollInterval = _basePollInterval * 2;
+      policy.historyInterval = _baseHistoryInterval * 3;
+      policy.refreshesPerHour = 2;
+      break;
+  }
+  return policy;
+}
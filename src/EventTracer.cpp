@@ -0,0 +1,133 @@
+#include "EventTracer.h"
+
+EventTracer eventTracer;
+
+// Timeline tracks: the loop task, and the panel controller working on its own
+enum TraceTrack {
+  TRACK_LOOP = 1,
+  TRACK_PANEL = 2
+};
+
+static const char* TRACK_NAMES[] = { nullptr, "loop", "panel" };
+
+struct EventInfo {
+  const char* name;
+  uint8_t track;
+};
+
+static const EventInfo EVENT_INFO[EVENT_COUNT] = {
+  { "sensor update",   TRACK_LOOP },
+  { "sensor recover",  TRACK_LOOP },
+  { "i2c",             TRACK_LOOP },
+  { "data ready",      TRACK_LOOP },
+  { "pipeline",        TRACK_LOOP },
+  { "history tick",    TRACK_LOOP },
+  { "alarm",           TRACK_LOOP },
+  { "render",          TRACK_LOOP },
+  { "frame compare",   TRACK_LOOP },
+  { "refresh skipped", TRACK_LOOP },
+  { "upload",          TRACK_LOOP },
+  { "panel wait",      TRACK_LOOP },
+  { "panel init",      TRACK_PANEL },
+  { "panel refresh",   TRACK_PANEL },
+  { "panel sleep",     TRACK_PANEL },
+  { "frame save",      TRACK_LOOP },
+  { "checkpoint",      TRACK_LOOP },
+  { "cpu clock",       TRACK_LOOP },
+};
+
+// Events per dump line, 16 hex digits each
+static const uint8_t EVENTS_PER_LINE = 8;
+
+EventTracer::EventTracer()
+  : _next(0),
+    _total(0) {
+}
+
+void EventTracer::begin(TraceEvent event, uint16_t arg) {
+  record('B', event, arg);
+}
+
+void EventTracer::end(TraceEvent event, uint16_t arg) {
+  record('E', event, arg);
+}
+
+void EventTracer::instant(TraceEvent event, uint16_t arg) {
+  record('I', event, arg);
+}
+
+void EventTracer::clear() {
+  _next = 0;
+  _total = 0;
+}
+
+uint32_t EventTracer::getCount() const {
+  return _total < CAPACITY ? _total : CAPACITY;
+}
+
+uint32_t EventTracer::getDropped() const {
+  return _total - getCount();
+}
+
+void EventTracer::dump(Print& out) const {
+  char line[8 + EVENTS_PER_LINE * 16];
+
+  snprintf(line, sizeof(line), "%lu", (unsigned long)micros());
+  out.print("=== Event trace v1: ");
+  out.print(getCount());
+  out.print(" events, ");
+  out.print(getDropped());
+  out.print(" dropped, now ");
+  out.print(line);
+  out.println(" us ===");
+
+  // Name tables first, so the converter needs no copy of the enums
+  for (int i = TRACK_LOOP; i <= TRACK_PANEL; i++) {
+    out.print("TT ");
+    out.print(i);
+    out.print(" ");
+    out.println(TRACK_NAMES[i]);
+  }
+  for (int i = 0; i < EVENT_COUNT; i++) {
+    out.print("TN ");
+    out.print(i);
+    out.print(" ");
+    out.print(EVENT_INFO[i].track);
+    out.print(" ");
+    out.println(EVENT_INFO[i].name);
+  }
+
+  // Each event as its 8 bytes, little endian: time, phase, event, arg
+  uint32_t count = getCount();
+  uint16_t first = (_next + CAPACITY - count) % CAPACITY;
+  for (uint32_t i = 0; i < count; i += EVENTS_PER_LINE) {
+    int length = snprintf(line, sizeof(line), "TE ");
+    for (uint32_t j = i; j < count && j < i + EVENTS_PER_LINE; j++) {
+      const Event& e = _events[(first + j) % CAPACITY];
+      length += snprintf(line + length, sizeof(line) - length, "%02x%02x%02x%02x%02x%02x%02x%02x",
+                         (unsigned)(e.time & 0xFF), (unsigned)((e.time >> 8) & 0xFF),
+                         (unsigned)((e.time >> 16) & 0xFF), (unsigned)(e.time >> 24),
+                         e.phase, e.event, (unsigned)(e.arg & 0xFF), (unsigned)(e.arg >> 8));
+    }
+    out.println(line);
+  }
+  out.println("=== End of event trace ===");
+}
+
+const char* EventTracer::getEventName(TraceEvent event) {
+  return event < EVENT_COUNT ? EVENT_INFO[event].name : "unknown";
+}
+
+uint8_t EventTracer::getEventTrack(TraceEvent event) {
+  return event < EVENT_COUNT ? EVENT_INFO[event].track : (uint8_t)TRACK_LOOP;
+}
+
+void EventTracer::record(uint8_t phase, TraceEvent event, uint16_t arg) {
+  Event& e = _events[_next];
+  e.time = micros();
+  e.phase = phase;
+  e.event = event;
+  e.arg = arg;
+  _next = (_next + 1) % CAPACITY;
+  _total++;
+}
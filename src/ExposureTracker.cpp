@@ -0,0 +1,90 @@
+#include "ExposureTracker.h"
+#include <string.h>
+
+ExposureTracker::ExposureTracker()
+  : _today(0),
+    _dayElapsed(0),
+    _lastStatus(AIR_EXCELLENT),
+    _lastTime(0),
+    _hasLast(false) {
+  memset(_days, 0, sizeof(_days));
+  memset(&_week, 0, sizeof(_week));
+}
+
+void ExposureTracker::addSample(uint16_t co2, unsigned long now) {
+  if (_hasLast) {
+    uint32_t elapsed = now - _lastTime;
+    if (elapsed > MAX_GAP_MS) {
+      elapsed = MAX_GAP_MS;
+    }
+    add(_lastStatus, elapsed);
+  }
+  _lastStatus = classifyAirQuality(co2);
+  _lastTime = now;
+  _hasLast = true;
+}
+
+void ExposureTracker::resetClock() {
+  _hasLast = false;
+}
+
+const ExposureSummary& ExposureTracker::getDay() const {
+  return _days[_today];
+}
+
+const ExposureSummary& ExposureTracker::getWeek() const {
+  return _week;
+}
+
+void ExposureTracker::printSummary(Print& out) const {
+  static const char* const names[AIR_STATUS_COUNT] = {
+    "excellent", "good", "fair", "poor", "unhealthy"
+  };
+  const ExposureSummary* periods[2] = { &_days[_today], &_week };
+  
+  for (int p = 0; p < 2; p++) {
+    uint64_t total = 0;
+    for (int level = 0; level < AIR_STATUS_COUNT; level++) {
+      total += periods[p]->ms[level];
+    }
+    
+    out.print(p == 0 ? "Exposure today:" : "Exposure week: ");
+    for (int level = 0; level < AIR_STATUS_COUNT; level++) {
+      out.print(" ");
+      out.print(names[level]);
+      out.print(" ");
+      out.print(total ? (int)((uint64_t)periods[p]->ms[level] * 100 / total) : 0);
+      out.print("%");
+    }
+    out.println();
+  }
+}
+
+void ExposureTracker::add(uint8_t status, uint32_t ms) {
+  // MAX_GAP_MS is much shorter than a day, so this crosses at most one
+  // day boundary
+  while (ms > 0) {
+    uint32_t step = DAY_MS - _dayElapsed;
+    if (step > ms) {
+      step = ms;
+    }
+    _days[_today].ms[status] += step;
+    _week.ms[status] += step;
+    _dayElapsed += step;
+    ms -= step;
+    
+    if (_dayElapsed >= DAY_MS) {
+      rollover();
+    }
+  }
+}
+
+void ExposureTracker::rollover() {
+  // The slot being reused holds the day that just left the week
+  _today = (_today + 1) % DAYS;
+  for (int level = 0; level < AIR_STATUS_COUNT; level++) {
+    _week.ms[level] -= _days[_today].ms[level];
+    _days[_today].ms[level] = 0;
+  }
+  _dayElapsed = 0;
+}
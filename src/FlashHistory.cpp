@@ -0,0 +1,278 @@
+#include "FlashHistory.h"
+#include <math.h>
+#include <string.h>
+
+#ifdef ARDUINO_ARCH_ESP32
+#include <Arduino.h>
+#else
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Size of the host image file, matching the "history" entry in partitions.csv
+#ifndef ARDUINO_ARCH_ESP32
+static const size_t HOST_IMAGE_SIZE = 0x20000;
+#endif
+
+// Whether count slots still read as erased flash
+static bool isErased(const HistoryRecord* records, uint32_t count) {
+  const uint8_t* bytes = (const uint8_t*)records;
+  for (size_t i = 0; i < count * sizeof(HistoryRecord); i++) {
+    if (bytes[i] != 0xFF) {
+      return false;
+    }
+  }
+  return true;
+}
+
+HistoryCursor::HistoryCursor(const HistoryRecord* records, uint32_t capacity, uint32_t start, uint32_t count)
+  : _records(records),
+    _capacity(capacity),
+    _position(start),
+    _remaining(count) {
+}
+
+const HistoryRecord* HistoryCursor::next() {
+  while (_remaining > 0) {
+    const HistoryRecord* record = &_records[_position];
+    _position = (_position + 1 == _capacity) ? 0 : _position + 1;
+    _remaining--;
+    
+    // Erased slots and torn writes are skipped
+    if (FlashHistory::isValid(*record)) {
+      return record;
+    }
+  }
+  return nullptr;
+}
+
+FlashHistory::FlashHistory(const char* name)
+  : _name(name),
+    _records(nullptr),
+    _capacity(0),
+    _head(0),
+    _nextSequence(0),
+    _runTimeBase(0),
+    _lastRunTime(0),
+#ifdef ARDUINO_ARCH_ESP32
+    _partition(nullptr),
+    _mapHandle(0) {
+#else
+    _fd(-1),
+    _mapSize(0) {
+#endif
+}
+
+FlashHistory::~FlashHistory() {
+#ifdef ARDUINO_ARCH_ESP32
+  if (_records) {
+    spi_flash_munmap(_mapHandle);
+  }
+#else
+  if (_records) {
+    munmap((void*)_records, _mapSize);
+  }
+  if (_fd >= 0) {
+    close(_fd);
+  }
+#endif
+}
+
+bool FlashHistory::begin() {
+#ifdef ARDUINO_ARCH_ESP32
+  _partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, _name);
+  if (!_partition) {
+    Serial.println("FlashHistory: ERROR - partition not found, check partitions.csv");
+    return false;
+  }
+  
+  const void* mapped = nullptr;
+  esp_err_t err = esp_partition_mmap(_partition, 0, _partition->size, SPI_FLASH_MMAP_DATA,
+                                     &mapped, &_mapHandle);
+  if (err != ESP_OK) {
+    Serial.print("FlashHistory: ERROR - mmap failed: ");
+    Serial.println(esp_err_to_name(err));
+    return false;
+  }
+  _records = (const HistoryRecord*)mapped;
+  _capacity = _partition->size / sizeof(HistoryRecord);
+#else
+  _fd = open(_name, O_RDWR | O_CREAT, 0644);
+  if (_fd < 0) {
+    perror("FlashHistory: open");
+    return false;
+  }
+  
+  // A new image starts out erased, like fresh flash
+  struct stat st;
+  if (fstat(_fd, &st) != 0) {
+    return false;
+  }
+  if ((size_t)st.st_size < HOST_IMAGE_SIZE) {
+    uint8_t erased[SECTOR_SIZE];
+    memset(erased, 0xFF, sizeof(erased));
+    for (size_t offset = st.st_size - st.st_size % SECTOR_SIZE; offset < HOST_IMAGE_SIZE; offset += SECTOR_SIZE) {
+      if (pwrite(_fd, erased, SECTOR_SIZE, offset) != (ssize_t)SECTOR_SIZE) {
+        return false;
+      }
+    }
+  }
+  
+  _mapSize = HOST_IMAGE_SIZE;
+  void* mapped = mmap(nullptr, _mapSize, PROT_READ, MAP_SHARED, _fd, 0);
+  if (mapped == MAP_FAILED) {
+    perror("FlashHistory: mmap");
+    return false;
+  }
+  _records = (const HistoryRecord*)mapped;
+  _capacity = _mapSize / sizeof(HistoryRecord);
+#endif
+  
+  // The newest record has the highest sequence number; writing resumes after it
+  uint32_t newest = 0;
+  bool found = false;
+  for (uint32_t i = 0; i < _capacity; i++) {
+    if (isValid(_records[i]) && (!found || _records[i].sequence >= _records[newest].sequence)) {
+      newest = i;
+      found = true;
+    }
+  }
+  
+  if (found) {
+    _head = (newest + 1) % _capacity;
+    _nextSequence = _records[newest].sequence + 1;
+    _runTimeBase = _records[newest].runTime;
+  } else {
+    _head = 0;
+    _nextSequence = 0;
+    _runTimeBase = 0;
+  }
+  _lastRunTime = _runTimeBase;
+  
+  // A reset can leave the slot after the newest record half written. It
+  // can't be written again without erasing its whole sector, which holds
+  // the newest records, so it is skipped. Only a sector the ring is about
+  // to enter is erased, as append() would have done.
+  while (_head % RECORDS_PER_SECTOR != 0 && !isErased(&_records[_head], 1)) {
+    _head = (_head + 1) % _capacity;
+  }
+  if (_head % RECORDS_PER_SECTOR == 0 && !isErased(&_records[_head], RECORDS_PER_SECTOR)) {
+    eraseSector(_head / RECORDS_PER_SECTOR);
+  }
+  
+#ifdef ARDUINO_ARCH_ESP32
+  Serial.print("FlashHistory: ");
+  Serial.print(_capacity);
+  Serial.print(" slots, next sequence ");
+  Serial.println(_nextSequence);
+#endif
+  return true;
+}
+
+bool FlashHistory::append(uint16_t co2, float temperature, float humidity, uint32_t uptime) {
+  if (!_records) {
+    return false;
+  }
+  
+  HistoryRecord record;
+  record.sequence = _nextSequence;
+  record.runTime = _runTimeBase + uptime;
+  if (record.runTime < _lastRunTime) {
+    record.runTime = _lastRunTime;
+  }
+  record.co2 = co2;
+  record.temperature = (int16_t)lroundf(temperature * 100.0f);
+  record.humidity = (uint16_t)lroundf(humidity * 100.0f);
+  record.checksum = computeChecksum(record);
+  
+  if (!writeRecord(_head, record)) {
+    return false;
+  }
+  
+  _nextSequence++;
+  _lastRunTime = record.runTime;
+  _head = (_head + 1) % _capacity;
+  
+  // Keep the next slot writable; this drops the oldest sector of the ring
+  if (_head % RECORDS_PER_SECTOR == 0) {
+    return eraseSector(_head / RECORDS_PER_SECTOR);
+  }
+  return true;
+}
+
+HistoryCursor FlashHistory::records() const {
+  return HistoryCursor(_records, _capacity, _head, _records ? _capacity : 0);
+}
+
+HistoryCursor FlashHistory::newest(uint32_t count) const {
+  if (count > _capacity) {
+    count = _capacity;
+  }
+  uint32_t start = (_head + _capacity - count) % (_capacity ? _capacity : 1);
+  return HistoryCursor(_records, _capacity, start, _records ? count : 0);
+}
+
+uint32_t FlashHistory::capacity() const {
+  return _capacity;
+}
+
+const HistoryRecord* FlashHistory::data() const {
+  return _records;
+}
+
+uint32_t FlashHistory::head() const {
+  return _head;
+}
+
+bool FlashHistory::isOpen() const {
+  return _records != nullptr;
+}
+
+bool FlashHistory::isValid(const HistoryRecord& record) {
+  return record.sequence != 0xFFFFFFFF && record.checksum == computeChecksum(record);
+}
+
+uint16_t FlashHistory::computeChecksum(const HistoryRecord& record) {
+  // Fletcher-16 over everything but the checksum itself
+  const uint8_t* bytes = (const uint8_t*)&record;
+  uint16_t sum1 = 0;
+  uint16_t sum2 = 0;
+  for (size_t i = 0; i < offsetof(HistoryRecord, checksum); i++) {
+    sum1 = (sum1 + bytes[i]) % 255;
+    sum2 = (sum2 + sum1) % 255;
+  }
+  return (sum2 << 8) | sum1;
+}
+
+bool FlashHistory::eraseSector(uint32_t sector) {
+#ifdef ARDUINO_ARCH_ESP32
+  esp_err_t err = esp_partition_erase_range(_partition, sector * SECTOR_SIZE, SECTOR_SIZE);
+  if (err != ESP_OK) {
+    Serial.print("FlashHistory: ERROR - erase failed: ");
+    Serial.println(esp_err_to_name(err));
+    return false;
+  }
+  return true;
+#else
+  uint8_t erased[SECTOR_SIZE];
+  memset(erased, 0xFF, sizeof(erased));
+  return pwrite(_fd, erased, SECTOR_SIZE, (off_t)sector * SECTOR_SIZE) == (ssize_t)SECTOR_SIZE;
+#endif
+}
+
+bool FlashHistory::writeRecord(uint32_t slot, const HistoryRecord& record) {
+#ifdef ARDUINO_ARCH_ESP32
+  esp_err_t err = esp_partition_write(_partition, slot * sizeof(HistoryRecord), &record, sizeof(record));
+  if (err != ESP_OK) {
+    Serial.print("FlashHistory: ERROR - write failed: ");
+    Serial.println(esp_err_to_name(err));
+    return false;
+  }
+  return true;
+#else
+  return pwrite(_fd, &record, sizeof(record), (off_t)slot * sizeof(HistoryRecord)) == (ssize_t)sizeof(record);
+#endif
+}
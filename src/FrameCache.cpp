@@ -0,0 +1,353 @@
+#include "FrameCache.h"
+#include "FrameCodec.h"
+#include "RasterKernels.h"
+#include <string.h>
+
+#ifdef ARDUINO_ARCH_ESP32
+#include <Arduino.h>
+#else
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Size of the host image file, matching the "frame" entry in partitions.csv
+#ifndef ARDUINO_ARCH_ESP32
+static const size_t HOST_IMAGE_SIZE = 0x20000;
+#endif
+
+static const uint32_t FRAME_MAGIC = 0x4D415246;  // "FRAM"
+
+// Chunk size for comparing a frame against packed data
+static const uint32_t COMPARE_CHUNK = 256;
+
+static uint32_t crc32(uint32_t crc, const void* data, size_t size) {
+  const uint8_t* p = (const uint8_t*)data;
+  crc = ~crc;
+  while (size--) {
+    crc ^= *p++;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+  }
+  return ~crc;
+}
+
+// ---------------------------------------------------------------------------
+// FrameCache
+
+FrameCache::FrameCache()
+  : _useCounter(0) {
+  memset(_slots, 0, sizeof(_slots));
+}
+
+FrameCache::~FrameCache() {
+  for (uint8_t i = 0; i < MAX_SLOTS; i++) {
+    delete[] _slots[i].data;
+  }
+}
+
+bool FrameCache::store(uint32_t key, const uint8_t* frame, uint32_t length) {
+  // Measure first, so the slot is allocated at its final size
+  uint32_t size = packBitsEncode(frame, length, nullptr);
+  Slot* slot = allocate(key, size);
+  if (!slot) {
+    return false;
+  }
+  packBitsEncode(frame, length, slot->data);
+  return true;
+}
+
+bool FrameCache::load(uint32_t key, const uint8_t* packed, uint32_t size) {
+  Slot* slot = allocate(key, size);
+  if (!slot) {
+    return false;
+  }
+  memcpy(slot->data, packed, size);
+  return true;
+}
+
+bool FrameCache::restore(uint32_t key, uint8_t* frame, uint32_t length) {
+  Slot* slot = findSlot(key);
+  if (!slot) {
+    return false;
+  }
+  slot->lastUse = ++_useCounter;
+  return packBitsDecode(slot->data, slot->size, frame, length);
+}
+
+uint32_t FrameCache::changedPixels(uint32_t key, const uint8_t* frame, uint32_t length) const {
+  const Slot* slot = findSlot(key);
+  if (!slot) {
+    return NOT_CACHED;
+  }
+
+  PackBitsReader reader(slot->data, slot->size);
+  uint8_t chunk[COMPARE_CHUNK];
+  uint32_t changed = 0;
+  for (uint32_t offset = 0; offset < length; offset += COMPARE_CHUNK) {
+    uint32_t count = length - offset < COMPARE_CHUNK ? length - offset : COMPARE_CHUNK;
+    if (reader.read(chunk, count) != count) {
+      return NOT_CACHED;
+    }
+    changed += rasterCountChanged(chunk, frame + offset, count);
+  }
+  return reader.atEnd() ? changed : NOT_CACHED;
+}
+
+const uint8_t* FrameCache::find(uint32_t key, uint32_t& size) const {
+  const Slot* slot = findSlot(key);
+  if (!slot) {
+    return nullptr;
+  }
+  size = slot->size;
+  return slot->data;
+}
+
+void FrameCache::remove(uint32_t key) {
+  Slot* slot = findSlot(key);
+  if (slot) {
+    delete[] slot->data;
+    slot->data = nullptr;
+    slot->size = 0;
+  }
+}
+
+FrameCache::Slot* FrameCache::findSlot(uint32_t key) const {
+  for (uint8_t i = 0; i < MAX_SLOTS; i++) {
+    if (_slots[i].data && _slots[i].key == key) {
+      return (Slot*)&_slots[i];
+    }
+  }
+  return nullptr;
+}
+
+FrameCache::Slot* FrameCache::allocate(uint32_t key, uint32_t size) {
+  Slot* slot = findSlot(key);
+  if (!slot) {
+    // A free slot, or else the least recently used one
+    slot = &_slots[0];
+    for (uint8_t i = 0; i < MAX_SLOTS; i++) {
+      if (!_slots[i].data) {
+        slot = &_slots[i];
+        break;
+      }
+      if (_slots[i].lastUse < slot->lastUse) {
+        slot = &_slots[i];
+      }
+    }
+  }
+
+  if (!slot->data || slot->size != size) {
+    delete[] slot->data;
+    slot->data = new uint8_t[size ? size : 1];
+    if (!slot->data) {
+      return nullptr;
+    }
+  }
+  slot->key = key;
+  slot->size = size;
+  slot->lastUse = ++_useCounter;
+  return slot;
+}
+
+// ---------------------------------------------------------------------------
+// FrameStore
+
+FrameStore::FrameStore(const char* name)
+  : _name(name),
+    _data(nullptr),
+    _capacity(0),
+    _newest(0),
+    _head(0),
+    _nextSequence(0),
+#ifdef ARDUINO_ARCH_ESP32
+    _partition(nullptr),
+    _mapHandle(0) {
+#else
+    _fd(-1) {
+#endif
+}
+
+FrameStore::~FrameStore() {
+#ifdef ARDUINO_ARCH_ESP32
+  if (_data) {
+    spi_flash_munmap(_mapHandle);
+  }
+#else
+  if (_data) {
+    munmap((void*)_data, _capacity);
+  }
+  if (_fd >= 0) {
+    close(_fd);
+  }
+#endif
+}
+
+bool FrameStore::begin() {
+#ifdef ARDUINO_ARCH_ESP32
+  _partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, _name);
+  if (!_partition) {
+    Serial.println("FrameStore: ERROR - partition not found, check partitions.csv");
+    return false;
+  }
+
+  const void* mapped = nullptr;
+  esp_err_t err = esp_partition_mmap(_partition, 0, _partition->size, SPI_FLASH_MMAP_DATA,
+                                     &mapped, &_mapHandle);
+  if (err != ESP_OK) {
+    Serial.print("FrameStore: ERROR - mmap failed: ");
+    Serial.println(esp_err_to_name(err));
+    return false;
+  }
+  _data = (const uint8_t*)mapped;
+  _capacity = _partition->size;
+#else
+  _fd = open(_name, O_RDWR | O_CREAT, 0644);
+  if (_fd < 0) {
+    perror("FrameStore: open");
+    return false;
+  }
+
+  // A new image starts out erased, like fresh flash
+  struct stat st;
+  if (fstat(_fd, &st) != 0) {
+    return false;
+  }
+  if ((size_t)st.st_size < HOST_IMAGE_SIZE) {
+    uint8_t erased[SECTOR_SIZE];
+    memset(erased, 0xFF, sizeof(erased));
+    for (size_t offset = st.st_size - st.st_size % SECTOR_SIZE; offset < HOST_IMAGE_SIZE; offset += SECTOR_SIZE) {
+      if (pwrite(_fd, erased, SECTOR_SIZE, offset) != (ssize_t)SECTOR_SIZE) {
+        return false;
+      }
+    }
+  }
+
+  void* mapped = mmap(nullptr, HOST_IMAGE_SIZE, PROT_READ, MAP_SHARED, _fd, 0);
+  if (mapped == MAP_FAILED) {
+    perror("FrameStore: mmap");
+    return false;
+  }
+  _data = (const uint8_t*)mapped;
+  _capacity = HOST_IMAGE_SIZE;
+#endif
+
+  // Every record starts on a sector boundary; the highest sequence is newest
+  _newest = _capacity;
+  for (uint32_t offset = 0; offset < _capacity; offset += SECTOR_SIZE) {
+    if (!isValid(offset)) {
+      continue;
+    }
+    const Header* header = (const Header*)(_data + offset);
+    if (_newest == _capacity || header->sequence >= ((const Header*)(_data + _newest))->sequence) {
+      _newest = offset;
+    }
+  }
+
+  if (_newest < _capacity) {
+    const Header* header = (const Header*)(_data + _newest);
+    uint32_t end = _newest + sizeof(Header) + header->size;
+    _head = (end + SECTOR_SIZE - 1) / SECTOR_SIZE * SECTOR_SIZE;
+    _nextSequence = header->sequence + 1;
+  } else {
+    _head = 0;
+    _nextSequence = 0;
+  }
+
+#ifdef ARDUINO_ARCH_ESP32
+  Serial.print("FrameStore: ");
+  Serial.print(_capacity / 1024);
+  Serial.print(" KB, ");
+  Serial.println(_newest < _capacity ? "last frame found" : "empty");
+#endif
+  return true;
+}
+
+const uint8_t* FrameStore::newest(uint32_t& key, uint32_t& size) const {
+  if (!_data || _newest >= _capacity) {
+    return nullptr;
+  }
+  const Header* header = (const Header*)(_data + _newest);
+  key = header->key;
+  size = header->size;
+  return _data + _newest + sizeof(Header);
+}
+
+bool FrameStore::save(uint32_t key, const uint8_t* packed, uint32_t size) {
+  if (!_data || sizeof(Header) + size > _capacity) {
+    return false;
+  }
+
+  uint32_t recordSize = sizeof(Header) + size;
+  if (_head + recordSize > _capacity) {
+    _head = 0;
+  }
+
+  Header header;
+  header.magic = FRAME_MAGIC;
+  header.sequence = _nextSequence;
+  header.key = key;
+  header.size = size;
+  header.crc = crc32(crc32(crc32(0, &key, sizeof(key)), &size, sizeof(size)), packed, size);
+
+  // Data first and the header last, so a reset halfway leaves no valid record
+  uint32_t sectors = (recordSize + SECTOR_SIZE - 1) / SECTOR_SIZE;
+  if (!erase(_head, sectors * SECTOR_SIZE) ||
+      !write(_head + sizeof(Header), packed, size) ||
+      !write(_head, &header, sizeof(header))) {
+    return false;
+  }
+
+  _newest = _head;
+  _head += sectors * SECTOR_SIZE;
+  _nextSequence++;
+  return true;
+}
+
+bool FrameStore::isValid(uint32_t offset) const {
+  const Header* header = (const Header*)(_data + offset);
+  if (header->magic != FRAME_MAGIC || header->size > _capacity - offset - sizeof(Header)) {
+    return false;
+  }
+  uint32_t crc = crc32(0, &header->key, sizeof(header->key));
+  crc = crc32(crc, &header->size, sizeof(header->size));
+  return crc32(crc, _data + offset + sizeof(Header), header->size) == header->crc;
+}
+
+bool FrameStore::erase(uint32_t offset, uint32_t size) {
+#ifdef ARDUINO_ARCH_ESP32
+  esp_err_t err = esp_partition_erase_range(_partition, offset, size);
+  if (err != ESP_OK) {
+    Serial.print("FrameStore: ERROR - erase failed: ");
+    Serial.println(esp_err_to_name(err));
+    return false;
+  }
+  return true;
+#else
+  uint8_t erased[SECTOR_SIZE];
+  memset(erased, 0xFF, sizeof(erased));
+  for (uint32_t done = 0; done < size; done += SECTOR_SIZE) {
+    if (pwrite(_fd, erased, SECTOR_SIZE, (off_t)(offset + done)) != (ssize_t)SECTOR_SIZE) {
+      return false;
+    }
+  }
+  return true;
+#endif
+}
+
+bool FrameStore::write(uint32_t offset, const void* data, uint32_t size) {
+#ifdef ARDUINO_ARCH_ESP32
+  esp_err_t err = esp_partition_write(_partition, offset, data, size);
+  if (err != ESP_OK) {
+    Serial.print("FrameStore: ERROR - write failed: ");
+    Serial.println(esp_err_to_name(err));
+    return false;
+  }
+  return true;
+#else
+  return pwrite(_fd, data, size, (off_t)offset) == (ssize_t)size;
+#endif
+}
@@ -0,0 +1,106 @@
+#include "FrameCodec.h"
+#include <string.h>
+
+// Longest packet of either kind
+static const uint32_t MAX_PACKET = 128;
+
+uint32_t packBitsBound(uint32_t length) {
+  return length + (length + MAX_PACKET - 1) / MAX_PACKET;
+}
+
+uint32_t packBitsEncode(const uint8_t* src, uint32_t length, uint8_t* dst) {
+  uint32_t out = 0;
+  uint32_t i = 0;
+
+  while (i < length) {
+    uint32_t run = 1;
+    while (i + run < length && run < MAX_PACKET && src[i + run] == src[i]) {
+      run++;
+    }
+
+    // A run of two costs as much as a literal pair, and splitting a literal
+    // for it costs an extra header, so runs start at three
+    if (run >= 3) {
+      if (dst) {
+        dst[out] = (uint8_t)(257 - run);
+        dst[out + 1] = src[i];
+      }
+      out += 2;
+      i += run;
+      continue;
+    }
+
+    // Literal up to the next run of three
+    uint32_t start = i;
+    while (i < length && i - start < MAX_PACKET) {
+      if (i + 2 < length && src[i] == src[i + 1] && src[i] == src[i + 2]) {
+        break;
+      }
+      i++;
+    }
+    uint32_t count = i - start;
+    if (dst) {
+      dst[out] = (uint8_t)(count - 1);
+      memcpy(dst + out + 1, src + start, count);
+    }
+    out += 1 + count;
+  }
+  return out;
+}
+
+bool packBitsDecode(const uint8_t* src, uint32_t size, uint8_t* dst, uint32_t length) {
+  PackBitsReader reader(src, size);
+  return reader.read(dst, length) == length && reader.atEnd();
+}
+
+PackBitsReader::PackBitsReader(const uint8_t* data, uint32_t size)
+  : _next(data),
+    _end(data + size),
+    _left(0),
+    _repeat(false),
+    _value(0) {
+}
+
+uint32_t PackBitsReader::read(uint8_t* dst, uint32_t length) {
+  uint32_t written = 0;
+
+  while (written < length) {
+    if (_left == 0) {
+      if (_next == _end) {
+        break;
+      }
+      uint8_t header = *_next++;
+      if (header < 128) {
+        // Truncated data ends the literal early rather than overreading
+        _left = header + 1;
+        if (_left > (uint32_t)(_end - _next)) {
+          _left = _end - _next;
+        }
+        _repeat = false;
+      } else if (header > 128) {
+        if (_next == _end) {
+          break;
+        }
+        _left = 257 - header;
+        _repeat = true;
+        _value = *_next++;
+      }
+      continue;
+    }
+
+    uint32_t count = length - written < _left ? length - written : _left;
+    if (_repeat) {
+      memset(dst + written, _value, count);
+    } else {
+      memcpy(dst + written, _next, count);
+      _next += count;
+    }
+    _left -= count;
+    written += count;
+  }
+  return written;
+}
+
+bool PackBitsReader::atEnd() const {
+  return _left == 0 && _next == _end;
+}
@@ -0,0 +1,88 @@
+#include "GlyphCache.h"
+#include <string.h>
+
+GlyphCache::GlyphCache()
+  : _count(0),
+    _used(0),
+    _pool(nullptr),
+    _useCounter(0),
+    _hits(0),
+    _misses(0) {
+  memset(_entries, 0, sizeof(_entries));
+}
+
+GlyphCache::~GlyphCache() {
+  delete[] _pool;
+}
+
+const uint8_t* GlyphCache::get(const PackedFont* font, uint16_t c) {
+  for (uint8_t i = 0; i < _count; i++) {
+    Entry& entry = _entries[i];
+    if (entry.font == font && entry.c == c) {
+      entry.lastUse = ++_useCounter;
+      _hits++;
+      return _pool + entry.offset;
+    }
+  }
+
+  _misses++;
+  const PackedGlyph* glyph = packedFontGlyph(*font, c);
+  uint32_t size = glyph ? (uint32_t)(glyph->width + 7) / 8 * glyph->height : 0;
+  if (!glyph || size > MAX_GLYPH_BYTES) {
+    return nullptr;
+  }
+  if (!_pool) {
+    _pool = new uint8_t[POOL_BYTES];
+    if (!_pool) {
+      return nullptr;
+    }
+  }
+  while (_count == MAX_ENTRIES || _used + size > POOL_BYTES) {
+    evictOldest();
+  }
+
+  uint8_t* rows = _pool + _used;
+  if (!packedGlyphDecode(*font, *glyph, rows)) {
+    return nullptr;
+  }
+  Entry& entry = _entries[_count++];
+  entry.font = font;
+  entry.c = c;
+  entry.offset = _used;
+  entry.size = size;
+  entry.lastUse = ++_useCounter;
+  _used += size;
+  return rows;
+}
+
+void GlyphCache::clear() {
+  _count = 0;
+  _used = 0;
+}
+
+uint32_t GlyphCache::getHits() const {
+  return _hits;
+}
+
+uint32_t GlyphCache::getMisses() const {
+  return _misses;
+}
+
+void GlyphCache::evictOldest() {
+  uint8_t oldest = 0;
+  for (uint8_t i = 1; i < _count; i++) {
+    if (_entries[i].lastUse < _entries[oldest].lastUse) {
+      oldest = i;
+    }
+  }
+
+  // Close the gap: the glyphs after it move down in the pool
+  Entry gone = _entries[oldest];
+  memmove(_pool + gone.offset, _pool + gone.offset + gone.size, _used - gone.offset - gone.size);
+  _used -= gone.size;
+  for (uint8_t i = oldest; i + 1 < _count; i++) {
+    _entries[i] = _entries[i + 1];
+    _entries[i].offset -= gone.size;
+  }
+  _count--;
+}
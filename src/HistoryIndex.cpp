@@ -0,0 +1,188 @@
+#include "HistoryIndex.h"
+
+void HistoryAggregate::clear() {
+  min = 0xFFFF;
+  max = 0;
+  sum = 0;
+  count = 0;
+}
+
+void HistoryAggregate::add(uint16_t co2) {
+  if (co2 < min) {
+    min = co2;
+  }
+  if (co2 > max) {
+    max = co2;
+  }
+  sum += co2;
+  count++;
+}
+
+void HistoryAggregate::merge(const HistoryAggregate& other) {
+  if (other.min < min) {
+    min = other.min;
+  }
+  if (other.max > max) {
+    max = other.max;
+  }
+  sum += other.sum;
+  count += other.count;
+}
+
+uint16_t HistoryAggregate::average() const {
+  return count ? (uint16_t)((sum + count / 2) / count) : 0;
+}
+
+HistoryIndex::HistoryIndex()
+  : _records(nullptr),
+    _capacity(0),
+    _blocks(0),
+    _nodes(nullptr) {
+}
+
+HistoryIndex::~HistoryIndex() {
+  delete[] _nodes;
+}
+
+bool HistoryIndex::begin(const HistoryRecord* records, uint32_t capacity) {
+  delete[] _nodes;
+  _nodes = nullptr;
+  _records = records;
+  _capacity = capacity;
+  _blocks = (capacity + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  if (!records || _blocks == 0) {
+    return false;
+  }
+
+  _nodes = new HistoryAggregate[2 * _blocks];
+  if (!_nodes) {
+    return false;
+  }
+
+  for (uint32_t block = 0; block < _blocks; block++) {
+    rebuildBlock(block);
+  }
+  return true;
+}
+
+bool HistoryIndex::begin(const FlashHistory& history) {
+  return begin(history.data(), history.capacity());
+}
+
+void HistoryIndex::invalidate(uint32_t first, uint32_t count) {
+  if (!_nodes || count == 0) {
+    return;
+  }
+  if (count >= _capacity) {
+    for (uint32_t block = 0; block < _blocks; block++) {
+      rebuildBlock(block);
+    }
+    return;
+  }
+
+  // Slots may wrap around the end of the ring, so walk them block by block
+  uint32_t block = (first % _capacity) / BLOCK_SIZE;
+  uint32_t last = ((first + count - 1) % _capacity) / BLOCK_SIZE;
+  while (true) {
+    rebuildBlock(block);
+    if (block == last) {
+      break;
+    }
+    block = (block + 1) % _blocks;
+  }
+}
+
+void HistoryIndex::appended(const FlashHistory& history) {
+  uint32_t head = history.head();
+  invalidate((head + _capacity - 1) % _capacity, 1);
+  if (head % FlashHistory::RECORDS_PER_SECTOR == 0) {
+    invalidate(head, FlashHistory::RECORDS_PER_SECTOR);
+  }
+}
+
+HistoryAggregate HistoryIndex::query(uint32_t first, uint32_t count) const {
+  HistoryAggregate result;
+  result.clear();
+  if (!_nodes) {
+    return result;
+  }
+  if (count > _capacity) {
+    count = _capacity;
+  }
+
+  first %= _capacity;
+  if (first + count <= _capacity) {
+    return queryLinear(first, first + count);
+  }
+  result = queryLinear(first, _capacity);
+  result.merge(queryLinear(0, first + count - _capacity));
+  return result;
+}
+
+HistoryAggregate HistoryIndex::queryNewest(uint32_t head, uint32_t skip, uint32_t count) const {
+  if (!_nodes) {
+    return query(0, 0);
+  }
+  skip %= _capacity;
+  if (count > _capacity) {
+    count = _capacity;
+  }
+  uint32_t first = (head + 2 * _capacity - skip - count) % _capacity;
+  return query(first, count);
+}
+
+HistoryAggregate HistoryIndex::scan(const HistoryRecord* records, uint32_t capacity,
+                                    uint32_t first, uint32_t count) {
+  HistoryAggregate result;
+  result.clear();
+  for (uint32_t i = 0; i < count && i < capacity; i++) {
+    const HistoryRecord& record = records[(first + i) % capacity];
+    if (FlashHistory::isValid(record)) {
+      result.add(record.co2);
+    }
+  }
+  return result;
+}
+
+bool HistoryIndex::isReady() const {
+  return _nodes != nullptr;
+}
+
+void HistoryIndex::rebuildBlock(uint32_t block) {
+  uint32_t first = block * BLOCK_SIZE;
+  uint32_t count = _capacity - first < BLOCK_SIZE ? _capacity - first : BLOCK_SIZE;
+
+  uint32_t node = _blocks + block;
+  _nodes[node] = scan(_records, _capacity, first, count);
+  for (node /= 2; node > 0; node /= 2) {
+    _nodes[node] = _nodes[2 * node];
+    _nodes[node].merge(_nodes[2 * node + 1]);
+  }
+}
+
+HistoryAggregate HistoryIndex::queryLinear(uint32_t first, uint32_t end) const {
+  // Whole blocks come from the tree, the ragged ends from the records
+  uint32_t firstBlock = (first + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  uint32_t endBlock = end / BLOCK_SIZE;
+  if (firstBlock >= endBlock) {
+    return scan(_records, _capacity, first, end - first);
+  }
+
+  HistoryAggregate result = scan(_records, _capacity, first, firstBlock * BLOCK_SIZE - first);
+  result.merge(scan(_records, _capacity, endBlock * BLOCK_SIZE, end - endBlock * BLOCK_SIZE));
+
+  // Bottom-up walk over the leaves [firstBlock, endBlock)
+  uint32_t left = firstBlock + _blocks;
+  uint32_t right = endBlock + _blocks;
+  while (left < right) {
+    if (left & 1) {
+      result.merge(_nodes[left++]);
+    }
+    if (right & 1) {
+      result.merge(_nodes[--right]);
+    }
+    left /= 2;
+    right /= 2;
+  }
+  return result;
+}
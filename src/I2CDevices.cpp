@@ -0,0 +1,303 @@
+#include "I2CDevices.h"
+#include "EventTracer.h"
+#include "LatencyTracer.h"
+
+// Sensirion CRC-8 over each 16-bit word: polynomial 0x31, init 0xFF
+static uint8_t sensirionCrc(const uint8_t* data) {
+  uint8_t crc = 0xFF;
+  for (int i = 0; i < 2; i++) {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x31) : (uint8_t)(crc << 1);
+    }
+  }
+  return crc;
+}
+
+// Responses come as word, word CRC, word, word CRC, ...
+static bool checkWords(const uint8_t* response, uint8_t length) {
+  for (uint8_t i = 0; i + 3 <= length; i += 3) {
+    if (sensirionCrc(response + i) != response[i + 2]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static uint16_t readWord(const uint8_t* data) {
+  return (uint16_t)((data[0] << 8) | data[1]);
+}
+
+static void setCommand(I2CCommand& command, uint8_t address, uint16_t code, uint8_t rxLength, uint32_t execMicros) {
+  command.address = address;
+  command.tx[0] = code >> 8;
+  command.tx[1] = code & 0xFF;
+  command.txLength = 2;
+  command.rxLength = rxLength;
+  command.execMicros = execMicros;
+  command.tag = 0;
+}
+
+// ---------------------------------------------------------------------------
+// SCD4x
+
+Scd4xDevice::Scd4xDevice(uint8_t address)
+  : _address(address),
+    _dueAt(0),
+    _failed(false),
+    _sampleId(0) {
+  _schedule.restart(micros());
+}
+
+bool Scd4xDevice::nextCommand(unsigned long now, I2CCommand& command) {
+  if (_failed) {
+    _dueAt = now + Scd4xSchedule::CHECK_INTERVAL_US;
+    return false;
+  }
+
+  Scd4xStep step;
+  if (!_schedule.next(now, step)) {
+    return false;
+  }
+  setCommand(command, _address, step.code, step.rxWords * 3, step.execMicros);
+  return true;
+}
+
+void Scd4xDevice::complete(const I2CCommand& command, const uint8_t* response, bool ok, unsigned long now) {
+  if (!ok || !checkWords(response, command.rxLength)) {
+    _failed = true;
+    _dueAt = now + Scd4xSchedule::CHECK_INTERVAL_US;
+    return;
+  }
+
+  uint16_t words[3] = {0, 0, 0};
+  for (uint8_t i = 0; i < command.rxLength / 3 && i < 3; i++) {
+    words[i] = readWord(response + 3 * i);
+  }
+
+  switch (_schedule.complete(words, now)) {
+    case SCD4X_MEASUREMENT_READY:
+      _sampleId = latencyTracer.beginSample();
+      eventTracer.instant(EVENT_DATA_READY);
+      break;
+
+    case SCD4X_CO2_READING:
+    case SCD4X_RHT_READING: {
+      latencyTracer.mark(_sampleId, STAGE_SAMPLE_READ);
+
+      SensorData sample;
+      sample.co2 = words[0];
+      sample.temperature = -45.0f + 175.0f * words[1] / 65535.0f;
+      sample.humidity = 100.0f * words[2] / 65535.0f;
+      sample.sampleId = _sampleId;
+      _samples.push(sample);
+      break;
+    }
+
+    case SCD4X_NOTHING:
+      break;
+  }
+}
+
+void Scd4xDevice::reset() {
+  _failed = false;
+  _samples.clear();
+  _schedule.restart(micros());
+}
+
+// ---------------------------------------------------------------------------
+// SGP41
+
+// 1 Hz sampling; both commands need 50 ms to execute
+static const unsigned long SGP41_INTERVAL_US = 1000000;
+static const uint32_t SGP41_EXEC_US = 50000;
+
+// Give up on a device that never answered after this many attempts
+static const uint8_t PROBE_ATTEMPTS = 3;
+
+Sgp41Device::Sgp41Device(uint8_t address)
+  : _address(address),
+    _dueAt(micros()),
+    _conditioningLeft(10),
+    _failures(0),
+    _seen(false),
+    _absent(false),
+    _temperatureTicks(0x6666),   // 25 C
+    _humidityTicks(0x8000) {     // 50 %RH
+}
+
+void Sgp41Device::setCompensation(float temperature, float humidity) {
+  _temperatureTicks = (uint16_t)((constrain(temperature, -45.0f, 130.0f) + 45.0f) * 65535.0f / 175.0f);
+  _humidityTicks = (uint16_t)(constrain(humidity, 0.0f, 100.0f) * 65535.0f / 100.0f);
+}
+
+bool Sgp41Device::nextCommand(unsigned long now, I2CCommand& command) {
+  if (_absent) {
+    _dueAt = now + 60 * SGP41_INTERVAL_US;
+    return false;
+  }
+
+  bool conditioning = _conditioningLeft > 0;
+  setCommand(command, _address, conditioning ? 0x2612 : 0x2619, conditioning ? 3 : 6, SGP41_EXEC_US);
+
+  // Compensation parameters: humidity, then temperature, each with its CRC
+  command.tx[2] = _humidityTicks >> 8;
+  command.tx[3] = _humidityTicks & 0xFF;
+  command.tx[4] = sensirionCrc(command.tx + 2);
+  command.tx[5] = _temperatureTicks >> 8;
+  command.tx[6] = _temperatureTicks & 0xFF;
+  command.tx[7] = sensirionCrc(command.tx + 5);
+  command.txLength = 8;
+  return true;
+}
+
+void Sgp41Device::complete(const I2CCommand& command, const uint8_t* response, bool ok, unsigned long now) {
+  // Keep a steady 1 Hz cadence, the command's 50 ms included
+  _dueAt += SGP41_INTERVAL_US;
+  if ((long)(now - _dueAt) >= 0) {
+    _dueAt = now + SGP41_INTERVAL_US;
+  }
+
+  if (!ok || !checkWords(response, command.rxLength)) {
+    if (!_seen && ++_failures >= PROBE_ATTEMPTS) {
+      Serial.println("SGP41 not found, disabling it");
+      _absent = true;
+    }
+    return;
+  }
+  _seen = true;
+
+  if (_conditioningLeft > 0) {
+    _conditioningLeft--;
+    return;
+  }
+
+  GasSample sample;
+  sample.vocRaw = readWord(response);
+  sample.noxRaw = readWord(response + 3);
+  sample.time = millis();
+  _samples.push(sample);
+}
+
+// ---------------------------------------------------------------------------
+// BMP280
+
+// Forced mode, temperature and pressure oversampling x1: at most 6.4 ms
+static const uint8_t BMP280_CTRL_MEAS = 0x25;
+static const uint32_t BMP280_CONVERSION_US = 7000;
+
+Bmp280Device::Bmp280Device(uint8_t address, unsigned long intervalMs)
+  : _address(address),
+    _interval(intervalMs * 1000),
+    _dueAt(micros()),
+    _step(READ_CALIBRATION),
+    _failures(0),
+    _absent(false) {
+}
+
+bool Bmp280Device::nextCommand(unsigned long now, I2CCommand& command) {
+  if (_absent) {
+    _dueAt = now + 60 * _interval;
+    return false;
+  }
+
+  command.address = _address;
+  command.execMicros = 0;
+  command.txLength = 1;
+  command.tag = _step;
+
+  switch (_step) {
+    case READ_CALIBRATION:
+      command.tx[0] = 0x88;
+      command.rxLength = 24;
+      break;
+    case TRIGGER:
+      command.tx[0] = 0xF4;
+      command.tx[1] = BMP280_CTRL_MEAS;
+      command.txLength = 2;
+      command.rxLength = 0;
+      command.execMicros = BMP280_CONVERSION_US;
+      break;
+    case READ_RESULT:
+      command.tx[0] = 0xF7;
+      command.rxLength = 6;
+      break;
+  }
+  return true;
+}
+
+void Bmp280Device::complete(const I2CCommand& command, const uint8_t* response, bool ok, unsigned long now) {
+  if (!ok) {
+    if (command.tag == READ_CALIBRATION && ++_failures >= PROBE_ATTEMPTS) {
+      Serial.println("BMP280 not found, disabling it");
+      _absent = true;
+    }
+    _step = _step == READ_CALIBRATION ? READ_CALIBRATION : TRIGGER;
+    _dueAt = now + _interval;
+    return;
+  }
+
+  switch (command.tag) {
+    case READ_CALIBRATION:
+      _t1 = response[0] | (response[1] << 8);
+      _t2 = response[2] | (response[3] << 8);
+      _t3 = response[4] | (response[5] << 8);
+      _p1 = response[6] | (response[7] << 8);
+      _p2 = response[8] | (response[9] << 8);
+      _p3 = response[10] | (response[11] << 8);
+      _p4 = response[12] | (response[13] << 8);
+      _p5 = response[14] | (response[15] << 8);
+      _p6 = response[16] | (response[17] << 8);
+      _p7 = response[18] | (response[19] << 8);
+      _p8 = response[20] | (response[21] << 8);
+      _p9 = response[22] | (response[23] << 8);
+      _step = TRIGGER;
+      _dueAt = now;
+      break;
+
+    case TRIGGER:
+      // The conversion time has already passed by the time we get here
+      _step = READ_RESULT;
+      _dueAt = now;
+      break;
+
+    case READ_RESULT: {
+      int32_t rawPressure = ((int32_t)response[0] << 12) | (response[1] << 4) | (response[2] >> 4);
+      int32_t rawTemperature = ((int32_t)response[3] << 12) | (response[4] << 4) | (response[5] >> 4);
+      compensate(rawTemperature, rawPressure);
+      _step = TRIGGER;
+      _dueAt = now + _interval;
+      break;
+    }
+  }
+}
+
+void Bmp280Device::compensate(int32_t rawTemperature, int32_t rawPressure) {
+  // Integer compensation from the BMP280 datasheet, section 8.2
+  int32_t var1 = ((((rawTemperature >> 3) - ((int32_t)_t1 << 1))) * ((int32_t)_t2)) >> 11;
+  int32_t var2 = (((((rawTemperature >> 4) - ((int32_t)_t1)) * ((rawTemperature >> 4) - ((int32_t)_t1))) >> 12) *
+                  ((int32_t)_t3)) >> 14;
+  int32_t tFine = var1 + var2;
+
+  int64_t p1 = ((int64_t)tFine) - 128000;
+  int64_t p2 = p1 * p1 * (int64_t)_p6;
+  p2 = p2 + ((p1 * (int64_t)_p5) << 17);
+  p2 = p2 + (((int64_t)_p4) << 35);
+  p1 = ((p1 * p1 * (int64_t)_p3) >> 8) + ((p1 * (int64_t)_p2) << 12);
+  p1 = (((((int64_t)1) << 47) + p1)) * ((int64_t)_p1) >> 33;
+  if (p1 == 0) {
+    return;  // Calibration data is garbage
+  }
+
+  int64_t p = 1048576 - rawPressure;
+  p = (((p << 31) - p2) * 3125) / p1;
+  p1 = (((int64_t)_p9) * (p >> 13) * (p >> 13)) >> 25;
+  p2 = (((int64_t)_p8) * p) >> 19;
+  p = ((p + p1 + p2) >> 8) + (((int64_t)_p7) << 4);
+
+  PressureSample sample;
+  sample.pressure = (float)p / 256.0f / 100.0f;
+  sample.temperature = ((tFine * 5 + 128) >> 8) / 100.0f;
+  sample.time = millis();
+  _samples.push(sample);
+}
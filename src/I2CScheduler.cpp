@@ -0,0 +1,158 @@
+#include "I2CScheduler.h"
+#include "CpuClock.h"
+#include "EventTracer.h"
+
+// Wrap-safe "a is at or after b" for micros() timestamps
+static bool reached(unsigned long now, unsigned long time) {
+  return (long)(now - time) >= 0;
+}
+
+I2CScheduler::I2CScheduler(TwoWire& wire)
+  : _wire(wire),
+    _count(0),
+    _transactions(0),
+    _errors(0) {
+}
+
+bool I2CScheduler::addDevice(I2CDevice* device) {
+  if (_count >= MAX_DEVICES) {
+    return false;
+  }
+  Slot& slot = _slots[_count++];
+  slot.device = device;
+  slot.readyAt = 0;
+  slot.busy = false;
+  slot.holds = 0;
+  return true;
+}
+
+void I2CScheduler::poll() {
+  // Collect finished commands first, so their drivers can queue the next
+  // step in the same pass
+  for (uint8_t i = 0; i < _count; i++) {
+    Slot& slot = _slots[i];
+    if (slot.busy && reached(micros(), slot.readyAt)) {
+      finish(slot);
+    }
+  }
+
+  for (uint8_t i = 0; i < _count; i++) {
+    Slot& slot = _slots[i];
+    if (!slot.busy && slot.holds == 0 && reached(micros(), slot.device->getDueTime())) {
+      start(slot);
+    }
+  }
+}
+
+unsigned long I2CScheduler::getIdleTime(unsigned long limit) const {
+  unsigned long now = micros();
+  unsigned long idle = limit;
+
+  for (uint8_t i = 0; i < _count; i++) {
+    const Slot& slot = _slots[i];
+    if (!slot.busy && slot.holds > 0) {
+      continue;
+    }
+    unsigned long time = slot.busy ? slot.readyAt : slot.device->getDueTime();
+    if (reached(now, time)) {
+      return 0;
+    }
+    if (time - now < idle) {
+      idle = time - now;
+    }
+  }
+  return idle;
+}
+
+void I2CScheduler::hold(I2CDevice* device) {
+  Slot* slot = findSlot(device);
+  if (!slot) {
+    return;
+  }
+
+  // The device can't take another command until this one has executed
+  if (slot->busy) {
+    unsigned long now = micros();
+    if (!reached(now, slot->readyAt)) {
+      delayMicroseconds(slot->readyAt - now);
+    }
+    finish(*slot);
+  }
+  slot->holds++;
+}
+
+void I2CScheduler::release(I2CDevice* device) {
+  Slot* slot = findSlot(device);
+  if (slot && slot->holds > 0) {
+    slot->holds--;
+  }
+}
+
+uint32_t I2CScheduler::getTransactionCount() const {
+  return _transactions;
+}
+
+uint32_t I2CScheduler::getErrorCount() const {
+  return _errors;
+}
+
+I2CScheduler::Slot* I2CScheduler::findSlot(I2CDevice* device) {
+  for (uint8_t i = 0; i < _count; i++) {
+    if (_slots[i].device == device) {
+      return &_slots[i];
+    }
+  }
+  return nullptr;
+}
+
+void I2CScheduler::start(Slot& slot) {
+  I2CCommand& command = slot.command;
+  if (!slot.device->nextCommand(micros(), command)) {
+    return;
+  }
+
+  // Bursts of register traffic; short enough that the full clock costs
+  // less than the time the CPU would spend awake at the idle one
+  ClockBoost boost;
+  eventTracer.instant(EVENT_I2C, command.address);
+  _wire.beginTransmission(command.address);
+  _wire.write(command.tx, command.txLength);
+  uint8_t error = _wire.endTransmission();
+  _transactions++;
+
+  if (error) {
+    _errors++;
+    slot.device->complete(command, nullptr, false, micros());
+    return;
+  }
+
+  slot.busy = true;
+  slot.readyAt = micros() + command.execMicros;
+  if (command.execMicros == 0) {
+    finish(slot);
+  }
+}
+
+void I2CScheduler::finish(Slot& slot) {
+  const I2CCommand& command = slot.command;
+  uint8_t response[MAX_RESPONSE];
+  bool ok = true;
+  slot.busy = false;
+
+  if (command.rxLength > 0) {
+    ClockBoost boost;
+    uint8_t length = command.rxLength < MAX_RESPONSE ? command.rxLength : MAX_RESPONSE;
+    uint8_t received = _wire.requestFrom(command.address, length);
+    _transactions++;
+
+    for (uint8_t i = 0; i < received && i < length; i++) {
+      response[i] = _wire.read();
+    }
+    ok = received == command.rxLength;
+    if (!ok) {
+      _errors++;
+    }
+  }
+
+  slot.device->complete(command, response, ok, micros());
+}
@@ -0,0 +1,77 @@
+#include "LatencyTracer.h"
+#include <string.h>
+
+LatencyTracer latencyTracer;
+
+LatencyTracer::LatencyTracer()
+  : _nextId(1) {
+  memset(_traces, 0, sizeof(_traces));
+  for (int i = 0; i < STAGE_COUNT; i++) {
+    _stageHistograms[i].reset();
+  }
+  _endToEnd.reset();
+}
+
+uint32_t LatencyTracer::beginSample() {
+  uint32_t id = _nextId++;
+  if (_nextId == 0) {
+    _nextId = 1;
+  }
+  
+  // Takes over the slot of the sample MAX_IN_FLIGHT before it
+  Trace& trace = _traces[id % MAX_IN_FLIGHT];
+  trace.id = id;
+  trace.lastStage = STAGE_DATA_READY;
+  trace.stageTimes[STAGE_DATA_READY] = micros();
+  _stageHistograms[STAGE_DATA_READY].add(0);
+  return id;
+}
+
+void LatencyTracer::mark(uint32_t sampleId, TraceStage stage) {
+  // Only samples still in flight are traced, and each stage only once
+  Trace& trace = _traces[sampleId % MAX_IN_FLIGHT];
+  if (sampleId == 0 || sampleId != trace.id || (int8_t)stage <= trace.lastStage) {
+    return;
+  }
+  
+  unsigned long now = micros();
+  trace.stageTimes[stage] = now;
+  _stageHistograms[stage].add(now - trace.stageTimes[trace.lastStage]);
+  trace.lastStage = stage;
+  
+  if (stage == STAGE_REFRESHED) {
+    _endToEnd.add(now - trace.stageTimes[STAGE_DATA_READY]);
+  }
+}
+
+const LogHistogram& LatencyTracer::getStageHistogram(TraceStage stage) const {
+  return _stageHistograms[stage];
+}
+
+const LogHistogram& LatencyTracer::getEndToEndHistogram() const {
+  return _endToEnd;
+}
+
+void LatencyTracer::printSummary(Print& out) const {
+  out.println("=== Sample-to-glass latency (us, from previous stage) ===");
+  for (int i = STAGE_SAMPLE_READ; i < STAGE_COUNT; i++) {
+    out.print(getStageName((TraceStage)i));
+    out.print(": ");
+    _stageHistograms[i].printSummary(out);
+  }
+  out.print("end-to-end: ");
+  _endToEnd.printSummary(out);
+}
+
+const char* LatencyTracer::getStageName(TraceStage stage) {
+  switch (stage) {
+    case STAGE_DATA_READY:     return "data-ready";
+    case STAGE_SAMPLE_READ:    return "sample-read";
+    case STAGE_SENSOR_UPDATED: return "sensor-updated";
+    case STAGE_CHANGE_CHECKED: return "change-checked";
+    case STAGE_RENDERED:       return "rendered";
+    case STAGE_UPLOADED:       return "uploaded";
+    case STAGE_REFRESHED:      return "refreshed";
+    default:                   return "unknown";
+  }
+}
@@ -0,0 +1,243 @@
+#include "LiveFeed.h"
+#include <string.h>
+
+// Header byte of a frame
+static const uint8_t FRAME_KEYFRAME = 0x80;
+static const uint8_t FRAME_TICK = 0x20;
+static const uint8_t FIELD_SEQUENCE = 0x01;
+static const uint8_t FIELD_TIME = 0x02;
+static const uint8_t FIELD_CO2 = 0x04;
+static const uint8_t FIELD_TEMPERATURE = 0x08;
+static const uint8_t FIELD_HUMIDITY = 0x10;
+static const uint8_t FIELD_COUNT = 5;
+
+static inline uint32_t zigzag(int32_t value) {
+  return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t value) {
+  return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+static uint8_t putVarint(uint8_t* out, uint32_t value) {
+  uint8_t length = 0;
+  while (value >= 0x80) {
+    out[length++] = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  out[length++] = (uint8_t)value;
+  return length;
+}
+
+static bool getVarint(const uint8_t*& p, const uint8_t* end, uint32_t& value) {
+  value = 0;
+  for (uint8_t shift = 0; shift < 35 && p < end; shift += 7) {
+    uint8_t byte = *p++;
+    value |= (uint32_t)(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Field values as sent: the error against the prediction from the baseline
+static void predictionErrors(const LiveBaseline& base, const LiveSample& sample, uint32_t* values) {
+  values[0] = zigzag((int32_t)(sample.sequence - (base.valid ? base.last.sequence + 1 : 0)));
+  values[1] = zigzag((int32_t)(sample.time - base.last.time - base.timeStep));
+  values[2] = zigzag((int32_t)sample.co2 - (int32_t)base.last.co2);
+  values[3] = zigzag((int32_t)sample.temperature - (int32_t)base.last.temperature);
+  values[4] = zigzag((int32_t)sample.humidity - (int32_t)base.last.humidity);
+}
+
+static void advance(LiveBaseline& base, const LiveSample& sample) {
+  base.timeStep = base.valid ? sample.time - base.last.time : 0;
+  base.last = sample;
+  base.valid = true;
+}
+
+void LiveBaseline::reset() {
+  memset(&last, 0, sizeof(last));
+  timeStep = 0;
+  valid = false;
+}
+
+uint8_t liveEncode(LiveBaseline& base, LiveFrameType type, const LiveSample& sample, uint8_t* out) {
+  if (!base.valid) {
+    base.reset();
+  }
+
+  uint32_t values[FIELD_COUNT];
+  predictionErrors(base, sample, values);
+
+  uint8_t header = (base.valid ? 0 : FRAME_KEYFRAME) | (type == LIVE_TICK ? FRAME_TICK : 0);
+  uint8_t length = 1;
+  for (uint8_t i = 0; i < FIELD_COUNT; i++) {
+    if (values[i]) {
+      header |= 1 << i;
+      length += putVarint(out + length, values[i]);
+    }
+  }
+  out[0] = header;
+
+  advance(base, sample);
+  return length;
+}
+
+bool liveDecode(LiveBaseline* bases, const uint8_t* data, size_t length,
+                LiveFrameType& type, LiveSample& sample) {
+  if (length == 0 || (data[0] & 0x40)) {
+    return false;
+  }
+  uint8_t header = data[0];
+  type = (header & FRAME_TICK) ? LIVE_TICK : LIVE_SAMPLE;
+  LiveBaseline& base = bases[type];
+  if (header & FRAME_KEYFRAME) {
+    base.reset();
+  } else if (!base.valid) {
+    return false;
+  }
+
+  uint32_t values[FIELD_COUNT] = {};
+  const uint8_t* p = data + 1;
+  const uint8_t* end = data + length;
+  for (uint8_t i = 0; i < FIELD_COUNT; i++) {
+    if ((header & (1 << i)) && !getVarint(p, end, values[i])) {
+      return false;
+    }
+  }
+  if (p != end) {
+    return false;
+  }
+
+  sample.sequence = (base.valid ? base.last.sequence + 1 : 0) + unzigzag(values[0]);
+  sample.time = base.last.time + base.timeStep + unzigzag(values[1]);
+  sample.co2 = (uint16_t)(base.last.co2 + unzigzag(values[2]));
+  sample.temperature = (int16_t)(base.last.temperature + unzigzag(values[3]));
+  sample.humidity = (uint16_t)(base.last.humidity + unzigzag(values[4]));
+  advance(base, sample);
+  return true;
+}
+
+LiveFeed::LiveFeed(uint16_t maxClients)
+  : _clients(new Client[maxClients]),
+    _maxClients(maxClients),
+    _clientCount(0) {
+  for (uint16_t i = 0; i < _maxClients; i++) {
+    _clients[i].active = false;
+  }
+  _sequences[LIVE_SAMPLE] = 0;
+  _sequences[LIVE_TICK] = 0;
+  memset(&_stats, 0, sizeof(_stats));
+}
+
+LiveFeed::~LiveFeed() {
+  delete[] _clients;
+}
+
+bool LiveFeed::addClient(uint16_t client) {
+  if (client >= _maxClients) {
+    return false;
+  }
+  Client& c = _clients[client];
+  if (!c.active) {
+    _clientCount++;
+  }
+  c.active = true;
+  c.samplePending = false;
+  c.tickHead = 0;
+  c.tickCount = 0;
+  c.bases[LIVE_SAMPLE].reset();
+  c.bases[LIVE_TICK].reset();
+  return true;
+}
+
+void LiveFeed::removeClient(uint16_t client) {
+  if (client < _maxClients && _clients[client].active) {
+    _clients[client].active = false;
+    _clientCount--;
+  }
+}
+
+uint16_t LiveFeed::getClientCount() const {
+  return _clientCount;
+}
+
+void LiveFeed::publishSample(const LiveSample& sample) {
+  LiveSample numbered = sample;
+  numbered.sequence = _sequences[LIVE_SAMPLE]++;
+
+  for (uint16_t i = 0; i < _maxClients; i++) {
+    Client& c = _clients[i];
+    if (!c.active) {
+      continue;
+    }
+    if (c.samplePending) {
+      _stats.samplesDropped++;
+    }
+    c.sample = numbered;
+    c.samplePending = true;
+  }
+}
+
+void LiveFeed::publishTick(const LiveSample& tick) {
+  LiveSample numbered = tick;
+  numbered.sequence = _sequences[LIVE_TICK]++;
+
+  for (uint16_t i = 0; i < _maxClients; i++) {
+    Client& c = _clients[i];
+    if (!c.active) {
+      continue;
+    }
+    if (c.tickCount == TICK_QUEUE) {
+      c.tickHead = (c.tickHead + 1) % TICK_QUEUE;
+      c.tickCount--;
+      _stats.ticksDropped++;
+    }
+    c.ticks[(c.tickHead + c.tickCount) % TICK_QUEUE] = numbered;
+    c.tickCount++;
+  }
+}
+
+uint32_t LiveFeed::flush(LiveTransport& transport) {
+  uint32_t sent = 0;
+  for (uint16_t i = 0; i < _maxClients; i++) {
+    Client& c = _clients[i];
+    while (c.active && (c.tickCount || c.samplePending) && transport.canSend(i)) {
+      if (!sendNext(c, i, transport)) {
+        break;
+      }
+      sent++;
+    }
+  }
+  return sent;
+}
+
+LiveFeedStats LiveFeed::getStats() const {
+  return _stats;
+}
+
+bool LiveFeed::sendNext(Client& client, uint16_t id, LiveTransport& transport) {
+  bool tick = client.tickCount > 0;
+  LiveFrameType type = tick ? LIVE_TICK : LIVE_SAMPLE;
+  const LiveSample& next = tick ? client.ticks[client.tickHead] : client.sample;
+
+  // The baseline only moves on once the frame is out
+  LiveBaseline base = client.bases[type];
+  uint8_t frame[LIVE_FRAME_MAX];
+  uint8_t length = liveEncode(base, type, next, frame);
+  if (!transport.send(id, frame, length)) {
+    return false;
+  }
+  client.bases[type] = base;
+
+  if (tick) {
+    client.tickHead = (client.tickHead + 1) % TICK_QUEUE;
+    client.tickCount--;
+  } else {
+    client.samplePending = false;
+  }
+  _stats.framesSent++;
+  _stats.bytesSent += length;
+  return true;
+}
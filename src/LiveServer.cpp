@@ -0,0 +1,159 @@
+#include "LiveServer.h"
+#include <math.h>
+
+#ifdef ARDUINO_ARCH_ESP32
+#include <WiFi.h>
+
+// Subscribers the WebSockets library can hold at once
+static const uint16_t MAX_SUBSCRIBERS = WEBSOCKETS_SERVER_CLIENT_MAX;
+#else
+static const uint16_t MAX_SUBSCRIBERS = 1;
+#endif
+
+// Ping idle subscribers and drop the ones that stop answering, so a
+// dashboard that vanished without closing does not keep its slot
+static const unsigned long PING_INTERVAL_MS = 15000;
+static const unsigned long PONG_TIMEOUT_MS = 3000;
+static const uint8_t MISSED_PONGS = 2;
+
+LiveServer::LiveServer(uint16_t port)
+  :
+#ifdef ARDUINO_ARCH_ESP32
+    _server(port),
+#endif
+    _feed(MAX_SUBSCRIBERS),
+    _enabled(false),
+    _online(false) {
+#ifndef ARDUINO_ARCH_ESP32
+  (void)port;
+#endif
+}
+
+bool LiveServer::begin(const char* ssid, const char* password) {
+  if (!ssid || !ssid[0]) {
+    Serial.println("Live push: no WiFi credentials, disabled");
+    return false;
+  }
+
+#ifdef ARDUINO_ARCH_ESP32
+  // Association finishes in the background; loop() announces the address
+  WiFi.mode(WIFI_STA);
+  WiFi.setAutoReconnect(true);
+  WiFi.begin(ssid, password);
+
+  _server.onEvent([this](uint8_t num, WStype_t type, uint8_t* payload, size_t length) {
+    (void)payload;
+    (void)length;
+    if (type == WStype_CONNECTED) {
+      _feed.addClient(num);
+      Serial.print("Live push: subscriber ");
+      Serial.print(num);
+      Serial.print(" connected from ");
+      Serial.println(_server.remoteIP(num).toString());
+    } else if (type == WStype_DISCONNECTED) {
+      _feed.removeClient(num);
+      Serial.print("Live push: subscriber ");
+      Serial.print(num);
+      Serial.println(" disconnected");
+    }
+  });
+  _server.begin();
+  _server.enableHeartbeat(PING_INTERVAL_MS, PONG_TIMEOUT_MS, MISSED_PONGS);
+  _enabled = true;
+
+  Serial.print("Live push: joining ");
+  Serial.println(ssid);
+  return true;
+#else
+  (void)password;
+  Serial.println("Live push: not available in this build");
+  return false;
+#endif
+}
+
+void LiveServer::loop() {
+  if (!_enabled) {
+    return;
+  }
+
+#ifdef ARDUINO_ARCH_ESP32
+  bool online = WiFi.status() == WL_CONNECTED;
+  if (online && !_online) {
+    Serial.print("Live push: ws://");
+    Serial.print(WiFi.localIP().toString());
+    Serial.println("/");
+  }
+  _online = online;
+
+  _server.loop();
+  _feed.flush(*this);
+#endif
+}
+
+void LiveServer::publishSample(const SensorData& data, unsigned long time) {
+  if (!_enabled) {
+    return;
+  }
+  _feed.publishSample(toLiveSample(data, time));
+  _feed.flush(*this);
+}
+
+void LiveServer::publishTick(const SensorData& average, unsigned long time) {
+  if (!_enabled) {
+    return;
+  }
+  _feed.publishTick(toLiveSample(average, time));
+  _feed.flush(*this);
+}
+
+bool LiveServer::isEnabled() const {
+  return _enabled;
+}
+
+void LiveServer::printSummary(Print& out) const {
+  if (!_enabled) {
+    return;
+  }
+  LiveFeedStats stats = _feed.getStats();
+  out.print("Live push: ");
+  out.print(_feed.getClientCount());
+  out.print(" subscribers, ");
+  out.print(stats.framesSent);
+  out.print(" frames (");
+  out.print(stats.bytesSent);
+  out.print(" bytes) sent, ");
+  out.print(stats.samplesDropped);
+  out.print(" samples and ");
+  out.print(stats.ticksDropped);
+  out.println(" ticks dropped");
+}
+
+bool LiveServer::canSend(uint16_t client) {
+#ifdef ARDUINO_ARCH_ESP32
+  return _online && _server.clientIsConnected(client);
+#else
+  (void)client;
+  return false;
+#endif
+}
+
+bool LiveServer::send(uint16_t client, const uint8_t* data, size_t length) {
+#ifdef ARDUINO_ARCH_ESP32
+  return _server.sendBIN(client, data, length);
+#else
+  (void)client;
+  (void)data;
+  (void)length;
+  return false;
+#endif
+}
+
+LiveSample LiveServer::toLiveSample(const SensorData& data, unsigned long time) {
+  LiveSample sample;
+  sample.sequence = 0;
+  sample.time = time;
+  sample.co2 = data.co2;
+  sample.temperature = (int16_t)lroundf(data.temperature * 100.0f);
+  sample.humidity = (uint16_t)lroundf(data.humidity * 100.0f);
+  return sample;
+}
@@ -0,0 +1,57 @@
+#include "LogHistogram.h"
+
+void LogHistogram::reset() {
+  memset(counts, 0, sizeof(counts));
+  total = 0;
+  maxValue = 0;
+  sum = 0;
+}
+
+void LogHistogram::add(uint32_t value) {
+  uint8_t bucket = value ? 32 - __builtin_clz(value) : 0;
+  if (bucket >= BUCKETS) {
+    bucket = BUCKETS - 1;
+  }
+  
+  counts[bucket]++;
+  total++;
+  sum += value;
+  if (value > maxValue) {
+    maxValue = value;
+  }
+}
+
+uint32_t LogHistogram::percentile(uint8_t percent) const {
+  if (total == 0) {
+    return 0;
+  }
+  
+  uint32_t target = ((uint64_t)total * percent + 99) / 100;
+  uint32_t seen = 0;
+  for (uint8_t i = 0; i < BUCKETS; i++) {
+    seen += counts[i];
+    if (seen >= target && counts[i] > 0) {
+      // Report the bucket's upper bound, but never more than was actually seen
+      uint32_t upper = i == 0 ? 0 : (uint32_t)((1ULL << i) - 1);
+      return upper < maxValue ? upper : maxValue;
+    }
+  }
+  return maxValue;
+}
+
+uint32_t LogHistogram::average() const {
+  return total ? (uint32_t)(sum / total) : 0;
+}
+
+void LogHistogram::printSummary(Print& out) const {
+  out.print("n=");
+  out.print(total);
+  out.print(" avg=");
+  out.print(average());
+  out.print(" p50<=");
+  out.print(percentile(50));
+  out.print(" p95<=");
+  out.print(percentile(95));
+  out.print(" max=");
+  out.println(maxValue);
+}
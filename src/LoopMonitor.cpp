@@ -0,0 +1,147 @@
+#include "LoopMonitor.h"
+#include "RtcSnapshot.h"
+#include <string.h>
+
+#ifdef ARDUINO_ARCH_ESP32
+#include <esp_attr.h>
+#include <esp_system.h>
+#include <esp_task_wdt.h>
+#else
+#define RTC_NOINIT_ATTR
+#endif
+
+static const uint32_t RECORD_MAGIC = 0x4D504F4C;  // "LOPM"
+
+// Updated in place on every phase change, so there is no CRC; the magic and
+// the phase range are enough to tell it from the garbage of a cold start
+struct LoopRecord {
+  uint32_t magic;
+  uint32_t crashes;
+  uint8_t phase;                      // Phase in progress
+  uint32_t phaseMax[PHASE_COUNT];     // us
+  LogHistogram iterations;            // us
+};
+
+static RTC_NOINIT_ATTR LoopRecord record;
+
+// Resets that leave the loop in the middle of a phase
+static bool isCrashReset() {
+#ifdef ARDUINO_ARCH_ESP32
+  switch (esp_reset_reason()) {
+    case ESP_RST_PANIC:
+    case ESP_RST_INT_WDT:
+    case ESP_RST_TASK_WDT:
+    case ESP_RST_WDT:
+      return true;
+    default:
+      return false;
+  }
+#else
+  return false;
+#endif
+}
+
+LoopMonitor::LoopMonitor(uint32_t timeoutSeconds)
+  : _timeoutSeconds(timeoutSeconds),
+    _iterationStart(0),
+    _phaseStart(0) {
+}
+
+void LoopMonitor::begin() {
+  bool valid = record.magic == RECORD_MAGIC && record.phase < PHASE_COUNT;
+  if (!valid || !isWarmReset()) {
+    memset(&record, 0, sizeof(record));
+    record.iterations.reset();
+    record.magic = RECORD_MAGIC;
+  } else if (isCrashReset()) {
+    record.crashes++;
+    LoopPhase phase = (LoopPhase)record.phase;
+    Serial.print("Loop monitor: ");
+    Serial.print(resetReasonName());
+    Serial.print(" reset during phase '");
+    Serial.print(getPhaseName(phase));
+    Serial.print("' (longest completed run ");
+    Serial.print(record.phaseMax[phase]);
+    Serial.print(" us, budget ");
+    Serial.print(_timeoutSeconds);
+    Serial.print(" s), crashes since cold start: ");
+    Serial.println(record.crashes);
+    printSummary(Serial);
+  }
+
+#ifdef ARDUINO_ARCH_ESP32
+  // The core starts the watchdog for the idle tasks only; this changes the
+  // timeout, makes it panic (and so reset) and adds the loop task
+  esp_task_wdt_init(_timeoutSeconds, true);
+  esp_task_wdt_add(NULL);
+#endif
+
+  record.phase = PHASE_SETUP;
+  _phaseStart = micros();
+}
+
+void LoopMonitor::beginIteration() {
+  enter(PHASE_BUS);
+  _iterationStart = _phaseStart;
+}
+
+void LoopMonitor::endIteration() {
+  enter(PHASE_IDLE);
+  record.iterations.add(_phaseStart - _iterationStart);
+}
+
+void LoopMonitor::enter(LoopPhase phase) {
+  unsigned long now = micros();
+  uint32_t elapsed = now - _phaseStart;
+  if (elapsed > record.phaseMax[record.phase]) {
+    record.phaseMax[record.phase] = elapsed;
+  }
+
+  record.phase = phase;
+  _phaseStart = now;
+
+#ifdef ARDUINO_ARCH_ESP32
+  esp_task_wdt_reset();
+#endif
+}
+
+const LogHistogram& LoopMonitor::getIterationHistogram() const {
+  return record.iterations;
+}
+
+uint32_t LoopMonitor::getPhaseMax(LoopPhase phase) const {
+  return record.phaseMax[phase];
+}
+
+uint32_t LoopMonitor::getCrashCount() const {
+  return record.crashes;
+}
+
+void LoopMonitor::printSummary(Print& out) const {
+  out.println("=== Loop timing (us, since cold start) ===");
+  out.print("iteration: ");
+  record.iterations.printSummary(out);
+  out.print("phase max:");
+  for (int i = 0; i < PHASE_COUNT; i++) {
+    out.print(" ");
+    out.print(getPhaseName((LoopPhase)i));
+    out.print("=");
+    out.print(record.phaseMax[i]);
+  }
+  out.println();
+}
+
+const char* LoopMonitor::getPhaseName(LoopPhase phase) {
+  switch (phase) {
+    case PHASE_SETUP:      return "setup";
+    case PHASE_BUS:        return "bus";
+    case PHASE_SENSOR:     return "sensor";
+    case PHASE_PIPELINE:   return "pipeline";
+    case PHASE_RENDER:     return "render";
+    case PHASE_PANEL:      return "panel";
+    case PHASE_CHECKPOINT: return "checkpoint";
+    case PHASE_IDLE:       return "idle";
+    case PHASE_NETWORK:    return "network";
+    default:               return "unknown";
+  }
+}
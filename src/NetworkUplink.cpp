@@ -0,0 +1,218 @@
+#include "NetworkUplink.h"
+#include <stdio.h>
+#include <string.h>
+
+static const unsigned long DAY_MS = 86400000UL;
+
+// Wrap-safe "a is at or after b" for millis() timestamps
+static bool reached(unsigned long now, unsigned long time) {
+  return (long)(now - time) >= 0;
+}
+
+NetworkUplink::NetworkUplink(NetworkStack& stack, const char* deviceName, unsigned long interval)
+  : _stack(stack),
+    _deviceName(deviceName),
+    _interval(interval),
+    _fastReconnect(true),
+    _head(0),
+    _count(0),
+    _state(UPLINK_IDLE),
+    _requested(false),
+    _usedCache(false),
+    _nextBurst(interval),
+    _burstStart(0),
+    _stateTime(0),
+    _lastUpdate(0),
+    _lineLength(0),
+    _lineSent(0),
+    _lineIsSample(false),
+    _headerSent(false),
+    _day(0),
+    _radioToday(0),
+    _radioYesterday(0),
+    _burstsToday(0) {
+  memset(&_cache, 0, sizeof(_cache));
+  memset(&_stats, 0, sizeof(_stats));
+}
+
+void NetworkUplink::add(const LiveSample& sample) {
+  if (_count == BACKLOG) {
+    _head = (_head + 1) % BACKLOG;
+    _count--;
+    _stats.samplesDropped++;
+  }
+  _backlog[(_head + _count) % BACKLOG] = sample;
+  _count++;
+}
+
+void NetworkUplink::requestBurst() {
+  _requested = true;
+}
+
+bool NetworkUplink::update(unsigned long now) {
+  account(now);
+
+  switch (_state) {
+    case UPLINK_IDLE: {
+      bool due = _requested || _count >= BACKLOG * 3 / 4 || reached(now, _nextBurst);
+      if (due && _count > 0) {
+        startBurst(now);
+      } else if (due) {
+        // Nothing to send; check again next interval
+        _requested = false;
+        _nextBurst = now + _interval;
+      }
+      break;
+    }
+
+    case UPLINK_JOINING:
+      if (_stack.isJoined()) {
+        if (_usedCache) {
+          _stats.fastJoins++;
+        } else if (_fastReconnect) {
+          _stack.getCache(_cache);
+        }
+        setState(UPLINK_CONNECTING, now);
+      } else if (now - _stateTime >= JOIN_TIMEOUT_MS) {
+        // The access point moved or the address was taken; scan next time
+        _cache.valid = false;
+        finish(now, false);
+      }
+      break;
+
+    case UPLINK_CONNECTING:
+      if (_stack.connect()) {
+        _headerSent = false;
+        _lineLength = 0;
+        _lineSent = 0;
+        _lineIsSample = false;
+        setState(UPLINK_SENDING, now);
+        send(now);
+      } else if (now - _stateTime >= CONNECT_TIMEOUT_MS) {
+        // A reused address may have been leased to someone else meanwhile
+        _cache.valid = false;
+        finish(now, false);
+      }
+      break;
+
+    case UPLINK_SENDING:
+      send(now);
+      break;
+  }
+  return _state != UPLINK_IDLE;
+}
+
+void NetworkUplink::setFastReconnect(bool enabled) {
+  _fastReconnect = enabled;
+  if (!enabled) {
+    _cache.valid = false;
+  }
+}
+
+UplinkState NetworkUplink::getState() const {
+  return _state;
+}
+
+uint16_t NetworkUplink::getBacklog() const {
+  return _count;
+}
+
+const UplinkStats& NetworkUplink::getStats() const {
+  return _stats;
+}
+
+uint32_t NetworkUplink::getRadioOnToday() const {
+  return _radioToday;
+}
+
+uint32_t NetworkUplink::getRadioOnYesterday() const {
+  return _radioYesterday;
+}
+
+uint16_t NetworkUplink::getBurstsToday() const {
+  return _burstsToday;
+}
+
+void NetworkUplink::startBurst(unsigned long now) {
+  _requested = false;
+  _burstStart = now;
+  _usedCache = _fastReconnect && _cache.valid;
+  _stats.bursts++;
+  _burstsToday++;
+  _stack.begin(_usedCache ? &_cache : nullptr);
+  setState(UPLINK_JOINING, now);
+}
+
+void NetworkUplink::send(unsigned long now) {
+  while (true) {
+    // Next line: who we are, then the readings oldest first
+    if (_lineSent == _lineLength) {
+      if (_lineIsSample) {
+        _head = (_head + 1) % BACKLOG;
+        _count--;
+        _stats.samplesSent++;
+      }
+      _lineSent = 0;
+      _lineLength = 0;
+      _lineIsSample = false;
+
+      int length;
+      if (!_headerSent) {
+        length = snprintf(_line, sizeof(_line), "device %s\n", _deviceName);
+        _headerSent = true;
+      } else if (_count > 0) {
+        const LiveSample& s = _backlog[_head];
+        int temperature = s.temperature < 0 ? -s.temperature : s.temperature;
+        length = snprintf(_line, sizeof(_line),
+                          "CO2: %u ppm, Temp: %s%d.%02d C, Humidity: %u.%02u%%, age: %lu ms\n",
+                          s.co2, s.temperature < 0 ? "-" : "", temperature / 100, temperature % 100,
+                          s.humidity / 100, s.humidity % 100, (unsigned long)(now - s.time));
+        _lineIsSample = true;
+      } else {
+        finish(now, true);
+        return;
+      }
+      _lineLength = (uint8_t)(length < (int)sizeof(_line) ? length : sizeof(_line) - 1);
+      _stateTime = now;
+    }
+
+    size_t written = _stack.write((const uint8_t*)_line + _lineSent, _lineLength - _lineSent);
+    _lineSent += written;
+    if (_lineSent < _lineLength) {
+      if (now - _stateTime >= SEND_TIMEOUT_MS) {
+        finish(now, false);
+      }
+      return;
+    }
+  }
+}
+
+void NetworkUplink::finish(unsigned long now, bool ok) {
+  _stack.end();
+  _state = UPLINK_IDLE;
+  if (ok) {
+    _nextBurst = _burstStart + _interval;
+  } else {
+    _stats.failures++;
+    _nextBurst = now + RETRY_MS;
+  }
+}
+
+void NetworkUplink::account(unsigned long now) {
+  uint32_t day = now / DAY_MS;
+  if (day != _day) {
+    _radioYesterday = day == _day + 1 ? _radioToday : 0;
+    _radioToday = 0;
+    _burstsToday = 0;
+    _day = day;
+  }
+  if (_state != UPLINK_IDLE) {
+    _radioToday += now - _lastUpdate;
+  }
+  _lastUpdate = now;
+}
+
+void NetworkUplink::setState(UplinkState state, unsigned long now) {
+  _state = state;
+  _stateTime = now;
+}
@@ -0,0 +1,218 @@
+#include "PackedFont.h"
+#include "RasterKernels.h"
+#include <string.h>
+
+// Varints out of a glyph stream
+struct NibbleReader {
+  const uint8_t* data;
+  uint32_t next;        // Nibble index
+  uint32_t end;
+
+  // false at the end of the stream, including an unfinished varint
+  bool read(uint32_t& value) {
+    value = 0;
+    while (next < end) {
+      uint8_t nibble = (data[next / 2] >> (next % 2 ? 0 : 4)) & 0x0F;
+      next++;
+      value = (value << 3) | (nibble & 0x07);
+      if (!(nibble & 0x08)) {
+        return true;
+      }
+    }
+    return false;
+  }
+};
+
+// Varints into a glyph stream; with data == nullptr only counts nibbles
+struct NibbleWriter {
+  uint8_t* data;
+  uint32_t next;
+
+  void put(uint8_t nibble) {
+    if (data) {
+      if (next % 2) {
+        data[next / 2] |= nibble;
+      } else {
+        data[next / 2] = (uint8_t)(nibble << 4);
+      }
+    }
+    next++;
+  }
+
+  void write(uint32_t value) {
+    uint8_t groups = 1;
+    while (groups < 11 && (value >> (3 * groups))) {
+      groups++;
+    }
+    while (groups-- > 0) {
+      put((uint8_t)(((value >> (3 * groups)) & 0x07) | (groups ? 0x08 : 0)));
+    }
+  }
+};
+
+static inline bool bitAt(const uint8_t* bitmap, uint32_t bit) {
+  return bitmap[bit / 8] & (0x80 >> (bit % 8));
+}
+
+static bool rowsEqual(const uint8_t* bitmap, uint8_t width, uint16_t a, uint16_t b) {
+  for (uint16_t x = 0; x < width; x++) {
+    if (bitAt(bitmap, (uint32_t)a * width + x) != bitAt(bitmap, (uint32_t)b * width + x)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Last row of the group of identical rows starting at row
+static uint16_t groupEnd(const uint8_t* bitmap, uint8_t width, uint8_t height, uint16_t row) {
+  uint16_t last = row;
+  while (last + 1 < height && rowsEqual(bitmap, width, last + 1, row)) {
+    last++;
+  }
+  return last;
+}
+
+const PackedGlyph* packedFontGlyph(const PackedFont& font, uint16_t c) {
+  if (c < font.first || c > font.last) {
+    return nullptr;
+  }
+  return &font.glyph[c - font.first];
+}
+
+bool packedGlyphDecode(const PackedFont& font, const PackedGlyph& glyph, uint8_t* dst) {
+  uint16_t stride = (glyph.width + 7) / 8;
+  memset(dst, 0, (uint32_t)stride * glyph.height);
+  if (glyph.width == 0 || glyph.height == 0) {
+    return true;
+  }
+
+  // The stream ends where the next glyph's starts
+  uint32_t end = font.size;
+  if (&glyph < &font.glyph[font.last - font.first]) {
+    end = (&glyph)[1].offset;
+  }
+  if (glyph.offset > end || end > font.size) {
+    return false;
+  }
+
+  // Groups are read as the rows come; the runs start after them
+  NibbleReader groups = { font.data + glyph.offset, 0, (end - glyph.offset) * 2 };
+  uint32_t groupCount;
+  if (!groups.read(groupCount)) {
+    return false;
+  }
+  NibbleReader runs = groups;
+  for (uint32_t i = 0, skip; i < groupCount * 2; i++) {
+    if (!runs.read(skip)) {
+      return false;
+    }
+  }
+
+  uint32_t groupRow = UINT32_MAX;
+  uint32_t copies = 0;
+  if (groupCount > 0) {
+    groups.read(groupRow);
+    groups.read(copies);
+    copies++;
+  }
+
+  uint16_t row = 0;        // In the glyph
+  uint32_t packedRow = 0;  // Among the rows left after grouping
+  uint16_t x = 0;
+  bool ink = false;
+  bool first = true;
+  while (row < glyph.height) {
+    uint32_t run;
+    bool last = !runs.read(run);
+    if (last) {
+      run = UINT32_MAX;    // The last run fills the glyph
+    } else if (!first) {
+      run++;
+    }
+    first = false;
+
+    while (run > 0 && row < glyph.height) {
+      uint16_t span = run < (uint32_t)(glyph.width - x) ? (uint16_t)run : glyph.width - x;
+      if (ink) {
+        rasterFillSpan(dst + (uint32_t)row * stride, x, x + span, true);
+      }
+      x += span;
+      run -= span;
+      if (x < glyph.width) {
+        continue;
+      }
+
+      // Row done: repeat it if it starts a group
+      x = 0;
+      if (packedRow == groupRow) {
+        if (row + copies >= glyph.height) {
+          return false;
+        }
+        for (uint32_t i = 0; i < copies; i++) {
+          memcpy(dst + (uint32_t)(row + 1) * stride, dst + (uint32_t)row * stride, stride);
+          row++;
+        }
+        uint32_t delta;
+        if (--groupCount > 0 && groups.read(delta) && groups.read(copies)) {
+          groupRow += delta;
+          copies++;
+        } else {
+          groupRow = UINT32_MAX;
+        }
+      }
+      row++;
+      packedRow++;
+    }
+    if (run > 0 && !last) {
+      return false;        // Runs past the end of the glyph
+    }
+    ink = !ink;
+  }
+  return true;
+}
+
+uint32_t packedGlyphEncode(const uint8_t* bitmap, uint8_t width, uint8_t height, uint8_t* dst) {
+  if (width == 0 || height == 0) {
+    return 0;
+  }
+  NibbleWriter out = { dst, 0 };
+
+  // Groups of identical rows
+  uint32_t groupCount = 0;
+  for (uint16_t row = 0; row < height; row = groupEnd(bitmap, width, height, row) + 1) {
+    groupCount += groupEnd(bitmap, width, height, row) > row;
+  }
+  out.write(groupCount);
+  uint32_t packedRow = 0;
+  uint32_t lastGroup = 0;
+  for (uint16_t row = 0; row < height; packedRow++) {
+    uint16_t last = groupEnd(bitmap, width, height, row);
+    if (last > row) {
+      out.write(packedRow - lastGroup);
+      out.write(last - row - 1);
+      lastGroup = packedRow;
+    }
+    row = last + 1;
+  }
+
+  // Runs of the rows left, all but the last
+  bool ink = false;
+  bool first = true;
+  uint32_t run = 0;
+  for (uint16_t row = 0; row < height; row = groupEnd(bitmap, width, height, row) + 1) {
+    for (uint16_t x = 0; x < width; x++) {
+      if (bitAt(bitmap, (uint32_t)row * width + x) == ink) {
+        run++;
+        continue;
+      }
+      out.write(first ? run : run - 1);
+      first = false;
+      ink = !ink;
+      run = 1;
+    }
+  }
+  if (out.next % 2) {
+    out.put(0x08);
+  }
+  return out.next / 2;
+}
@@ -0,0 +1,318 @@
+#include "RasterKernels.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RASTER_X86 1
+#include <immintrin.h>
+#endif
+
+// Portable scalar kernels, 32 bits at a time
+
+static inline uint32_t load32(const uint8_t* p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static uint32_t countChangedScalar(const uint8_t* a, const uint8_t* b, uint32_t length) {
+  uint32_t changed = 0;
+  uint32_t i = 0;
+  for (; i + 4 <= length; i += 4) {
+    changed += __builtin_popcount(load32(a + i) ^ load32(b + i));
+  }
+  for (; i < length; i++) {
+    changed += __builtin_popcount(a[i] ^ b[i]);
+  }
+  return changed;
+}
+
+static void fillBytesScalar(uint8_t* dst, uint8_t value, uint32_t length) {
+  memset(dst, value, length);
+}
+
+// Mask for the valid bits of the last source byte of a row
+static inline uint8_t lastByteMask(uint16_t width) {
+  return (width & 7) ? (uint8_t)(0xFF << (8 - (width & 7))) : 0xFF;
+}
+
+static void blitRowScalar(uint8_t* dst, const uint8_t* bits, uint16_t width, uint8_t shift, bool white) {
+  uint16_t bytes = (width + 7) >> 3;
+  
+  for (uint16_t i = 0; i < bytes; i++) {
+    uint8_t src = bits[i];
+    
+    // Drop padding bits past the end of the source row
+    if (i == bytes - 1) {
+      src &= lastByteMask(width);
+    }
+    if (!src) {
+      continue;
+    }
+    
+    uint8_t hi = src >> shift;
+    uint8_t lo = shift ? (uint8_t)(src << (8 - shift)) : 0;
+    if (white) {
+      dst[i] |= hi;
+      if (lo) dst[i + 1] |= lo;
+    } else {
+      dst[i] &= ~hi;
+      if (lo) dst[i + 1] &= ~lo;
+    }
+  }
+}
+
+#ifdef RASTER_X86
+
+// The vector blits work per destination byte j, which takes the high bits
+// of source byte j and the low bits of source byte j-1. The first byte and
+// the ones next to the masked last source byte are done here.
+static void blitBytesScalar(uint8_t* dst, const uint8_t* bits, uint16_t width, uint8_t shift, bool white,
+                            uint16_t from, uint16_t to) {
+  uint16_t bytes = (width + 7) >> 3;
+  uint8_t mask = lastByteMask(width);
+  for (uint16_t j = from; j <= to; j++) {
+    uint8_t src = j < bytes ? bits[j] : 0;
+    uint8_t prev = j > 0 ? bits[j - 1] : 0;
+    if (j == bytes - 1) {
+      src &= mask;
+    } else if (j == bytes) {
+      prev &= mask;
+    }
+    uint8_t out = (src >> shift) | (shift ? (uint8_t)(prev << (8 - shift)) : 0);
+    if (out) {
+      dst[j] = white ? (dst[j] | out) : (dst[j] & ~out);
+    }
+  }
+}
+
+// SSE2 has no popcount instruction; count bits per byte, then sum the bytes
+static inline __m128i popcountBytesSse2(__m128i x) {
+  const __m128i m1 = _mm_set1_epi8(0x55);
+  const __m128i m2 = _mm_set1_epi8(0x33);
+  const __m128i m4 = _mm_set1_epi8(0x0F);
+  x = _mm_sub_epi8(x, _mm_and_si128(_mm_srli_epi16(x, 1), m1));
+  x = _mm_add_epi8(_mm_and_si128(x, m2), _mm_and_si128(_mm_srli_epi16(x, 2), m2));
+  x = _mm_and_si128(_mm_add_epi8(x, _mm_srli_epi16(x, 4)), m4);
+  return _mm_sad_epu8(x, _mm_setzero_si128());
+}
+
+static inline uint32_t sumLanesSse2(__m128i acc) {
+  return (uint32_t)(_mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc, 8)));
+}
+
+__attribute__((target("sse2")))
+static uint32_t countChangedSse2(const uint8_t* a, const uint8_t* b, uint32_t length) {
+  __m128i acc = _mm_setzero_si128();
+  uint32_t i = 0;
+  for (; i + 16 <= length; i += 16) {
+    __m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(a + i)),
+                              _mm_loadu_si128((const __m128i*)(b + i)));
+    acc = _mm_add_epi64(acc, popcountBytesSse2(x));
+  }
+  return sumLanesSse2(acc) + countChangedScalar(a + i, b + i, length - i);
+}
+
+// Whole vectors, then one last vector overlapping the ones before it
+__attribute__((target("sse2")))
+static void fillBytesSse2(uint8_t* dst, uint8_t value, uint32_t length) {
+  if (length < 16) {
+    fillBytesScalar(dst, value, length);
+    return;
+  }
+  const __m128i v = _mm_set1_epi8((char)value);
+  for (uint32_t i = 0; i + 16 <= length; i += 16) {
+    _mm_storeu_si128((__m128i*)(dst + i), v);
+  }
+  _mm_storeu_si128((__m128i*)(dst + length - 16), v);
+}
+
+__attribute__((target("sse2")))
+static void blitRowSse2(uint8_t* dst, const uint8_t* bits, uint16_t width, uint8_t shift, bool white) {
+  uint16_t bytes = (width + 7) >> 3;
+  
+  // A 16-bit shift plus a mask is a per-byte shift
+  const __m128i right = _mm_cvtsi32_si128(shift);
+  const __m128i left = _mm_cvtsi32_si128(8 - shift);
+  const __m128i hiMask = _mm_set1_epi8((char)(0xFF >> shift));
+  const __m128i loMask = _mm_set1_epi8((char)(uint8_t)(0xFF << (8 - shift)));
+  
+  blitBytesScalar(dst, bits, width, shift, white, 0, 0);
+  uint16_t j = 1;
+  for (; j + 16 < bytes; j += 16) {
+    __m128i src = _mm_loadu_si128((const __m128i*)(bits + j));
+    __m128i prev = _mm_loadu_si128((const __m128i*)(bits + j - 1));
+    __m128i out = _mm_or_si128(_mm_and_si128(_mm_srl_epi16(src, right), hiMask),
+                               _mm_and_si128(_mm_sll_epi16(prev, left), loMask));
+    __m128i d = _mm_loadu_si128((const __m128i*)(dst + j));
+    _mm_storeu_si128((__m128i*)(dst + j), white ? _mm_or_si128(d, out) : _mm_andnot_si128(out, d));
+  }
+  blitBytesScalar(dst, bits, width, shift, white, j, bytes);
+}
+
+// AVX2 popcount via a 4-bit lookup table (pshufb), summed with vpsadbw
+__attribute__((target("avx2")))
+static inline __m256i popcountBytesAvx2(__m256i x) {
+  const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                          0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low = _mm256_set1_epi8(0x0F);
+  __m256i lo = _mm256_shuffle_epi8(lookup, _mm256_and_si256(x, low));
+  __m256i hi = _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(x, 4), low));
+  return _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256());
+}
+
+__attribute__((target("avx2")))
+static inline uint32_t sumLanesAvx2(__m256i acc) {
+  __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+  return (uint32_t)(_mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_srli_si128(sum, 8)));
+}
+
+__attribute__((target("avx2")))
+static uint32_t countChangedAvx2(const uint8_t* a, const uint8_t* b, uint32_t length) {
+  __m256i acc = _mm256_setzero_si256();
+  uint32_t i = 0;
+  for (; i + 32 <= length; i += 32) {
+    __m256i x = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(a + i)),
+                                 _mm256_loadu_si256((const __m256i*)(b + i)));
+    acc = _mm256_add_epi64(acc, popcountBytesAvx2(x));
+  }
+  return sumLanesAvx2(acc) + countChangedSse2(a + i, b + i, length - i);
+}
+
+__attribute__((target("avx2")))
+static void fillBytesAvx2(uint8_t* dst, uint8_t value, uint32_t length) {
+  if (length < 32) {
+    fillBytesSse2(dst, value, length);
+    return;
+  }
+  const __m256i v = _mm256_set1_epi8((char)value);
+  for (uint32_t i = 0; i + 32 <= length; i += 32) {
+    _mm256_storeu_si256((__m256i*)(dst + i), v);
+  }
+  _mm256_storeu_si256((__m256i*)(dst + length - 32), v);
+}
+
+__attribute__((target("avx2")))
+static void blitRowAvx2(uint8_t* dst, const uint8_t* bits, uint16_t width, uint8_t shift, bool white) {
+  uint16_t bytes = (width + 7) >> 3;
+  
+  const __m128i right = _mm_cvtsi32_si128(shift);
+  const __m128i left = _mm_cvtsi32_si128(8 - shift);
+  const __m256i hiMask = _mm256_set1_epi8((char)(0xFF >> shift));
+  const __m256i loMask = _mm256_set1_epi8((char)(uint8_t)(0xFF << (8 - shift)));
+  
+  blitBytesScalar(dst, bits, width, shift, white, 0, 0);
+  uint16_t j = 1;
+  for (; j + 32 < bytes; j += 32) {
+    __m256i src = _mm256_loadu_si256((const __m256i*)(bits + j));
+    __m256i prev = _mm256_loadu_si256((const __m256i*)(bits + j - 1));
+    __m256i out = _mm256_or_si256(_mm256_and_si256(_mm256_srl_epi16(src, right), hiMask),
+                                  _mm256_and_si256(_mm256_sll_epi16(prev, left), loMask));
+    __m256i d = _mm256_loadu_si256((const __m256i*)(dst + j));
+    _mm256_storeu_si256((__m256i*)(dst + j), white ? _mm256_or_si256(d, out) : _mm256_andnot_si256(out, d));
+  }
+  blitBytesScalar(dst, bits, width, shift, white, j, bytes);
+}
+
+#endif // RASTER_X86
+
+// Runtime selection
+
+struct RasterOps {
+  void (*fillBytes)(uint8_t*, uint8_t, uint32_t);
+  void (*blitRow)(uint8_t*, const uint8_t*, uint16_t, uint8_t, bool);
+  uint32_t (*countChanged)(const uint8_t*, const uint8_t*, uint32_t);
+  const char* name;
+};
+
+// Fastest first
+static const RasterOps RASTER_VARIANTS[] = {
+#ifdef RASTER_X86
+  { fillBytesAvx2, blitRowAvx2, countChangedAvx2, "avx2" },
+  { fillBytesSse2, blitRowSse2, countChangedSse2, "sse2" },
+#endif
+  { fillBytesScalar, blitRowScalar, countChangedScalar, "scalar" },
+};
+
+static const uint8_t RASTER_VARIANT_COUNT = sizeof(RASTER_VARIANTS) / sizeof(RASTER_VARIANTS[0]);
+
+static bool cpuSupports(const RasterOps& ops) {
+#ifdef RASTER_X86
+  __builtin_cpu_init();
+  if (!strcmp(ops.name, "avx2")) {
+    return __builtin_cpu_supports("avx2");
+  }
+  if (!strcmp(ops.name, "sse2")) {
+    return __builtin_cpu_supports("sse2");
+  }
+#endif
+  (void)ops;
+  return true;
+}
+
+static const RasterOps* selectRasterOps() {
+  for (uint8_t i = 0; i < RASTER_VARIANT_COUNT; i++) {
+    if (cpuSupports(RASTER_VARIANTS[i])) {
+      return &RASTER_VARIANTS[i];
+    }
+  }
+  return &RASTER_VARIANTS[RASTER_VARIANT_COUNT - 1];
+}
+
+static const RasterOps*& rasterOpsSlot() {
+  static const RasterOps* ops = selectRasterOps();
+  return ops;
+}
+
+static const RasterOps& rasterOps() {
+  return *rasterOpsSlot();
+}
+
+// Public entry points
+
+void rasterFillSpan(uint8_t* row, int16_t x0, int16_t x1, bool white) {
+  if (x1 <= x0) {
+    return;
+  }
+  
+  int16_t firstByte = x0 >> 3;
+  int16_t lastByte = (x1 - 1) >> 3;
+  uint8_t firstMask = 0xFF >> (x0 & 7);
+  uint8_t lastMask = 0xFF << (7 - ((x1 - 1) & 7));
+  
+  if (firstByte == lastByte) {
+    uint8_t mask = firstMask & lastMask;
+    row[firstByte] = white ? (row[firstByte] | mask) : (row[firstByte] & ~mask);
+    return;
+  }
+  
+  row[firstByte] = white ? (row[firstByte] | firstMask) : (row[firstByte] & ~firstMask);
+  if (lastByte - firstByte > 1) {
+    rasterOps().fillBytes(row + firstByte + 1, white ? 0xFF : 0x00, lastByte - firstByte - 1);
+  }
+  row[lastByte] = white ? (row[lastByte] | lastMask) : (row[lastByte] & ~lastMask);
+}
+
+void rasterBlitRow(uint8_t* row, int16_t x, const uint8_t* bits, uint16_t width, bool white) {
+  if (!width) {
+    return;
+  }
+  rasterOps().blitRow(row + (x >> 3), bits, width, x & 7, white);
+}
+
+uint32_t rasterCountChanged(const uint8_t* a, const uint8_t* b, uint32_t length) {
+  return rasterOps().countChanged(a, b, length);
+}
+
+const char* rasterKernelName() {
+  return rasterOps().name;
+}
+
+bool rasterUseKernel(const char* name) {
+  for (uint8_t i = 0; i < RASTER_VARIANT_COUNT; i++) {
+    if (!strcmp(RASTER_VARIANTS[i].name, name) && cpuSupports(RASTER_VARIANTS[i])) {
+      rasterOpsSlot() = &RASTER_VARIANTS[i];
+      return true;
+    }
+  }
+  return false;
+}
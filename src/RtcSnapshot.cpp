@@ -0,0 +1,150 @@
+#include "RtcSnapshot.h"
+#include <string.h>
+
+#ifdef ARDUINO_ARCH_ESP32
+#include <esp_attr.h>
+#include <esp_system.h>
+#else
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const uint32_t SNAPSHOT_MAGIC = 0x52544353;  // "SCTR"
+
+struct Snapshot {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t size;
+  uint32_t crc;       // Over version, size and data; written last
+  uint8_t data[RTC_SNAPSHOT_CAPACITY];
+};
+
+#ifdef ARDUINO_ARCH_ESP32
+static RTC_NOINIT_ATTR Snapshot rtcSnapshot;
+
+static Snapshot& rtcMemory() {
+  return rtcSnapshot;
+}
+#else
+// Off the device an image file stands in for RTC memory, like the flash
+// partitions' files: a new process that finds it is a warm reset, one that
+// doesn't is a power-on
+static const char* HOST_IMAGE_NAME = "rtc";
+static bool hostWarm = false;
+
+static Snapshot& rtcMemory() {
+  static Snapshot* mapped = nullptr;
+  static Snapshot fallback;
+  if (!mapped) {
+    struct stat st;
+    hostWarm = stat(HOST_IMAGE_NAME, &st) == 0 && (size_t)st.st_size >= sizeof(Snapshot);
+    int fd = open(HOST_IMAGE_NAME, O_RDWR | O_CREAT, 0644);
+    if (fd >= 0 && ftruncate(fd, sizeof(Snapshot)) == 0) {
+      void* memory = mmap(nullptr, sizeof(Snapshot), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if (memory != MAP_FAILED) {
+        mapped = (Snapshot*)memory;
+      }
+    }
+    if (fd >= 0) {
+      close(fd);
+    }
+    if (!mapped) {
+      perror("RtcSnapshot: rtc image");
+      hostWarm = false;
+      mapped = &fallback;
+    }
+  }
+  return *mapped;
+}
+#endif
+
+static uint32_t crc32(uint32_t crc, const void* data, size_t size) {
+  const uint8_t* p = (const uint8_t*)data;
+  crc = ~crc;
+  while (size--) {
+    crc ^= *p++;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+  }
+  return ~crc;
+}
+
+static uint32_t snapshotCrc(const Snapshot& snapshot) {
+  uint32_t crc = crc32(0, &snapshot.version, sizeof(snapshot.version));
+  crc = crc32(crc, &snapshot.size, sizeof(snapshot.size));
+  return crc32(crc, snapshot.data, snapshot.size);
+}
+
+bool rtcSnapshotSave(const void* state, size_t size, uint32_t version) {
+  if (size > RTC_SNAPSHOT_CAPACITY) {
+    return false;
+  }
+
+  // A reset halfway through leaves a CRC mismatch, never a mixed state
+  Snapshot& snapshot = rtcMemory();
+  snapshot.magic = SNAPSHOT_MAGIC;
+  snapshot.version = version;
+  snapshot.size = size;
+  memcpy(snapshot.data, state, size);
+  snapshot.crc = snapshotCrc(snapshot);
+  return true;
+}
+
+bool rtcSnapshotRestore(void* state, size_t size, uint32_t version) {
+  const Snapshot& snapshot = rtcMemory();
+  if (snapshot.magic != SNAPSHOT_MAGIC || snapshot.version != version || snapshot.size != size) {
+    return false;
+  }
+  if (snapshot.crc != snapshotCrc(snapshot)) {
+    return false;
+  }
+  memcpy(state, snapshot.data, size);
+  return true;
+}
+
+void rtcSnapshotInvalidate() {
+  rtcMemory().magic = 0;
+}
+
+bool isWarmReset() {
+#ifdef ARDUINO_ARCH_ESP32
+  switch (esp_reset_reason()) {
+    case ESP_RST_SW:
+    case ESP_RST_PANIC:
+    case ESP_RST_INT_WDT:
+    case ESP_RST_TASK_WDT:
+    case ESP_RST_WDT:
+      return true;
+    default:
+      return false;
+  }
+#else
+  rtcMemory();
+  return hostWarm;
+#endif
+}
+
+const char* resetReasonName() {
+#ifdef ARDUINO_ARCH_ESP32
+  switch (esp_reset_reason()) {
+    case ESP_RST_POWERON:   return "power on";
+    case ESP_RST_EXT:       return "external pin";
+    case ESP_RST_SW:        return "software";
+    case ESP_RST_PANIC:     return "panic";
+    case ESP_RST_INT_WDT:   return "interrupt watchdog";
+    case ESP_RST_TASK_WDT:  return "task watchdog";
+    case ESP_RST_WDT:       return "watchdog";
+    case ESP_RST_DEEPSLEEP: return "deep sleep";
+    case ESP_RST_BROWNOUT:  return "brownout";
+    case ESP_RST_SDIO:      return "SDIO";
+    default:                return "unknown";
+  }
+#else
+  rtcMemory();
+  return hostWarm ? "software" : "power on";
+#endif
+}
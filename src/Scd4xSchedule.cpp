@@ -0,0 +1,139 @@
+#include "Scd4xSchedule.h"
+
+static inline bool reached(unsigned long now, unsigned long time) {
+  return (long)(now - time) >= 0;
+}
+
+Scd4xSchedule::Scd4xSchedule()
+  : _singleShot(false),
+    _co2Interval(0),
+    _rhtInterval(0),
+    _dueAt(0),
+    _lastCo2(0),
+    _lastRht(0),
+    _sent(0),
+    _pending(PENDING_NONE) {
+}
+
+void Scd4xSchedule::setPeriodic() {
+  _singleShot = false;
+}
+
+void Scd4xSchedule::setSingleShot(uint32_t co2IntervalMs, uint32_t rhtIntervalMs) {
+  _singleShot = true;
+  setIntervals(co2IntervalMs, rhtIntervalMs);
+}
+
+void Scd4xSchedule::setIntervals(uint32_t co2IntervalMs, uint32_t rhtIntervalMs) {
+  _co2Interval = co2IntervalMs * 1000;
+  _rhtInterval = rhtIntervalMs * 1000;
+
+  // Shorter intervals can bring the next shot forward; with a command in
+  // flight or a read pending the due time is worked out when it's done
+  if (_singleShot && _sent == 0 && _pending == PENDING_NONE) {
+    unsigned long co2Due = _lastCo2 + _co2Interval;
+    unsigned long rhtDue = _lastRht + _rhtInterval;
+    if (reached(_dueAt, co2Due)) {
+      _dueAt = co2Due;
+    }
+    if (_rhtInterval > 0 && reached(_dueAt, rhtDue)) {
+      _dueAt = rhtDue;
+    }
+  }
+}
+
+bool Scd4xSchedule::isSingleShot() const {
+  return _singleShot;
+}
+
+void Scd4xSchedule::restart(unsigned long now) {
+  _pending = PENDING_NONE;
+  _sent = 0;
+  _dueAt = now;
+  _lastCo2 = now - _co2Interval;
+  _lastRht = _lastCo2;
+}
+
+unsigned long Scd4xSchedule::getDueTime() const {
+  return _dueAt;
+}
+
+bool Scd4xSchedule::next(unsigned long now, Scd4xStep& step) {
+  step.rxWords = 0;
+  step.execMicros = COMMAND_US;
+
+  if (_pending != PENDING_NONE) {
+    step.code = SCD4X_READ_MEASUREMENT;
+    step.rxWords = 3;
+  } else if (!_singleShot) {
+    step.code = SCD4X_GET_DATA_READY;
+    step.rxWords = 1;
+  } else if (reached(now, _lastCo2 + _co2Interval)) {
+    step.code = SCD4X_MEASURE_SINGLE_SHOT;
+    step.execMicros = SINGLE_SHOT_US;
+    _lastCo2 = now;
+    _lastRht = now;
+    _pending = PENDING_CO2;
+  } else if (_rhtInterval > 0 && reached(now, _lastRht + _rhtInterval) && rhtFits(now)) {
+    step.code = SCD4X_MEASURE_SINGLE_SHOT_RHT_ONLY;
+    step.execMicros = RHT_ONLY_US;
+    _lastRht = now;
+    _pending = PENDING_RHT;
+  } else {
+    _dueAt = nextShot(now);
+    return false;
+  }
+
+  _sent = step.code;
+  return true;
+}
+
+Scd4xEvent Scd4xSchedule::complete(const uint16_t* words, unsigned long now) {
+  uint16_t sent = _sent;
+  _sent = 0;
+
+  switch (sent) {
+    case SCD4X_GET_DATA_READY:
+      // Any of the low 11 bits set means a measurement is waiting
+      if (words[0] & 0x07FF) {
+        _pending = PENDING_CO2;
+        _dueAt = now;
+        return SCD4X_MEASUREMENT_READY;
+      }
+      _dueAt = now + CHECK_INTERVAL_US;
+      return SCD4X_NOTHING;
+
+    case SCD4X_MEASURE_SINGLE_SHOT:
+    case SCD4X_MEASURE_SINGLE_SHOT_RHT_ONLY:
+      // The execution time has passed, the result can be read
+      _dueAt = now;
+      return SCD4X_MEASUREMENT_READY;
+
+    case SCD4X_READ_MEASUREMENT: {
+      Pending pending = _pending;
+      _pending = PENDING_NONE;
+      _dueAt = _singleShot ? nextShot(now) : now + CHECK_INTERVAL_US;
+      return pending == PENDING_RHT ? SCD4X_RHT_READING : SCD4X_CO2_READING;
+    }
+  }
+  return SCD4X_NOTHING;
+}
+
+unsigned long Scd4xSchedule::nextShot(unsigned long now) const {
+  unsigned long co2Due = _lastCo2 + _co2Interval;
+  if (_rhtInterval == 0) {
+    return co2Due;
+  }
+
+  // An RHT shot that is due but too close to the CO2 shot waits for it
+  unsigned long rhtDue = _lastRht + _rhtInterval;
+  if (reached(now, rhtDue)) {
+    return rhtFits(now) ? now : co2Due;
+  }
+  return reached(rhtDue, co2Due) ? co2Due : rhtDue;
+}
+
+bool Scd4xSchedule::rhtFits(unsigned long now) const {
+  // The shot and its read have to be done before the next CO2 shot
+  return _lastCo2 + _co2Interval - now >= RHT_ONLY_US + COMMAND_US;
+}
@@ -0,0 +1,122 @@
+#include "SensorPipeline.h"
+
+bool ValidateStage::process(PipelineSample& sample) {
+  // SCD4x specified output ranges
+  if (sample.data.co2 == 0 || sample.data.co2 > 40000) {
+    Serial.println("Pipeline: Dropping reading with invalid CO2 value");
+    return false;
+  }
+  if (sample.data.temperature < -10.0f || sample.data.temperature > 60.0f ||
+      sample.data.humidity < 0.0f || sample.data.humidity > 100.0f) {
+    Serial.println("Pipeline: Dropping reading with invalid temperature/humidity");
+    return false;
+  }
+  return true;
+}
+
+FilterStage::FilterStage(float weight)
+  : _weight(weight),
+    _primed(false),
+    _temperature(0),
+    _humidity(0) {
+}
+
+bool FilterStage::process(PipelineSample& sample) {
+  if (!_primed) {
+    _temperature = sample.data.temperature;
+    _humidity = sample.data.humidity;
+    _primed = true;
+  } else {
+    _temperature += _weight * (sample.data.temperature - _temperature);
+    _humidity += _weight * (sample.data.humidity - _humidity);
+  }
+  
+  sample.data.temperature = _temperature;
+  sample.data.humidity = _humidity;
+  return true;
+}
+
+AggregateStage::AggregateStage(unsigned long windowMs)
+  : _windowMs(windowMs),
+    _windowStart(0),
+    _co2Sum(0),
+    _temperatureSum(0),
+    _humiditySum(0),
+    _count(0) {
+}
+
+bool AggregateStage::process(PipelineSample& sample) {
+  // The readings from before the sensor settled stay out of the averages;
+  // the level they settled at is the first entry, closed right away
+  if (sample.settledCo2) {
+    sample.average = sample.data;
+    sample.average.co2 = sample.settledCo2;
+    sample.windowClosed = true;
+    
+    _windowStart = sample.time;
+    _co2Sum = 0;
+    _temperatureSum = 0;
+    _humiditySum = 0;
+    _count = 0;
+    return true;
+  }
+  
+  _co2Sum += sample.data.co2;
+  _temperatureSum += sample.data.temperature;
+  _humiditySum += sample.data.humidity;
+  _count++;
+  
+  if (sample.time - _windowStart >= _windowMs) {
+    sample.average = sample.data;
+    sample.average.co2 = (_co2Sum + _count / 2) / _count;
+    sample.average.temperature = _temperatureSum / _count;
+    sample.average.humidity = _humiditySum / _count;
+    sample.windowClosed = true;
+    
+    _windowStart = sample.time;
+    _co2Sum = 0;
+    _temperatureSum = 0;
+    _humiditySum = 0;
+    _count = 0;
+  }
+  return true;
+}
+
+void AggregateStage::setWindow(unsigned long windowMs) {
+  _windowMs = windowMs;
+}
+
+StatsStage::StatsStage()
+  : _minCO2(0xFFFF),
+    _maxCO2(0),
+    _co2Sum(0),
+    _count(0) {
+}
+
+bool StatsStage::process(PipelineSample& sample) {
+  if (sample.data.co2 < _minCO2) {
+    _minCO2 = sample.data.co2;
+  }
+  if (sample.data.co2 > _maxCO2) {
+    _maxCO2 = sample.data.co2;
+  }
+  _co2Sum += sample.data.co2;
+  _count++;
+  return true;
+}
+
+uint16_t StatsStage::getMinCO2() const {
+  return _count ? _minCO2 : 0;
+}
+
+uint16_t StatsStage::getMaxCO2() const {
+  return _maxCO2;
+}
+
+uint16_t StatsStage::getAverageCO2() const {
+  return _count ? _co2Sum / _count : 0;
+}
+
+uint32_t StatsStage::getSampleCount() const {
+  return _count;
+}
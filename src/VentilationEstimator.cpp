@@ -0,0 +1,194 @@
+#include "VentilationEstimator.h"
+#include <math.h>
+#include <string.h>
+
+// What a decay needs before it gives an estimate: enough readings, a fall
+// of at least a fifth of the excess (ln 1.25) in the readings and in the
+// fit, a good exponential fit and an error small enough to show
+static const uint16_t MIN_POINTS = 6;
+static const double MIN_LOG_DROP = 0.223;
+static const double MIN_R2 = 0.9;
+static const double MAX_ERROR = 0.3;
+
+static const double MS_PER_HOUR = 3600000.0;
+
+VentilationEstimator::VentilationEstimator(uint16_t outdoorCo2)
+  : _outdoor(outdoorCo2),
+    _active(false),
+    _confirmed(false),
+    _below(false),
+    _spike(false),
+    _first(0),
+    _lowest(0),
+    _sum(0),
+    _previous(0),
+    _previousTime(0),
+    _startTime(0),
+    _lastTime(0) {
+  memset(&_fit, 0, sizeof(_fit));
+  memset(&_estimate, 0, sizeof(_estimate));
+}
+
+bool VentilationEstimator::addSample(uint16_t co2, unsigned long now) {
+  bool ended = false;
+  if (_active && now - _lastTime > MAX_GAP_MS) {
+    ended = finish();
+  }
+
+  if (!_active) {
+    if (co2 >= _outdoor + MIN_START_EXCESS) {
+      start(co2, now);
+    }
+    return ended;
+  }
+
+  // Near outdoor air the log of the excess is mostly noise
+  if (co2 < _outdoor + MIN_EXCESS) {
+    return finish() || ended;
+  }
+
+  if (!_confirmed) {
+    // Still at the top: move the start to the highest reading, and give up
+    // on a level that does not fall
+    if (co2 >= _first || now - _startTime > CONFIRM_MS) {
+      _active = false;
+      if (co2 >= _outdoor + MIN_START_EXCESS) {
+        start(co2, now);
+      }
+      return ended;
+    }
+    // Two readings in a row clearly below the average so far, so a noise
+    // dip on a level stretch does not count
+    uint16_t mean = _sum / _fit.points;
+    bool below = co2 + START_DROP + (mean - _outdoor) * 3 / 100 <= mean;
+    if (below && _below) {
+      // The level before the fall would flatten the fit; it starts with
+      // the first reading below
+      start(_previous, _previousTime);
+      _confirmed = true;
+    }
+    add(co2, now);
+    _below = below;
+    _previous = co2;
+    _previousTime = now;
+    return ended;
+  }
+
+  // Two readings in a row above the lowest by more than the sensor's noise
+  // mean a source is back; start over from there, it may be the top of the
+  // next decay. A single one is a spike and left out of the fit.
+  uint16_t tolerance = 40 + (_lowest - _outdoor) / 20;
+  if (co2 > _lowest + tolerance) {
+    if (!_spike) {
+      _spike = true;
+      return ended;
+    }
+    ended = finish() || ended;
+    if (co2 >= _outdoor + MIN_START_EXCESS) {
+      start(co2, now);
+    }
+    return ended;
+  }
+  _spike = false;
+
+  add(co2, now);
+  VentilationEstimate estimate;
+  if (evaluate(estimate)) {
+    _estimate = estimate;
+  }
+  return ended;
+}
+
+void VentilationEstimator::resetClock() {
+  finish();
+}
+
+const VentilationEstimate& VentilationEstimator::getEstimate() const {
+  return _estimate;
+}
+
+bool VentilationEstimator::isInDecay() const {
+  return _active && _confirmed;
+}
+
+void VentilationEstimator::start(uint16_t co2, unsigned long now) {
+  _active = true;
+  _confirmed = false;
+  _below = false;
+  _spike = false;
+  _first = co2;
+  _lowest = co2;
+  _startTime = now;
+  memset(&_fit, 0, sizeof(_fit));
+  _sum = 0;
+  add(co2, now);
+}
+
+void VentilationEstimator::add(uint16_t co2, unsigned long now) {
+  double excess = (double)co2 - _outdoor;
+  double t = (now - _startTime) / MS_PER_HOUR;
+  double y = log(excess);
+  double ratio = excess / ((double)_first - _outdoor);
+  double w = ratio * ratio;
+
+  _fit.w += w;
+  _fit.wt += w * t;
+  _fit.wy += w * y;
+  _fit.wtt += w * t * t;
+  _fit.wty += w * t * y;
+  _fit.wyy += w * y * y;
+  _fit.ww += w * w;
+  _fit.points++;
+  _sum += co2;
+
+  if (co2 < _lowest) {
+    _lowest = co2;
+  }
+  _lastTime = now;
+}
+
+bool VentilationEstimator::finish() {
+  bool published = false;
+  if (_active && _confirmed) {
+    VentilationEstimate estimate;
+    published = evaluate(estimate);
+    if (published) {
+      _estimate = estimate;
+    }
+  }
+  _active = false;
+  _confirmed = false;
+  _spike = false;
+  return published;
+}
+
+bool VentilationEstimator::evaluate(VentilationEstimate& estimate) const {
+  if (_fit.points < MIN_POINTS || _lowest <= _outdoor ||
+      log(((double)_first - _outdoor) / ((double)_lowest - _outdoor)) < MIN_LOG_DROP) {
+    return false;
+  }
+
+  double stt = _fit.w * _fit.wtt - _fit.wt * _fit.wt;
+  double sty = _fit.w * _fit.wty - _fit.wt * _fit.wy;
+  double syy = _fit.w * _fit.wyy - _fit.wy * _fit.wy;
+  if (stt <= 0 || syy <= 0 || sty >= 0) {
+    return false;
+  }
+
+  double ach = -sty / stt;
+  double r2 = sty * sty / (stt * syy);
+  double effective = _fit.w * _fit.w / _fit.ww;
+  double error = effective > 2 ? sqrt((1.0 / r2 - 1.0) / (effective - 2)) : MAX_ERROR * 2;
+  double hours = (_lastTime - _startTime) / MS_PER_HOUR;
+  if (r2 < MIN_R2 || error > MAX_ERROR || ach * hours < MIN_LOG_DROP) {
+    return false;
+  }
+
+  estimate.ach = (float)ach;
+  estimate.r2 = (float)r2;
+  estimate.error = (float)error;
+  estimate.points = _fit.points;
+  estimate.duration = (_lastTime - _startTime) / 1000;
+  estimate.valid = true;
+  return true;
+}
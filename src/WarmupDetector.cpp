@@ -0,0 +1,135 @@
+#include "WarmupDetector.h"
+
+WarmupDetector::WarmupDetector(uint16_t tolerancePpm, uint8_t tolerancePercent, uint32_t maxWarmupMs)
+  : _tolerancePpm(tolerancePpm),
+    _tolerancePercent(tolerancePercent),
+    _maxWarmup(maxWarmupMs),
+    _interval(BASE_INTERVAL_MS),
+    _window(WINDOW),
+    _startTime(0),
+    _warmupTime(0),
+    _ready(false),
+    _timedOut(false),
+    _settled(0),
+    _count(0),
+    _next(0) {
+}
+
+void WarmupDetector::restart(unsigned long now) {
+  _startTime = now;
+  _warmupTime = 0;
+  _ready = false;
+  _timedOut = false;
+  _settled = 0;
+  _count = 0;
+  _next = 0;
+}
+
+bool WarmupDetector::addReading(uint16_t co2, unsigned long now) {
+  if (_ready) {
+    return false;
+  }
+
+  _co2[_next] = co2;
+  _time[_next] = now;
+  _next = (_next + 1) % _window;
+  if (_count < _window) {
+    _count++;
+  }
+
+  if (!settled()) {
+    _timedOut = now - _startTime >= getMaxWarmup();
+    if (!_timedOut) {
+      return false;
+    }
+    _settled = co2;
+  }
+  _ready = true;
+  _warmupTime = now - _startTime;
+  return true;
+}
+
+bool WarmupDetector::isReady() const {
+  return _ready;
+}
+
+bool WarmupDetector::isTimedOut() const {
+  return _timedOut;
+}
+
+unsigned long WarmupDetector::getWarmupTime() const {
+  return _warmupTime;
+}
+
+uint16_t WarmupDetector::getSettledCo2() const {
+  return _settled;
+}
+
+void WarmupDetector::setReady() {
+  _ready = true;
+  _timedOut = false;
+}
+
+void WarmupDetector::setInterval(unsigned long intervalMs) {
+  if (intervalMs == 0 || intervalMs == _interval) {
+    return;
+  }
+  _interval = intervalMs;
+
+  uint32_t window = WINDOW * BASE_INTERVAL_MS / intervalMs;
+  _window = (uint8_t)(window < MIN_WINDOW ? MIN_WINDOW : window > WINDOW ? WINDOW : window);
+  _count = 0;
+  _next = 0;
+}
+
+uint8_t WarmupDetector::getWindow() const {
+  return _window;
+}
+
+unsigned long WarmupDetector::getMaxWarmup() const {
+  // As many windows as fit into maxWarmupMs at BASE_INTERVAL_MS
+  uint64_t span = (uint64_t)_window * _interval;
+  uint64_t baseSpan = (uint64_t)WINDOW * BASE_INTERVAL_MS;
+  return span <= baseSpan ? _maxWarmup : (unsigned long)(_maxWarmup * span / baseSpan);
+}
+
+bool WarmupDetector::settled() {
+  if (_count < _window) {
+    return false;
+  }
+
+  // Least squares line through the window, times in seconds from the
+  // oldest reading
+  unsigned long first = _time[_next];
+  float st = 0, sc = 0, stt = 0, stc = 0;
+  for (uint8_t i = 0; i < _window; i++) {
+    float t = (_time[i] - first) / 1000.0f;
+    st += t;
+    sc += _co2[i];
+    stt += t * t;
+    stc += t * _co2[i];
+  }
+  float d = _window * stt - st * st;
+  if (d <= 0) {
+    return false;
+  }
+  float slope = (_window * stc - st * sc) / d;
+  float mean = sc / _window;
+  float tolerance = _tolerancePpm + mean * _tolerancePercent / 100.0f;
+
+  if ((slope < 0 ? -slope : slope) * (HORIZON_MS / 1000.0f) > tolerance) {
+    return false;
+  }
+
+  float intercept = (sc - slope * st) / _window;
+  for (uint8_t i = 0; i < _window; i++) {
+    float residual = _co2[i] - (intercept + slope * (_time[i] - first) / 1000.0f);
+    if ((residual < 0 ? -residual : residual) > tolerance) {
+      return false;
+    }
+  }
+
+  uint8_t newest = (_next + _window - 1) % _window;
+  _settled = (uint16_t)(intercept + slope * (_time[newest] - first) / 1000.0f + 0.5f);
+  return true;
+}
@@ -0,0 +1,87 @@
+#include "WiFiStack.h"
+#include <string.h>
+
+// Longest a connect() call may block the loop; NetworkUplink keeps calling
+// it until its own timeout
+static const int CONNECT_ATTEMPT_MS = 1000;
+
+WiFiStack::WiFiStack(const char* ssid, const char* password, const char* host, uint16_t port)
+  : _ssid(ssid),
+    _password(password),
+    _host(host),
+    _port(port) {
+}
+
+void WiFiStack::begin(const UplinkCache* cache) {
+#ifdef ARDUINO_ARCH_ESP32
+  // Nothing goes to NVS: the cache lives in RAM and the credentials are
+  // compiled in, so every join would otherwise be a flash write
+  WiFi.persistent(false);
+  WiFi.mode(WIFI_STA);
+
+  if (cache) {
+    // Skip the scan and DHCP; a join takes a few hundred ms instead of seconds
+    WiFi.config(IPAddress(cache->ip), IPAddress(cache->gateway), IPAddress(cache->subnet), IPAddress(cache->dns));
+    WiFi.begin(_ssid, _password, cache->channel, cache->bssid);
+  } else {
+    WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE);
+    WiFi.begin(_ssid, _password);
+  }
+#else
+  (void)cache;
+#endif
+}
+
+bool WiFiStack::isJoined() {
+#ifdef ARDUINO_ARCH_ESP32
+  return WiFi.status() == WL_CONNECTED;
+#else
+  return false;
+#endif
+}
+
+bool WiFiStack::getCache(UplinkCache& cache) {
+#ifdef ARDUINO_ARCH_ESP32
+  const uint8_t* bssid = WiFi.BSSID();
+  if (!bssid) {
+    return false;
+  }
+  memcpy(cache.bssid, bssid, sizeof(cache.bssid));
+  cache.channel = WiFi.channel();
+  cache.ip = WiFi.localIP();
+  cache.gateway = WiFi.gatewayIP();
+  cache.subnet = WiFi.subnetMask();
+  cache.dns = WiFi.dnsIP();
+  cache.valid = true;
+  return true;
+#else
+  (void)cache;
+  return false;
+#endif
+}
+
+bool WiFiStack::connect() {
+#ifdef ARDUINO_ARCH_ESP32
+  return _client.connected() || _client.connect(_host, _port, CONNECT_ATTEMPT_MS);
+#else
+  return false;
+#endif
+}
+
+size_t WiFiStack::write(const uint8_t* data, size_t length) {
+#ifdef ARDUINO_ARCH_ESP32
+  return _client.write(data, length);
+#else
+  (void)data;
+  (void)length;
+  return 0;
+#endif
+}
+
+void WiFiStack::end() {
+#ifdef ARDUINO_ARCH_ESP32
+  _client.stop();
+  WiFi.disconnect(true);
+  WiFi.mode(WIFI_OFF);
+#endif
+}
@@ -3,6 +3,22 @@
 #include <Wire.h>
 #include "Display.h"            // Our display class
 #include "CO2Sensor.h"          // Our new sensor class
+#include "LatencyTracer.h"      // Sample-to-glass latency tracing
+#include "FlashHistory.h"       // History log in its own flash partition
+#include "SensorPipeline.h"     // Per-sample processing stages
+#include "EnergyGovernor.h"     // Battery-aware sampling and refresh rates
+#include "RtcSnapshot.h"        // State checkpoint that survives warm resets
+#include "I2CScheduler.h"       // Interleaved access to the sensors on the I2C bus
+#include "I2CDevices.h"         // SGP41 and BMP280 drivers
+#include "ExposureTracker.h"    // Time spent in each air quality level
+#include "VentilationEstimator.h" // Air changes per hour from CO2 decays
+#include "LoopMonitor.h"        // Task watchdog and loop timing
+#include "HistoryIndex.h"       // Range aggregates over the flash history
+#include "EventTracer.h"        // Timeline of what the firmware did
+#include "LiveServer.h"         // WebSocket push to dashboards
+#include "NetworkUplink.h"      // Burst uploads with the radio off in between
+#include "WiFiStack.h"          // The uplink's WiFi
+#include "CpuClock.h"           // Low CPU clock, boosted for CPU-bound work
 
 // Pin Definitions
 #define BUZZER_PIN 25                       // Buzzer pin - adjust as needed
@@ -15,6 +31,66 @@
 #define TEMP_THRESHOLD 0.5                 // 0.5°C difference
 #define HUM_THRESHOLD 2                    // 2% difference
 
+// Sample processing
+#define SENSOR_POLL_INTERVAL 30000          // Sensor poll every 30 seconds (on external power or a full battery)
+#define HISTORY_INTERVAL 300000             // History entry every 5 minutes (average of the readings)
+#define SAMPLE_SMOOTHING 1.0                // Temperature/humidity smoothing weight (1.0 = raw readings)
+#define OUTDOOR_CO2 420                     // Outdoor air, what CO2 decays towards (ppm)
+
+// How often the loop checks a refreshing panel (ms)
+#define PANEL_POLL_INTERVAL 20
+
+// Task watchdog budget per loop phase (s); the longest legitimate phase is a
+// full sensor reinitialization at about 10 s
+#define WATCHDOG_TIMEOUT 30
+
+// Character that dumps the event trace when sent over the serial console;
+// tools/trace2json.cpp turns the dump into a Perfetto timeline
+#define TRACE_DUMP_COMMAND 't'
+
+// CPU clock while idle and while rendering, uploading a frame or talking
+// I2C (80, 160 or 240 MHz). Sending CLOCK_CYCLE_COMMAND over the serial
+// console steps the boost clock through all three, so the render times in
+// the summary can be compared.
+#define CPU_IDLE_MHZ 80
+#define CPU_BOOST_MHZ 240
+#define CLOCK_CYCLE_COMMAND 'f'
+
+// Network use, enabled by WiFi credentials passed as build flags, e.g. in
+// platformio.ini: -D WIFI_SSID=\"garage\" -D WIFI_PASSWORD=\"secret\"
+// NETWORK_LIVE keeps the radio on and pushes every reading over WebSocket
+// (ws://<address>:LIVE_PUSH_PORT/). NETWORK_BURST keeps the radio off,
+// buffers the readings and uploads them to the collector
+// (tools/collector.cpp) at COLLECTOR_HOST every UPLINK_INTERVAL and on
+// alarms, for a fraction of the power.
+#define NETWORK_LIVE 0
+#define NETWORK_BURST 1
+#define NETWORK_MODE NETWORK_LIVE
+#define LIVE_PUSH_PORT 81
+#define UPLINK_INTERVAL 3600000             // Burst upload every hour (ms)
+#define UPLINK_POLL_INTERVAL 20             // How often the loop runs a burst in progress (ms)
+#define DEVICE_NAME "garage"                // Name the collector stores the readings under
+#define COLLECTOR_PORT 7700
+#ifndef WIFI_SSID
+#define WIFI_SSID ""
+#define WIFI_PASSWORD ""
+#endif
+#ifndef COLLECTOR_HOST
+#define COLLECTOR_HOST ""
+#endif
+
+// History chart window (hours): 1, 6, 24 or 168 (a week). Up to 48 bars,
+// each the average of the history entries it covers.
+#define CHART_WINDOW 24
+
+// Display mounting: 0 = landscape, 1 = portrait (rotated 90° clockwise),
+// 2 = landscape upside down, 3 = portrait (rotated 90° counter-clockwise)
+#define DISPLAY_ROTATION 0
+
+// Battery voltage, measured through the board's 1:2 divider
+#define BATTERY_ADC_PIN 35
+#define BATTERY_DIVIDER 2.0
+
 // LILYGO T5 v2.4.1 pins for e-Paper
 #define EPD_BUSY 4
 #define EPD_CS 5
@@ -25,7 +101,20 @@
 
 // Global variables
 Display* display = nullptr;           // Our display object
+I2CScheduler i2cScheduler(Wire);      // Owns the I2C bus
+Sgp41Device gasSensor;                // Optional VOC/NOx sensor
+Bmp280Device pressureSensor;          // Optional pressure sensor
 CO2Sensor* co2Sensor = nullptr;       // Our CO2 sensor object
+FlashHistory flashHistory("history"); // History log, survives reboots
+HistoryIndex flashIndex;              // Chart aggregates over the history log
+EnergyGovernor energyGovernor(BATTERY_ADC_PIN, BATTERY_DIVIDER, CO2_ALARM_THRESHOLD,
+                              SENSOR_POLL_INTERVAL, HISTORY_INTERVAL);
+LoopMonitor loopMonitor(WATCHDOG_TIMEOUT);  // Watchdog, survives resets
+LiveServer liveServer(LIVE_PUSH_PORT);      // Pushes readings to dashboards
+WiFiStack wifiStack(WIFI_SSID, WIFI_PASSWORD, COLLECTOR_HOST, COLLECTOR_PORT);
+NetworkUplink networkUplink(wifiStack, DEVICE_NAME, UPLINK_INTERVAL);
+bool uplinkEnabled = false;                 // Burst mode with somewhere to send to
+VentilationEstimator ventilationEstimator(OUTDOOR_CO2);
 
 // Global variables for sensor values and history
 SensorData currentData = {400, 20.0, 50.0};     // Default values
@@ -33,30 +122,149 @@ SensorData lastDisplayedData = {0, 0.0, 0.0};   // Last displayed values
 uint16_t co2History[DATA_HISTORY_SIZE] = {0};   // History array for CO2 values
 
 // Add history for temperature and humidity (last 12 readings)
-float temperatureHistory[12] = {0};
-float humidityHistory[12] = {0};
-int miniHistoryIndex = 0;
-int miniHistoryCount = 0;
+HistoricalData miniHistory = {};
 
 int historyIndex = 0;                           // Current index in history array
 unsigned long lastFullUpdateTime = 0;           // Time of last full display update
+bool refreshPending = false;                    // A refresh was deferred by the energy budget
 unsigned long lastDataUpdateTime = 0;           // Time of last data collection
-unsigned long lastHistoryUpdateTime = 0;        // Time of last history update
 unsigned long lastBuzzerTime = 0;               // Time of last buzzer activation
 bool buzzerActive = false;                      // Track if buzzer is currently active
 
+// State checkpointed to RTC memory after every update, so a panic or
+// watchdog reset resumes where it left off. Bump APP_STATE_VERSION when the
+// layout changes.
+#define APP_STATE_VERSION 6
+
+struct AppState {
+  uint16_t co2History[DATA_HISTORY_SIZE];
+  int historyIndex;
+  HistoricalData miniHistory;
+  SensorData currentData;
+  SensorData lastDisplayedData;
+  unsigned long buzzerAge;        // Time since the last alarm (ms)
+  unsigned long fullUpdateAge;    // Time since the last full refresh (ms)
+  unsigned long dataUpdateAge;    // Time since the last sensor poll (ms)
+  bool sensorReady;               // Sensor measuring
+  bool sensorWarmedUp;            // Its readings have settled
+  bool sensorLowPower;            // Sensor in low power periodic mode
+  bool sensorSingleShot;          // Sensor idle, measured by single shots
+  ExposureTracker exposure;
+  VentilationEstimator ventilation;
+};
+
+static_assert(sizeof(AppState) <= RTC_SNAPSHOT_CAPACITY, "AppState no longer fits the RTC checkpoint");
+
 // Function prototypes
-void updateDisplay(bool fullUpdate);
-void updateHistory();
+void updateDisplay(bool fullUpdate, bool force = false);
+bool updateHistory(const SensorData& data);
 bool significantChange();
-void checkAlarm();
+void checkAlarm(const SensorData& data, unsigned long currentTime);
 void activateBuzzer(bool activate);
 bool tryReconnectSensor();
+void restoreHistory();
+void applyEnergyPolicy();
+void saveState(unsigned long currentTime);
+void resumeState(const AppState& state);
+void readEnvironment(SensorData& data);
+bool buildChart(ChartData& chart);
+void printUplinkSummary();
+void printGlyphCacheSummary();
+
+// Pipeline stages that work on the application state; the generic ones live
+// in SensorPipeline.h
+struct HistoryStage {
+  bool process(PipelineSample& sample) {
+    if (sample.windowClosed) {
+      sample.historyTick = updateHistory(sample.average);
+      if (sample.historyTick) {
+        eventTracer.instant(EVENT_HISTORY_TICK, sample.average.co2);
+      }
+    }
+    return true;
+  }
+};
+
+struct AlarmStage {
+  bool process(PipelineSample& sample) {
+    checkAlarm(sample.data, sample.time);
+    return true;
+  }
+};
+
+struct VentilationStage {
+  bool process(PipelineSample& sample) {
+    // A held CO2 value would flatten the decay
+    if (!sample.co2Fresh) {
+      return true;
+    }
+    if (ventilationEstimator.addSample(sample.data.co2, sample.time)) {
+      const VentilationEstimate& estimate = ventilationEstimator.getEstimate();
+      Serial.print("Ventilation: ");
+      Serial.print(estimate.ach, 2);
+      Serial.print(" air changes per hour (+-");
+      Serial.print(estimate.error * 100, 0);
+      Serial.print("%, R2 ");
+      Serial.print(estimate.r2, 3);
+      Serial.print(", ");
+      Serial.print(estimate.points);
+      Serial.print(" readings over ");
+      Serial.print(estimate.duration / 60);
+      Serial.println(" min)");
+    }
+    return true;
+  }
+};
+
+struct DisplayInvalidateStage {
+  bool process(PipelineSample& sample) {
+    currentData = sample.data;
+    
+    // A history tick always refreshes to keep the chart and values in sync
+    sample.displayDirty = sample.historyTick || significantChange();
+    latencyTracer.mark(sample.data.sampleId, STAGE_CHANGE_CHECKED);
+    return true;
+  }
+};
+
+// Every new reading flows through these stages in one pass
+ValidateStage validateStage;
+FilterStage filterStage(SAMPLE_SMOOTHING);
+AggregateStage aggregateStage(HISTORY_INTERVAL);
+HistoryStage historyStage;
+StatsStage statsStage;
+AlarmStage alarmStage;
+ExposureTracker exposureTracker;
+VentilationStage ventilationStage;
+DisplayInvalidateStage displayInvalidateStage;
+
+SensorPipeline<ValidateStage, FilterStage, AggregateStage, HistoryStage,
+               StatsStage, AlarmStage, ExposureTracker, VentilationStage,
+               DisplayInvalidateStage>
+  pipeline(validateStage, filterStage, aggregateStage, historyStage,
+           statsStage, alarmStage, exposureTracker, ventilationStage,
+           displayInvalidateStage);
 
 void setup() {
   Serial.begin(115200);
   Serial.println("=== Starting CO2 Monitor with SCD40 sensor ===");
   
+  // Arm the watchdog before anything can hang; after a crash this also
+  // reports which phase was running
+  loopMonitor.begin();
+  
+  // Idle at the low clock from here on; the display and the bus boost it
+  cpuClock.begin(CPU_IDLE_MHZ, CPU_BOOST_MHZ);
+  
+  // After a panic or watchdog reset the last checkpoint is still in RTC
+  // memory; resuming from it skips the loading screen, the sensor warmup
+  // and the first full refresh (the panel still shows the last frame)
+  AppState state;
+  bool warmStart = isWarmReset() && rtcSnapshotRestore(&state, sizeof(state), APP_STATE_VERSION);
+  Serial.print("Reset reason: ");
+  Serial.print(resetReasonName());
+  Serial.println(warmStart ? ", resuming from RTC checkpoint" : ", cold start");
+  
   // Setup buzzer pin
   pinMode(BUZZER_PIN, OUTPUT);
   digitalWrite(BUZZER_PIN, LOW);
@@ -68,6 +276,8 @@ void setup() {
   
   // Initialize I2C
   Wire.begin();
+  i2cScheduler.addDevice(&gasSensor);
+  i2cScheduler.addDevice(&pressureSensor);
   Serial.println("I2C initialized");
   
   // Initialize display
@@ -84,53 +294,111 @@ void setup() {
     }
   }
   Serial.println("Display initialized successfully");
+  display->setRotation(DISPLAY_ROTATION);
   
   // Show loading screen - this causes a single display update
-  display->showLoadingScreen();
+  if (!warmStart) {
+    display->showLoadingScreen();
+  }
   
   // Initialize CO2 sensor
+  loopMonitor.enter(PHASE_SENSOR);
   Serial.println("Initializing CO2 sensor...");
-  co2Sensor = new CO2Sensor(CO2_ALARM_THRESHOLD);
-  bool sensorInitialized = co2Sensor->begin();
+  co2Sensor = new CO2Sensor(i2cScheduler, CO2_ALARM_THRESHOLD);
+  bool sensorInitialized = warmStart && state.sensorReady
+    ? co2Sensor->resume(state.sensorWarmedUp, state.sensorLowPower, state.sensorSingleShot)
+    : co2Sensor->begin();
   Serial.println("Sensor initialization complete. Connected: " + String(sensorInitialized ? "YES" : "NO"));
   
-  // Get initial sensor data
-  currentData = co2Sensor->getData();  // Get initial data from sensor
+  // Pick sampling and refresh rates for the battery level
+  energyGovernor.begin();
+  applyEnergyPolicy();
   
-  // Initialize history arrays with initial values
-  for (int i = 0; i < 12; i++) {
-    temperatureHistory[i] = currentData.temperature;
-    humidityHistory[i] = currentData.humidity;
+  // Dashboards can subscribe once the network is up, or readings wait for
+  // the next burst upload
+  if (NETWORK_MODE == NETWORK_LIVE) {
+    liveServer.begin(WIFI_SSID, WIFI_PASSWORD);
+  } else {
+    uplinkEnabled = WIFI_SSID[0] && COLLECTOR_HOST[0];
+    Serial.println(uplinkEnabled ? "Burst upload to " COLLECTOR_HOST
+                                 : "Burst upload: no WiFi credentials or collector, disabled");
   }
   
-  // Set initial history count to ensure charts display correctly
-  miniHistoryCount = 1; // At least one value in the history
-  
-  // Initialize CO2 history array with zeros
-  Serial.println("Initializing history array...");
-  for (int i = 0; i < DATA_HISTORY_SIZE; i++) {
-    co2History[i] = 0;  // Start with no data
+  if (warmStart) {
+    resumeState(state);
+    if (flashHistory.begin()) {
+      flashIndex.begin(flashHistory);
+    }
+  } else {
+    // Get initial sensor data
+    currentData = co2Sensor->getData();  // Get initial data from sensor
+    
+    // Initialize history arrays with initial values
+    for (int i = 0; i < 12; i++) {
+      miniHistory.co2[i] = currentData.co2;
+      miniHistory.temp[i] = currentData.temperature;
+      miniHistory.humidity[i] = currentData.humidity;
+    }
+    
+    // Set initial history count to ensure charts display correctly
+    miniHistory.count = 1; // At least one value in the history
+    
+    // Initialize CO2 history array with zeros
+    Serial.println("Initializing history array...");
+    for (int i = 0; i < DATA_HISTORY_SIZE; i++) {
+      co2History[i] = 0;  // Start with no data
+    }
+    
+    // Refill the charts from the flash log so a reboot doesn't empty them
+    if (flashHistory.begin()) {
+      flashIndex.begin(flashHistory);
+      restoreHistory();
+    }
+    
+    // Do a single final update with all data
+    Serial.println("Performing first display update...");
+    updateDisplay(true);
+    Serial.println("Display updated");
   }
+  loopMonitor.enter(PHASE_CHECKPOINT);
+  saveState(millis());
+  loopMonitor.enter(PHASE_IDLE);
   
-  // Do a single final update with all data
-  Serial.println("Performing first display update...");
-  updateDisplay(true);
-  Serial.println("Display updated");
-  
-  Serial.println("Setup complete");
+  // millis() counts from boot, so this is the whole recovery time
+  Serial.print("Setup complete in ");
+  Serial.print(millis());
+  Serial.println(warmStart ? " ms (warm start)" : " ms");
 }
 
 void loop() {
+  loopMonitor.beginIteration();
+  
+  // Run whatever bus transactions are due; the sensors fill their queues
+  i2cScheduler.poll();
+  
   unsigned long currentTime = millis();
   
-  // Update sensor data every 30 seconds
-  if (currentTime - lastDataUpdateTime >= 30000) {
+  // Update sensor data every poll interval (stretched on a low battery,
+  // except close to the alarm threshold). While the sensor warms up every
+  // CO2 reading is taken, at whatever interval the sensor measures, so
+  // history starts as soon as they settle.
+  unsigned long pollInterval = energyGovernor.getPollInterval(currentData.co2);
+  if (!co2Sensor->isWarmedUp()) {
+    pollInterval = co2Sensor->getCo2Interval();
+  }
+  if (currentTime - lastDataUpdateTime >= pollInterval) {
     Serial.println("\n=== Updating sensor data ===");
     Serial.println("Time since last update: " + String((currentTime - lastDataUpdateTime) / 1000) + " seconds");
     
     bool dataUpdated = false;
     
+    loopMonitor.enter(PHASE_PIPELINE);
+    if (energyGovernor.update(currentTime)) {
+      applyEnergyPolicy();
+    }
+    
     // If sensor is not connected, try to reconnect
+    loopMonitor.enter(PHASE_SENSOR);
     if (!co2Sensor->isConnected()) {
       Serial.println("Sensor not connected, attempting to reconnect...");
       tryReconnectSensor();
@@ -139,55 +407,130 @@ void loop() {
     // Update sensor data
     if (co2Sensor->isConnected()) {
       dataUpdated = co2Sensor->update();
-      if (dataUpdated) {
-        currentData = co2Sensor->getData();
+      
+      // A bus error drops the connection; the first recovery levels only
+      // take milliseconds, so try them before showing the error screen
+      if (!co2Sensor->isConnected()) {
+        Serial.println("Sensor connection lost, attempting recovery...");
+        tryReconnectSensor();
       }
     }
     
     lastDataUpdateTime = currentTime;
     
-    // Only check alarm and update display if sensor is connected
+    // Only process data and update display if sensor is connected
     if (co2Sensor->isConnected()) {
-      Serial.println("Sensor is connected, checking CO2 levels...");
-      // Check CO2 levels for alarm condition
-      checkAlarm();
-      
-      // Check if values changed significantly
-      if (dataUpdated && significantChange()) {
-        Serial.println("Significant change detected, updating display");
-        updateDisplay(true);  // Full update
-        lastDisplayedData = currentData;
-        lastFullUpdateTime = currentTime;
-      } else if (dataUpdated) {
-        Serial.println("No significant change detected");
+      if (dataUpdated) {
+        // Validate, filter, record history, check the alarm and decide on
+        // a display refresh in a single pass
+        loopMonitor.enter(PHASE_PIPELINE);
+        SensorData reading = co2Sensor->getData();
+        readEnvironment(reading);
+        PipelineSample sample(reading, currentTime);
+        sample.co2Fresh = co2Sensor->isCo2Fresh();
+        if (co2Sensor->hasFinishedWarmup()) {
+          sample.settledCo2 = co2Sensor->getSettledCo2();
+        }
+        bool wasAlarm = lastDisplayedData.co2 >= CO2_ALARM_THRESHOLD;
+        
+        eventTracer.begin(EVENT_PIPELINE, reading.co2);
+        bool processed = pipeline.process(sample);
+        eventTracer.end(EVENT_PIPELINE);
+        
+        // Subscribers get every valid reading, not only the ones shown
+        if (processed) {
+          loopMonitor.enter(PHASE_NETWORK);
+          if (sample.historyTick) {
+            liveServer.publishTick(sample.average, currentTime);
+          }
+          liveServer.publishSample(currentData, currentTime);
+          if (uplinkEnabled) {
+            networkUplink.add(LiveServer::toLiveSample(currentData, currentTime));
+          }
+          loopMonitor.enter(PHASE_PIPELINE);
+        }
+        
+        if (processed && (sample.displayDirty || refreshPending)) {
+          // Alarm state changes are always shown, other refreshes come out
+          // of the energy budget and stay pending until it allows one
+          bool alarmChanged = (currentData.co2 >= CO2_ALARM_THRESHOLD) != wasAlarm;
+          if (!energyGovernor.allowRefresh(alarmChanged, currentTime)) {
+            Serial.println("Display refresh deferred, refresh budget used up");
+            refreshPending = true;
+          } else {
+            if (!sample.displayDirty) {
+              Serial.println("Refresh budget available, showing the deferred update");
+            } else if (sample.historyTick) {
+              Serial.println("History updated - full display refresh to keep values in sync");
+            } else {
+              Serial.println("Significant change detected, updating display");
+            }
+            updateDisplay(true);  // Full update
+            lastFullUpdateTime = currentTime;
+          }
+        } else {
+          Serial.println("No significant change detected");
+        }
+        
+        if (sample.historyTick) {
+          // After the whole pass, so the statistics include this reading
+          Serial.print("CO2 since boot - min: ");
+          Serial.print(statsStage.getMinCO2());
+          Serial.print(", avg: ");
+          Serial.print(statsStage.getAverageCO2());
+          Serial.print(", max: ");
+          Serial.println(statsStage.getMaxCO2());
+          latencyTracer.printSummary(Serial);
+          exposureTracker.printSummary(Serial);
+          loopMonitor.printSummary(Serial);
+          liveServer.printSummary(Serial);
+          cpuClock.printSummary(Serial);
+          if (uplinkEnabled) {
+            printUplinkSummary();
+          }
+#ifdef PACKED_FONTS
+          printGlyphCacheSummary();
+#endif
+        }
       }
     } else {
       // If sensor is not connected, update display with connection instructions
       Serial.println("Sensor is not connected, showing connection instructions");
-      updateDisplay(true);
-      lastFullUpdateTime = currentTime;
+      if (energyGovernor.allowRefresh(false, currentTime)) {
+        updateDisplay(true);
+        lastFullUpdateTime = currentTime;
+      }
     }
-  }
-  
-  // Update history every 5 minutes (only if sensor is connected) - changed from 30 minutes for faster testing
-  if (co2Sensor->isConnected() && co2Sensor->getValidReadingCount() >= 3 && 
-      currentTime - lastHistoryUpdateTime >= 300000) {
-    // Update history with current data
-    updateHistory();
-    lastHistoryUpdateTime = currentTime;
-    
-    // Perform a full update to keep chart and values in sync
-    updateDisplay(true);
-    lastDisplayedData = currentData;
-    lastFullUpdateTime = currentTime;
     
-    Serial.println("Chart updated - full display refresh to keep values in sync");
+    loopMonitor.enter(PHASE_CHECKPOINT);
+    saveState(currentTime);
   }
   
-  // Force full refresh every 6 hours to prevent ghosting
+  // Force full refresh every 6 hours to prevent ghosting; the refresh is
+  // what clears it, so it runs even when the frame has not changed
   if (currentTime - lastFullUpdateTime >= 21600000) {
-    updateDisplay(true);
+    updateDisplay(true, true);
     lastFullUpdateTime = currentTime;
+    loopMonitor.enter(PHASE_CHECKPOINT);
+    saveState(currentTime);
+  }
+  
+  // Answer subscribers and send what the slow ones still have queued, or
+  // run the burst upload when one is due
+  loopMonitor.enter(PHASE_NETWORK);
+  liveServer.loop();
+  bool uplinkActive = uplinkEnabled && networkUplink.update(millis());
+  
+  // Dump the event trace, or change the boost clock, on request
+  while (Serial.available() > 0) {
+    int command = Serial.read();
+    if (command == TRACE_DUMP_COMMAND) {
+      eventTracer.dump(Serial);
+    } else if (command == CLOCK_CYCLE_COMMAND) {
+      Serial.print("CPU boost clock: ");
+      Serial.print(cpuClock.cycleBoostFrequency());
+      Serial.println(" MHz");
+    }
   }
   
   // Turn off buzzer after 5 seconds if it's active
@@ -195,54 +538,75 @@ void loop() {
     activateBuzzer(false);
   }
   
-  delay(1000);  // Small delay to prevent excessive CPU usage
+  // Sleep until the next bus transaction is due, at most a second; while
+  // the panel refreshes, come back often enough to catch BUSY going idle,
+  // and keep a burst upload short so the radio is off again soon
+  loopMonitor.enter(PHASE_PANEL);
+  unsigned long idleLimit = display->poll() ? PANEL_POLL_INTERVAL * 1000UL : 1000000UL;
+  if (uplinkActive && idleLimit > UPLINK_POLL_INTERVAL * 1000UL) {
+    idleLimit = UPLINK_POLL_INTERVAL * 1000UL;
+  }
+  loopMonitor.endIteration();
+  delay((i2cScheduler.getIdleTime(idleLimit) + 999) / 1000);
 }
 
-void updateDisplay(bool fullUpdate) {
+void updateDisplay(bool fullUpdate, bool force) {
   if (!display) {
     Serial.println("ERROR: Display not initialized");
     return;
   }
   
+  loopMonitor.enter(PHASE_RENDER);
   if (fullUpdate) {
-    // Pass current data and history arrays to display
-    display->updateFull(currentData, co2History, historyIndex, co2Sensor->isConnected());
+    // Pass current data and history arrays to display; the chart comes
+    // from the flash history when it is available
+    ChartData chart;
+    bool haveChart = buildChart(chart);
+    display->updateFull(currentData, co2History, historyIndex, miniHistory, co2Sensor->isConnected(),
+                        &exposureTracker.getDay(), &exposureTracker.getWeek(),
+                        haveChart ? &chart : nullptr, &ventilationEstimator.getEstimate(), force);
     
-    // Update last displayed data
+    // Update last displayed data; whatever was deferred is shown now
     lastDisplayedData = currentData;
+    refreshPending = false;
     Serial.println("Full display update completed");
   } else {
-    display->updateChart(co2History, historyIndex);
+    display->updateChart(co2History, historyIndex, force);
     Serial.println("Chart-only update completed");
   }
 }
 
-void updateHistory() {
-  // Only add to history if we have collected at least 3 valid readings
-  // This ensures the sensor has stabilized before recording data
-  if (co2Sensor->getValidReadingCount() >= 3) {
-    // Add current CO2 value to main history
-    co2History[historyIndex] = currentData.co2;
+bool updateHistory(const SensorData& data) {
+  // Only add to history once the sensor's readings have settled
+  if (co2Sensor->isWarmedUp()) {
+    // Add the CO2 value to main history
+    co2History[historyIndex] = data.co2;
     historyIndex = (historyIndex + 1) % DATA_HISTORY_SIZE;
     
     // Update mini history for temperature and humidity
-    temperatureHistory[miniHistoryIndex] = currentData.temperature;
-    humidityHistory[miniHistoryIndex] = currentData.humidity;
-    miniHistoryIndex = (miniHistoryIndex + 1) % 12;
+    miniHistory.co2[miniHistory.index] = data.co2;
+    miniHistory.temp[miniHistory.index] = data.temperature;
+    miniHistory.humidity[miniHistory.index] = data.humidity;
+    miniHistory.index = (miniHistory.index + 1) % 12;
     
     // Increment mini history count if not at max
-    if (miniHistoryCount < 12) {
-      miniHistoryCount++;
+    if (miniHistory.count < 12) {
+      miniHistory.count++;
+    }
+    
+    // Persist the sample; its time continues from the records of earlier boots
+    if (flashHistory.append(data.co2, data.temperature, data.humidity, millis() / 1000)) {
+      flashIndex.appended(flashHistory);
     }
     
     Serial.println("Updated CO2 history");
     Serial.print("Current index: ");
     Serial.println(historyIndex);
-  } else {
-    Serial.println("Not enough valid readings yet, skipping history update");
-    Serial.print("Current valid reading count: ");
-    Serial.println(co2Sensor->getValidReadingCount());
+    return true;
   }
+  
+  Serial.println("Sensor still warming up, skipping history update");
+  return false;
 }
 
 bool significantChange() {
@@ -262,14 +626,16 @@ bool significantChange() {
   return false;
 }
 
-void checkAlarm() {
-  unsigned long currentTime = millis();
-  
+void checkAlarm(const SensorData& data, unsigned long currentTime) {
   // Check if CO2 is above threshold and if enough time has passed since last alarm
-  if (currentData.co2 >= CO2_ALARM_THRESHOLD && 
+  if (data.co2 >= CO2_ALARM_THRESHOLD && 
       (currentTime - lastBuzzerTime >= BUZZER_INTERVAL)) {
     // Activate buzzer
+    eventTracer.instant(EVENT_ALARM, data.co2);
     activateBuzzer(true);
+    
+    // Get the readings leading up to the alarm out now, not at the next burst
+    networkUplink.requestBurst();
     lastBuzzerTime = currentTime;
   }
 }
@@ -285,11 +651,44 @@ void activateBuzzer(bool activate) {
   }
 }
 
+void restoreHistory() {
+  // Records are read straight from the flash mapping, oldest first
+  HistoryCursor cursor = flashHistory.newest(DATA_HISTORY_SIZE);
+  int restored = 0;
+  
+  while (const HistoryRecord* record = cursor.next()) {
+    co2History[historyIndex] = record->co2;
+    historyIndex = (historyIndex + 1) % DATA_HISTORY_SIZE;
+    
+    miniHistory.co2[miniHistory.index] = record->co2;
+    miniHistory.temp[miniHistory.index] = record->getTemperature();
+    miniHistory.humidity[miniHistory.index] = record->getHumidity();
+    miniHistory.index = (miniHistory.index + 1) % 12;
+    restored++;
+  }
+  
+  if (restored > 0) {
+    miniHistory.count = restored < 12 ? restored : 12;
+  }
+  Serial.print("Restored history entries from flash: ");
+  Serial.println(restored);
+}
+
 bool tryReconnectSensor() {
   Serial.println("Attempting to reconnect CO2 sensor...");
   
-  // Try to reset and reinitialize the sensor
-  if (co2Sensor->reset()) {
+  // Escalate from bus recovery up to a full reinitialization
+  bool recovered = co2Sensor->recover();
+  
+  RecoveryStats stats = co2Sensor->getRecoveryStats();
+  Serial.print("Recovery counts - bus: ");
+  Serial.print(stats.busRecoveries);
+  Serial.print(", measurement restart: ");
+  Serial.print(stats.measurementRestarts);
+  Serial.print(", full reinit: ");
+  Serial.println(stats.fullReinits);
+  
+  if (recovered) {
     Serial.println("Successfully reconnected CO2 sensor");
     return true;
   }
@@ -297,3 +696,188 @@ bool tryReconnectSensor() {
   Serial.println("Failed to reconnect CO2 sensor");
   return false;
 }
+
+void applyEnergyPolicy() {
+  const EnergyPolicy& policy = energyGovernor.getPolicy();
+  
+  // The low power flag is only stored while single shots run, so it is set
+  // after entering and before leaving them to restart the sensor once
+  if (policy.co2ShotInterval > 0) {
+    co2Sensor->setSingleShotMode(policy.co2ShotInterval, policy.pollInterval);
+    co2Sensor->setLowPowerMode(policy.lowPowerSensor);
+  } else {
+    co2Sensor->setLowPowerMode(policy.lowPowerSensor);
+    co2Sensor->setSingleShotMode(0, 0);
+  }
+  aggregateStage.setWindow(policy.historyInterval);
+  
+  Serial.print("Energy policy: ");
+  Serial.print(EnergyGovernor::getLevelName(policy.level));
+  Serial.print(", poll every ");
+  Serial.print(policy.pollInterval / 1000);
+  if (co2Sensor->isSingleShotMode()) {
+    Serial.print(" s, CO2 shot every ");
+    Serial.print(policy.co2ShotInterval / 1000);
+  }
+  Serial.print(" s, history every ");
+  Serial.print(policy.historyInterval / 60000);
+  Serial.print(" min, refresh budget ");
+  if (policy.refreshesPerHour == 0) {
+    Serial.println("unlimited");
+  } else {
+    Serial.print(policy.refreshesPerHour);
+    Serial.println(" per hour");
+  }
+}
+
+void saveState(unsigned long currentTime) {
+  TraceSpan span(EVENT_CHECKPOINT);
+  AppState state;
+  memcpy(state.co2History, co2History, sizeof(co2History));
+  state.historyIndex = historyIndex;
+  state.miniHistory = miniHistory;
+  state.currentData = currentData;
+  state.lastDisplayedData = lastDisplayedData;
+  
+  // millis() restarts at 0, so timers are kept as ages
+  state.buzzerAge = currentTime - lastBuzzerTime;
+  state.fullUpdateAge = currentTime - lastFullUpdateTime;
+  state.dataUpdateAge = currentTime - lastDataUpdateTime;
+  
+  state.sensorReady = co2Sensor->isConnected();
+  state.sensorLowPower = co2Sensor->isLowPowerMode();
+  state.sensorSingleShot = co2Sensor->isSingleShotMode();
+  state.sensorWarmedUp = co2Sensor->isWarmedUp();
+  state.exposure = exposureTracker;
+  state.ventilation = ventilationEstimator;
+  
+  if (!rtcSnapshotSave(&state, sizeof(state), APP_STATE_VERSION)) {
+    Serial.println("ERROR: RTC checkpoint not saved, a reset now loses the state");
+  }
+}
+
+void resumeState(const AppState& state) {
+  memcpy(co2History, state.co2History, sizeof(co2History));
+  historyIndex = state.historyIndex;
+  miniHistory = state.miniHistory;
+  currentData = state.currentData;
+  lastDisplayedData = state.lastDisplayedData;
+  exposureTracker = state.exposure;
+  exposureTracker.resetClock();
+  ventilationEstimator = state.ventilation;
+  ventilationEstimator.resetClock();
+  
+  // Unsigned arithmetic wraps, so these land "in the past" of the new millis()
+  unsigned long now = millis();
+  lastBuzzerTime = now - state.buzzerAge;
+  lastFullUpdateTime = now - state.fullUpdateAge;
+  lastDataUpdateTime = now - state.dataUpdateAge;
+  
+  Serial.print("Resumed state: CO2 ");
+  Serial.print(currentData.co2);
+  Serial.print(" ppm, history index ");
+  Serial.println(historyIndex);
+}
+
+void readEnvironment(SensorData& data) {
+  static uint16_t vocRaw = 0;
+  static float pressure = 0;
+  
+  // Average the VOC signal over the samples queued since the last poll
+  GasSample gas;
+  uint32_t vocSum = 0;
+  uint8_t vocCount = 0;
+  while (gasSensor.samples().pop(gas)) {
+    vocSum += gas.vocRaw;
+    vocCount++;
+  }
+  if (vocCount > 0) {
+    vocRaw = vocSum / vocCount;
+  }
+  
+  PressureSample sample;
+  if (pressureSensor.samples().popLatest(sample)) {
+    pressure = sample.pressure;
+  }
+  
+  data.vocRaw = vocRaw;
+  data.pressure = pressure;
+  
+  // The SGP41 compensates its signals with the SCD4x humidity
+  gasSensor.setCompensation(data.temperature, data.humidity);
+  
+  if (gasSensor.isPresent() || pressureSensor.isPresent()) {
+    Serial.print("VOC raw: ");
+    Serial.print(vocRaw);
+    Serial.print(", Pressure: ");
+    Serial.print(pressure);
+    Serial.println(" hPa");
+  }
+}
+
+bool buildChart(ChartData& chart) {
+  if (!flashIndex.isReady()) {
+    return false;
+  }
+  
+  // Entries in the window at the current history interval; on a low
+  // battery the interval is longer, so the same entries span more time
+  uint32_t entries = (uint32_t)CHART_WINDOW * 3600000UL / energyGovernor.getPolicy().historyInterval;
+  entries = constrain(entries, 1, flashHistory.capacity());
+  chart.count = entries < ChartData::MAX_BARS ? entries : ChartData::MAX_BARS;
+  
+  // Bar i covers entries [i * entries / count, (i + 1) * entries / count)
+  // counted from the oldest; each is one O(log n) query
+  uint32_t head = flashHistory.head();
+  for (uint8_t i = 0; i < chart.count; i++) {
+    uint32_t begin = (uint32_t)i * entries / chart.count;
+    uint32_t end = (uint32_t)(i + 1) * entries / chart.count;
+    HistoryAggregate bar = flashIndex.queryNewest(head, entries - end, end - begin);
+    chart.average[i] = bar.average();
+    chart.peak[i] = bar.count ? bar.max : 0;
+  }
+  
+  HistoryAggregate window = flashIndex.queryNewest(head, 0, entries);
+  chart.min = window.count ? window.min : 0;
+  chart.max = window.max;
+  
+  if (CHART_WINDOW % 24 == 0 && CHART_WINDOW > 24) {
+    snprintf(chart.title, sizeof(chart.title), "CO2 History (%dd)", CHART_WINDOW / 24);
+  } else {
+    snprintf(chart.title, sizeof(chart.title), "CO2 History (%dh)", CHART_WINDOW);
+  }
+  return true;
+}
+
+void printUplinkSummary() {
+  const UplinkStats& stats = networkUplink.getStats();
+  Serial.print("Network: radio on ");
+  Serial.print(networkUplink.getRadioOnToday() / 1000.0f, 1);
+  Serial.print(" s today in ");
+  Serial.print(networkUplink.getBurstsToday());
+  Serial.print(" bursts (yesterday ");
+  Serial.print(networkUplink.getRadioOnYesterday() / 1000.0f, 1);
+  Serial.print(" s), ");
+  Serial.print(stats.samplesSent);
+  Serial.print(" readings sent, ");
+  Serial.print(networkUplink.getBacklog());
+  Serial.print(" waiting, ");
+  Serial.print(stats.samplesDropped);
+  Serial.print(" dropped, ");
+  Serial.print(stats.fastJoins);
+  Serial.print(" fast joins, ");
+  Serial.print(stats.failures);
+  Serial.println(" failed bursts");
+}
+
+void printGlyphCacheSummary() {
+  const GlyphCache& cache = display->getGlyphCache();
+  uint32_t lookups = cache.getHits() + cache.getMisses();
+  Serial.print("Glyph cache: ");
+  Serial.print(cache.getHits());
+  Serial.print(" hits, ");
+  Serial.print(cache.getMisses());
+  Serial.print(" misses (");
+  Serial.print(lookups ? 100.0f * cache.getHits() / lookups : 0.0f, 1);
+  Serial.println("% hit rate)");
+}
@@ -0,0 +1,356 @@
+// CO2Sensor::recover() against a scripted I2C bus: a sensor that holds
+// SDA low mid-byte, a shorted SDA line, NACKs after a brown-out and a sensor
+// that is gone (host program, not part of the firmware).
+//
+// Build against the firmware sources and the host Arduino layer:
+//   g++ -O2 -std=c++11 -Itools/host -Iinclude tools/bus_recovery_mock.cpp tools/host/Arduino.cpp tools/host/Wire.cpp tools/host/SensirionI2CScd4x.cpp src/CO2Sensor.cpp src/I2CScheduler.cpp src/I2CDevices.cpp src/Scd4xSchedule.cpp src/WarmupDetector.cpp src/EventTracer.cpp src/LatencyTracer.cpp src/LogHistogram.cpp src/CpuClock.cpp -o bus_recovery_mock
+//
+// Usage:
+//   bus_recovery_mock [--verbose]
+//
+// Each scenario starts the sensor with begin(), lets the bus scheduler
+// collect readings, injects a fault, runs the scheduler until the driver
+// reports the failure (as the main loop would before reconnecting) and
+// calls recover(). The bus is modelled at the pin level: SDA and SCL are
+// open-drain lines with pull-ups, low when the ESP32 or the sensor pulls
+// them down. A sensor stuck mid-byte holds SDA low until SCL has clocked
+// out the rest of its byte (and may stretch each clock); a shorted line
+// never comes free. While SDA is low every Wire transaction fails.
+//
+// The sensor model is an SCD41 in periodic measurement (a reading every
+// 5 s) that answers the driver's commands with their datasheet execution
+// times and NACKs any command sent before the previous one has executed.
+//
+// Scenarios and what recover() must do:
+//   healthy      bus and sensor fine: level 1, no bus recovery counted
+//   stuck_1..9   SDA held for 1..9 more bits: level 1, one bus recovery
+//   stretch      9 bits, each clock stretched 200 us: level 1
+//   shorted      SDA shorted to ground: fails after a full reinit
+//   brownout     sensor reset to idle, NACKs the scheduler's poll and the
+//                first probe: level 2 restarts the measurement
+//   absent       sensor NACKs everything: fails after a full reinit
+// After a successful recovery new readings must come in within 15 s.
+//
+// --verbose passes the firmware's serial output through to stderr.
+//
+// Output is CSV: scenario, result, recovery counters (bus, measurement
+// restart, full reinit), SCL pulses the recovery clocked, time recover()
+// took (ms), readings in the 15 s after it, and ok or FAIL against the
+// expectation. The exit status is 1 if any scenario failed.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "CO2Sensor.h"
+#include "I2CScheduler.h"
+
+static const uint8_t SDA_PIN = 21;
+static const uint8_t SCL_PIN = 22;
+static const uint8_t SCD4X_ADDRESS = 0x62;
+
+// Bit count that never runs out, for a shorted line
+static const int FOREVER = 1 << 30;
+
+static uint8_t crc8(const uint8_t* data) {
+  uint8_t crc = 0xFF;
+  for (int i = 0; i < 2; i++) {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x31) : (uint8_t)(crc << 1);
+    }
+  }
+  return crc;
+}
+
+static void putWord(uint8_t* data, uint16_t word) {
+  data[0] = word >> 8;
+  data[1] = word & 0xFF;
+  data[2] = crc8(data);
+}
+
+// The sensor side of the bus
+class MockScd41 : public I2CTarget {
+public:
+  MockScd41() : _measuring(false), _busyUntil(0), _lastData(0), _command(0), _pending(false),
+                _nacks(0), _counter(0) {}
+
+  // Browned out: back to idle, and the next `count` transactions NACK
+  void brownOut(int count) {
+    _measuring = false;
+    _pending = false;
+    _nacks = count;
+  }
+
+  uint8_t write(const uint8_t* data, size_t length) {
+    unsigned long now = micros();
+    if (_nacks > 0) {
+      _nacks--;
+      return 2;
+    }
+    if (length < 2 || (long)(now - _busyUntil) < 0) {
+      return 3;
+    }
+
+    _command = (data[0] << 8) | data[1];
+    _pending = false;
+    unsigned long exec = 1000;
+    switch (_command) {
+      case 0x21B1:   // start_periodic_measurement
+      case 0x21AC:   // start_low_power_periodic_measurement
+        _measuring = true;
+        _lastData = now;
+        break;
+      case 0x3F86:   // stop_periodic_measurement
+        _measuring = false;
+        exec = 500000;
+        break;
+      case 0x3682:   // get_serial_number, refused while measuring
+        if (_measuring) {
+          return 3;
+        }
+        _pending = true;
+        break;
+      case 0xE4B8:   // get_data_ready_status
+      case 0xEC05:   // read_measurement
+        _pending = true;
+        break;
+      case 0x2196:   // measure_single_shot_rht_only
+      case 0x219D:   // measure_single_shot
+        if (_measuring) {
+          return 3;
+        }
+        exec = _command == 0x2196 ? 50000 : 5000000;
+        _lastData = now + exec - 5000000;
+        break;
+      default:
+        return 3;
+    }
+    _busyUntil = now + exec;
+    return 0;
+  }
+
+  size_t read(uint8_t* data, size_t length) {
+    unsigned long now = micros();
+    if (_nacks > 0) {
+      _nacks--;
+      return 0;
+    }
+    if (!_pending || (long)(now - _busyUntil) < 0) {
+      return 0;
+    }
+    _pending = false;
+
+    bool ready = (long)(now - _lastData) >= 5000000;
+    if (_command == 0xE4B8 && length >= 3) {
+      putWord(data, ready ? 0x8006 : 0x8000);
+      return 3;
+    }
+    if (_command == 0xEC05 && length >= 9) {
+      _lastData = now;
+      putWord(data, 650 + (_counter++ % 7));
+      putWord(data + 3, 0x6666);
+      putWord(data + 6, 0x8000);
+      return 9;
+    }
+    if (_command == 0x3682 && length >= 9) {
+      putWord(data, 0x1234);
+      putWord(data + 3, 0x5678);
+      putWord(data + 6, 0x9ABC);
+      return 9;
+    }
+    return 0;
+  }
+
+private:
+  bool _measuring;
+  unsigned long _busyUntil;
+  unsigned long _lastData;
+  uint16_t _command;
+  bool _pending;
+  int _nacks;
+  uint16_t _counter;
+};
+
+// SDA and SCL as open-drain lines with pull-ups. The sensor can hold SDA
+// low for a number of bits and stretch each SCL low phase.
+class BusLines : public HostPins {
+public:
+  BusLines() : _stuckBits(0), _stretchUs(0), _stretchUntil(0), _scl(HIGH), _pulses(0) {
+    memset(_modes, INPUT, sizeof(_modes));
+    memset(_latches, LOW, sizeof(_latches));
+  }
+
+  // The sensor holds SDA low until SCL has risen `bits` times
+  void stick(int bits, unsigned long stretchUs) {
+    _stuckBits = bits;
+    _stretchUs = stretchUs;
+  }
+
+  uint32_t getPulses() const { return _pulses; }
+  void resetPulses() { _pulses = 0; }
+
+  void mode(uint8_t pin, uint8_t mode) {
+    _modes[pin & 63] = mode;
+    update();
+  }
+
+  void write(uint8_t pin, uint8_t value) {
+    _latches[pin & 63] = value ? HIGH : LOW;
+    update();
+  }
+
+  int read(uint8_t pin) {
+    update();
+    if (pin == SDA_PIN) {
+      return driven(SDA_PIN) || _stuckBits > 0 ? LOW : HIGH;
+    }
+    if (pin == SCL_PIN) {
+      return _scl;
+    }
+    return _modes[pin & 63] == INPUT_PULLUP ? HIGH : _latches[pin & 63];
+  }
+
+private:
+  int _stuckBits;
+  unsigned long _stretchUs;
+  unsigned long _stretchUntil;
+  int _scl;
+  uint32_t _pulses;
+  uint8_t _modes[64];
+  uint8_t _latches[64];
+
+  bool driven(uint8_t pin) const {
+    return _modes[pin] == OUTPUT && _latches[pin] == LOW;
+  }
+
+  // Follow SCL; the sensor shifts out a bit on each rising edge
+  void update() {
+    bool mcuLow = driven(SCL_PIN);
+    if (mcuLow && _scl == HIGH) {
+      _scl = LOW;
+      _stretchUntil = micros() + (_stuckBits > 0 ? _stretchUs : 0);
+    } else if (!mcuLow && _scl == LOW && (long)(micros() - _stretchUntil) >= 0) {
+      _scl = HIGH;
+      _pulses++;
+      if (_stuckBits > 0 && _stuckBits != FOREVER) {
+        _stuckBits--;
+      }
+    }
+  }
+};
+
+struct Scenario {
+  const char* name;
+  int stuckBits;
+  unsigned long stretchUs;
+  int brownOutNacks;
+  bool absent;
+  bool recovers;
+  RecoveryStats expected;
+};
+
+static int verbose = 0;
+
+// Run the scheduler and the sensor updates for `ms`; returns the readings
+static int run(I2CScheduler& scheduler, CO2Sensor& sensor, unsigned long ms, bool stopOnFailure) {
+  int readings = 0;
+  unsigned long end = millis() + ms;
+  unsigned long nextUpdate = millis();
+  while ((long)(millis() - end) < 0) {
+    scheduler.poll();
+    if ((long)(millis() - nextUpdate) >= 0) {
+      nextUpdate += 1000;
+      if (sensor.update()) {
+        readings++;
+      } else if (stopOnFailure && !sensor.isConnected()) {
+        break;
+      }
+    }
+    unsigned long idle = scheduler.getIdleTime(1000);
+    hostAdvance(idle > 0 ? idle : 10);
+  }
+  return readings;
+}
+
+static bool runScenario(const Scenario& scenario) {
+  BusLines lines;
+  MockScd41 scd41;
+  hostAttachPins(&lines);
+  hostSetMicros(0);
+  Wire.attach(SCD4X_ADDRESS, &scd41);
+  Wire.begin(SDA_PIN, SCL_PIN);
+
+  I2CScheduler scheduler(Wire);
+  CO2Sensor sensor(scheduler, 1000, SDA_PIN, SCL_PIN);
+  bool started = sensor.begin();
+  int before = run(scheduler, sensor, 20000, false);
+
+  // Inject the fault, then let the scheduler trip over it
+  if (scenario.stuckBits) {
+    lines.stick(scenario.stuckBits, scenario.stretchUs);
+  }
+  if (scenario.brownOutNacks) {
+    scd41.brownOut(scenario.brownOutNacks);
+  }
+  if (scenario.absent) {
+    scd41.brownOut(FOREVER);
+  }
+  if (scenario.stuckBits || scenario.brownOutNacks || scenario.absent) {
+    run(scheduler, sensor, 20000, true);
+  }
+
+  lines.resetPulses();
+  unsigned long start = micros();
+  bool recovered = sensor.recover();
+  double recoverMs = (micros() - start) / 1000.0;
+  uint32_t pulses = lines.getPulses();
+  int after = recovered ? run(scheduler, sensor, 15000, false) : 0;
+
+  RecoveryStats stats = sensor.getRecoveryStats();
+  bool ok = started && before > 0 &&
+            recovered == scenario.recovers &&
+            (!recovered || after > 0) &&
+            stats.busRecoveries == scenario.expected.busRecoveries &&
+            stats.measurementRestarts == scenario.expected.measurementRestarts &&
+            stats.fullReinits == scenario.expected.fullReinits;
+
+  printf("%s,%s,%u,%u,%u,%u,%.1f,%d,%s\n", scenario.name, recovered ? "recovered" : "failed",
+         stats.busRecoveries, stats.measurementRestarts, stats.fullReinits, pulses,
+         recoverMs, after, ok ? "ok" : "FAIL");
+
+  Wire.attach(SCD4X_ADDRESS, nullptr);
+  hostAttachPins(nullptr);
+  return ok;
+}
+
+int main(int argc, char** argv) {
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--verbose")) {
+      verbose = 1;
+    } else {
+      fprintf(stderr, "usage: %s [--verbose]\n", argv[0]);
+      return 2;
+    }
+  }
+  hostSerialOutput(verbose ? stderr : nullptr);
+
+  const Scenario scenarios[] = {
+    { "healthy",  0,       0,   0, false, true,  { 0, 0, 0 } },
+    { "stuck_1",  1,       0,   0, false, true,  { 1, 0, 0 } },
+    { "stuck_5",  5,       0,   0, false, true,  { 1, 0, 0 } },
+    { "stuck_9",  9,       0,   0, false, true,  { 1, 0, 0 } },
+    { "stretch",  9,       200, 0, false, true,  { 1, 0, 0 } },
+    { "shorted",  FOREVER, 0,   0, false, false, { 0, 0, 1 } },
+    { "brownout", 0,       0,   2, false, true,  { 0, 1, 0 } },
+    { "absent",   0,       0,   0, true,  false, { 0, 0, 1 } },
+  };
+
+  printf("scenario,result,bus_recoveries,measurement_restarts,full_reinits,scl_pulses,"
+         "recover_ms,readings_after,check\n");
+  bool ok = true;
+  for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+    ok = runScenario(scenarios[i]) && ok;
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,1169 @@
+// Telemetry collector for a fleet of monitors (Linux host program, not part
+// of the firmware).
+//
+// Build:
+//   g++ -O2 -std=c++11 -pthread tools/collector.cpp -o collector
+//
+// Usage:
+//   collector serve [options]
+//   collector query <data dir> <device> <from ms> <to ms> <bucket ms> [co2|temp|rh]
+//   collector loadgen [--host H] [--port P] [--devices N] [--rate R] [--seconds S]
+//
+// serve options:
+//   --data DIR          segment directory (default: ./telemetry)
+//   --port P            ingest port for devices and log forwarders (default: 7700)
+//   --query-port P      query port (default: 7701)
+//   --bridge NAME=H:P   connect to a serial-over-TCP bridge (ser2net and the
+//                       like) and store what it forwards as device NAME; repeatable
+//   --shards N          writer threads (default: 2)
+//   --flush-ms MS       longest time a sample waits before its block is written
+//                       (default: 10000)
+//
+// Ingest is line based and accepts the serial output of the firmware as is:
+// "CO2: X ppm, Temp: Y C, Humidity: Z%" lines are stored with the time they
+// arrived, every other line is ignored. Readings uploaded in bursts end in
+// ", age: N ms" and are stored with the time they were taken. A plain TCP
+// client may name itself with a first line "device <name>"; otherwise the
+// peer address is used.
+//
+// Queries are one line each on the query port:
+//   QUERY <device> <from ms> <to ms> <bucket ms> [co2|temp|rh]
+// Times are milliseconds since the epoch; values <= 0 are relative to now.
+// The answer is one "bucket_start,count,min,max,avg" line per non-empty
+// bucket followed by "END".
+//
+// Storage: <data>/<device>/<seq>.seg files of SEGMENT_SIZE bytes, mapped
+// with mmap. A segment is a header followed by immutable blocks of up to
+// BLOCK_SAMPLES samples. Each block stores its time range and CO2
+// min/max/sum, then four columns: time as zigzag varint delta-of-delta, CO2
+// as zigzag varint delta, temperature and humidity as XOR of the float bits
+// with the previous value, with leading and trailing zero bytes dropped.
+// Blocks are published by a release store of the segment's used size, so
+// queries read them without locks while the writers append.
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <map>
+#include <math.h>
+#include <memory>
+#include <mutex>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+static const uint32_t SEGMENT_MAGIC = 0x31474553;  // "SEG1"
+static const size_t SEGMENT_SIZE = 4 << 20;
+static const size_t SEGMENT_HEADER_SIZE = 64;
+static const uint16_t BLOCK_SAMPLES = 1024;
+static const size_t RING_CAPACITY = 1 << 16;
+
+static std::atomic<bool> g_stop(false);
+
+static int64_t nowMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+           std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// ---------------------------------------------------------------------------
+// Encoding
+
+struct Sample {
+  int64_t time;
+  uint16_t co2;
+  float temperature;
+  float humidity;
+};
+
+static inline uint64_t zigzag(int64_t v) {
+  return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t v) {
+  return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static inline void putVarint(std::vector<uint8_t>& out, uint64_t v) {
+  while (v >= 0x80) {
+    out.push_back((uint8_t)(v | 0x80));
+    v >>= 7;
+  }
+  out.push_back((uint8_t)v);
+}
+
+static inline uint64_t getVarint(const uint8_t*& p, const uint8_t* end) {
+  uint64_t v = 0;
+  for (unsigned shift = 0; p < end && shift < 64; shift += 7) {
+    uint8_t b = *p++;
+    v |= (uint64_t)(b & 0x7F) << shift;
+    if (!(b & 0x80)) break;
+  }
+  return v;
+}
+
+static inline uint32_t floatBits(float f) {
+  uint32_t u;
+  memcpy(&u, &f, sizeof u);
+  return u;
+}
+
+static inline float bitsFloat(uint32_t u) {
+  float f;
+  memcpy(&f, &u, sizeof f);
+  return f;
+}
+
+// Control byte: leading zero bytes in bits 3-5, trailing zero bytes in bits
+// 0-2, followed by the remaining bytes most significant first
+static inline void putXor(std::vector<uint8_t>& out, uint32_t x) {
+  unsigned lead = x ? __builtin_clz(x) / 8 : 4;
+  unsigned trail = x ? __builtin_ctz(x) / 8 : 0;
+  out.push_back((uint8_t)(lead << 3 | trail));
+  for (int i = 3 - (int)lead; i >= (int)trail; i--) out.push_back((uint8_t)(x >> (i * 8)));
+}
+
+static inline uint32_t getXor(const uint8_t*& p, const uint8_t* end) {
+  if (p >= end) return 0;
+  uint8_t control = *p++;
+  unsigned lead = (control >> 3) & 7, trail = control & 7;
+  uint32_t x = 0;
+  for (int i = 3 - (int)lead; i >= (int)trail && p < end; i--) x |= (uint32_t)*p++ << (i * 8);
+  return x;
+}
+
+enum Column { COLUMN_TIME, COLUMN_CO2, COLUMN_TEMPERATURE, COLUMN_HUMIDITY, COLUMN_COUNT };
+
+struct BlockHeader {
+  uint32_t bytes;      // Whole block including this header, multiple of 8
+  uint16_t count;
+  uint16_t reserved;
+  int64_t firstTime;
+  int64_t lastTime;
+  uint32_t sumCO2;
+  uint16_t minCO2;
+  uint16_t maxCO2;
+  uint32_t columnBytes[COLUMN_COUNT];
+};
+
+struct SegmentHeader {
+  uint32_t magic;
+  uint32_t blocks;
+  uint64_t used;       // Bytes in use including this header; published with release
+  int64_t firstTime;
+  int64_t lastTime;
+};
+
+static void encodeBlock(const std::vector<Sample>& samples, std::vector<uint8_t>& out) {
+  std::vector<uint8_t> columns[COLUMN_COUNT];
+  BlockHeader header;
+  memset(&header, 0, sizeof header);
+  header.count = (uint16_t)samples.size();
+  header.firstTime = samples.front().time;
+  header.lastTime = samples.back().time;
+  header.minCO2 = 0xFFFF;
+
+  int64_t prevTime = header.firstTime, prevDelta = 0;
+  int32_t prevCO2 = 0;
+  uint32_t prevTemperature = 0, prevHumidity = 0;
+  for (size_t i = 0; i < samples.size(); i++) {
+    const Sample& s = samples[i];
+    int64_t delta = s.time - prevTime;
+    putVarint(columns[COLUMN_TIME], zigzag(delta - prevDelta));
+    prevTime = s.time;
+    prevDelta = delta;
+
+    putVarint(columns[COLUMN_CO2], zigzag((int32_t)s.co2 - prevCO2));
+    prevCO2 = s.co2;
+
+    uint32_t t = floatBits(s.temperature), h = floatBits(s.humidity);
+    putXor(columns[COLUMN_TEMPERATURE], t ^ prevTemperature);
+    putXor(columns[COLUMN_HUMIDITY], h ^ prevHumidity);
+    prevTemperature = t;
+    prevHumidity = h;
+
+    header.sumCO2 += s.co2;
+    header.minCO2 = std::min(header.minCO2, s.co2);
+    header.maxCO2 = std::max(header.maxCO2, s.co2);
+  }
+
+  size_t bytes = sizeof header;
+  for (int c = 0; c < COLUMN_COUNT; c++) {
+    header.columnBytes[c] = (uint32_t)columns[c].size();
+    bytes += columns[c].size();
+  }
+  header.bytes = (uint32_t)((bytes + 7) & ~(size_t)7);
+
+  out.assign(header.bytes, 0);
+  memcpy(out.data(), &header, sizeof header);
+  size_t offset = sizeof header;
+  for (int c = 0; c < COLUMN_COUNT; c++) {
+    memcpy(out.data() + offset, columns[c].data(), columns[c].size());
+    offset += columns[c].size();
+  }
+}
+
+// Decodes one column of a block alongside the time column
+class BlockReader {
+public:
+  BlockReader(const BlockHeader* header, Column column) : _header(header), _column(column), _index(0) {
+    const uint8_t* base = (const uint8_t*)(header + 1);
+    _time = base;
+    _timeEnd = _time + header->columnBytes[COLUMN_TIME];
+    _value = base;
+    for (int c = 0; c < column; c++) _value += header->columnBytes[c];
+    _valueEnd = _value + header->columnBytes[column];
+    _prevTime = header->firstTime;
+    _prevDelta = 0;
+    _prevCO2 = 0;
+    _prevBits = 0;
+  }
+
+  bool next(int64_t* time, float* value) {
+    if (_index >= _header->count) return false;
+    _index++;
+    _prevDelta += unzigzag(getVarint(_time, _timeEnd));
+    _prevTime += _prevDelta;
+    *time = _prevTime;
+    if (_column == COLUMN_CO2) {
+      _prevCO2 += (int32_t)unzigzag(getVarint(_value, _valueEnd));
+      *value = (float)_prevCO2;
+    } else {
+      _prevBits ^= getXor(_value, _valueEnd);
+      *value = bitsFloat(_prevBits);
+    }
+    return true;
+  }
+
+private:
+  const BlockHeader* _header;
+  Column _column;
+  uint16_t _index;
+  const uint8_t* _time;
+  const uint8_t* _timeEnd;
+  const uint8_t* _value;
+  const uint8_t* _valueEnd;
+  int64_t _prevTime;
+  int64_t _prevDelta;
+  int32_t _prevCO2;
+  uint32_t _prevBits;
+};
+
+// ---------------------------------------------------------------------------
+// Segments and devices
+
+struct Segment {
+  std::string path;
+  uint8_t* base = nullptr;
+  size_t size = 0;
+  bool writable = false;
+
+  SegmentHeader* header() const { return (SegmentHeader*)base; }
+  uint64_t used() const { return __atomic_load_n(&header()->used, __ATOMIC_ACQUIRE); }
+
+  ~Segment() {
+    if (base) munmap(base, size);
+  }
+};
+
+static Segment* openSegment(const std::string& path, bool writable) {
+  int fd = open(path.c_str(), writable ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+  if (fd < 0) return nullptr;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (st.st_size == 0 && (!writable || ftruncate(fd, SEGMENT_SIZE) != 0))) {
+    close(fd);
+    return nullptr;
+  }
+  size_t size = st.st_size ? (size_t)st.st_size : SEGMENT_SIZE;
+  void* base = mmap(nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) return nullptr;
+
+  Segment* segment = new Segment;
+  segment->path = path;
+  segment->base = (uint8_t*)base;
+  segment->size = size;
+  segment->writable = writable;
+  SegmentHeader* header = segment->header();
+  if (header->magic != SEGMENT_MAGIC) {
+    if (!writable) {
+      delete segment;
+      return nullptr;
+    }
+    memset(header, 0, SEGMENT_HEADER_SIZE);
+    header->magic = SEGMENT_MAGIC;
+    __atomic_store_n(&header->used, (uint64_t)SEGMENT_HEADER_SIZE, __ATOMIC_RELEASE);
+  }
+  return segment;
+}
+
+struct Device {
+  std::string name;
+  std::string dir;
+  unsigned shard = 0;
+
+  // Segment list; the writer appends, queries take a snapshot
+  std::mutex lock;
+  std::vector<std::shared_ptr<Segment>> segments;
+  uint32_t nextSequence = 0;
+
+  // Writer state, only touched by the shard that owns the device
+  std::vector<Sample> pending;
+  int64_t pendingSince = 0;
+  bool registered = false;
+
+  std::vector<std::shared_ptr<Segment>> snapshot() {
+    std::lock_guard<std::mutex> guard(lock);
+    return segments;
+  }
+};
+
+static std::string sanitize(const std::string& name) {
+  std::string out;
+  for (size_t i = 0; i < name.size() && out.size() < 64; i++) {
+    char c = name[i];
+    out += (isalnum((unsigned char)c) || c == '-' || c == '_') ? c : '_';
+  }
+  return out.empty() ? "unnamed" : out;
+}
+
+class Registry {
+public:
+  Registry(const std::string& dataDir, bool writable, unsigned shards)
+    : _dataDir(dataDir), _writable(writable), _shards(shards ? shards : 1) {
+    if (writable) mkdir(dataDir.c_str(), 0755);
+  }
+
+  // Opens the device and its existing segments; nullptr when it does not
+  // exist and `create` is false or the registry is read-only
+  Device* get(const std::string& rawName, bool create = true) {
+    std::string name = sanitize(rawName);
+    std::lock_guard<std::mutex> guard(_lock);
+    auto it = _devices.find(name);
+    if (it != _devices.end()) return it->second.get();
+
+    std::string dir = _dataDir + "/" + name;
+    if (_writable && create) {
+      mkdir(dir.c_str(), 0755);
+    } else if (access(dir.c_str(), F_OK) != 0) {
+      return nullptr;
+    }
+
+    Device* device = new Device;
+    device->name = name;
+    device->dir = dir;
+    device->shard = (unsigned)(std::hash<std::string>()(name) % _shards);
+    loadSegments(device);
+    _devices[name].reset(device);
+    return device;
+  }
+
+  std::vector<Device*> all() {
+    std::lock_guard<std::mutex> guard(_lock);
+    std::vector<Device*> devices;
+    for (auto it = _devices.begin(); it != _devices.end(); ++it) devices.push_back(it->second.get());
+    return devices;
+  }
+
+  bool writable() const { return _writable; }
+
+private:
+  std::string _dataDir;
+  bool _writable;
+  unsigned _shards;
+  std::mutex _lock;
+  std::map<std::string, std::unique_ptr<Device>> _devices;
+
+  void loadSegments(Device* device) {
+    std::vector<uint32_t> sequences;
+    DIR* dir = opendir(device->dir.c_str());
+    if (dir) {
+      while (struct dirent* entry = readdir(dir)) {
+        unsigned sequence;
+        char suffix[8];
+        if (sscanf(entry->d_name, "%8u.%4s", &sequence, suffix) == 2 && strcmp(suffix, "seg") == 0) {
+          sequences.push_back(sequence);
+        }
+      }
+      closedir(dir);
+    }
+    std::sort(sequences.begin(), sequences.end());
+    for (size_t i = 0; i < sequences.size(); i++) {
+      char file[32];
+      snprintf(file, sizeof file, "/%08u.seg", sequences[i]);
+      Segment* segment = openSegment(device->dir + file, _writable);
+      if (segment) device->segments.push_back(std::shared_ptr<Segment>(segment));
+      device->nextSequence = sequences[i] + 1;
+    }
+  }
+};
+
+// ---------------------------------------------------------------------------
+// Queries
+
+enum QueryField { FIELD_CO2, FIELD_TEMPERATURE, FIELD_HUMIDITY };
+
+struct Bucket {
+  uint32_t count = 0;
+  float min = 0;
+  float max = 0;
+  double sum = 0;
+
+  void add(uint32_t n, double total, float lo, float hi) {
+    if (count == 0 || lo < min) min = lo;
+    if (count == 0 || hi > max) max = hi;
+    count += n;
+    sum += total;
+  }
+};
+
+static bool runQuery(Device* device, int64_t from, int64_t to, int64_t bucketMs, QueryField field,
+                     std::vector<Bucket>& buckets) {
+  if (bucketMs <= 0 || to <= from) return false;
+  int64_t bucketCount = (to - from + bucketMs - 1) / bucketMs;
+  if (bucketCount > 1000000) return false;
+  buckets.assign((size_t)bucketCount, Bucket());
+
+  Column column = field == FIELD_CO2 ? COLUMN_CO2 : field == FIELD_TEMPERATURE ? COLUMN_TEMPERATURE : COLUMN_HUMIDITY;
+  std::vector<std::shared_ptr<Segment>> segments = device->snapshot();
+  for (size_t s = 0; s < segments.size(); s++) {
+    const Segment& segment = *segments[s];
+    uint64_t used = segment.used();
+    const SegmentHeader* header = segment.header();
+    if (used <= SEGMENT_HEADER_SIZE) continue;
+    if (__atomic_load_n(&header->lastTime, __ATOMIC_RELAXED) < from || __atomic_load_n(&header->firstTime, __ATOMIC_RELAXED) >= to) continue;
+
+    for (uint64_t offset = SEGMENT_HEADER_SIZE; offset + sizeof(BlockHeader) <= used;) {
+      const BlockHeader* block = (const BlockHeader*)(segment.base + offset);
+      offset += block->bytes;
+      if (block->bytes < sizeof(BlockHeader) || offset > used) break;
+      if (block->lastTime < from || block->firstTime >= to) continue;
+
+      // A CO2 block that falls in a single bucket is answered from its summary
+      int64_t first = (block->firstTime - from) / bucketMs;
+      if (field == FIELD_CO2 && block->firstTime >= from && block->lastTime < to &&
+          first == (block->lastTime - from) / bucketMs) {
+        buckets[(size_t)first].add(block->count, block->sumCO2, block->minCO2, block->maxCO2);
+        continue;
+      }
+
+      BlockReader reader(block, column);
+      int64_t time;
+      float value;
+      while (reader.next(&time, &value)) {
+        if (time < from || time >= to) continue;
+        buckets[(size_t)((time - from) / bucketMs)].add(1, value, value, value);
+      }
+    }
+  }
+  return true;
+}
+
+static std::string formatQuery(const std::vector<Bucket>& buckets, int64_t from, int64_t bucketMs) {
+  std::string out;
+  char line[128];
+  for (size_t i = 0; i < buckets.size(); i++) {
+    const Bucket& b = buckets[i];
+    if (b.count == 0) continue;
+    int n = snprintf(line, sizeof line, "%lld,%u,%.2f,%.2f,%.2f\n", (long long)(from + (int64_t)i * bucketMs),
+                     b.count, b.min, b.max, b.sum / b.count);
+    out.append(line, n);
+  }
+  out += "END\n";
+  return out;
+}
+
+static bool parseField(const char* name, QueryField* field) {
+  if (!name || strcmp(name, "co2") == 0) {
+    *field = FIELD_CO2;
+  } else if (strcmp(name, "temp") == 0) {
+    *field = FIELD_TEMPERATURE;
+  } else if (strcmp(name, "rh") == 0) {
+    *field = FIELD_HUMIDITY;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+static std::string handleQueryLine(Registry& registry, const std::string& line) {
+  char command[16], name[128], fieldName[8] = "co2";
+  long long from, to, bucketMs;
+  int fields = sscanf(line.c_str(), "%15s %127s %lld %lld %lld %7s", command, name, &from, &to, &bucketMs, fieldName);
+  QueryField field;
+  if (fields < 5 || strcmp(command, "QUERY") != 0 || !parseField(fieldName, &field)) {
+    return "ERROR usage: QUERY <device> <from ms> <to ms> <bucket ms> [co2|temp|rh]\n";
+  }
+  int64_t now = nowMs();
+  if (from <= 0) from += now;
+  if (to <= 0) to += now;
+
+  Device* device = registry.get(name, false);
+  std::vector<Bucket> buckets;
+  if (!device) return "ERROR unknown device\n";
+  if (!runQuery(device, from, to, bucketMs, field, buckets)) return "ERROR bad range\n";
+  return formatQuery(buckets, from, bucketMs);
+}
+
+// ---------------------------------------------------------------------------
+// Ingest to writer handoff
+
+struct IngestItem {
+  Device* device;
+  Sample sample;
+};
+
+// Single producer (the event loop), single consumer (one shard writer)
+class SpscRing {
+public:
+  explicit SpscRing(size_t capacity) : _items(capacity), _mask(capacity - 1), _head(0), _tail(0) {}
+
+  bool push(const IngestItem& item) {
+    size_t head = _head.load(std::memory_order_relaxed);
+    if (head - _cachedTail == _items.size()) {
+      _cachedTail = _tail.load(std::memory_order_acquire);
+      if (head - _cachedTail == _items.size()) return false;
+    }
+    _items[head & _mask] = item;
+    _head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool pop(IngestItem* item) {
+    size_t tail = _tail.load(std::memory_order_relaxed);
+    if (tail == _cachedHead) {
+      _cachedHead = _head.load(std::memory_order_acquire);
+      if (tail == _cachedHead) return false;
+    }
+    *item = _items[tail & _mask];
+    _tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+private:
+  // Producer and consumer fields sit on separate cache lines
+  std::vector<IngestItem> _items;
+  size_t _mask;
+  char _pad0[64];
+  std::atomic<size_t> _head;
+  size_t _cachedTail = 0;  // Producer's view of _tail
+  char _pad1[64];
+  std::atomic<size_t> _tail;
+  size_t _cachedHead = 0;  // Consumer's view of _head
+  char _pad2[64];
+};
+
+struct Counters {
+  std::atomic<uint64_t> received{0};
+  std::atomic<uint64_t> dropped{0};
+  std::atomic<uint64_t> stored{0};
+  std::atomic<uint64_t> storedBytes{0};
+  std::atomic<uint64_t> blocks{0};
+};
+
+class ShardWriter {
+public:
+  ShardWriter(Counters& counters, int64_t flushMs) : _ring(RING_CAPACITY), _counters(counters), _flushMs(flushMs) {}
+
+  SpscRing& ring() { return _ring; }
+
+  void run() {
+    IngestItem item;
+    int64_t lastSweep = nowMs();
+    unsigned idle = 0;
+    while (true) {
+      bool any = false;
+      for (int i = 0; i < 4096 && _ring.pop(&item); i++) {
+        append(item.device, item.sample);
+        any = true;
+      }
+
+      int64_t now = nowMs();
+      if (now - lastSweep >= 100) {
+        for (size_t i = 0; i < _devices.size(); i++) {
+          Device* device = _devices[i];
+          if (!device->pending.empty() && now - device->pendingSince >= _flushMs) flush(device);
+        }
+        lastSweep = now;
+      }
+
+      if (any) {
+        idle = 0;
+      } else if (g_stop.load()) {
+        break;
+      } else if (++idle > 64) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      } else {
+        std::this_thread::yield();
+      }
+    }
+    for (size_t i = 0; i < _devices.size(); i++) flush(_devices[i]);
+  }
+
+private:
+  SpscRing _ring;
+  Counters& _counters;
+  int64_t _flushMs;
+  std::vector<Device*> _devices;
+  std::vector<uint8_t> _block;
+
+  void append(Device* device, const Sample& sample) {
+    if (!device->registered) {
+      device->registered = true;
+      _devices.push_back(device);
+    }
+    // Blocks cover a time range in order; a reading from before the last
+    // one (a burst upload catching up) starts a block of its own
+    if (!device->pending.empty() && sample.time < device->pending.back().time) flush(device);
+    if (device->pending.empty()) device->pendingSince = nowMs();
+    device->pending.push_back(sample);
+    if (device->pending.size() >= BLOCK_SAMPLES) flush(device);
+  }
+
+  Segment* writableSegment(Device* device, size_t bytes) {
+    std::lock_guard<std::mutex> guard(device->lock);
+    if (!device->segments.empty()) {
+      Segment* last = device->segments.back().get();
+      if (last->used() + bytes <= last->size) return last;
+    }
+    char file[32];
+    snprintf(file, sizeof file, "/%08u.seg", device->nextSequence++);
+    Segment* segment = openSegment(device->dir + file, true);
+    if (!segment) return nullptr;
+    device->segments.push_back(std::shared_ptr<Segment>(segment));
+    return segment;
+  }
+
+  void flush(Device* device) {
+    if (device->pending.empty()) return;
+    encodeBlock(device->pending, _block);
+    Segment* segment = writableSegment(device, _block.size());
+    if (!segment) {
+      fprintf(stderr, "collector: cannot open a segment for %s: %s\n", device->name.c_str(), strerror(errno));
+      _counters.dropped += device->pending.size();
+      device->pending.clear();
+      return;
+    }
+
+    SegmentHeader* header = segment->header();
+    uint64_t used = segment->used();
+    memcpy(segment->base + used, _block.data(), _block.size());
+    if (header->blocks == 0 || device->pending.front().time < header->firstTime) {
+      __atomic_store_n(&header->firstTime, device->pending.front().time, __ATOMIC_RELAXED);
+    }
+    header->blocks++;
+    __atomic_store_n(&header->lastTime, std::max(header->lastTime, device->pending.back().time), __ATOMIC_RELAXED);
+    __atomic_store_n(&header->used, used + _block.size(), __ATOMIC_RELEASE);
+
+    _counters.stored += device->pending.size();
+    _counters.storedBytes += _block.size();
+    _counters.blocks++;
+    device->pending.clear();
+  }
+};
+
+// ---------------------------------------------------------------------------
+// Event loop
+
+// Parses "12.34" or "-5.6"; returns NAN when there are no digits
+static float parseDecimal(const char*& p, const char* end) {
+  bool negative = p < end && *p == '-';
+  if (negative) p++;
+  const char* start = p;
+  float value = 0;
+  while (p < end && (unsigned)(*p - '0') < 10) value = value * 10 + (*p++ - '0');
+  if (p < end && *p == '.') {
+    p++;
+    float scale = 0.1f;
+    while (p < end && (unsigned)(*p - '0') < 10) {
+      value += (*p++ - '0') * scale;
+      scale *= 0.1f;
+    }
+  }
+  if (p == start) return NAN;
+  return negative ? -value : value;
+}
+
+template <size_t N>
+static inline bool expect(const char*& p, const char* end, const char (&literal)[N]) {
+  if ((size_t)(end - p) < N - 1 || memcmp(p, literal, N - 1) != 0) return false;
+  p += N - 1;
+  return true;
+}
+
+// "CO2: 812 ppm, Temp: 21.35 C, Humidity: 48.20%", optionally after the
+// "HH:MM:SS.mmm > " prefix of the PlatformIO time filter, and optionally
+// followed by ", age: 1234 ms" (0 when missing)
+static bool parseSampleLine(const char* p, const char* end, Sample* sample, int64_t* ageMs) {
+  if (end - p > 15 && p[2] == ':' && p[13] == '>') p += 15;
+  if (!expect(p, end, "CO2: ")) return false;
+  float co2 = parseDecimal(p, end);
+  if (!expect(p, end, " ppm, Temp: ")) return false;
+  float temperature = parseDecimal(p, end);
+  if (!expect(p, end, " C, Humidity: ")) return false;
+  float humidity = parseDecimal(p, end);
+  if (!(co2 > 0 && co2 <= 40000) || isnan(temperature) || isnan(humidity)) return false;
+  *ageMs = 0;
+  if (expect(p, end, "%, age: ")) {
+    while (p < end && (unsigned)(*p - '0') < 10) *ageMs = *ageMs * 10 + (*p++ - '0');
+  }
+  sample->co2 = (uint16_t)co2;
+  sample->temperature = temperature;
+  sample->humidity = humidity;
+  return true;
+}
+
+enum ConnectionKind { CONN_INGEST_LISTEN, CONN_QUERY_LISTEN, CONN_INGEST, CONN_BRIDGE, CONN_QUERY };
+
+struct Bridge {
+  std::string name;
+  std::string host;
+  std::string port;
+  int64_t retryAt = 0;
+  bool connected = false;
+};
+
+struct Connection {
+  Connection(ConnectionKind kind, int fd) : kind(kind), fd(fd) {}
+
+  ConnectionKind kind;
+  int fd;
+  Device* device = nullptr;
+  Bridge* bridge = nullptr;
+  std::string peer;
+  std::string partial;
+  bool connecting = false;
+};
+
+static int listenOn(uint16_t port) {
+  int fd = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) return -1;
+  int on = 1, off = 0;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+  setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof off);
+  sockaddr_in6 addr;
+  memset(&addr, 0, sizeof addr);
+  addr.sin6_family = AF_INET6;
+  addr.sin6_addr = in6addr_any;
+  addr.sin6_port = htons(port);
+  if (bind(fd, (sockaddr*)&addr, sizeof addr) != 0 || listen(fd, 512) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Writes a whole reply, waiting briefly when the socket buffer is full
+static void sendAll(int fd, const std::string& data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (n > 0) {
+      sent += (size_t)n;
+    } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      pollfd pfd = { fd, POLLOUT, 0 };
+      if (poll(&pfd, 1, 1000) <= 0) return;
+    } else if (n < 0 && errno == EINTR) {
+      continue;
+    } else {
+      return;
+    }
+  }
+}
+
+class Collector {
+public:
+  Collector(Registry& registry, unsigned shards, int64_t flushMs)
+    : _registry(registry), _epoll(epoll_create1(EPOLL_CLOEXEC)) {
+    for (unsigned i = 0; i < shards; i++) _writers.emplace_back(new ShardWriter(_counters, flushMs));
+  }
+
+  bool listen(uint16_t ingestPort, uint16_t queryPort) {
+    int ingest = listenOn(ingestPort), query = listenOn(queryPort);
+    if (ingest < 0 || query < 0) return false;
+    watch(new Connection(CONN_INGEST_LISTEN, ingest), EPOLLIN);
+    watch(new Connection(CONN_QUERY_LISTEN, query), EPOLLIN);
+    return true;
+  }
+
+  void addBridge(const std::string& name, const std::string& host, const std::string& port) {
+    Bridge* bridge = new Bridge;
+    bridge->name = name;
+    bridge->host = host;
+    bridge->port = port;
+    _bridges.emplace_back(bridge);
+  }
+
+  void run() {
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < _writers.size(); i++) threads.emplace_back(&ShardWriter::run, _writers[i].get());
+
+    epoll_event events[128];
+    int64_t lastReport = nowMs();
+    uint64_t lastReceived = 0;
+    while (!g_stop.load()) {
+      int n = epoll_wait(_epoll, events, 128, 200);
+      for (int i = 0; i < n; i++) handle((Connection*)events[i].data.ptr, events[i].events);
+
+      int64_t now = nowMs();
+      for (size_t i = 0; i < _bridges.size(); i++) {
+        Bridge* bridge = _bridges[i].get();
+        if (!bridge->connected && now >= bridge->retryAt) connectBridge(bridge);
+      }
+      if (now - lastReport >= 5000) {
+        uint64_t received = _counters.received.load();
+        uint64_t stored = _counters.stored.load();
+        double ratio = stored ? (double)stored * sizeof(Sample) / _counters.storedBytes.load() : 0;
+        fprintf(stderr, "collector: %.0f samples/s, %llu stored in %llu blocks (%.1fx), %llu dropped\n",
+                (received - lastReceived) * 1000.0 / (now - lastReport), (unsigned long long)stored,
+                (unsigned long long)_counters.blocks.load(), ratio, (unsigned long long)_counters.dropped.load());
+        lastReport = now;
+        lastReceived = received;
+      }
+    }
+
+    for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+  }
+
+private:
+  Registry& _registry;
+  int _epoll;
+  Counters _counters;
+  std::vector<std::unique_ptr<ShardWriter>> _writers;
+  std::vector<std::unique_ptr<Bridge>> _bridges;
+
+  void watch(Connection* conn, uint32_t events) {
+    epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = conn;
+    epoll_ctl(_epoll, EPOLL_CTL_ADD, conn->fd, &ev);
+  }
+
+  void closeConnection(Connection* conn) {
+    epoll_ctl(_epoll, EPOLL_CTL_DEL, conn->fd, nullptr);
+    close(conn->fd);
+    if (conn->bridge) {
+      conn->bridge->connected = false;
+      conn->bridge->retryAt = nowMs() + 2000;
+    }
+    delete conn;
+  }
+
+  void connectBridge(Bridge* bridge) {
+    bridge->retryAt = nowMs() + 2000;
+    addrinfo hints, *result = nullptr;
+    memset(&hints, 0, sizeof hints);
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(bridge->host.c_str(), bridge->port.c_str(), &hints, &result) != 0 || !result) return;
+    int fd = socket(result->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int rc = fd < 0 ? -1 : connect(fd, result->ai_addr, result->ai_addrlen);
+    freeaddrinfo(result);
+    if (fd < 0 || (rc != 0 && errno != EINPROGRESS)) {
+      if (fd >= 0) close(fd);
+      return;
+    }
+    Connection* conn = new Connection(CONN_BRIDGE, fd);
+    conn->bridge = bridge;
+    conn->device = _registry.get(bridge->name);
+    conn->connecting = true;
+    bridge->connected = true;
+    watch(conn, EPOLLIN | EPOLLOUT | EPOLLRDHUP);
+  }
+
+  void accept(Connection* listener) {
+    while (true) {
+      sockaddr_storage addr;
+      socklen_t length = sizeof addr;
+      int fd = accept4(listener->fd, (sockaddr*)&addr, &length, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (fd < 0) return;
+      int on = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof on);
+
+      char host[NI_MAXHOST] = "peer";
+      getnameinfo((sockaddr*)&addr, length, host, sizeof host, nullptr, 0, NI_NUMERICHOST);
+      Connection* conn = new Connection(listener->kind == CONN_INGEST_LISTEN ? CONN_INGEST : CONN_QUERY, fd);
+      conn->peer = host;
+      watch(conn, EPOLLIN | EPOLLRDHUP);
+    }
+  }
+
+  void handle(Connection* conn, uint32_t events) {
+    if (conn->kind == CONN_INGEST_LISTEN || conn->kind == CONN_QUERY_LISTEN) {
+      accept(conn);
+      return;
+    }
+    if (conn->connecting && (events & (EPOLLOUT | EPOLLERR))) {
+      int error = 0;
+      socklen_t length = sizeof error;
+      getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &error, &length);
+      if (error != 0) {
+        closeConnection(conn);
+        return;
+      }
+      conn->connecting = false;
+      fprintf(stderr, "collector: bridge %s connected\n", conn->bridge->name.c_str());
+      epoll_event ev;
+      ev.events = EPOLLIN | EPOLLRDHUP;
+      ev.data.ptr = conn;
+      epoll_ctl(_epoll, EPOLL_CTL_MOD, conn->fd, &ev);
+    }
+
+    char buffer[65536];
+    while (true) {
+      ssize_t n = read(conn->fd, buffer, sizeof buffer);
+      if (n > 0) {
+        consume(conn, buffer, (size_t)n);
+      } else if (n < 0 && errno == EINTR) {
+        continue;
+      } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        break;
+      } else {
+        closeConnection(conn);
+        return;
+      }
+    }
+  }
+
+  // Split a read into lines, keeping an unfinished line for the next read
+  void consume(Connection* conn, const char* data, size_t size) {
+    const char* p = data;
+    const char* end = data + size;
+    while (p < end) {
+      const char* eol = (const char*)memchr(p, '\n', end - p);
+      if (!eol) {
+        if (conn->partial.size() + (end - p) > 4096) conn->partial.clear();  // Garbage without newlines
+        conn->partial.append(p, end - p);
+        return;
+      }
+      if (!conn->partial.empty()) {
+        conn->partial.append(p, eol - p);
+        line(conn, conn->partial.data(), conn->partial.data() + conn->partial.size());
+        conn->partial.clear();
+      } else {
+        line(conn, p, eol);
+      }
+      p = eol + 1;
+    }
+  }
+
+  void line(Connection* conn, const char* p, const char* end) {
+    if (end > p && end[-1] == '\r') end--;
+
+    if (conn->kind == CONN_QUERY) {
+      sendAll(conn->fd, handleQueryLine(_registry, std::string(p, end)));
+      return;
+    }
+
+    if (!conn->device && end - p > 7 && memcmp(p, "device ", 7) == 0) {
+      conn->device = _registry.get(std::string(p + 7, end));
+      return;
+    }
+
+    Sample sample;
+    int64_t ageMs;
+    if (!parseSampleLine(p, end, &sample, &ageMs)) return;
+    if (!conn->device) conn->device = _registry.get(conn->peer);
+    sample.time = nowMs() - ageMs;
+    _counters.received++;
+    if (!_writers[conn->device->shard]->ring().push(IngestItem{ conn->device, sample })) _counters.dropped++;
+  }
+};
+
+// ---------------------------------------------------------------------------
+// Load generator
+
+static int connectTo(const std::string& host, const std::string& port) {
+  addrinfo hints, *result = nullptr;
+  memset(&hints, 0, sizeof hints);
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host.c_str(), port.c_str(), &hints, &result) != 0 || !result) return -1;
+  int fd = socket(result->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd >= 0 && connect(fd, result->ai_addr, result->ai_addrlen) != 0) {
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(result);
+  return fd;
+}
+
+// Simulates devices that each send `rate` samples per second, interleaved
+// with the debug lines the firmware prints around them
+static int runLoadgen(const std::string& host, const std::string& port, unsigned devices, double rate,
+                      double seconds) {
+  unsigned threadCount = std::min(devices, std::max(1u, std::thread::hardware_concurrency()));
+  std::atomic<uint64_t> sent(0);
+  std::atomic<bool> failed(false);
+
+  auto worker = [&](unsigned first, unsigned count) {
+    struct SimDevice {
+      int fd;
+      float co2, temperature, humidity;
+      double due;
+    };
+    std::vector<SimDevice> sims;
+    uint32_t seed = first * 2654435761u + 1;
+    for (unsigned i = 0; i < count; i++) {
+      int fd = connectTo(host, port);
+      if (fd < 0) {
+        failed = true;
+        break;
+      }
+      char hello[64];
+      int n = snprintf(hello, sizeof hello, "device sim-%04u\n", first + i);
+      sendAll(fd, std::string(hello, n));
+      sims.push_back(SimDevice{ fd, 600, 18, 45, (double)i / count / rate });
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::string batch;
+    char text[160];
+    while (!failed) {
+      double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      if (elapsed >= seconds) break;
+      bool idle = true;
+      for (size_t i = 0; i < sims.size(); i++) {
+        SimDevice& sim = sims[i];
+        batch.clear();
+        while (sim.due <= elapsed) {
+          seed = seed * 1103515245 + 12345;
+          sim.co2 = std::min(5000.0f, std::max(400.0f, sim.co2 + (int)(seed >> 28) - 7));
+          sim.temperature += ((seed >> 20) & 7) * 0.01f - 0.035f;
+          sim.humidity += ((seed >> 12) & 7) * 0.02f - 0.07f;
+          int n = snprintf(text, sizeof text,
+                           "Data ready\nCO2: %u ppm, Temp: %.2f C, Humidity: %.2f%%\nNo significant change detected\n",
+                           (unsigned)sim.co2, sim.temperature, sim.humidity);
+          batch.append(text, n);
+          sim.due += 1.0 / rate;
+          sent++;
+        }
+        if (!batch.empty()) {
+          sendAll(sim.fd, batch);
+          idle = false;
+        }
+      }
+      if (idle) std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    for (size_t i = 0; i < sims.size(); i++) close(sims[i].fd);
+  };
+
+  std::vector<std::thread> threads;
+  unsigned first = 0;
+  for (unsigned t = 0; t < threadCount; t++) {
+    unsigned count = devices / threadCount + (t < devices % threadCount ? 1 : 0);
+    threads.emplace_back(worker, first, count);
+    first += count;
+  }
+  for (size_t t = 0; t < threads.size(); t++) threads[t].join();
+
+  if (failed) {
+    fprintf(stderr, "loadgen: cannot connect to %s:%s\n", host.c_str(), port.c_str());
+    return 1;
+  }
+  printf("loadgen: %u devices, %llu samples in %.1f s (%.0f samples/s)\n", devices, (unsigned long long)sent.load(),
+         seconds, sent.load() / seconds);
+  return 0;
+}
+
+// ---------------------------------------------------------------------------
+
+static void usage() {
+  fprintf(stderr,
+          "usage: collector serve [--data DIR] [--port P] [--query-port P] [--bridge NAME=HOST:PORT]...\n"
+          "                       [--shards N] [--flush-ms MS]\n"
+          "       collector query <data dir> <device> <from ms> <to ms> <bucket ms> [co2|temp|rh]\n"
+          "       collector loadgen [--host H] [--port P] [--devices N] [--rate R] [--seconds S]\n");
+}
+
+static void onSignal(int) {
+  g_stop = true;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    usage();
+    return 2;
+  }
+  std::string mode = argv[1];
+
+  if (mode == "query") {
+    if (argc < 7) {
+      usage();
+      return 2;
+    }
+    Registry registry(argv[2], false, 1);
+    std::string line = std::string("QUERY ") + argv[3] + " " + argv[4] + " " + argv[5] + " " + argv[6];
+    if (argc > 7) line += std::string(" ") + argv[7];
+    std::string answer = handleQueryLine(registry, line);
+    fputs(answer.c_str(), stdout);
+    return answer.compare(0, 5, "ERROR") == 0 ? 1 : 0;
+  }
+
+  std::map<std::string, std::string> options;
+  std::vector<std::string> bridges;
+  for (int i = 2; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "--bridge") == 0) {
+      bridges.push_back(argv[i + 1]);
+    } else {
+      options[argv[i]] = argv[i + 1];
+    }
+  }
+  auto option = [&](const char* name, const char* fallback) {
+    auto it = options.find(name);
+    return it == options.end() ? std::string(fallback) : it->second;
+  };
+
+  if (mode == "loadgen") {
+    return runLoadgen(option("--host", "127.0.0.1"), option("--port", "7700"),
+                      (unsigned)atoi(option("--devices", "50").c_str()), atof(option("--rate", "100").c_str()),
+                      atof(option("--seconds", "10").c_str()));
+  }
+  if (mode != "serve") {
+    usage();
+    return 2;
+  }
+
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+  signal(SIGPIPE, SIG_IGN);
+
+  unsigned shards = std::max(1, atoi(option("--shards", "2").c_str()));
+  Registry registry(option("--data", "telemetry"), true, shards);
+  Collector collector(registry, shards, atoll(option("--flush-ms", "10000").c_str()));
+  uint16_t port = (uint16_t)atoi(option("--port", "7700").c_str());
+  uint16_t queryPort = (uint16_t)atoi(option("--query-port", "7701").c_str());
+  if (!collector.listen(port, queryPort)) {
+    fprintf(stderr, "collector: cannot listen on ports %u/%u: %s\n", port, queryPort, strerror(errno));
+    return 1;
+  }
+  for (size_t i = 0; i < bridges.size(); i++) {
+    size_t eq = bridges[i].find('='), colon = bridges[i].rfind(':');
+    if (eq == std::string::npos || colon == std::string::npos || colon < eq) {
+      fprintf(stderr, "collector: bad bridge %s, expected NAME=HOST:PORT\n", bridges[i].c_str());
+      return 2;
+    }
+    collector.addBridge(bridges[i].substr(0, eq), bridges[i].substr(eq + 1, colon - eq - 1),
+                        bridges[i].substr(colon + 1));
+  }
+
+  fprintf(stderr, "collector: ingest on %u, queries on %u, %u shards\n", port, queryPort, shards);
+  collector.run();
+  fprintf(stderr, "collector: stopped\n");
+  return 0;
+}
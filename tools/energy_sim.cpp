@@ -0,0 +1,354 @@
+// Battery discharge against the energy policy (host program, not part of
+// the firmware).
+//
+// Build against the firmware sources and the host Arduino layer:
+//   g++ -O2 -std=c++11 -Itools/host -Iinclude tools/energy_sim.cpp src/EnergyGovernor.cpp tools/host/Arduino.cpp -o energy_sim
+//
+// Usage:
+//   energy_sim [--capacity MAH] [--cars N] [--mcu-ma MA] [--seed N] [--verbose 1]
+//
+// Drains a LiPo pack through EnergyGovernor the way the firmware loop does:
+// the governor reads the pack through the ADC divider at every poll, the
+// sensor mode, poll interval, history window and refresh budget follow its
+// policy, and a refresh is due after a history entry or a significant CO2
+// change. The pack's resting voltage follows the governor's own discharge
+// curve and sags with the load. The garage sits near outdoor CO2, with cars
+// started a few times a day at random: a jump of several hundred ppm that
+// airs out over the next hour, some of them past the alarm threshold. The
+// temperature follows the day, so refreshes also come at times unrelated
+// to the history window.
+//
+// Setups:
+//   unlimited   the governor sees external power, so nothing is scaled down
+//   drop        refreshes over budget are dropped until the next change
+//   pending     refreshes over budget stay pending until the budget allows
+//               one (what main.cpp does)
+//
+// Output is CSV: setup, hours until the pack is empty, hours at each
+// power level, refreshes, deferred refreshes, pending retries shown, the
+// longest time an update waited for the panel (min), alarms and the
+// slowest alarm (s) from the CO2 crossing the threshold to the panel
+// showing it. Exits with 1 when the pending setup lets an update wait
+// longer than one refresh budget period or delays an alarm by more than a
+// single shot interval.
+
+#include <algorithm>
+#include <random>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include <Arduino.h>
+#include "EnergyGovernor.h"
+
+// Same as main.cpp
+static const uint8_t BATTERY_ADC_PIN = 35;
+static const float BATTERY_DIVIDER = 2.0f;
+static const int CO2_ALARM_THRESHOLD = 1000;
+static const unsigned long SENSOR_POLL_INTERVAL = 30000;
+static const unsigned long HISTORY_INTERVAL = 300000;
+static const int CO2_THRESHOLD = 50;
+static const float TEMP_THRESHOLD = 0.5f;
+
+// Supply currents (mA) and charge per event (mA*s)
+static const float SCD4X_PERIODIC_MA = 15.0f;   // Periodic measurement, average
+static const float SCD4X_LOW_POWER_MA = 3.2f;   // Low power periodic measurement, average
+static const float SCD4X_SHOT_MAS = 135.0f;     // One CO2 single shot (5 s at ~27 mA)
+static const float SCD4X_RHT_SHOT_MAS = 2.5f;   // One RHT only shot
+static const float REFRESH_MAS = 60.0f;         // Full e-paper refresh
+static const float INTERNAL_OHMS = 0.15f;       // Pack and wiring resistance, for the sag
+
+static const unsigned long STEP_MS = 1000;
+static const unsigned long OUTDOOR_CO2 = 430;
+
+enum Setup { SETUP_UNLIMITED, SETUP_DROP, SETUP_PENDING };
+
+// The pack behind the divider; the ADC sees half its voltage with a few mV
+// of noise
+class Pack : public HostPins {
+public:
+  Pack(float capacityMah, uint32_t seed)
+    : _capacityMas(capacityMah * 3600.0f), _usedMas(0), _loadMa(0), _external(false), _noise(seed) {}
+
+  void setExternal(bool external) { _external = external; }
+  void setLoad(float ma) { _loadMa = ma; }
+  void draw(float mas) { _usedMas += mas; }
+
+  float charge() const {
+    float left = 1.0f - _usedMas / _capacityMas;
+    return left > 0 ? left * 100.0f : 0;
+  }
+
+  bool empty() const { return charge() <= 0; }
+
+  uint16_t restingMillivolts() const {
+    // Invert the governor's curve, so its estimate matches the model
+    float target = charge();
+    uint16_t low = 3300;
+    uint16_t high = 4200;
+    while (low < high) {
+      uint16_t mid = (low + high + 1) / 2;
+      if (EnergyGovernor::chargeFromMillivolts(mid) <= target) {
+        low = mid;
+      } else {
+        high = mid - 1;
+      }
+    }
+    return low;
+  }
+
+  void mode(uint8_t, uint8_t) {}
+  void write(uint8_t, uint8_t) {}
+  int read(uint8_t) { return HIGH; }
+  uint32_t readMilliVolts(uint8_t pin) {
+    if (pin != BATTERY_ADC_PIN || _external) {
+      return 0;
+    }
+    std::uniform_int_distribution<int> noise(-8, 8);
+    float mv = restingMillivolts() - _loadMa * INTERNAL_OHMS + noise(_noise);
+    return (uint32_t)(mv / BATTERY_DIVIDER);
+  }
+
+private:
+  float _capacityMas;
+  float _usedMas;
+  float _loadMa;
+  bool _external;
+  std::mt19937 _noise;
+};
+
+struct Car {
+  unsigned long start;   // ms
+  float peak;            // ppm above outdoor
+};
+
+// CO2 in the garage over time: each car adds a rise over three minutes
+// that airs out with a 40 minute time constant
+static float garageCo2(const std::vector<Car>& cars, unsigned long now) {
+  float co2 = OUTDOOR_CO2;
+  for (size_t i = 0; i < cars.size(); i++) {
+    if (now < cars[i].start) {
+      break;
+    }
+    float t = (now - cars[i].start) / 60000.0f;
+    if (t < 3) {
+      co2 += cars[i].peak * t / 3;
+    } else {
+      co2 += cars[i].peak * expf(-(t - 3) / 40.0f);
+    }
+  }
+  return co2;
+}
+
+// Temperature over the day (4 degrees either side of 15, warmest at 15:00)
+static float garageTemperature(unsigned long now) {
+  return 15.0f + 4.0f * sinf((now % 86400000UL - 9 * 3600000UL) * (float)(2 * M_PI / 86400000.0));
+}
+
+static std::vector<Car> makeCars(int perDay, uint32_t seed) {
+  std::mt19937 rng(seed);
+  std::vector<Car> cars;
+  const unsigned long days = 14;
+  for (unsigned long d = 0; d < days; d++) {
+    std::uniform_int_distribution<unsigned long> when(d * 86400000UL + 6 * 3600000UL,
+                                                      d * 86400000UL + 22 * 3600000UL);
+    std::uniform_real_distribution<float> peak(300, 1300);
+    for (int i = 0; i < perDay; i++) {
+      Car car = { when(rng), peak(rng) };
+      cars.push_back(car);
+    }
+  }
+  std::sort(cars.begin(), cars.end(), [](const Car& a, const Car& b) { return a.start < b.start; });
+  return cars;
+}
+
+struct Result {
+  float hours;
+  float levelHours[4];
+  uint32_t refreshes;
+  uint32_t deferred;
+  uint32_t retried;
+  float maxWaitMin;
+  uint32_t alarms;
+  float maxAlarmS;
+};
+
+static Result run(Setup setup, const std::vector<Car>& cars, float capacityMah, float mcuMa, uint32_t seed) {
+  Result result;
+  memset(&result, 0, sizeof(result));
+
+  Pack pack(capacityMah, seed);
+  pack.setExternal(setup == SETUP_UNLIMITED);
+  hostAttachPins(&pack);
+  hostSetMicros(0);
+
+  EnergyGovernor governor(BATTERY_ADC_PIN, BATTERY_DIVIDER, CO2_ALARM_THRESHOLD,
+                          SENSOR_POLL_INTERVAL, HISTORY_INTERVAL);
+  governor.begin();
+
+  unsigned long lastPoll = 0;
+  unsigned long lastShot = 0;
+  unsigned long windowStart = 0;
+  float reading = OUTDOOR_CO2;
+  float shown = OUTDOOR_CO2;
+  float shownTemperature = garageTemperature(0);
+  bool refreshPending = false;
+  unsigned long waitingSince = 0;      // First deferred update not shown yet
+  bool waiting = false;
+  bool aboveTruth = false;
+  unsigned long crossedAt = 0;
+  bool alarmOpen = false;
+
+  for (unsigned long now = STEP_MS; !pack.empty(); now += STEP_MS) {
+    hostAdvance(STEP_MS * 1000UL);
+    const EnergyPolicy& policy = governor.getPolicy();
+
+    // The alarm clock starts when the air crosses the threshold
+    float truth = garageCo2(cars, now);
+    if (truth >= CO2_ALARM_THRESHOLD && !aboveTruth) {
+      crossedAt = now;
+      alarmOpen = true;
+    }
+    aboveTruth = truth >= CO2_ALARM_THRESHOLD;
+
+    // Background draw of the sensor in its current mode
+    float sensorMa = policy.co2ShotInterval ? 0 : (policy.lowPowerSensor ? SCD4X_LOW_POWER_MA : SCD4X_PERIODIC_MA);
+    pack.setLoad(mcuMa + sensorMa);
+    pack.draw((mcuMa + sensorMa) * STEP_MS / 1000.0f);
+
+    if (now - lastPoll < governor.getPollInterval((uint16_t)reading)) {
+      continue;
+    }
+    lastPoll = now;
+    governor.update(now);
+
+    // A CO2 single shot when one is due (or on every poll near the
+    // threshold), otherwise RHT only
+    if (policy.co2ShotInterval == 0) {
+      reading = truth;
+    } else if (now - lastShot >= policy.co2ShotInterval || reading >= CO2_ALARM_THRESHOLD * 8 / 10) {
+      reading = truth;
+      lastShot = now;
+      pack.draw(SCD4X_SHOT_MAS);
+    } else {
+      pack.draw(SCD4X_RHT_SHOT_MAS);
+    }
+
+    bool historyTick = now - windowStart >= policy.historyInterval;
+    if (historyTick) {
+      windowStart = now;
+    }
+    float temperature = garageTemperature(now);
+    bool dirty = historyTick || fabsf(reading - shown) >= CO2_THRESHOLD ||
+                 fabsf(temperature - shownTemperature) >= TEMP_THRESHOLD;
+    if (dirty && !waiting) {
+      waiting = true;
+      waitingSince = now;
+    }
+
+    if (dirty || (setup == SETUP_PENDING && refreshPending)) {
+      bool alarmChanged = (reading >= CO2_ALARM_THRESHOLD) != (shown >= CO2_ALARM_THRESHOLD);
+      if (!governor.allowRefresh(alarmChanged, now)) {
+        result.deferred++;
+        refreshPending = true;
+      } else {
+        if (!dirty) {
+          result.retried++;
+        }
+        shown = reading;
+        shownTemperature = temperature;
+        refreshPending = false;
+        result.refreshes++;
+        pack.draw(REFRESH_MAS);
+        if (waiting) {
+          float wait = (now - waitingSince) / 60000.0f;
+          if (wait > result.maxWaitMin) {
+            result.maxWaitMin = wait;
+          }
+          waiting = false;
+        }
+        if (alarmOpen && shown >= CO2_ALARM_THRESHOLD) {
+          float latency = (now - crossedAt) / 1000.0f;
+          if (latency > result.maxAlarmS) {
+            result.maxAlarmS = latency;
+          }
+          result.alarms++;
+          alarmOpen = false;
+        }
+      }
+    }
+
+    result.levelHours[governor.getPolicy().level] += governor.getPollInterval((uint16_t)reading) / 3600000.0f;
+    result.hours = now / 3600000.0f;
+  }
+
+  hostAttachPins(nullptr);
+  return result;
+}
+
+int main(int argc, char** argv) {
+  float capacity = 1200;
+  int carsPerDay = 4;
+  float mcuMa = 25;
+  uint32_t seed = 1;
+  bool verbose = false;
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 >= argc) {
+      fprintf(stderr, "%s needs a value\n", argv[i]);
+      return 2;
+    }
+    if (!strcmp(argv[i], "--capacity")) {
+      capacity = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--cars")) {
+      carsPerDay = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--mcu-ma")) {
+      mcuMa = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--seed")) {
+      seed = (uint32_t)atol(argv[++i]);
+    } else if (!strcmp(argv[i], "--verbose")) {
+      verbose = atoi(argv[++i]) != 0;
+    } else {
+      fprintf(stderr, "unknown option %s\n", argv[i]);
+      return 2;
+    }
+  }
+  if (capacity <= 0 || carsPerDay <= 0 || mcuMa <= 0 || seed == 0) {
+    fprintf(stderr, "All options must be positive\n");
+    return 2;
+  }
+
+  // The governor logs its level changes
+  hostSerialOutput(verbose ? stderr : nullptr);
+  std::vector<Car> cars = makeCars(carsPerDay, seed);
+
+  struct Named {
+    const char* name;
+    Setup setup;
+  };
+  const Named setups[] = {
+    { "unlimited", SETUP_UNLIMITED },
+    { "drop", SETUP_DROP },
+    { "pending", SETUP_PENDING },
+  };
+
+  printf("setup,hours,normal_h,saving_h,critical_h,refreshes,deferred,retried,max_wait_min,alarms,max_alarm_s\n");
+  bool pass = true;
+  for (size_t i = 0; i < sizeof(setups) / sizeof(setups[0]); i++) {
+    Result r = run(setups[i].setup, cars, capacity, mcuMa, seed);
+    printf("%s,%.1f,%.1f,%.1f,%.1f,%u,%u,%u,%.1f,%u,%.0f\n", setups[i].name, r.hours,
+           r.levelHours[POWER_NORMAL] + r.levelHours[POWER_EXTERNAL], r.levelHours[POWER_SAVING],
+           r.levelHours[POWER_CRITICAL], r.refreshes, r.deferred, r.retried, r.maxWaitMin, r.alarms,
+           r.maxAlarmS);
+
+    // Two refreshes an hour at the lowest level, plus the polls it takes
+    // to notice the budget is back
+    if (setups[i].setup == SETUP_PENDING &&
+        (r.maxWaitMin > 30 + 2 * SENSOR_POLL_INTERVAL * 2 / 60000.0f || r.maxAlarmS > 120 + SENSOR_POLL_INTERVAL / 1000)) {
+      pass = false;
+    }
+  }
+  printf("%s\n", pass ? "PASS" : "FAIL");
+  return pass ? 0 : 1;
+}
@@ -0,0 +1,208 @@
+// Read throughput of the flash history: records walked in place through
+// the memory mapping against copies read into RAM, the way a filesystem or
+// esp_partition_read() hands them out (host program, not part of the
+// firmware).
+//
+// Build against the firmware sources:
+//   g++ -O2 -std=c++11 -Iinclude tools/flash_bench.cpp src/FlashHistory.cpp -o flash_bench
+//
+// Usage:
+//   flash_bench [--image FILE] [--records N] [--rounds N]
+//
+// Fills a partition image through FlashHistory (the ring wraps when there
+// are more records than its 8192 slots), reopens it as at boot and reads
+// the newest 48 records (the 24 h chart), 1024 records and the whole ring
+// three ways:
+//   mmap     HistoryCursor over the mapping, no copies
+//   sector   pread() of each 4 KB sector into a buffer, then a walk of it
+//   record   one pread() per record into a stack copy
+// Every way checks each record's checksum and sums the CO2 values; the sums
+// must agree. The image is written to --image (default: a file in /tmp
+// that is removed afterwards).
+//
+// Options:
+//   --image FILE   partition image to use
+//   --records N    records to append (default: 20000)
+//   --rounds N     passes per measurement, best one counts (default: 50)
+//
+// Output is CSV: window (records read), method, records found, CO2 sum,
+// time per pass (us), million records/s and MB/s of record data.
+
+#include <chrono>
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "FlashHistory.h"
+
+struct Result {
+  uint32_t found;
+  uint64_t sum;
+};
+
+static Result readMapped(const FlashHistory& history, uint32_t window) {
+  Result result = { 0, 0 };
+  HistoryCursor cursor = history.newest(window);
+  while (const HistoryRecord* record = cursor.next()) {
+    result.found++;
+    result.sum += record->co2;
+  }
+  return result;
+}
+
+// Slot range of the newest `window` records, as FlashHistory::newest()
+static uint32_t firstSlot(const FlashHistory& history, uint32_t window) {
+  return (history.head() + history.capacity() - window) % history.capacity();
+}
+
+static Result readSectors(int fd, const FlashHistory& history, uint32_t window) {
+  Result result = { 0, 0 };
+  static HistoryRecord buffer[FlashHistory::RECORDS_PER_SECTOR];
+  uint32_t slot = firstSlot(history, window);
+  uint32_t remaining = window;
+  while (remaining > 0) {
+    uint32_t sector = slot / FlashHistory::RECORDS_PER_SECTOR;
+    uint32_t offset = slot % FlashHistory::RECORDS_PER_SECTOR;
+    if (pread(fd, buffer, FlashHistory::SECTOR_SIZE, (off_t)sector * FlashHistory::SECTOR_SIZE) !=
+        (ssize_t)FlashHistory::SECTOR_SIZE) {
+      break;
+    }
+    for (uint32_t i = offset; i < FlashHistory::RECORDS_PER_SECTOR && remaining > 0; i++, remaining--) {
+      if (FlashHistory::isValid(buffer[i])) {
+        result.found++;
+        result.sum += buffer[i].co2;
+      }
+      slot = (slot + 1) % history.capacity();
+    }
+  }
+  return result;
+}
+
+static Result readRecords(int fd, const FlashHistory& history, uint32_t window) {
+  Result result = { 0, 0 };
+  uint32_t slot = firstSlot(history, window);
+  for (uint32_t i = 0; i < window; i++) {
+    HistoryRecord record;
+    if (pread(fd, &record, sizeof(record), (off_t)slot * sizeof(record)) != (ssize_t)sizeof(record)) {
+      break;
+    }
+    if (FlashHistory::isValid(record)) {
+      result.found++;
+      result.sum += record.co2;
+    }
+    slot = (slot + 1) % history.capacity();
+  }
+  return result;
+}
+
+int main(int argc, char** argv) {
+  const char* image = nullptr;
+  uint32_t records = 20000;
+  int rounds = 50;
+
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 >= argc) {
+      fprintf(stderr, "%s needs a value\n", argv[i]);
+      return 2;
+    }
+    if (!strcmp(argv[i], "--image")) {
+      image = argv[++i];
+    } else if (!strcmp(argv[i], "--records")) {
+      records = (uint32_t)atol(argv[++i]);
+    } else if (!strcmp(argv[i], "--rounds")) {
+      rounds = atoi(argv[++i]);
+    } else {
+      fprintf(stderr, "unknown option %s\n", argv[i]);
+      return 2;
+    }
+  }
+  if (records == 0 || rounds <= 0) {
+    fprintf(stderr, "All options must be positive\n");
+    return 2;
+  }
+
+  char temporary[] = "/tmp/flash_bench.XXXXXX";
+  if (!image) {
+    int fd = mkstemp(temporary);
+    if (fd < 0) {
+      perror("mkstemp");
+      return 1;
+    }
+    close(fd);
+    image = temporary;
+  }
+
+  // A day cycle of CO2 every 2880 records (30 s apart)
+  {
+    FlashHistory writer(image);
+    if (!writer.begin()) {
+      return 1;
+    }
+    for (uint32_t i = 0; i < records; i++) {
+      uint16_t co2 = (uint16_t)(700 + 450 * sin(2 * M_PI * (i % 2880) / 2880.0));
+      if (!writer.append(co2, 21.0f, 45.0f, i * 30)) {
+        fprintf(stderr, "append failed\n");
+        return 1;
+      }
+    }
+  }
+
+  FlashHistory history(image);
+  int fd = open(image, O_RDONLY);
+  if (!history.begin() || fd < 0) {
+    fprintf(stderr, "cannot reopen %s\n", image);
+    return 1;
+  }
+
+  typedef Result (*Reader)(int, const FlashHistory&, uint32_t);
+  struct Method {
+    const char* name;
+    Reader read;
+  };
+  const Method methods[] = {
+    { "mmap", [](int, const FlashHistory& h, uint32_t w) { return readMapped(h, w); } },
+    { "sector", readSectors },
+    { "record", readRecords },
+  };
+  const uint32_t windows[] = { 48, 1024, history.capacity() };
+
+  printf("window,method,found,co2_sum,us_per_pass,mrecords_per_s,mb_per_s\n");
+  bool agree = true;
+  for (uint32_t window : windows) {
+    Result reference = { 0, 0 };
+    for (size_t m = 0; m < sizeof(methods) / sizeof(methods[0]); m++) {
+      Result result = { 0, 0 };
+      double best = 1e30;
+      for (int round = 0; round < rounds; round++) {
+        auto start = std::chrono::steady_clock::now();
+        result = methods[m].read(fd, history, window);
+        double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        if (us < best) {
+          best = us;
+        }
+      }
+      if (m == 0) {
+        reference = result;
+      } else if (result.found != reference.found || result.sum != reference.sum) {
+        agree = false;
+      }
+      double perSecond = window / best;
+      printf("%u,%s,%u,%llu,%.2f,%.2f,%.1f\n", window, methods[m].name, result.found,
+             (unsigned long long)result.sum, best, perSecond, perSecond * sizeof(HistoryRecord));
+    }
+  }
+
+  close(fd);
+  if (image == temporary) {
+    unlink(temporary);
+  }
+  if (!agree) {
+    fprintf(stderr, "Methods disagree\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,446 @@
+// Packs Adafruit GFX fonts into PackedFont headers, and measures what that
+// saves and what drawing from them costs (host program, not part of the
+// firmware).
+//
+// Build against the firmware sources:
+//   g++ -O2 -std=c++11 -Iinclude tools/fontpack.cpp src/PackedFont.cpp src/GlyphCache.cpp src/RasterKernels.cpp -o fontpack
+//
+// Usage:
+//   fontpack [--out DIR] <GFX font headers...>
+//   fontpack --bench [--text S] [--rounds N] <GFX font headers...>
+//
+// Input is the font headers as fontconvert writes them, e.g. those of the
+// Adafruit GFX library under .pio/libdeps/<env>/Adafruit GFX Library/Fonts.
+// Every glyph is packed and decoded back, and must come back bit for bit
+// and be small enough for the GlyphCache.
+//
+// Without --bench, lists per font the glyph bitmap bytes raw and packed,
+// and the flash saved (the glyph table and font struct stay the same
+// size). With --out, also writes DIR/<font name>.h declaring a PackedFont
+// under the GFX font's name; with DIR include/packed the firmware draws
+// from them unchanged when built with -D PACKED_FONTS.
+//
+// With --bench, draws the text into a frame buffer over and over, the way
+// Display does: from the GFX bitmaps (realigning each row), from the packed
+// streams decoding every glyph, and through a GlyphCache.
+//
+// Options:
+//   --out DIR       write the packed headers to DIR
+//   --text S        text to draw (default: "1234 ppm CO2 Temp 21.5C Humidity 48%")
+//   --rounds N      times the text is drawn per measurement (default: 20000)
+//
+// Output is CSV: font, glyphs, bitmap bytes, packed bytes, bytes saved,
+// ratio, largest decoded glyph (bytes); with --bench, per font and way of
+// drawing, glyphs per second, ns per glyph and the cache hit rate.
+
+#include <chrono>
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "GlyphCache.h"
+#include "PackedFont.h"
+#include "RasterKernels.h"
+
+// The display's frame buffer
+static const uint16_t WIDTH = 648;
+static const uint16_t HEIGHT = 480;
+static const uint16_t STRIDE = WIDTH / 8;
+
+struct GfxFont {
+  std::string path;
+  std::string name;
+  std::vector<uint8_t> bitmap;
+  std::vector<PackedGlyph> glyphs;    // offset is into bitmap here
+  uint16_t first;
+  uint16_t last;
+  uint8_t yAdvance;
+};
+
+struct Packed {
+  std::vector<uint8_t> data;
+  std::vector<PackedGlyph> glyphs;
+  PackedFont font;
+  uint32_t largest;
+};
+
+static std::string readFile(const char* path) {
+  std::string text;
+  FILE* file = fopen(path, "rb");
+  if (!file) {
+    return text;
+  }
+  char buffer[4096];
+  size_t count;
+  while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    text.append(buffer, count);
+  }
+  fclose(file);
+  return text;
+}
+
+// Numbers between the braces of the array declared after `marker`
+static bool readArray(const std::string& text, const char* marker, std::vector<long>& values) {
+  size_t at = text.find(marker);
+  size_t open = at == std::string::npos ? at : text.find('{', at);
+  if (open == std::string::npos) {
+    return false;
+  }
+  const char* p = text.c_str() + open + 1;
+  int depth = 1;
+  while (*p && depth > 0) {
+    if (*p == '{') {
+      depth++;
+    } else if (*p == '}') {
+      depth--;
+    } else if (*p == '/' && p[1] == '/') {
+      p = strchr(p, '\n');
+      if (!p) {
+        break;
+      }
+    } else if (isdigit((unsigned char)*p) || (*p == '-' && isdigit((unsigned char)p[1]))) {
+      char* end;
+      values.push_back(strtol(p, &end, 0));
+      p = end;
+      continue;
+    }
+    p++;
+  }
+  return depth == 0;
+}
+
+static bool parseFont(const char* path, GfxFont& font) {
+  std::string text = readFile(path);
+  if (text.empty()) {
+    fprintf(stderr, "fontpack: cannot read %s\n", path);
+    return false;
+  }
+
+  // const GFXfont <name> PROGMEM = { bitmaps, glyphs, first, last, yAdvance };
+  size_t at = text.find("const GFXfont ");
+  if (at == std::string::npos) {
+    fprintf(stderr, "fontpack: %s: no GFXfont\n", path);
+    return false;
+  }
+  at += strlen("const GFXfont ");
+  size_t end = text.find_first_of(" \t=", at);
+  font.path = path;
+  font.name = text.substr(at, end - at);
+
+  std::vector<long> bitmap, glyphs, header;
+  if (!readArray(text, "Bitmaps[]", bitmap) || !readArray(text, "Glyphs[]", glyphs) || glyphs.size() % 6 != 0) {
+    fprintf(stderr, "fontpack: %s: cannot parse the bitmap or glyph table\n", path);
+    return false;
+  }
+  // The fields after the two pointers
+  size_t open = text.find('{', end);
+  size_t close = open == std::string::npos ? open : text.find('}', open);
+  if (close != std::string::npos) {
+    std::string fields = text.substr(open + 1, close - open - 1);
+    size_t comma = fields.find(',', fields.find(',') + 1);
+    while (comma != std::string::npos) {
+      header.push_back(strtol(fields.c_str() + comma + 1, nullptr, 0));
+      comma = fields.find(',', comma + 1);
+    }
+  }
+  if (header.size() != 3 || header[1] - header[0] + 1 != (long)glyphs.size() / 6) {
+    fprintf(stderr, "fontpack: %s: glyph table does not match the font range\n", path);
+    return false;
+  }
+
+  for (long value : bitmap) {
+    font.bitmap.push_back((uint8_t)value);
+  }
+  for (size_t i = 0; i < glyphs.size(); i += 6) {
+    PackedGlyph glyph;
+    glyph.offset = (uint16_t)glyphs[i];
+    glyph.width = (uint8_t)glyphs[i + 1];
+    glyph.height = (uint8_t)glyphs[i + 2];
+    glyph.xAdvance = (uint8_t)glyphs[i + 3];
+    glyph.xOffset = (int8_t)glyphs[i + 4];
+    glyph.yOffset = (int8_t)glyphs[i + 5];
+    if (glyphs[i] + ((long)glyph.width * glyph.height + 7) / 8 > (long)font.bitmap.size()) {
+      fprintf(stderr, "fontpack: %s: glyph %zu runs past the bitmap\n", path, i / 6);
+      return false;
+    }
+    font.glyphs.push_back(glyph);
+  }
+  font.first = (uint16_t)header[0];
+  font.last = (uint16_t)header[1];
+  font.yAdvance = (uint8_t)header[2];
+  return true;
+}
+
+// GFX glyph rows realigned to whole bytes, as Display::drawGlyph does
+static void alignRows(const GfxFont& font, const PackedGlyph& glyph, uint8_t* rows) {
+  uint16_t stride = (glyph.width + 7) / 8;
+  memset(rows, 0, (size_t)stride * glyph.height);
+  const uint8_t* bitmap = font.bitmap.data() + glyph.offset;
+  for (uint32_t bit = 0; bit < (uint32_t)glyph.width * glyph.height; bit++) {
+    if (bitmap[bit / 8] & (0x80 >> (bit % 8))) {
+      uint32_t row = bit / glyph.width;
+      uint32_t x = bit % glyph.width;
+      rows[row * stride + x / 8] |= 0x80 >> (x % 8);
+    }
+  }
+}
+
+static bool pack(const GfxFont& font, Packed& packed) {
+  packed.largest = 0;
+  for (const PackedGlyph& glyph : font.glyphs) {
+    const uint8_t* bitmap = font.bitmap.data() + glyph.offset;
+    PackedGlyph out = glyph;
+    out.offset = (uint16_t)packed.data.size();
+    uint32_t size = packedGlyphEncode(bitmap, glyph.width, glyph.height, nullptr);
+    packed.data.resize(packed.data.size() + size);
+    packedGlyphEncode(bitmap, glyph.width, glyph.height, packed.data.data() + out.offset);
+    packed.glyphs.push_back(out);
+    if (packed.data.size() > 0xFFFF) {
+      fprintf(stderr, "fontpack: %s: packed data over 64 KB\n", font.path.c_str());
+      return false;
+    }
+  }
+  packed.font.data = packed.data.data();
+  packed.font.size = packed.data.size();
+  packed.font.glyph = packed.glyphs.data();
+  packed.font.first = font.first;
+  packed.font.last = font.last;
+  packed.font.yAdvance = font.yAdvance;
+
+  // Every glyph must come back exactly and fit the cache
+  for (size_t i = 0; i < font.glyphs.size(); i++) {
+    const PackedGlyph& glyph = font.glyphs[i];
+    uint32_t bytes = (uint32_t)(glyph.width + 7) / 8 * glyph.height;
+    std::vector<uint8_t> expected(bytes), decoded(bytes);
+    alignRows(font, glyph, expected.data());
+    if (!packedGlyphDecode(packed.font, packed.glyphs[i], decoded.data()) || decoded != expected) {
+      fprintf(stderr, "fontpack: %s: glyph 0x%02zX does not round trip\n", font.path.c_str(),
+              font.first + i);
+      return false;
+    }
+    if (bytes > GlyphCache::MAX_GLYPH_BYTES) {
+      fprintf(stderr, "fontpack: %s: glyph 0x%02zX needs %u bytes, the cache takes up to %u\n",
+              font.path.c_str(), font.first + i, bytes, GlyphCache::MAX_GLYPH_BYTES);
+      return false;
+    }
+    if (bytes > packed.largest) {
+      packed.largest = bytes;
+    }
+  }
+  return true;
+}
+
+static bool writeHeader(const char* dir, const GfxFont& font, const Packed& packed) {
+  std::string path = std::string(dir) + "/" + font.name + ".h";
+  FILE* out = fopen(path.c_str(), "w");
+  if (!out) {
+    fprintf(stderr, "fontpack: cannot write %s\n", path.c_str());
+    return false;
+  }
+
+  std::string guard = font.name + "_PACKED_H";
+  for (char& c : guard) {
+    c = (char)toupper((unsigned char)c);
+  }
+  const char* base = strrchr(font.path.c_str(), '/');
+  fprintf(out, "// %s packed by tools/fontpack from %s: glyph bitmaps of %zu bytes\n",
+          font.name.c_str(), base ? base + 1 : font.path.c_str(), font.bitmap.size());
+  fprintf(out, "// in %zu. Generated, do not edit.\n", packed.data.size());
+  fprintf(out, "#ifndef %s\n#define %s\n\n#include \"PackedFont.h\"\n\n", guard.c_str(), guard.c_str());
+
+  fprintf(out, "const uint8_t %sPacked[] = {", font.name.c_str());
+  for (size_t i = 0; i < packed.data.size(); i++) {
+    fprintf(out, "%s0x%02X%s", i % 12 ? " " : "\n  ", packed.data[i], i + 1 < packed.data.size() ? "," : "");
+  }
+  fprintf(out, " };\n\nconst PackedGlyph %sGlyphs[] = {\n", font.name.c_str());
+  for (size_t i = 0; i < packed.glyphs.size(); i++) {
+    const PackedGlyph& glyph = packed.glyphs[i];
+    unsigned c = font.first + i;
+    fprintf(out, "  { %5u, %3u, %3u, %3u, %4d, %4d }%s   // 0x%02X", glyph.offset, glyph.width, glyph.height,
+            glyph.xAdvance, glyph.xOffset, glyph.yOffset, i + 1 < packed.glyphs.size() ? "," : " };", c);
+    if (c >= 0x20 && c < 0x7F) {
+      fprintf(out, " '%c'", c);
+    }
+    fprintf(out, "\n");
+  }
+  fprintf(out, "\nconst PackedFont %s = {\n  %sPacked, sizeof(%sPacked), %sGlyphs,\n  0x%02X, 0x%02X, %u };\n",
+          font.name.c_str(), font.name.c_str(), font.name.c_str(), font.name.c_str(), font.first, font.last,
+          font.yAdvance);
+  fprintf(out, "\n#endif // %s\n", guard.c_str());
+  fclose(out);
+  return true;
+}
+
+// Blit glyph rows at (x, y), clipped rows skipped
+static void blitRows(uint8_t* frame, const uint8_t* rows, const PackedGlyph& glyph, int16_t x, int16_t y) {
+  uint16_t stride = (glyph.width + 7) / 8;
+  for (uint16_t row = 0; row < glyph.height; row++) {
+    int16_t py = y + row;
+    if (py >= 0 && py < HEIGHT) {
+      rasterBlitRow(frame + (uint32_t)py * STRIDE, x, rows + (uint32_t)row * stride, glyph.width, false);
+    }
+  }
+}
+
+// The GFX path of Display::drawGlyph: realign each row of the continuous
+// bitmap into whole bytes, then blit it
+static void blitGfx(uint8_t* frame, const GfxFont& font, const PackedGlyph& glyph, int16_t x, int16_t y) {
+  const uint8_t* bitmap = font.bitmap.data() + glyph.offset;
+  uint16_t w = glyph.width;
+  uint32_t end = ((uint32_t)w * glyph.height + 7) / 8;
+  uint8_t bits[32];
+  for (uint16_t row = 0; row < glyph.height; row++) {
+    int16_t py = y + row;
+    if (py < 0 || py >= HEIGHT) {
+      continue;
+    }
+    uint32_t bit = (uint32_t)row * w;
+    uint32_t idx = bit / 8;
+    uint8_t shift = bit % 8;
+    for (uint16_t i = 0; i < (w + 7) / 8; i++, idx++) {
+      uint8_t next = (shift && idx + 1 < end) ? bitmap[idx + 1] : 0;
+      bits[i] = shift ? (uint8_t)((bitmap[idx] << shift) | (next >> (8 - shift))) : bitmap[idx];
+    }
+    rasterBlitRow(frame + (uint32_t)py * STRIDE, x, bits, w, false);
+  }
+}
+
+enum DrawMode { DRAW_GFX, DRAW_PACKED, DRAW_CACHED, DRAW_MODES };
+static const char* const MODE_NAMES[DRAW_MODES] = { "gfx", "packed_uncached", "packed_cached" };
+
+// Draw text from the top left of the frame; returns the glyphs drawn
+static uint32_t drawText(uint8_t* frame, DrawMode mode, const GfxFont& font, const Packed& packed,
+                         GlyphCache& cache, const char* text) {
+  static uint8_t scratch[GlyphCache::MAX_GLYPH_BYTES];
+  int16_t cursorX = 0;
+  int16_t cursorY = font.yAdvance;
+  uint32_t drawn = 0;
+  for (const char* p = text; *p; p++) {
+    uint16_t c = (uint8_t)*p;
+    if (c < font.first || c > font.last) {
+      continue;
+    }
+    const PackedGlyph& glyph = packed.glyphs[c - font.first];
+    int16_t x = cursorX + glyph.xOffset;
+    int16_t y = cursorY + glyph.yOffset;
+    if (x + glyph.width > WIDTH) {
+      cursorX = 0;
+      cursorY += font.yAdvance;
+      x = glyph.xOffset;
+      y = cursorY + glyph.yOffset;
+    }
+    if (glyph.width > 0 && glyph.height > 0) {
+      if (mode == DRAW_GFX) {
+        blitGfx(frame, font, font.glyphs[c - font.first], x, y);
+      } else if (mode == DRAW_PACKED) {
+        packedGlyphDecode(packed.font, glyph, scratch);
+        blitRows(frame, scratch, glyph, x, y);
+      } else if (const uint8_t* rows = cache.get(&packed.font, c)) {
+        blitRows(frame, rows, glyph, x, y);
+      }
+      drawn++;
+    }
+    cursorX += glyph.xAdvance;
+  }
+  return drawn;
+}
+
+static bool bench(const GfxFont& font, const Packed& packed, const char* text, int rounds) {
+  std::vector<uint8_t> frames[DRAW_MODES];
+  for (int mode = 0; mode < DRAW_MODES; mode++) {
+    GlyphCache cache;
+    frames[mode].assign((size_t)STRIDE * HEIGHT, 0xFF);
+    uint32_t glyphs = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+      glyphs += drawText(frames[mode].data(), (DrawMode)mode, font, packed, cache, text);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    uint32_t lookups = cache.getHits() + cache.getMisses();
+    printf("%s,%s,%.0f,%.1f,", font.name.c_str(), MODE_NAMES[mode], glyphs / elapsed.count(),
+           elapsed.count() * 1e9 / (glyphs ? glyphs : 1));
+    if (lookups) {
+      printf("%.4f\n", (double)cache.getHits() / lookups);
+    } else {
+      printf("\n");
+    }
+  }
+  if (frames[DRAW_PACKED] != frames[DRAW_GFX] || frames[DRAW_CACHED] != frames[DRAW_GFX]) {
+    fprintf(stderr, "fontpack: %s: packed text does not match the GFX text\n", font.path.c_str());
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char** argv) {
+  const char* outDir = nullptr;
+  const char* text = "1234 ppm CO2 Temp 21.5C Humidity 48%";
+  int rounds = 20000;
+  bool benchmark = false;
+  std::vector<const char*> files;
+
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    if (arg[0] != '-') {
+      files.push_back(arg);
+    } else if (!strcmp(arg, "--bench")) {
+      benchmark = true;
+    } else if (i + 1 >= argc) {
+      fprintf(stderr, "fontpack: %s needs a value\n", arg);
+      return 2;
+    } else if (!strcmp(arg, "--out")) {
+      outDir = argv[++i];
+    } else if (!strcmp(arg, "--text")) {
+      text = argv[++i];
+    } else if (!strcmp(arg, "--rounds")) {
+      rounds = atoi(argv[++i]);
+    } else {
+      fprintf(stderr, "fontpack: unknown option %s\n", arg);
+      return 2;
+    }
+  }
+  if (files.empty() || rounds <= 0) {
+    fprintf(stderr, "Usage: fontpack [--out DIR] <fonts.h...>\n"
+                    "       fontpack --bench [--text S] [--rounds N] <fonts.h...>\n");
+    return 2;
+  }
+
+  if (benchmark) {
+    printf("font,mode,glyphs_per_s,ns_per_glyph,cache_hit_rate\n");
+  } else {
+    printf("font,glyphs,bitmap_bytes,packed_bytes,saved_bytes,ratio,largest_glyph_bytes\n");
+  }
+  uint64_t totalBitmap = 0;
+  uint64_t totalPacked = 0;
+  int failures = 0;
+  for (const char* path : files) {
+    GfxFont font;
+    Packed packed;
+    if (!parseFont(path, font) || !pack(font, packed)) {
+      failures++;
+      continue;
+    }
+    if (benchmark) {
+      failures += !bench(font, packed, text, rounds);
+      continue;
+    }
+    if (outDir && !writeHeader(outDir, font, packed)) {
+      failures++;
+      continue;
+    }
+    printf("%s,%zu,%zu,%zu,%ld,%.2f,%u\n", font.name.c_str(), font.glyphs.size(), font.bitmap.size(),
+           packed.data.size(), (long)font.bitmap.size() - (long)packed.data.size(),
+           (double)font.bitmap.size() / packed.data.size(), packed.largest);
+    totalBitmap += font.bitmap.size();
+    totalPacked += packed.data.size();
+  }
+  if (!benchmark && totalPacked > 0) {
+    printf("total,,%llu,%llu,%lld,%.2f,\n", (unsigned long long)totalBitmap, (unsigned long long)totalPacked,
+           (long long)totalBitmap - (long long)totalPacked, (double)totalBitmap / totalPacked);
+  }
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,136 @@
+// Compression ratio and speed of the frame cache codec on rendered frames.
+//
+// Build on the host (not part of the firmware), against the firmware codec:
+//   g++ -O2 -std=c++11 -Iinclude tools/frame_bench.cpp src/FrameCodec.cpp -o frame_bench
+//
+// Usage:
+//   frame_bench [--rounds N] <frames.pbm...>
+//
+// Frames are binary PBM images (P4) as written by Display::writePBM, e.g. the
+// golden frames of a rendering test. For each frame it reports the packed
+// size, and the encode, decode and chunked decode (one panel band at a time,
+// as when streaming to SPI) throughput.
+//
+// Options:
+//   --rounds N      repetitions per measurement (default: 200)
+
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "FrameCodec.h"
+
+// One band of 8 panel rows, the unit Display streams out
+static const uint32_t BAND_BYTES = 8 * 648 / 8;
+
+static bool readPBM(const char* path, std::vector<uint8_t>& frame, int& width, int& height) {
+  FILE* f = fopen(path, "rb");
+  if (!f) {
+    perror(path);
+    return false;
+  }
+
+  char magic[3] = {0};
+  bool ok = fscanf(f, "%2s %d %d", magic, &width, &height) == 3 && strcmp(magic, "P4") == 0 &&
+            width > 0 && height > 0 && fgetc(f) != EOF;
+  if (ok) {
+    // PBM uses 1 for black, the frame buffer uses 1 for white
+    frame.resize((size_t)(width + 7) / 8 * height);
+    ok = fread(frame.data(), 1, frame.size(), f) == frame.size();
+    for (size_t i = 0; i < frame.size(); i++) {
+      frame[i] = ~frame[i];
+    }
+  }
+  fclose(f);
+  if (!ok) {
+    fprintf(stderr, "%s: not a binary PBM image\n", path);
+  }
+  return ok;
+}
+
+// Seconds per call of fn, averaged over rounds calls
+template <typename F>
+static double timeIt(int rounds, F fn) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < rounds; i++) {
+    fn();
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count() / rounds;
+}
+
+int main(int argc, char** argv) {
+  int rounds = 200;
+  std::vector<const char*> files;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--rounds") == 0 && i + 1 < argc) {
+      rounds = atoi(argv[++i]);
+    } else if (argv[i][0] == '-') {
+      fprintf(stderr, "Unknown option %s\n", argv[i]);
+      return 2;
+    } else {
+      files.push_back(argv[i]);
+    }
+  }
+  if (files.empty() || rounds <= 0) {
+    fprintf(stderr, "Usage: frame_bench [--rounds N] <frames.pbm...>\n");
+    return 2;
+  }
+
+  printf("frame,bytes,packed,ratio,encode_MBps,decode_MBps,stream_MBps,decode_us\n");
+  uint64_t totalBytes = 0;
+  uint64_t totalPacked = 0;
+  int failures = 0;
+
+  for (const char* path : files) {
+    std::vector<uint8_t> frame;
+    int width;
+    int height;
+    if (!readPBM(path, frame, width, height)) {
+      failures++;
+      continue;
+    }
+
+    uint32_t length = frame.size();
+    std::vector<uint8_t> packed(packBitsBound(length));
+    std::vector<uint8_t> unpacked(length);
+    uint32_t size = packBitsEncode(frame.data(), length, packed.data());
+
+    if (!packBitsDecode(packed.data(), size, unpacked.data(), length) || unpacked != frame) {
+      fprintf(stderr, "%s: round trip mismatch\n", path);
+      failures++;
+      continue;
+    }
+
+    volatile uint32_t sink = 0;
+    double encode = timeIt(rounds, [&]() {
+      sink = packBitsEncode(frame.data(), length, packed.data());
+    });
+    double decode = timeIt(rounds, [&]() {
+      sink = packBitsDecode(packed.data(), size, unpacked.data(), length);
+    });
+    double stream = timeIt(rounds, [&]() {
+      PackBitsReader reader(packed.data(), size);
+      uint8_t band[BAND_BYTES];
+      while (uint32_t count = reader.read(band, sizeof(band))) {
+        sink += band[count - 1];
+      }
+    });
+    (void)sink;
+
+    printf("%s,%u,%u,%.1f,%.0f,%.0f,%.0f,%.1f\n", path, length, size, (double)length / size,
+           length / encode / 1e6, length / decode / 1e6, length / stream / 1e6, decode * 1e6);
+    totalBytes += length;
+    totalPacked += size;
+  }
+
+  if (totalPacked > 0) {
+    printf("total,%llu,%llu,%.1f\n", (unsigned long long)totalBytes, (unsigned long long)totalPacked,
+           (double)totalBytes / totalPacked);
+  }
+  return failures ? 1 : 0;
+}
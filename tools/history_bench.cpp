@@ -0,0 +1,153 @@
+// Chart rendering cost with and without the history segment tree.
+//
+// Build on the host (not part of the firmware), against the firmware sources:
+//   g++ -O2 -std=c++11 -Iinclude tools/history_bench.cpp src/HistoryIndex.cpp src/FlashHistory.cpp -o history_bench
+//
+// Usage:
+//   history_bench [--samples N] [--interval S] [--bars N] [--rounds N]
+//
+// Fills a history ring with synthetic samples (daily CO2 cycle plus noise,
+// with some slots erased as after a ring wrap) and computes the bars of the
+// 1h, 6h, 24h and 7d charts two ways: by scanning every record of each bar,
+// and with one HistoryIndex query per bar. Both must give the same bars.
+//
+// Options:
+//   --samples N     records in the ring (default: 100000)
+//   --interval S    seconds between records (default: 30)
+//   --bars N        bars per chart (default: 48)
+//   --rounds N      repetitions per measurement (default: 200)
+
+#include <chrono>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "FlashHistory.h"
+#include "HistoryIndex.h"
+
+struct Chart {
+  std::vector<HistoryAggregate> bars;
+  HistoryAggregate window;
+};
+
+static bool sameAggregate(const HistoryAggregate& a, const HistoryAggregate& b) {
+  return a.count == b.count && a.sum == b.sum && (a.count == 0 || (a.min == b.min && a.max == b.max));
+}
+
+// Bar i covers records [i * entries / bars, (i + 1) * entries / bars) from
+// the oldest, as in buildChart() in main.cpp
+template <typename Query>
+static void buildChart(Chart& chart, uint32_t entries, uint32_t bars, Query query) {
+  chart.bars.resize(bars);
+  for (uint32_t i = 0; i < bars; i++) {
+    uint32_t begin = (uint64_t)i * entries / bars;
+    uint32_t end = (uint64_t)(i + 1) * entries / bars;
+    chart.bars[i] = query(entries - end, end - begin);
+  }
+  chart.window = query(0, entries);
+}
+
+template <typename F>
+static double timeIt(int rounds, F fn) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < rounds; i++) {
+    fn();
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count() / rounds;
+}
+
+int main(int argc, char** argv) {
+  uint32_t samples = 100000;
+  uint32_t interval = 30;
+  uint32_t bars = 48;
+  int rounds = 200;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc) {
+      samples = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--interval") == 0 && i + 1 < argc) {
+      interval = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--bars") == 0 && i + 1 < argc) {
+      bars = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--rounds") == 0 && i + 1 < argc) {
+      rounds = atoi(argv[++i]);
+    } else {
+      fprintf(stderr, "Usage: history_bench [--samples N] [--interval S] [--bars N] [--rounds N]\n");
+      return 2;
+    }
+  }
+  if (samples == 0 || interval == 0 || bars == 0 || rounds <= 0) {
+    fprintf(stderr, "All options must be positive\n");
+    return 2;
+  }
+
+  // The ring has wrapped once: the head sits a third of the way in, and the
+  // sector after it was erased to make room
+  std::vector<HistoryRecord> records(samples);
+  uint32_t head = samples / 3;
+  srand(1);
+  for (uint32_t i = 0; i < samples; i++) {
+    uint32_t slot = (head + i) % samples;
+    HistoryRecord& record = records[slot];
+    record.sequence = i;
+    record.runTime = i * interval;
+    double day = fmod(i * (double)interval / 86400.0, 1.0);
+    record.co2 = (uint16_t)(700 + 450 * sin(2 * M_PI * day) + rand() % 80);
+    record.temperature = 2100;
+    record.humidity = 4500;
+    record.checksum = FlashHistory::computeChecksum(record);
+  }
+  for (uint32_t i = 0; i < FlashHistory::RECORDS_PER_SECTOR && i < samples; i++) {
+    memset(&records[(head + i) % samples], 0xFF, sizeof(HistoryRecord));
+  }
+
+  HistoryIndex index;
+  auto buildStart = std::chrono::steady_clock::now();
+  if (!index.begin(records.data(), samples)) {
+    fprintf(stderr, "Could not build the index\n");
+    return 1;
+  }
+  std::chrono::duration<double> build = std::chrono::steady_clock::now() - buildStart;
+  printf("%u records, index built in %.2f ms\n", samples, build.count() * 1e3);
+
+  static const uint32_t windows[] = { 1, 6, 24, 168 };
+  printf("window,records,scan_us,index_us,speedup\n");
+  int failures = 0;
+
+  for (uint32_t hours : windows) {
+    uint32_t entries = hours * 3600 / interval;
+    if (entries > samples) {
+      entries = samples;
+    }
+    uint32_t chartBars = entries < bars ? entries : bars;
+
+    auto scanQuery = [&](uint32_t skip, uint32_t count) {
+      uint32_t first = (head + 2 * samples - skip - count) % samples;
+      return HistoryIndex::scan(records.data(), samples, first, count);
+    };
+    auto indexQuery = [&](uint32_t skip, uint32_t count) {
+      return index.queryNewest(head, skip, count);
+    };
+
+    Chart scanned;
+    Chart indexed;
+    double scanTime = timeIt(rounds, [&]() { buildChart(scanned, entries, chartBars, scanQuery); });
+    double indexTime = timeIt(rounds, [&]() { buildChart(indexed, entries, chartBars, indexQuery); });
+
+    bool same = sameAggregate(scanned.window, indexed.window);
+    for (uint32_t i = 0; i < chartBars; i++) {
+      same = same && sameAggregate(scanned.bars[i], indexed.bars[i]);
+    }
+    if (!same) {
+      fprintf(stderr, "%uh: indexed bars differ from scanned bars\n", hours);
+      failures++;
+    }
+
+    printf("%uh,%u,%.1f,%.1f,%.1f\n", hours, entries, scanTime * 1e6, indexTime * 1e6, scanTime / indexTime);
+  }
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,7 @@
+#ifndef HOST_ADAFRUIT_I2CDEVICE_H
+#define HOST_ADAFRUIT_I2CDEVICE_H
+
+// Included by Adafruit_GFX.h for its bus-driven displays, which the host
+// builds don't compile; empty on purpose
+
+#endif // HOST_ADAFRUIT_I2CDEVICE_H
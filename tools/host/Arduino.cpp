@@ -0,0 +1,324 @@
+#include "Arduino.h"
+#include <stdarg.h>
+#include <string>
+
+HardwareSerial Serial;
+
+static unsigned long clockMicros = 0;
+static uint32_t cpuMhz = 240;
+static FILE* serialOut = nullptr;
+static std::string serialIn;
+
+// ---------------------------------------------------------------------------
+// Time
+
+unsigned long millis() {
+  return clockMicros / 1000;
+}
+
+unsigned long micros() {
+  return clockMicros;
+}
+
+void delay(unsigned long ms) {
+  clockMicros += ms * 1000;
+}
+
+void delayMicroseconds(unsigned int us) {
+  clockMicros += us;
+}
+
+void yield() {
+}
+
+void hostAdvance(unsigned long us) {
+  clockMicros += us;
+}
+
+void hostSetMicros(unsigned long us) {
+  clockMicros = us;
+}
+
+bool setCpuFrequencyMhz(uint32_t mhz) {
+  cpuMhz = mhz;
+  return true;
+}
+
+uint32_t getCpuFrequencyMhz() {
+  return cpuMhz;
+}
+
+long map(long x, long inMin, long inMax, long outMin, long outMax) {
+  return (x - inMin) * (outMax - outMin) / (inMax - inMin) + outMin;
+}
+
+// ---------------------------------------------------------------------------
+// Pins
+
+class DefaultPins : public HostPins {
+public:
+  DefaultPins() {
+    memset(_levels, LOW, sizeof(_levels));
+  }
+
+  void mode(uint8_t pin, uint8_t mode) {
+    if (pin < PINS && mode == INPUT_PULLUP) {
+      _levels[pin] = HIGH;
+    }
+  }
+
+  void write(uint8_t pin, uint8_t value) {
+    if (pin < PINS) {
+      _levels[pin] = value ? HIGH : LOW;
+    }
+  }
+
+  int read(uint8_t pin) {
+    return pin < PINS ? _levels[pin] : LOW;
+  }
+
+private:
+  static const uint8_t PINS = 64;
+  uint8_t _levels[PINS];
+};
+
+static DefaultPins defaultPins;
+static HostPins* pins = &defaultPins;
+
+void hostAttachPins(HostPins* model) {
+  pins = model ? model : &defaultPins;
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  pins->mode(pin, mode);
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+  pins->write(pin, value);
+}
+
+int digitalRead(uint8_t pin) {
+  return pins->read(pin);
+}
+
+void analogSetPinAttenuation(uint8_t pin, adc_attenuation_t attenuation) {
+  (void)pin;
+  (void)attenuation;
+}
+
+uint32_t analogReadMilliVolts(uint8_t pin) {
+  return pins->readMilliVolts(pin);
+}
+
+// ---------------------------------------------------------------------------
+// Serial
+
+void hostSerialOutput(FILE* out) {
+  serialOut = out;
+}
+
+void hostSerialInput(const char* text) {
+  serialIn += text;
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+  if (serialOut) {
+    fputc(c, serialOut);
+  }
+  return 1;
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) {
+  if (serialOut) {
+    fwrite(buffer, 1, size, serialOut);
+  }
+  return size;
+}
+
+int HardwareSerial::available() {
+  return serialIn.size();
+}
+
+int HardwareSerial::read() {
+  if (serialIn.empty()) {
+    return -1;
+  }
+  int c = (uint8_t)serialIn[0];
+  serialIn.erase(0, 1);
+  return c;
+}
+
+int HardwareSerial::peek() {
+  return serialIn.empty() ? -1 : (uint8_t)serialIn[0];
+}
+
+// ---------------------------------------------------------------------------
+// Print
+
+size_t Print::write(const uint8_t* buffer, size_t size) {
+  size_t n = 0;
+  while (size--) {
+    n += write(*buffer++);
+  }
+  return n;
+}
+
+size_t Print::write(const char* text) {
+  return text ? write((const uint8_t*)text, strlen(text)) : 0;
+}
+
+size_t Print::printNumber(unsigned long long value, int base, bool negative) {
+  char buffer[68];
+  char* p = buffer + sizeof(buffer) - 1;
+  *p = 0;
+  if (base < 2) {
+    base = 10;
+  }
+  do {
+    int digit = value % base;
+    *--p = digit < 10 ? '0' + digit : 'A' + digit - 10;
+    value /= base;
+  } while (value);
+  if (negative) {
+    *--p = '-';
+  }
+  return write(p);
+}
+
+size_t Print::print(const __FlashStringHelper* text) {
+  return write((const char*)text);
+}
+
+size_t Print::print(const String& text) {
+  return write(text.c_str());
+}
+
+size_t Print::print(const char* text) {
+  return write(text);
+}
+
+size_t Print::print(char c) {
+  return write((uint8_t)c);
+}
+
+size_t Print::print(unsigned char value, int base) {
+  return printNumber(value, base, false);
+}
+
+size_t Print::print(int value, int base) {
+  return print((long long)value, base);
+}
+
+size_t Print::print(unsigned int value, int base) {
+  return printNumber(value, base, false);
+}
+
+size_t Print::print(long value, int base) {
+  return print((long long)value, base);
+}
+
+size_t Print::print(unsigned long value, int base) {
+  return printNumber(value, base, false);
+}
+
+size_t Print::print(long long value, int base) {
+  // Like the Arduino core, only base 10 has a sign
+  if (base == DEC && value < 0) {
+    return printNumber(0ULL - (unsigned long long)value, base, true);
+  }
+  return printNumber((unsigned long long)value, base, false);
+}
+
+size_t Print::print(unsigned long long value, int base) {
+  return printNumber(value, base, false);
+}
+
+size_t Print::print(double value, int digits) {
+  char buffer[64];
+  snprintf(buffer, sizeof(buffer), "%.*f", digits, value);
+  return write(buffer);
+}
+
+size_t Print::println() {
+  return write("\r\n");
+}
+
+size_t Print::println(const __FlashStringHelper* text) { return print(text) + println(); }
+size_t Print::println(const String& text) { return print(text) + println(); }
+size_t Print::println(const char* text) { return print(text) + println(); }
+size_t Print::println(char c) { return print(c) + println(); }
+size_t Print::println(unsigned char value, int base) { return print(value, base) + println(); }
+size_t Print::println(int value, int base) { return print(value, base) + println(); }
+size_t Print::println(unsigned int value, int base) { return print(value, base) + println(); }
+size_t Print::println(long value, int base) { return print(value, base) + println(); }
+size_t Print::println(unsigned long value, int base) { return print(value, base) + println(); }
+size_t Print::println(long long value, int base) { return print(value, base) + println(); }
+size_t Print::println(unsigned long long value, int base) { return print(value, base) + println(); }
+size_t Print::println(double value, int digits) { return print(value, digits) + println(); }
+
+size_t Print::printf(const char* format, ...) {
+  char buffer[256];
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  if (length < 0) {
+    return 0;
+  }
+  return write((const uint8_t*)buffer, length < (int)sizeof(buffer) ? length : sizeof(buffer) - 1);
+}
+
+// ---------------------------------------------------------------------------
+// String
+
+static std::string formatNumber(unsigned long long value, unsigned char base, bool negative) {
+  std::string text;
+  if (base < 2) {
+    base = 10;
+  }
+  do {
+    int digit = value % base;
+    text.insert(text.begin(), (char)(digit < 10 ? '0' + digit : 'a' + digit - 10));
+    value /= base;
+  } while (value);
+  if (negative) {
+    text.insert(text.begin(), '-');
+  }
+  return text;
+}
+
+static std::string formatSigned(long long value, unsigned char base) {
+  if (base == 10 && value < 0) {
+    return formatNumber(0ULL - (unsigned long long)value, base, true);
+  }
+  return formatNumber((unsigned long long)value, base, false);
+}
+
+static std::string formatFloat(double value, unsigned int decimals) {
+  char buffer[64];
+  snprintf(buffer, sizeof(buffer), "%.*f", (int)decimals, value);
+  return buffer;
+}
+
+String::String(const char* text) : _text(text ? text : "") {}
+String::String(const std::string& text) : _text(text) {}
+String::String(char c) : _text(1, c) {}
+String::String(int value, unsigned char base) : _text(formatSigned(value, base)) {}
+String::String(unsigned int value, unsigned char base) : _text(formatNumber(value, base, false)) {}
+String::String(long value, unsigned char base) : _text(formatSigned(value, base)) {}
+String::String(unsigned long value, unsigned char base) : _text(formatNumber(value, base, false)) {}
+String::String(float value, unsigned int decimals) : _text(formatFloat(value, decimals)) {}
+String::String(double value, unsigned int decimals) : _text(formatFloat(value, decimals)) {}
+
+String& String::operator+=(const String& other) {
+  _text += other._text;
+  return *this;
+}
+
+String String::operator+(const String& other) const {
+  return String(_text + other._text);
+}
+
+String operator+(const char* left, const String& right) {
+  return String(left) + right;
+}
@@ -0,0 +1,110 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+// Just enough of the Arduino core to build the firmware sources into the
+// host tools. Time is virtual: it only moves when the code waits (delay(),
+// delayMicroseconds(), bus transfers) or a tool advances it, so simulated
+// hours take seconds and every run is the same. Pins and the ADC read what
+// an attached HostPins model says. Only these host tools use this
+// directory; the firmware is built against the real core.
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Print.h"
+#include "WString.h"
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define PULLUP 0x04
+#define INPUT_PULLUP 0x05
+
+#define PROGMEM
+#define IRAM_ATTR
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+typedef enum { ADC_0db, ADC_2_5db, ADC_6db, ADC_11db } adc_attenuation_t;
+
+static const uint8_t SDA = 21;
+static const uint8_t SCL = 22;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+void analogSetPinAttenuation(uint8_t pin, adc_attenuation_t attenuation);
+uint32_t analogReadMilliVolts(uint8_t pin);
+
+long map(long x, long inMin, long inMax, long outMin, long outMax);
+
+bool setCpuFrequencyMhz(uint32_t mhz);
+uint32_t getCpuFrequencyMhz();
+
+class Stream : public Print {
+public:
+  virtual int available() { return 0; }
+  virtual int read() { return -1; }
+  virtual int peek() { return -1; }
+};
+
+// Serial output goes to a stdio stream (dropped when none is set); input
+// is whatever the tool queued with hostSerialInput()
+class HardwareSerial : public Stream {
+public:
+  void begin(unsigned long baud) { (void)baud; }
+  void flush() {}
+  operator bool() const { return true; }
+
+  size_t write(uint8_t c);
+  size_t write(const uint8_t* buffer, size_t size);
+  using Print::write;
+  int available();
+  int read();
+  int peek();
+};
+
+extern HardwareSerial Serial;
+
+// ---------------------------------------------------------------------------
+// Host side
+
+// What the pins are wired to. The default model keeps the level last
+// written, reads a pulled up input as HIGH and the ADC as 0 mV.
+class HostPins {
+public:
+  virtual ~HostPins() {}
+  virtual void mode(uint8_t pin, uint8_t mode) = 0;
+  virtual void write(uint8_t pin, uint8_t value) = 0;
+  virtual int read(uint8_t pin) = 0;
+  virtual uint32_t readMilliVolts(uint8_t pin) { (void)pin; return 0; }
+};
+
+// Attach a pin model (nullptr goes back to the default one)
+void hostAttachPins(HostPins* pins);
+
+// Move the virtual clock forward, or set it (a reboot starts at 0)
+void hostAdvance(unsigned long us);
+void hostSetMicros(unsigned long us);
+
+// Where Serial output goes, nullptr to drop it
+void hostSerialOutput(FILE* out);
+
+// Queue text for Serial.read(), as if typed into the serial monitor
+void hostSerialInput(const char* text);
+
+#endif // HOST_ARDUINO_H
@@ -0,0 +1,58 @@
+#ifndef HOST_PRINT_H
+#define HOST_PRINT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "WString.h"
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+class __FlashStringHelper;
+
+// Arduino Print for the host builds: everything ends up in write()
+class Print {
+public:
+  virtual ~Print() {}
+
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* buffer, size_t size);
+  size_t write(const char* text);
+  size_t write(const char* buffer, size_t size) { return write((const uint8_t*)buffer, size); }
+
+  size_t print(const __FlashStringHelper* text);
+  size_t print(const String& text);
+  size_t print(const char* text);
+  size_t print(char c);
+  size_t print(unsigned char value, int base = DEC);
+  size_t print(int value, int base = DEC);
+  size_t print(unsigned int value, int base = DEC);
+  size_t print(long value, int base = DEC);
+  size_t print(unsigned long value, int base = DEC);
+  size_t print(long long value, int base = DEC);
+  size_t print(unsigned long long value, int base = DEC);
+  size_t print(double value, int digits = 2);
+
+  size_t println(const __FlashStringHelper* text);
+  size_t println(const String& text);
+  size_t println(const char* text);
+  size_t println(char c);
+  size_t println(unsigned char value, int base = DEC);
+  size_t println(int value, int base = DEC);
+  size_t println(unsigned int value, int base = DEC);
+  size_t println(long value, int base = DEC);
+  size_t println(unsigned long value, int base = DEC);
+  size_t println(long long value, int base = DEC);
+  size_t println(unsigned long long value, int base = DEC);
+  size_t println(double value, int digits = 2);
+  size_t println();
+
+  size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+private:
+  size_t printNumber(unsigned long long value, int base, bool negative);
+};
+
+#endif // HOST_PRINT_H
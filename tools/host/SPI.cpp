@@ -0,0 +1,61 @@
+#include "SPI.h"
+
+SPIClass SPI;
+
+SPIClass::SPIClass()
+  : _target(nullptr),
+    _frequency(1000000),
+    _bytes(0),
+    _nanos(0) {
+}
+
+void SPIClass::begin(int8_t sck, int8_t miso, int8_t mosi, int8_t ss) {
+  (void)sck;
+  (void)miso;
+  (void)mosi;
+  (void)ss;
+}
+
+void SPIClass::end() {
+}
+
+void SPIClass::setFrequency(uint32_t frequency) {
+  if (frequency) {
+    _frequency = frequency;
+  }
+}
+
+void SPIClass::beginTransaction(SPISettings settings) {
+  setFrequency(settings.clock);
+}
+
+void SPIClass::attach(SPITarget* target) {
+  _target = target;
+}
+
+uint8_t SPIClass::transfer(uint8_t data) {
+  clockByte();
+  return _target ? _target->transfer(data) : 0xFF;
+}
+
+void SPIClass::transfer(void* data, uint32_t size) {
+  uint8_t* bytes = (uint8_t*)data;
+  for (uint32_t i = 0; i < size; i++) {
+    bytes[i] = transfer(bytes[i]);
+  }
+}
+
+void SPIClass::writeBytes(const uint8_t* data, uint32_t size) {
+  for (uint32_t i = 0; i < size; i++) {
+    transfer(data[i]);
+  }
+}
+
+void SPIClass::clockByte() {
+  _bytes++;
+  _nanos += 8000000000ULL / _frequency;
+  if (_nanos >= 1000) {
+    hostAdvance(_nanos / 1000);
+    _nanos %= 1000;
+  }
+}
@@ -0,0 +1,68 @@
+#ifndef HOST_SPI_H
+#define HOST_SPI_H
+
+#include "Arduino.h"
+
+#define SPI_MODE0 0x00
+#define SPI_MODE1 0x01
+#define SPI_MODE2 0x02
+#define SPI_MODE3 0x03
+
+#define SPI_LSBFIRST 0
+#define SPI_MSBFIRST 1
+#define LSBFIRST SPI_LSBFIRST
+#define MSBFIRST SPI_MSBFIRST
+
+// What sits on the other end of the host SPI bus. transfer() gets every
+// byte clocked out and returns the byte clocked back in.
+class SPITarget {
+public:
+  virtual ~SPITarget() {}
+  virtual uint8_t transfer(uint8_t data) = 0;
+};
+
+class SPISettings {
+public:
+  SPISettings(uint32_t clock = 1000000, uint8_t bitOrder = SPI_MSBFIRST, uint8_t dataMode = SPI_MODE0)
+    : clock(clock), bitOrder(bitOrder), dataMode(dataMode) {}
+
+  uint32_t clock;
+  uint8_t bitOrder;
+  uint8_t dataMode;
+};
+
+// Arduino SPIClass for the host builds. Bytes go to the attached target
+// (none: they are dropped and read back as 0xFF) and take the virtual
+// clock forward by their time on the wire.
+class SPIClass {
+public:
+  SPIClass();
+
+  void begin(int8_t sck = -1, int8_t miso = -1, int8_t mosi = -1, int8_t ss = -1);
+  void end();
+  void setFrequency(uint32_t frequency);
+  void beginTransaction(SPISettings settings);
+  void endTransaction() {}
+
+  uint8_t transfer(uint8_t data);
+  void transfer(void* data, uint32_t size);
+  void writeBytes(const uint8_t* data, uint32_t size);
+
+  // Host side: connect a device model (nullptr disconnects it)
+  void attach(SPITarget* target);
+
+  // Bytes clocked since the start
+  uint32_t getByteCount() const { return _bytes; }
+
+private:
+  SPITarget* _target;
+  uint32_t _frequency;
+  uint32_t _bytes;
+  uint32_t _nanos;    // Wire time not yet moved onto the clock
+
+  void clockByte();
+};
+
+extern SPIClass SPI;
+
+#endif // HOST_SPI_H
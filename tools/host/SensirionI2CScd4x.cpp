@@ -0,0 +1,154 @@
+#include "SensirionI2CScd4x.h"
+
+static const uint8_t SCD4X_ADDRESS = 0x62;
+
+static const uint16_t WRITE_ERROR = 0x0100;
+static const uint16_t READ_ERROR = 0x0200;
+static const uint16_t CRC_ERROR = 0x0000;
+static const uint16_t NOT_ENOUGH_DATA_ERROR = 0x0003;
+
+static uint8_t crc8(const uint8_t* data) {
+  uint8_t crc = 0xFF;
+  for (int i = 0; i < 2; i++) {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x31) : (uint8_t)(crc << 1);
+    }
+  }
+  return crc;
+}
+
+SensirionI2CScd4x::SensirionI2CScd4x()
+  : _i2cBus(nullptr) {
+}
+
+void SensirionI2CScd4x::begin(TwoWire& i2cBus) {
+  _i2cBus = &i2cBus;
+}
+
+uint16_t SensirionI2CScd4x::sendCommand(uint16_t command) {
+  if (!_i2cBus) {
+    return WRITE_ERROR | 4;
+  }
+  _i2cBus->beginTransmission(SCD4X_ADDRESS);
+  _i2cBus->write((uint8_t)(command >> 8));
+  _i2cBus->write((uint8_t)(command & 0xFF));
+  uint8_t status = _i2cBus->endTransmission();
+  return status ? WRITE_ERROR | status : 0;
+}
+
+uint16_t SensirionI2CScd4x::readWords(uint16_t* words, uint8_t count) {
+  uint8_t length = count * 3;
+  if (_i2cBus->requestFrom(SCD4X_ADDRESS, length, true) != length) {
+    return READ_ERROR | NOT_ENOUGH_DATA_ERROR;
+  }
+  for (uint8_t i = 0; i < count; i++) {
+    uint8_t word[3];
+    for (uint8_t j = 0; j < 3; j++) {
+      word[j] = _i2cBus->read();
+    }
+    if (crc8(word) != word[2]) {
+      return READ_ERROR | CRC_ERROR;
+    }
+    words[i] = (uint16_t)((word[0] << 8) | word[1]);
+  }
+  return 0;
+}
+
+uint16_t SensirionI2CScd4x::startPeriodicMeasurement() {
+  uint16_t error = sendCommand(0x21B1);
+  delay(1);
+  return error;
+}
+
+uint16_t SensirionI2CScd4x::startLowPowerPeriodicMeasurement() {
+  uint16_t error = sendCommand(0x21AC);
+  delay(1);
+  return error;
+}
+
+uint16_t SensirionI2CScd4x::stopPeriodicMeasurement() {
+  uint16_t error = sendCommand(0x3F86);
+  delay(500);
+  return error;
+}
+
+uint16_t SensirionI2CScd4x::readMeasurement(uint16_t& co2, float& temperature, float& humidity) {
+  uint16_t error = sendCommand(0xEC05);
+  if (error) {
+    return error;
+  }
+  delay(1);
+
+  uint16_t words[3];
+  error = readWords(words, 3);
+  if (error) {
+    return error;
+  }
+  co2 = words[0];
+  temperature = words[1] * 175.0f / 65536.0f - 45.0f;
+  humidity = words[2] * 100.0f / 65536.0f;
+  return 0;
+}
+
+uint16_t SensirionI2CScd4x::getDataReadyFlag(bool& dataReadyFlag) {
+  uint16_t error = sendCommand(0xE4B8);
+  if (error) {
+    return error;
+  }
+  delay(1);
+
+  uint16_t status = 0;
+  error = readWords(&status, 1);
+  dataReadyFlag = (status & 0x07FF) != 0;
+  return error;
+}
+
+uint16_t SensirionI2CScd4x::getSerialNumber(uint16_t& serial0, uint16_t& serial1, uint16_t& serial2) {
+  uint16_t error = sendCommand(0x3682);
+  if (error) {
+    return error;
+  }
+  delay(1);
+
+  uint16_t words[3];
+  error = readWords(words, 3);
+  if (error) {
+    return error;
+  }
+  serial0 = words[0];
+  serial1 = words[1];
+  serial2 = words[2];
+  return 0;
+}
+
+uint16_t SensirionI2CScd4x::measureSingleShot() {
+  uint16_t error = sendCommand(0x219D);
+  delay(5000);
+  return error;
+}
+
+uint16_t SensirionI2CScd4x::measureSingleShotRhtOnly() {
+  uint16_t error = sendCommand(0x2196);
+  delay(50);
+  return error;
+}
+
+uint16_t SensirionI2CScd4x::powerDown() {
+  uint16_t error = sendCommand(0x36E0);
+  delay(1);
+  return error;
+}
+
+uint16_t SensirionI2CScd4x::wakeUp() {
+  // The sensor doesn't acknowledge wake_up
+  sendCommand(0x36F6);
+  delay(20);
+  return 0;
+}
+
+uint16_t SensirionI2CScd4x::reinit() {
+  uint16_t error = sendCommand(0x3646);
+  delay(20);
+  return error;
+}
@@ -0,0 +1,36 @@
+#ifndef HOST_SENSIRIONI2CSCD4X_H
+#define HOST_SENSIRIONI2CSCD4X_H
+
+#include "Arduino.h"
+#include "Wire.h"
+
+// The commands of Sensirion's SCD4x driver that the firmware uses, for the
+// host builds: same command codes, CRCs, waits and conversions, sent over
+// the host Wire to whatever model sits at 0x62. Errors are WriteError (0x100)
+// or ReadError (0x200) combined with the Wire status, as in the driver.
+class SensirionI2CScd4x {
+public:
+  SensirionI2CScd4x();
+
+  void begin(TwoWire& i2cBus);
+
+  uint16_t startPeriodicMeasurement();
+  uint16_t startLowPowerPeriodicMeasurement();
+  uint16_t stopPeriodicMeasurement();
+  uint16_t readMeasurement(uint16_t& co2, float& temperature, float& humidity);
+  uint16_t getDataReadyFlag(bool& dataReadyFlag);
+  uint16_t getSerialNumber(uint16_t& serial0, uint16_t& serial1, uint16_t& serial2);
+  uint16_t measureSingleShot();
+  uint16_t measureSingleShotRhtOnly();
+  uint16_t powerDown();
+  uint16_t wakeUp();
+  uint16_t reinit();
+
+private:
+  TwoWire* _i2cBus;
+
+  uint16_t sendCommand(uint16_t command);
+  uint16_t readWords(uint16_t* words, uint8_t count);
+};
+
+#endif // HOST_SENSIRIONI2CSCD4X_H
@@ -0,0 +1,33 @@
+#ifndef HOST_WSTRING_H
+#define HOST_WSTRING_H
+
+#include <stddef.h>
+#include <string>
+
+// Arduino String for the host builds, on top of std::string
+class String {
+public:
+  String(const char* text = "");
+  String(const std::string& text);
+  String(char c);
+  String(int value, unsigned char base = 10);
+  String(unsigned int value, unsigned char base = 10);
+  String(long value, unsigned char base = 10);
+  String(unsigned long value, unsigned char base = 10);
+  String(float value, unsigned int decimals = 2);
+  String(double value, unsigned int decimals = 2);
+
+  String& operator+=(const String& other);
+  String operator+(const String& other) const;
+  bool operator==(const String& other) const { return _text == other._text; }
+
+  const char* c_str() const { return _text.c_str(); }
+  unsigned int length() const { return _text.size(); }
+
+private:
+  std::string _text;
+};
+
+String operator+(const char* left, const String& right);
+
+#endif // HOST_WSTRING_H
@@ -0,0 +1,134 @@
+#include "Wire.h"
+
+TwoWire Wire;
+
+TwoWire::TwoWire()
+  : _sda(SDA),
+    _scl(SCL),
+    _frequency(100000),
+    _begun(false),
+    _address(0),
+    _txLength(0),
+    _rxLength(0),
+    _rxPosition(0),
+    _transactions(0),
+    _errors(0) {
+  memset(_targets, 0, sizeof(_targets));
+}
+
+bool TwoWire::begin() {
+  return begin(_sda, _scl);
+}
+
+bool TwoWire::begin(int sda, int scl, uint32_t frequency) {
+  // The controller takes the pins over as open-drain with pull-ups
+  _sda = sda;
+  _scl = scl;
+  if (frequency) {
+    _frequency = frequency;
+  }
+  pinMode(_sda, INPUT_PULLUP);
+  pinMode(_scl, INPUT_PULLUP);
+  _begun = true;
+  return true;
+}
+
+bool TwoWire::end() {
+  _begun = false;
+  return true;
+}
+
+void TwoWire::setClock(uint32_t frequency) {
+  if (frequency) {
+    _frequency = frequency;
+  }
+}
+
+void TwoWire::attach(uint8_t address, I2CTarget* target) {
+  _targets[address & 0x7F] = target;
+}
+
+void TwoWire::beginTransmission(int address) {
+  _address = address & 0x7F;
+  _txLength = 0;
+}
+
+size_t TwoWire::write(uint8_t c) {
+  if (_txLength >= BUFFER_SIZE) {
+    return 0;
+  }
+  _tx[_txLength++] = c;
+  return 1;
+}
+
+size_t TwoWire::write(const uint8_t* buffer, size_t size) {
+  size_t n = 0;
+  while (n < size && write(buffer[n])) {
+    n++;
+  }
+  return n;
+}
+
+uint8_t TwoWire::endTransmission(bool sendStop) {
+  (void)sendStop;
+  _transactions++;
+  if (!busReady()) {
+    _errors++;
+    return 4;
+  }
+
+  // Address byte plus data, 9 clocks each
+  I2CTarget* target = _targets[_address];
+  uint8_t status = target ? target->write(_tx, _txLength) : 2;
+  clockBytes(1 + (status == 2 ? 0 : _txLength));
+  _txLength = 0;
+  if (status) {
+    _errors++;
+  }
+  return status;
+}
+
+uint8_t TwoWire::requestFrom(int address, int size, int sendStop) {
+  (void)sendStop;
+  _transactions++;
+  _rxLength = 0;
+  _rxPosition = 0;
+  if (size > (int)BUFFER_SIZE) {
+    size = BUFFER_SIZE;
+  }
+  if (!busReady() || size <= 0) {
+    _errors++;
+    return 0;
+  }
+
+  I2CTarget* target = _targets[address & 0x7F];
+  _rxLength = target ? target->read(_rx, size) : 0;
+  if (_rxLength > (size_t)size) {
+    _rxLength = size;
+  }
+  clockBytes(1 + _rxLength);
+  if (_rxLength == 0) {
+    _errors++;
+  }
+  return _rxLength;
+}
+
+int TwoWire::available() {
+  return _rxLength - _rxPosition;
+}
+
+int TwoWire::read() {
+  return _rxPosition < _rxLength ? _rx[_rxPosition++] : -1;
+}
+
+int TwoWire::peek() {
+  return _rxPosition < _rxLength ? _rx[_rxPosition] : -1;
+}
+
+bool TwoWire::busReady() {
+  return _begun && digitalRead(_sda) == HIGH;
+}
+
+void TwoWire::clockBytes(size_t bytes) {
+  hostAdvance((unsigned long)(bytes * 9ULL * 1000000 / _frequency));
+}
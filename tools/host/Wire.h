@@ -0,0 +1,72 @@
+#ifndef HOST_WIRE_H
+#define HOST_WIRE_H
+
+#include "Arduino.h"
+
+// A device model on the host bus. write() gets the bytes of a write
+// transaction and returns its endTransmission() status (0 ACK, 2 address
+// NACK, 3 data NACK, 4 other error); read() fills a read transaction and
+// returns how many bytes the device sent, 0 for an address NACK.
+class I2CTarget {
+public:
+  virtual ~I2CTarget() {}
+  virtual uint8_t write(const uint8_t* data, size_t length) = 0;
+  virtual size_t read(uint8_t* data, size_t length) = 0;
+};
+
+// Arduino TwoWire for the host builds. Transactions go to the target
+// attached at the address (no target: address NACK) and take the virtual
+// clock forward by their time on the wire. A bus whose SDA pin reads LOW
+// before a transaction is stuck, and every transaction fails.
+class TwoWire : public Stream {
+public:
+  TwoWire();
+
+  bool begin();
+  bool begin(int sda, int scl, uint32_t frequency = 0);
+  bool end();
+  void setClock(uint32_t frequency);
+  void setTimeOut(uint16_t timeoutMs) { (void)timeoutMs; }
+
+  void beginTransmission(int address);
+  uint8_t endTransmission(bool sendStop = true);
+  uint8_t requestFrom(int address, int size, int sendStop = 1);
+
+  size_t write(uint8_t c);
+  size_t write(const uint8_t* buffer, size_t size);
+  using Print::write;
+  int available();
+  int read();
+  int peek();
+
+  // Host side: put a device model on the bus (nullptr removes it)
+  void attach(uint8_t address, I2CTarget* target);
+
+  // Transactions and failed transactions so far
+  uint32_t getTransactionCount() const { return _transactions; }
+  uint32_t getErrorCount() const { return _errors; }
+
+private:
+  static const size_t BUFFER_SIZE = 128;
+
+  I2CTarget* _targets[128];
+  int _sda;
+  int _scl;
+  uint32_t _frequency;
+  bool _begun;
+  uint8_t _address;
+  uint8_t _tx[BUFFER_SIZE];
+  size_t _txLength;
+  uint8_t _rx[BUFFER_SIZE];
+  size_t _rxLength;
+  size_t _rxPosition;
+  uint32_t _transactions;
+  uint32_t _errors;
+
+  bool busReady();
+  void clockBytes(size_t bytes);
+};
+
+extern TwoWire Wire;
+
+#endif // HOST_WIRE_H
@@ -0,0 +1,340 @@
+// The bus scheduler and its device drivers against device models that
+// enforce the datasheet execution times (host program, not part of the
+// firmware).
+//
+// Build against the firmware sources and the host Arduino layer:
+//   g++ -O2 -std=c++11 -Itools/host -Iinclude tools/i2c_bus_mock.cpp tools/host/Arduino.cpp tools/host/Wire.cpp src/I2CScheduler.cpp src/I2CDevices.cpp src/Scd4xSchedule.cpp src/EventTracer.cpp src/LatencyTracer.cpp src/LogHistogram.cpp src/CpuClock.cpp -o i2c_bus_mock
+//
+// Usage:
+//   i2c_bus_mock [--verbose]
+//
+// An SCD41 (0x62), an SGP41 (0x59) and a BMP280 (0x76) share the bus, run
+// by I2CScheduler as in the firmware's main loop: poll(), then sleep for
+// getIdleTime(), waking up late by a random amount. Each model starts
+// executing a command at the stop condition of its write and is busy for
+// the time its datasheet gives, independent of the times the drivers
+// assume. A model records, and NACKs:
+//   busy_writes   a command written while the previous one still executes
+//   early_reads   a read before the command it answers has executed, or
+//                 with no command to answer
+//
+// Scenarios:
+//   periodic      SCD41 in periodic measurement, 10 minutes
+//   single_shot   SCD41 single shots, CO2 every 30 s and RHT every 5 s
+//   hold          single_shot, with the SCD41 held every 3.7 s as
+//                 CO2Sensor does for setup and recovery (the hold must wait
+//                 out a single shot in flight)
+//   late_loop     periodic, waking up to 40 ms late (a frame being drawn)
+//   slow_bmp280   control: a BMP280 model needing 9 ms per conversion
+//                 (oversampling the driver doesn't use); the checks must
+//                 catch the driver going for the result too soon
+// Every scenario but the control must end without a violation and with
+// readings from all three devices.
+//
+// --verbose passes the firmware's serial output through to stderr.
+//
+// Output is CSV: scenario, bus transactions, busy writes, early reads,
+// SCD41 readings, SGP41 samples, BMP280 samples, and ok or FAIL. The exit
+// status is 1 if any scenario failed.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "I2CDevices.h"
+#include "I2CScheduler.h"
+
+static const uint32_t BUS_HZ = 100000;
+
+static int verbose = 0;
+
+static uint8_t crc8(const uint8_t* data) {
+  uint8_t crc = 0xFF;
+  for (int i = 0; i < 2; i++) {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x31) : (uint8_t)(crc << 1);
+    }
+  }
+  return crc;
+}
+
+static void putWord(uint8_t* data, uint16_t word) {
+  data[0] = word >> 8;
+  data[1] = word & 0xFF;
+  data[2] = crc8(data);
+}
+
+// The timing rules every device model checks. A subclass decides how long
+// a command executes and what the read after it returns.
+class TimedTarget : public I2CTarget {
+public:
+  TimedTarget(const char* name)
+    : _name(name), _busyUntil(0), _responseLength(0), _busyWrites(0), _earlyReads(0) {}
+
+  uint8_t write(const uint8_t* data, size_t length) {
+    unsigned long now = micros();
+    if ((long)(now - _busyUntil) < 0) {
+      if (verbose) {
+        fprintf(stderr, "%10.3f ms %s: command 0x%02X%02X while busy for %lu us more\n",
+                now / 1000.0, _name, data[0], data[1], _busyUntil - now);
+      }
+      _busyWrites++;
+      return 2;
+    }
+    // Execution starts at the stop condition
+    unsigned long stop = now + (unsigned long)((1 + length) * 9ULL * 1000000 / BUS_HZ);
+    _responseLength = execute(data, length, _response, _execUs);
+    _busyUntil = stop + _execUs;
+    return 0;
+  }
+
+  size_t read(uint8_t* data, size_t length) {
+    unsigned long now = micros();
+    if ((long)(now - _busyUntil) < 0) {
+      if (verbose) {
+        fprintf(stderr, "%10.3f ms %s: read %lu us before the command executed\n",
+                now / 1000.0, _name, _busyUntil - now);
+      }
+      _earlyReads++;
+      return 0;
+    }
+    if (_responseLength == 0) {
+      if (verbose) {
+        fprintf(stderr, "%10.3f ms %s: read with no command to answer\n", now / 1000.0, _name);
+      }
+      _earlyReads++;
+      return 0;
+    }
+    size_t n = length < _responseLength ? length : _responseLength;
+    memcpy(data, _response, n);
+    _responseLength = 0;
+    return n;
+  }
+
+  uint32_t getBusyWrites() const { return _busyWrites; }
+  uint32_t getEarlyReads() const { return _earlyReads; }
+
+protected:
+  // Take the command in data; returns the length of the response the next
+  // read gets (0 for none) and sets execUs to its execution time
+  virtual size_t execute(const uint8_t* data, size_t length, uint8_t* response, uint32_t& execUs) = 0;
+
+private:
+  const char* _name;
+  unsigned long _busyUntil;
+  uint8_t _response[32];
+  size_t _responseLength;
+  uint32_t _execUs;
+  uint32_t _busyWrites;
+  uint32_t _earlyReads;
+};
+
+// SCD41 after start_periodic_measurement (a measurement every 5 s), or
+// idle for single shots
+class MockScd41 : public TimedTarget {
+public:
+  MockScd41() : TimedTarget("SCD41"), _periodic(true), _nextData(5000000), _ready(false), _counter(0) {}
+
+  void setSingleShot() { _periodic = false; }
+
+protected:
+  size_t execute(const uint8_t* data, size_t length, uint8_t* response, uint32_t& execUs) {
+    (void)length;
+    uint16_t command = (data[0] << 8) | data[1];
+    unsigned long now = micros();
+    if (_periodic && (long)(now - _nextData) >= 0) {
+      _ready = true;
+      _nextData += 5000000;
+    }
+
+    execUs = 1000;
+    switch (command) {
+      case 0xE4B8:  // get_data_ready_status
+        putWord(response, _ready ? 0x8006 : 0x8000);
+        return 3;
+      case 0xEC05:  // read_measurement
+        _ready = false;
+        _counter++;
+        putWord(response, (uint16_t)(600 + _counter % 200));
+        putWord(response + 3, 0x6667);
+        putWord(response + 6, 0x5EB9);
+        return 9;
+      case 0x219D:  // measure_single_shot
+        execUs = 5000000;
+        return 0;
+      case 0x2196:  // measure_single_shot_rht_only
+        execUs = 50000;
+        return 0;
+      default:
+        return 0;
+    }
+  }
+
+private:
+  bool _periodic;
+  unsigned long _nextData;
+  bool _ready;
+  uint32_t _counter;
+};
+
+// SGP41: conditioning and measure_raw_signals both take 50 ms
+class MockSgp41 : public TimedTarget {
+public:
+  MockSgp41() : TimedTarget("SGP41") {}
+
+protected:
+  size_t execute(const uint8_t* data, size_t length, uint8_t* response, uint32_t& execUs) {
+    (void)length;
+    uint16_t command = (data[0] << 8) | data[1];
+    execUs = 50000;
+    putWord(response, 0x7000);
+    if (command == 0x2612) {  // execute_conditioning
+      return 3;
+    }
+    putWord(response + 3, 0x4000);
+    return 6;
+  }
+};
+
+// BMP280: register reads answer at once; a forced mode write to ctrl_meas
+// converts for conversionUs (6.4 ms at x1 oversampling of T and P)
+class MockBmp280 : public TimedTarget {
+public:
+  MockBmp280(uint32_t conversionUs = 6400) : TimedTarget("BMP280"), _conversionUs(conversionUs) {}
+
+protected:
+  size_t execute(const uint8_t* data, size_t length, uint8_t* response, uint32_t& execUs) {
+    // Calibration and data sample of the datasheet, section 8.2
+    static const uint8_t CALIBRATION[24] = {
+      0x70, 0x6B, 0x43, 0x67, 0x18, 0xFC, 0x7D, 0x8E, 0x43, 0xD6, 0xD0, 0x0B,
+      0x27, 0x0B, 0x8C, 0x00, 0xF9, 0xFF, 0x8C, 0x3C, 0xF8, 0xC6, 0x70, 0x17
+    };
+    static const uint8_t SAMPLE[6] = { 0x65, 0x5A, 0xC0, 0x7E, 0xED, 0x00 };
+
+    execUs = 0;
+    if (data[0] == 0xF4 && length == 2) {
+      execUs = (data[1] & 0x03) == 0x01 ? _conversionUs : 0;
+      return 0;
+    }
+    if (data[0] == 0x88) {
+      memcpy(response, CALIBRATION, sizeof(CALIBRATION));
+      return sizeof(CALIBRATION);
+    }
+    if (data[0] == 0xF7) {
+      memcpy(response, SAMPLE, sizeof(SAMPLE));
+      return sizeof(SAMPLE);
+    }
+    return 0;
+  }
+
+private:
+  uint32_t _conversionUs;
+};
+
+struct Scenario {
+  const char* name;
+  bool singleShot;
+  unsigned long holdEveryMs;   // 0 for no holds
+  unsigned long maxLateUs;     // Most the loop wakes up late
+  uint32_t bmp280ConversionUs;
+  bool expectViolations;
+};
+
+static bool runScenario(const Scenario& scenario) {
+  MockScd41 scd41;
+  MockSgp41 sgp41;
+  MockBmp280 bmp280(scenario.bmp280ConversionUs);
+  hostSetMicros(0);
+  Wire.attach(0x62, &scd41);
+  Wire.attach(0x59, &sgp41);
+  Wire.attach(0x76, &bmp280);
+  Wire.begin(21, 22, BUS_HZ);
+
+  I2CScheduler scheduler(Wire);
+  Scd4xDevice scd4x;
+  Sgp41Device sgp41Driver;
+  Bmp280Device bmp280Driver;
+  if (scenario.singleShot) {
+    scd41.setSingleShot();
+    scd4x.setSingleShot(30000, 5000);
+    scd4x.reset();
+  }
+  scheduler.addDevice(&scd4x);
+  scheduler.addDevice(&sgp41Driver);
+  scheduler.addDevice(&bmp280Driver);
+
+  uint32_t readings = 0, gasSamples = 0, pressureSamples = 0;
+  uint32_t seed = 12345;
+  unsigned long nextHold = scenario.holdEveryMs * 1000;
+  while (millis() < 600000) {
+    scheduler.poll();
+
+    SensorData reading;
+    while (scd4x.samples().pop(reading)) {
+      readings++;
+    }
+    GasSample gas;
+    while (sgp41Driver.samples().pop(gas)) {
+      gasSamples++;
+    }
+    PressureSample pressure;
+    while (bmp280Driver.samples().pop(pressure)) {
+      pressureSamples++;
+    }
+
+    if (scenario.holdEveryMs && (long)(micros() - nextHold) >= 0) {
+      nextHold += scenario.holdEveryMs * 1000;
+      I2CHold hold(scheduler, &scd4x);
+      hostAdvance(20000);
+    }
+
+    unsigned long idle = scheduler.getIdleTime(100000);
+    seed = seed * 1103515245 + 12345;
+    unsigned long late = scenario.maxLateUs ? (seed >> 8) % (scenario.maxLateUs + 1) : 0;
+    hostAdvance(idle + late > 0 ? idle + late : 10);
+  }
+
+  uint32_t busyWrites = scd41.getBusyWrites() + sgp41.getBusyWrites() + bmp280.getBusyWrites();
+  uint32_t earlyReads = scd41.getEarlyReads() + sgp41.getEarlyReads() + bmp280.getEarlyReads();
+  bool violated = busyWrites + earlyReads > 0;
+  bool ok = violated == scenario.expectViolations &&
+            (scenario.expectViolations || (readings > 0 && gasSamples > 0 && pressureSamples > 0));
+
+  printf("%s,%u,%u,%u,%u,%u,%u,%s\n", scenario.name, Wire.getTransactionCount(), busyWrites,
+         earlyReads, readings, gasSamples, pressureSamples, ok ? "ok" : "FAIL");
+
+  Wire.attach(0x62, nullptr);
+  Wire.attach(0x59, nullptr);
+  Wire.attach(0x76, nullptr);
+  Wire.end();
+  return ok;
+}
+
+int main(int argc, char** argv) {
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--verbose")) {
+      verbose = 1;
+    } else {
+      fprintf(stderr, "usage: %s [--verbose]\n", argv[0]);
+      return 2;
+    }
+  }
+  hostSerialOutput(verbose ? stderr : nullptr);
+
+  const Scenario scenarios[] = {
+    { "periodic",    false, 0,    2000,  6400, false },
+    { "single_shot", true,  0,    2000,  6400, false },
+    { "hold",        true,  3700, 2000,  6400, false },
+    { "late_loop",   false, 0,    40000, 6400, false },
+    { "slow_bmp280", false, 0,    2000,  9000, true  },
+  };
+
+  printf("scenario,transactions,busy_writes,early_reads,scd41_readings,sgp41_samples,"
+         "bmp280_samples,check\n");
+  bool ok = true;
+  for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+    ok = runScenario(scenarios[i]) && ok;
+  }
+  return ok ? 0 : 1;
+}
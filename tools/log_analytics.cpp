@@ -0,0 +1,482 @@
+// Offline analytics for serial logs captured from the monitors.
+//
+// Build on the host (not part of the firmware):
+//   g++ -O2 -std=c++11 -pthread tools/log_analytics.cpp -o log_analytics
+//
+// Usage:
+//   log_analytics [options] <log files...>
+//   log_analytics --bench [options] [log files...]
+//
+// Each file is one capture from one device; the device name is the file name
+// up to the first '.', so "garage.2024-05-01.log" and "garage.2024-05-02.log"
+// are merged into device "garage". Lines may carry the "HH:MM:SS.mmm > "
+// prefix added by the PlatformIO `time` monitor filter; without it, samples
+// are assumed to be one poll interval apart. When the file name contains a
+// YYYY-MM-DD date the days are labeled from it, otherwise as day offsets.
+//
+// Options:
+//   -j N            worker threads (default: all cores)
+//   --threshold N   CO2 level counted as "above" (default: CO2_ALARM_THRESHOLD, 1000)
+//   --interval S    seconds between samples without timestamps (default: 30)
+//   --max-gap S     longest gap counted towards time above (default: 120)
+//   --bench         report parse throughput for 1, 2, 4, ... threads
+//   --synth MB      with --bench and no files, synthesize 16 logs of MB each
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct Options {
+  unsigned threads = 0;
+  uint16_t threshold = 1000;
+  uint32_t intervalMs = 30000;
+  uint32_t maxGapMs = 120000;
+  bool bench = false;
+  uint32_t synthMB = 0;
+};
+
+// Statistics for one device and one day
+struct DayStats {
+  uint32_t samples = 0;
+  uint64_t aboveMs = 0;
+  uint16_t maxCO2 = 0;
+  uint32_t reconnects = 0;
+  uint32_t connectionLost = 0;
+  uint32_t refreshes = 0;
+  // Counts per 10 ppm bucket, for the percentile (the SCD4x tops out at 40000 ppm)
+  std::vector<uint32_t> histogram;
+
+  void addSample(uint16_t co2) {
+    if (histogram.empty()) histogram.assign(4001, 0);
+    histogram[std::min<uint32_t>(co2 / 10, 4000)]++;
+    maxCO2 = std::max(maxCO2, co2);
+    samples++;
+  }
+
+  void merge(const DayStats& other) {
+    samples += other.samples;
+    aboveMs += other.aboveMs;
+    maxCO2 = std::max(maxCO2, other.maxCO2);
+    reconnects += other.reconnects;
+    connectionLost += other.connectionLost;
+    refreshes += other.refreshes;
+    if (other.histogram.empty()) return;
+    if (histogram.empty()) histogram.assign(4001, 0);
+    for (size_t i = 0; i < histogram.size(); i++) histogram[i] += other.histogram[i];
+  }
+
+  // Upper edge of the bucket holding the requested percentile
+  uint16_t percentile(uint8_t p) const {
+    if (samples == 0) return 0;
+    uint64_t rank = ((uint64_t)samples * p + 99) / 100;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < histogram.size(); i++) {
+      seen += histogram[i];
+      if (seen >= rank) return std::min<uint32_t>(i * 10 + 9, maxCO2);
+    }
+    return maxCO2;
+  }
+};
+
+// Key for a day: days since 1970-01-01 when the file is dated, otherwise
+// the offset from the start of the capture
+struct FileResult {
+  std::string device;
+  bool dated = false;
+  uint64_t bytes = 0;
+  std::map<int32_t, DayStats> days;
+};
+
+// A log held in memory, either mapped from a file or synthesized
+struct LogBuffer {
+  std::string path;
+  const char* data = nullptr;
+  size_t size = 0;
+};
+
+// Days since 1970-01-01 for a civil date (proleptic Gregorian)
+static int32_t daysFromCivil(int y, unsigned m, unsigned d) {
+  y -= m <= 2;
+  int era = (y >= 0 ? y : y - 399) / 400;
+  unsigned yoe = (unsigned)(y - era * 400);
+  unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + (int32_t)doe - 719468;
+}
+
+static void civilFromDays(int32_t z, int* y, unsigned* m, unsigned* d) {
+  z += 719468;
+  int era = (z >= 0 ? z : z - 146096) / 146097;
+  unsigned doe = (unsigned)(z - era * 146097);
+  unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  unsigned mp = (5 * doy + 2) / 153;
+  *d = doy - (153 * mp + 2) / 5 + 1;
+  *m = mp < 10 ? mp + 3 : mp - 9;
+  *y = (int)yoe + era * 400 + (*m <= 2);
+}
+
+static inline bool isDigit(char c) {
+  return (unsigned)(c - '0') < 10;
+}
+
+// Find a YYYY-MM-DD date in a file name
+static bool parseDate(const std::string& name, int32_t* day) {
+  for (size_t i = 0; i + 10 <= name.size(); i++) {
+    const char* s = name.c_str() + i;
+    if (isDigit(s[0]) && isDigit(s[1]) && isDigit(s[2]) && isDigit(s[3]) && s[4] == '-' &&
+        isDigit(s[5]) && isDigit(s[6]) && s[7] == '-' && isDigit(s[8]) && isDigit(s[9])) {
+      int y = atoi(s);
+      unsigned m = (unsigned)atoi(s + 5), d = (unsigned)atoi(s + 8);
+      if (m < 1 || m > 12 || d < 1 || d > 31) continue;
+      *day = daysFromCivil(y, m, d);
+      return true;
+    }
+  }
+  return false;
+}
+
+static std::string deviceName(const std::string& path) {
+  size_t slash = path.find_last_of('/');
+  std::string base = slash == std::string::npos ? path : path.substr(slash + 1);
+  return base.substr(0, base.find('.'));
+}
+
+// Compare a line against a literal without reading past its end
+template <size_t N>
+static inline bool startsWith(const char* p, const char* end, const char (&literal)[N]) {
+  return (size_t)(end - p) >= N - 1 && memcmp(p, literal, N - 1) == 0;
+}
+
+// Parse "HH:MM:SS.mmm > " into milliseconds since midnight
+static inline bool parseTimestamp(const char* p, const char* end, uint32_t* ms) {
+  if (end - p < 15 || p[2] != ':' || p[5] != ':' || p[8] != '.' || p[12] != ' ' || p[13] != '>') {
+    return false;
+  }
+  // Digits are validated as a group with non-short-circuit ORs
+  unsigned h0 = p[0] - '0', h1 = p[1] - '0', m0 = p[3] - '0', m1 = p[4] - '0';
+  unsigned s0 = p[6] - '0', s1 = p[7] - '0', f0 = p[9] - '0', f1 = p[10] - '0', f2 = p[11] - '0';
+  if ((h0 > 9) | (h1 > 9) | (m0 > 9) | (m1 > 9) | (s0 > 9) | (s1 > 9) | (f0 > 9) | (f1 > 9) | (f2 > 9)) {
+    return false;
+  }
+  *ms = (((h0 * 10 + h1) * 60 + m0 * 10 + m1) * 60 + s0 * 10 + s1) * 1000 + f0 * 100 + f1 * 10 + f2;
+  return true;
+}
+
+class LogScanner {
+public:
+  LogScanner(const Options& options, FileResult& result, int32_t firstDay)
+    : _options(options), _result(result), _day(firstDay), _stats(&result.days[firstDay]) {}
+
+  void scan(const char* data, size_t size) {
+    const char* p = data;
+    const char* end = data + size;
+    while (p < end) {
+      const char* eol = (const char*)memchr(p, '\n', end - p);
+      if (!eol) eol = end;
+      const char* lineEnd = (eol > p && eol[-1] == '\r') ? eol - 1 : eol;
+      scanLine(p, lineEnd);
+      p = eol + 1;
+    }
+  }
+
+private:
+  const Options& _options;
+  FileResult& _result;
+  int32_t _day;
+  DayStats* _stats;
+  bool _timestamped = false;
+  uint32_t _lastTimeOfDay = 0;
+  // Milliseconds since the start of the capture
+  uint64_t _now = 0;
+  uint64_t _lastSampleTime = 0;
+  bool _haveSample = false;
+  bool _lastAbove = false;
+
+  void scanLine(const char* p, const char* end) {
+    uint32_t timeOfDay;
+    if (parseTimestamp(p, end, &timeOfDay)) {
+      advanceClock(timeOfDay);
+      p += 15;
+    }
+    if (p == end) return;
+
+    // Dispatch on the first character; only a handful of lines matter
+    switch (*p) {
+      case 'C':
+        if (startsWith(p, end, "CO2: ")) {
+          sample(p + 5, end);
+        } else if (startsWith(p, end, "Chart-only update completed")) {
+          _stats->refreshes++;
+        }
+        break;
+      case 'F':
+        if (startsWith(p, end, "Full display update completed")) {
+          _stats->refreshes++;
+        }
+        break;
+      case 'S':
+        if (startsWith(p, end, "Successfully reconnected CO2 sensor")) {
+          _stats->reconnects++;
+        } else if (startsWith(p, end, "Sensor connection lost")) {
+          _stats->connectionLost++;
+        }
+        break;
+      default:
+        break;
+    }
+  }
+
+  void advanceClock(uint32_t timeOfDay) {
+    // The filter only prints the time of day; going backwards means midnight
+    if (_timestamped && timeOfDay < _lastTimeOfDay) {
+      _day++;
+      _stats = &_result.days[_day];
+      _now += 86400000u - _lastTimeOfDay + timeOfDay;
+    } else if (_timestamped) {
+      _now += timeOfDay - _lastTimeOfDay;
+    }
+    _timestamped = true;
+    _lastTimeOfDay = timeOfDay;
+  }
+
+  void sample(const char* p, const char* end) {
+    uint32_t co2 = 0;
+    while (p < end && isDigit(*p)) co2 = co2 * 10 + (*p++ - '0');
+    if (co2 == 0 || co2 > 40000) return;
+
+    if (!_timestamped) _now += _options.intervalMs;
+
+    if (_haveSample && _lastAbove) {
+      _stats->aboveMs += std::min<uint64_t>(_now - _lastSampleTime, _options.maxGapMs);
+    }
+    _stats->addSample((uint16_t)co2);
+    _haveSample = true;
+    _lastAbove = co2 >= _options.threshold;
+    _lastSampleTime = _now;
+  }
+};
+
+static bool mapFile(const std::string& path, LogBuffer* buffer) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return false;
+  }
+  buffer->path = path;
+  buffer->size = (size_t)st.st_size;
+  buffer->data = "";
+  if (buffer->size > 0) {
+    void* data = mmap(nullptr, buffer->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      close(fd);
+      return false;
+    }
+    madvise(data, buffer->size, MADV_SEQUENTIAL);
+    buffer->data = (const char*)data;
+  }
+  close(fd);
+  return true;
+}
+
+static FileResult analyzeBuffer(const LogBuffer& buffer, const Options& options) {
+  FileResult result;
+  result.device = deviceName(buffer.path);
+  result.bytes = buffer.size;
+  int32_t firstDay = 0;
+  result.dated = parseDate(buffer.path, &firstDay);
+  LogScanner scanner(options, result, firstDay);
+  scanner.scan(buffer.data, buffer.size);
+  return result;
+}
+
+// Analyze the buffers on a pool of threads, largest first so a big file
+// does not end up as the tail of the schedule
+static std::vector<FileResult> analyzeAll(const std::vector<LogBuffer>& buffers, const Options& options,
+                                          unsigned threads) {
+  std::vector<size_t> order(buffers.size());
+  for (size_t i = 0; i < order.size(); i++) order[i] = i;
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return buffers[a].size > buffers[b].size; });
+
+  std::vector<FileResult> results(buffers.size());
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    for (size_t i = next++; i < order.size(); i = next++) {
+      results[order[i]] = analyzeBuffer(buffers[order[i]], options);
+    }
+  };
+
+  std::vector<std::thread> pool;
+  for (unsigned t = 1; t < threads; t++) pool.emplace_back(worker);
+  worker();
+  for (size_t t = 0; t < pool.size(); t++) pool[t].join();
+  return results;
+}
+
+static void printReport(const std::vector<FileResult>& results, const Options& options) {
+  // Merge captures of the same device; dated and undated days stay apart
+  std::map<std::string, std::map<std::pair<bool, int32_t>, DayStats>> devices;
+  for (size_t i = 0; i < results.size(); i++) {
+    for (auto it = results[i].days.begin(); it != results[i].days.end(); ++it) {
+      devices[results[i].device][std::make_pair(results[i].dated, it->first)].merge(it->second);
+    }
+  }
+
+  printf("device,day,samples,minutes_above_%u,p95_ppm,max_ppm,reconnects,connection_lost,refreshes\n",
+         options.threshold);
+  for (auto dev = devices.begin(); dev != devices.end(); ++dev) {
+    for (auto it = dev->second.begin(); it != dev->second.end(); ++it) {
+      const DayStats& day = it->second;
+      if (day.samples == 0 && day.reconnects == 0 && day.connectionLost == 0 && day.refreshes == 0) continue;
+      char label[32];
+      if (it->first.first) {
+        int y;
+        unsigned m, d;
+        civilFromDays(it->first.second, &y, &m, &d);
+        snprintf(label, sizeof label, "%04d-%02u-%02u", y, m, d);
+      } else {
+        snprintf(label, sizeof label, "+%d", it->first.second);
+      }
+      printf("%s,%s,%u,%.1f,%u,%u,%u,%u,%u\n", dev->first.c_str(), label, day.samples, day.aboveMs / 60000.0,
+             day.percentile(95), day.maxCO2, day.reconnects, day.connectionLost, day.refreshes);
+    }
+  }
+}
+
+// Logs that look like a capture with the `time` filter, for benchmarking
+// without real fleet data
+static std::string synthesizeLog(uint32_t bytes, uint32_t seed) {
+  static const char* noise[] = {
+    "\n=== Updating sensor data ===", "Time since last update: 30 seconds", "Valid reading count: 3",
+    "No significant change detected", "Data not ready yet, waiting...", "Display: Filling screen...",
+    "Full display update completed",
+  };
+  std::string log;
+  log.reserve(bytes + 128);
+  uint32_t ms = 0;
+  char line[96];
+  while (log.size() < bytes) {
+    seed = seed * 1103515245 + 12345;
+    ms = (ms + 30000 + (seed >> 20) % 500) % 86400000;
+    unsigned co2 = 400 + (seed >> 8) % 1400;
+    int n = snprintf(line, sizeof line, "%02u:%02u:%02u.%03u > CO2: %u ppm, Temp: %.2f C, Humidity: %.2f%%\n",
+                     ms / 3600000, ms / 60000 % 60, ms / 1000 % 60, ms % 1000, co2, 12 + (seed & 0xFF) / 25.0,
+                     40 + (seed >> 24) / 6.0);
+    log.append(line, n);
+    for (unsigned i = 0; i < 4; i++) {
+      n = snprintf(line, sizeof line, "%02u:%02u:%02u.%03u > %s\n", ms / 3600000, ms / 60000 % 60, ms / 1000 % 60,
+                   ms % 1000, noise[(seed >> (i * 3)) % 7]);
+      log.append(line, n);
+    }
+  }
+  return log;
+}
+
+static void runBenchmark(const std::vector<LogBuffer>& buffers, const Options& options) {
+  uint64_t total = 0;
+  for (size_t i = 0; i < buffers.size(); i++) total += buffers[i].size;
+  unsigned maxThreads = options.threads;
+
+  // Warm the page cache so the first row does not measure the disk
+  analyzeAll(buffers, options, maxThreads);
+
+  printf("%zu files, %.1f MB\n", buffers.size(), total / 1e6);
+  printf("threads  seconds   GB/s  speedup\n");
+  double base = 0;
+  for (unsigned threads = 1;; threads = std::min(threads * 2, maxThreads)) {
+    double best = 1e9;
+    for (int run = 0; run < 3; run++) {
+      auto start = std::chrono::steady_clock::now();
+      std::vector<FileResult> results = analyzeAll(buffers, options, threads);
+      double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      best = std::min(best, seconds);
+    }
+    if (threads == 1) base = best;
+    printf("%7u  %7.3f  %5.2f  %7.2f\n", threads, best, total / best / 1e9, base / best);
+    if (threads == maxThreads) break;
+  }
+}
+
+static void usage() {
+  fprintf(stderr,
+          "usage: log_analytics [-j N] [--threshold PPM] [--interval S] [--max-gap S] <logs...>\n"
+          "       log_analytics --bench [-j N] [--synth MB] [logs...]\n");
+}
+
+int main(int argc, char** argv) {
+  Options options;
+  std::vector<std::string> paths;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (arg == "-j" && hasValue) {
+      options.threads = (unsigned)atoi(argv[++i]);
+    } else if (arg == "--threshold" && hasValue) {
+      options.threshold = (uint16_t)atoi(argv[++i]);
+    } else if (arg == "--interval" && hasValue) {
+      options.intervalMs = (uint32_t)atoi(argv[++i]) * 1000;
+    } else if (arg == "--max-gap" && hasValue) {
+      options.maxGapMs = (uint32_t)atoi(argv[++i]) * 1000;
+    } else if (arg == "--synth" && hasValue) {
+      options.synthMB = (uint32_t)atoi(argv[++i]);
+    } else if (arg == "--bench") {
+      options.bench = true;
+    } else if (!arg.empty() && arg[0] == '-') {
+      usage();
+      return 2;
+    } else {
+      paths.push_back(arg);
+    }
+  }
+  if (options.threads == 0) options.threads = std::max(1u, std::thread::hardware_concurrency());
+
+  std::vector<LogBuffer> buffers;
+  std::vector<std::string> synthesized;
+  for (size_t i = 0; i < paths.size(); i++) {
+    LogBuffer buffer;
+    if (!mapFile(paths[i], &buffer)) {
+      fprintf(stderr, "log_analytics: cannot read %s\n", paths[i].c_str());
+      return 1;
+    }
+    buffers.push_back(buffer);
+  }
+
+  if (buffers.empty() && options.bench) {
+    uint32_t mb = options.synthMB ? options.synthMB : 16;
+    synthesized.resize(16);
+    for (size_t i = 0; i < synthesized.size(); i++) {
+      synthesized[i] = synthesizeLog(mb << 20, (uint32_t)i + 1);
+      LogBuffer buffer;
+      buffer.path = "synth" + std::to_string(i) + ".log";
+      buffer.data = synthesized[i].data();
+      buffer.size = synthesized[i].size();
+      buffers.push_back(buffer);
+    }
+  }
+  if (buffers.empty()) {
+    usage();
+    return 2;
+  }
+
+  if (options.bench) {
+    runBenchmark(buffers, options);
+  } else {
+    printReport(analyzeAll(buffers, options, options.threads), options);
+  }
+  return 0;
+}
@@ -0,0 +1,78 @@
+# Packs the GFX fonts the display uses into include/packed before a build
+# with -D PACKED_FONTS (PlatformIO extra script, runs on the host).
+#
+# The headers are generated from the Adafruit GFX library PlatformIO
+# downloads, so they are not kept in the tree. tools/fontpack.cpp is built
+# with the host g++ and run when a packed header is missing or older than
+# its GFX font or the packer; it fails the build if a glyph does not decode
+# back exactly, and prints the bytes saved per font.
+
+import os
+import subprocess
+
+Import("env")
+
+FONTS = ["FreeMonoBold12pt7b", "FreeMonoBold18pt7b", "FreeMonoBold24pt7b"]
+
+PACKER_SOURCES = [
+    "tools/fontpack.cpp",
+    "src/PackedFont.cpp",
+    "src/GlyphCache.cpp",
+    "src/RasterKernels.cpp",
+    "include/PackedFont.h",
+    "include/GlyphCache.h",
+    "include/RasterKernels.h",
+]
+
+
+def packed_fonts_enabled():
+    defines = env.ParseFlags(env.get("BUILD_FLAGS", [])).get("CPPDEFINES", [])
+    for define in defines:
+        name = define[0] if isinstance(define, (list, tuple)) else define
+        if name == "PACKED_FONTS":
+            return True
+    return False
+
+
+def newest(paths):
+    return max(os.path.getmtime(path) for path in paths)
+
+
+def pack_fonts():
+    project = env.subst("$PROJECT_DIR")
+    fonts_dir = os.path.join(env.subst("$PROJECT_LIBDEPS_DIR"), env.subst("$PIOENV"),
+                             "Adafruit GFX Library", "Fonts")
+    out_dir = os.path.join(project, "include", "packed")
+    fonts = [os.path.join(fonts_dir, name + ".h") for name in FONTS]
+    packed = [os.path.join(out_dir, name + ".h") for name in FONTS]
+    sources = [os.path.join(project, path) for path in PACKER_SOURCES]
+
+    missing = [font for font in fonts if not os.path.isfile(font)]
+    if missing:
+        print("pack_fonts: GFX fonts not found, run `pio pkg install` first: " + ", ".join(missing))
+        env.Exit(1)
+
+    if all(os.path.isfile(path) for path in packed) and \
+            min(os.path.getmtime(path) for path in packed) >= newest(fonts + sources):
+        return
+
+    build_dir = env.subst("$BUILD_DIR")
+    if not os.path.isdir(build_dir):
+        os.makedirs(build_dir)
+    packer = os.path.join(build_dir, "fontpack")
+    cpp_sources = [path for path in sources if path.endswith(".cpp")]
+    if not os.path.isfile(packer) or os.path.getmtime(packer) < newest(sources):
+        print("pack_fonts: building " + packer)
+        subprocess.check_call(["g++", "-O2", "-std=c++11", "-I" + os.path.join(project, "include")] +
+                              cpp_sources + ["-o", packer])
+
+    if not os.path.isdir(out_dir):
+        os.makedirs(out_dir)
+    print("pack_fonts: packing into " + out_dir)
+    if subprocess.call([packer, "--out", out_dir] + fonts) != 0:
+        print("pack_fonts: fontpack failed")
+        env.Exit(1)
+
+
+if packed_fonts_enabled():
+    pack_fonts()
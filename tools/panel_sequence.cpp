@@ -0,0 +1,532 @@
+// Checks that the EPaperPanel sequencer drives the panel exactly as the
+// blocking code it replaced, and that it never talks to a busy controller
+// (host program, not part of the firmware).
+//
+// Build against the firmware sources and the host Arduino layer:
+//   g++ -O2 -std=c++11 -Itools/host -Iinclude tools/panel_sequence.cpp src/EPaperPanel.cpp src/EventTracer.cpp tools/host/Arduino.cpp tools/host/SPI.cpp -o panel_sequence
+//
+// Usage:
+//   panel_sequence [--verbose]
+//
+// Both implementations run the same session: begin(), two frames (upload,
+// refresh, wait for the refresh as the main loop does) and sleep(). The
+// old one is BlockingPanel below, the EPaperPanel of before the sequencer
+// with only its name changed. A model of the GDEY0583T81 records every SPI
+// byte with its D/C level, every RST edge, and each byte sent outside CS
+// or while BUSY is high. The controller raises BUSY 200 us after a power
+// on (0x04), refresh (0x12) or power off (0x02) command and for a while
+// after RST is released; these times vary per scenario:
+//   typical      BUSY for 20 ms after reset, 80 ms power on, 3 s refresh,
+//                30 ms power off
+//   no_reset     no BUSY after reset
+//   slow_reset   BUSY for 300 ms after reset, longer than the old fixed
+//                100 ms: the old code sends its first command into it
+//   stuck        BUSY never drops; every wait ends in the 5 s timeout
+//   busy_low     typical times, but BUSY is driven low while busy, as the
+//                UC8179 datasheet has it for its BUSY_N pin
+// The sequencer must send the same bytes, D/C levels and RST edges in the
+// same order as the old code, and (but for stuck and busy_low) nothing
+// while BUSY is asserted; its wait after reset must last until BUSY drops.
+// Whatever the BUSY line does, it must also keep the old code's fixed
+// waits: 100 ms after reset and after power on, 200 ms from a refresh to
+// the next byte and 100 ms after power off. With BUSY the other way round
+// both wait for the wrong level; the sequencer must not send more bytes
+// into a busy controller than the old code did.
+//
+// --verbose passes the firmware's serial output through to stderr.
+//
+// Output is CSV: scenario, implementation, SPI bytes, RST edges, bytes
+// sent outside CS, bytes sent while BUSY, bytes sent before one of the
+// fixed waits was over, ms from the release of RST to the first command,
+// ms begin() blocked, ms for the whole session, whether the bytes match
+// the old code's, and ok or FAIL for the sequencer. The exit status is 1
+// if any scenario failed.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "EPaperPanel.h"
+
+static const uint8_t BUSY_PIN = 4;
+static const uint8_t CS_PIN = 5;
+static const uint8_t RST_PIN = 16;
+static const uint8_t DC_PIN = 17;
+static const uint16_t WIDTH = 648;
+static const uint16_t HEIGHT = 480;
+
+// Delay between a command and the controller raising BUSY
+static const unsigned long BUSY_RISE_US = 200;
+
+static const unsigned long NEVER = 0xFFFFFFFF;
+
+// The old code's fixed waits, from the event to the next byte
+static const unsigned long RESET_SETTLE_US = 100000;
+static const unsigned long POWER_ON_SETTLE_US = 100000;
+static const unsigned long REFRESH_SETTLE_US = 200000;
+static const unsigned long POWER_OFF_SETTLE_US = 100000;
+
+// ---------------------------------------------------------------------------
+// The panel layer before the sequencer
+
+class BlockingPanel {
+public:
+  BlockingPanel(uint8_t busy_pin, uint8_t cs_pin, uint8_t rst_pin, uint8_t dc_pin,
+                uint16_t width, uint16_t height);
+
+  void begin();
+  void beginFrame();
+  void sendPixels(const uint8_t* data, uint32_t length);
+  void endFrame();
+  void refresh();
+  void sleep();
+
+private:
+  uint8_t _busy_pin;
+  uint8_t _cs_pin;
+  uint8_t _rst_pin;
+  uint8_t _dc_pin;
+  uint16_t _width;
+  uint16_t _height;
+  uint32_t _framePosition;
+
+  void sendCommand(uint8_t command);
+  void sendData(uint8_t data);
+  void waitUntilIdle();
+  void reset();
+  void initDisplay();
+};
+
+BlockingPanel::BlockingPanel(uint8_t busy_pin, uint8_t cs_pin, uint8_t rst_pin, uint8_t dc_pin,
+                             uint16_t width, uint16_t height)
+  : _busy_pin(busy_pin), _cs_pin(cs_pin), _rst_pin(rst_pin), _dc_pin(dc_pin),
+    _width(width), _height(height), _framePosition(0) {
+}
+
+void BlockingPanel::begin() {
+    // Setup pins
+    pinMode(_busy_pin, INPUT);
+    pinMode(_rst_pin, OUTPUT);
+    pinMode(_dc_pin, OUTPUT);
+    pinMode(_cs_pin, OUTPUT);
+
+    digitalWrite(_cs_pin, HIGH);
+    digitalWrite(_dc_pin, HIGH);
+    digitalWrite(_rst_pin, HIGH);
+
+    // Initialize display
+    initDisplay();
+}
+
+void BlockingPanel::reset() {
+    Serial.println("Display: Resetting...");
+    digitalWrite(_rst_pin, LOW);
+    delay(10);
+    digitalWrite(_rst_pin, HIGH);
+    delay(10);
+}
+
+void BlockingPanel::initDisplay() {
+    Serial.println("Display: Sending init commands...");
+
+    // Reset the display first
+    reset();
+    delay(100);  // Give it more time after reset
+
+    // Based on the working example's initialization sequence for GDEY0583T81
+    sendCommand(0x06);   // Booster Soft Start
+    sendData(0x17);      // A
+    sendData(0x17);      // B
+    sendData(0x28);      // C
+    sendData(0x17);      // D
+
+    delay(10);  // Add small delay between commands
+
+    sendCommand(0x04);   // POWER ON
+    delay(100);          // Give more time for power-on
+    waitUntilIdle();
+
+    sendCommand(0x00);   // PANEL SETTING
+    sendData(0x0F);      // KW-3f KWR-2F BWROTP 0f BWOTP 1f
+
+    delay(10);  // Add small delay between commands
+
+    sendCommand(0x50);   // VCOM AND DATA INTERVAL SETTING
+    sendData(0x20);      // Default value for this display
+    sendData(0x07);
+
+    delay(10);  // Add small delay between commands
+
+    sendCommand(0x61);   // Resolution Setting
+    sendData(_width >> 8); // High byte of width
+    sendData(_width & 0xFF); // Low byte of width
+    sendData(_height >> 8); // High byte of height
+    sendData(_height & 0xFF); // Low byte of height
+
+    delay(10);  // Add small delay between commands
+
+    Serial.println("Display: Init commands sent");
+}
+
+void BlockingPanel::sendCommand(uint8_t command) {
+    digitalWrite(_dc_pin, LOW);   // Command mode
+    digitalWrite(_cs_pin, LOW);
+    SPI.transfer(command);
+    digitalWrite(_cs_pin, HIGH);
+}
+
+void BlockingPanel::sendData(uint8_t data) {
+    digitalWrite(_dc_pin, HIGH);  // Data mode
+    digitalWrite(_cs_pin, LOW);
+    SPI.transfer(data);
+    digitalWrite(_cs_pin, HIGH);
+}
+
+void BlockingPanel::waitUntilIdle() {
+    Serial.println("Display: Waiting for display to be idle...");
+
+    // Add a timeout to prevent getting stuck in a loop
+    unsigned long startTime = millis();
+    const unsigned long timeout = 5000; // 5 second timeout
+
+    while(digitalRead(_busy_pin) == HIGH) {
+        delay(10);
+
+        // Check for timeout
+        if (millis() - startTime > timeout) {
+            Serial.println("Display: BUSY timeout - forcing continue");
+            break;
+        }
+    }
+
+    Serial.println("Display: Display is idle now");
+}
+
+void BlockingPanel::beginFrame() {
+    // Send black buffer data
+    sendCommand(0x10);
+    delay(10);  // Add a small delay after command
+    _framePosition = 0;
+}
+
+void BlockingPanel::sendPixels(const uint8_t* data, uint32_t length) {
+    for (uint32_t i = 0; i < length; i++, _framePosition++) {
+        sendData(data[i]);
+
+        // Add a tiny delay every 1024 bytes to prevent overrunning the display controller
+        if ((_framePosition % 1024) == 0) {
+            delayMicroseconds(100);
+        }
+    }
+}
+
+void BlockingPanel::endFrame() {
+    delay(10);  // Add a small delay after data transfer
+
+    // Send red buffer data (we're using B/W display so just send 0s)
+    sendCommand(0x13);
+    delay(10);  // Add a small delay after command
+
+    // Send red buffer data (all zeros)
+    for (uint32_t i = 0; i < (uint32_t)_width * _height / 8; i++) {
+        sendData(0x00);
+
+        // Add a tiny delay every 1024 bytes to prevent overrunning the display controller
+        if ((i % 1024) == 0) {
+            delayMicroseconds(100);
+        }
+    }
+
+    delay(10);  // Add a small delay after data transfer
+}
+
+void BlockingPanel::refresh() {
+    // Refresh display
+    sendCommand(0x12);
+    delay(100);  // Increased delay to give more time before asking for busy status
+    waitUntilIdle();
+}
+
+void BlockingPanel::sleep() {
+    Serial.println("Display: Going to sleep...");
+    sendCommand(0x02);  // Power off
+    waitUntilIdle();
+    delay(100);
+    sendCommand(0x07);  // Deep sleep
+    sendData(0xA5);
+    Serial.println("Display: Now sleeping");
+}
+
+// ---------------------------------------------------------------------------
+// Controller model
+
+struct Timing {
+  unsigned long resetBusyUs;   // NEVER for a BUSY line stuck high
+  unsigned long powerOnUs;
+  unsigned long refreshUs;
+  unsigned long powerOffUs;
+  bool activeLow;              // BUSY reads LOW while busy
+};
+
+// What the controller sees, in order
+enum TraceKind { TRACE_COMMAND, TRACE_DATA, TRACE_RST_LOW, TRACE_RST_HIGH };
+
+class PanelModel : public HostPins, public SPITarget {
+public:
+  PanelModel(const Timing& timing)
+    : _timing(timing), _cs(HIGH), _dc(HIGH), _rst(HIGH), _busyFrom(0), _busyUntil(0),
+      _settledAt(0), _outsideCs(0), _whileBusy(0), _early(0), _resetReleased(0), _firstCommandUs(NEVER) {}
+
+  // HostPins
+  void mode(uint8_t pin, uint8_t mode) { (void)pin; (void)mode; }
+
+  void write(uint8_t pin, uint8_t value) {
+    if (pin == CS_PIN) {
+      _cs = value;
+    } else if (pin == DC_PIN) {
+      _dc = value;
+    } else if (pin == RST_PIN) {
+      if (value != _rst) {
+        _trace.push_back(value ? TRACE_RST_HIGH << 8 : TRACE_RST_LOW << 8);
+        if (value) {
+          // Out of reset: busy while the controller loads its settings
+          _resetReleased = micros();
+          _firstCommandUs = NEVER;
+          _settledAt = _resetReleased + RESET_SETTLE_US;
+          busyFor(0, _timing.resetBusyUs);
+        }
+      }
+      _rst = value;
+    }
+  }
+
+  int read(uint8_t pin) {
+    if (pin != BUSY_PIN) {
+      return LOW;
+    }
+    return busy() != _timing.activeLow ? HIGH : LOW;
+  }
+
+  // SPITarget
+  uint8_t transfer(uint8_t data) {
+    if (_cs != LOW) {
+      _outsideCs++;
+    }
+    if (busy()) {
+      _whileBusy++;
+    }
+    if ((long)(micros() - _settledAt) < 0) {
+      _early++;
+    }
+    _trace.push_back((_dc == LOW ? TRACE_COMMAND : TRACE_DATA) << 8 | data);
+
+    if (_dc == LOW) {
+      if (_firstCommandUs == NEVER) {
+        _firstCommandUs = micros() - _resetReleased;
+      }
+      switch (data) {
+        case 0x04: busyFor(BUSY_RISE_US, _timing.powerOnUs); settleFor(POWER_ON_SETTLE_US); break;
+        case 0x12: busyFor(BUSY_RISE_US, _timing.refreshUs); settleFor(REFRESH_SETTLE_US); break;
+        case 0x02: busyFor(BUSY_RISE_US, _timing.powerOffUs); settleFor(POWER_OFF_SETTLE_US); break;
+      }
+    }
+    return 0xFF;
+  }
+
+  const std::vector<uint16_t>& getTrace() const { return _trace; }
+  uint32_t getRstEdges() const {
+    uint32_t edges = 0;
+    for (uint16_t entry : _trace) {
+      edges += (entry >> 8) >= TRACE_RST_LOW;
+    }
+    return edges;
+  }
+  uint32_t getSpiBytes() const { return _trace.size() - getRstEdges(); }
+  uint32_t getOutsideCs() const { return _outsideCs; }
+  uint32_t getWhileBusy() const { return _whileBusy; }
+  uint32_t getEarly() const { return _early; }
+  unsigned long getFirstCommandUs() const { return _firstCommandUs; }
+
+private:
+  Timing _timing;
+  uint8_t _cs, _dc, _rst;
+  unsigned long _busyFrom;
+  unsigned long _busyUntil;     // NEVER while stuck
+  unsigned long _settledAt;     // End of the current fixed wait
+  uint32_t _outsideCs;
+  uint32_t _whileBusy;
+  uint32_t _early;
+  unsigned long _resetReleased;
+  unsigned long _firstCommandUs;
+  std::vector<uint16_t> _trace;
+
+  void busyFor(unsigned long riseUs, unsigned long us) {
+    if (_timing.resetBusyUs == NEVER) {
+      _busyFrom = 0;
+      _busyUntil = NEVER;
+      return;
+    }
+    _busyFrom = micros() + riseUs;
+    _busyUntil = _busyFrom + us;
+  }
+
+  void settleFor(unsigned long us) {
+    _settledAt = micros() + us;
+  }
+
+  bool busy() const {
+    unsigned long now = micros();
+    return _busyUntil == NEVER || ((long)(now - _busyFrom) >= 0 && (long)(now - _busyUntil) < 0);
+  }
+};
+
+// ---------------------------------------------------------------------------
+// Sessions
+
+struct Result {
+  std::vector<uint16_t> trace;
+  uint32_t spiBytes;
+  uint32_t rstEdges;
+  uint32_t outsideCs;
+  uint32_t whileBusy;
+  uint32_t early;
+  double firstCommandMs;
+  double beginMs;
+  double totalMs;
+};
+
+static void makeFrame(std::vector<uint8_t>& frame, uint32_t seed) {
+  frame.resize(WIDTH * HEIGHT / 8);
+  for (size_t i = 0; i < frame.size(); i++) {
+    seed = seed * 1103515245 + 12345;
+    frame[i] = seed >> 16;
+  }
+}
+
+static Result finishResult(const PanelModel& model, unsigned long beginUs) {
+  Result result;
+  result.trace = model.getTrace();
+  result.spiBytes = model.getSpiBytes();
+  result.rstEdges = model.getRstEdges();
+  result.outsideCs = model.getOutsideCs();
+  result.whileBusy = model.getWhileBusy();
+  result.early = model.getEarly();
+  result.firstCommandMs = model.getFirstCommandUs() == NEVER ? -1 : model.getFirstCommandUs() / 1000.0;
+  result.beginMs = beginUs / 1000.0;
+  result.totalMs = micros() / 1000.0;
+  return result;
+}
+
+static Result runBlocking(const Timing& timing) {
+  PanelModel model(timing);
+  hostSetMicros(0);
+  hostAttachPins(&model);
+  SPI.attach(&model);
+
+  BlockingPanel panel(BUSY_PIN, CS_PIN, RST_PIN, DC_PIN, WIDTH, HEIGHT);
+  panel.begin();
+  unsigned long beginUs = micros();
+  std::vector<uint8_t> frame;
+  for (uint32_t f = 0; f < 2; f++) {
+    makeFrame(frame, f + 1);
+    panel.beginFrame();
+    panel.sendPixels(frame.data(), frame.size());
+    panel.endFrame();
+    panel.refresh();
+    delay(100);  // What update() waited after each refresh
+  }
+  panel.sleep();
+
+  Result result = finishResult(model, beginUs);
+  SPI.attach(nullptr);
+  hostAttachPins(nullptr);
+  return result;
+}
+
+static Result runSequencer(const Timing& timing) {
+  PanelModel model(timing);
+  hostSetMicros(0);
+  hostAttachPins(&model);
+  SPI.attach(&model);
+
+  EPaperPanel panel(BUSY_PIN, CS_PIN, RST_PIN, DC_PIN, WIDTH, HEIGHT);
+  panel.begin();
+  unsigned long beginUs = micros();
+  std::vector<uint8_t> frame;
+  for (uint32_t f = 0; f < 2; f++) {
+    makeFrame(frame, f + 1);
+    panel.beginFrame();
+    panel.sendPixels(frame.data(), frame.size());
+    panel.endFrame();
+    panel.refresh();
+
+    // The main loop polls the panel every 20 ms while it is busy
+    while (panel.poll()) {
+      hostAdvance(20000);
+    }
+  }
+  panel.sleep();
+
+  Result result = finishResult(model, beginUs);
+  SPI.attach(nullptr);
+  hostAttachPins(nullptr);
+  return result;
+}
+
+struct Scenario {
+  const char* name;
+  Timing timing;
+};
+
+static void print(const char* scenario, const char* implementation, const Result& result,
+                  const char* match, const char* check) {
+  printf("%s,%s,%u,%u,%u,%u,%u,%.1f,%.1f,%.1f,%s,%s\n", scenario, implementation, result.spiBytes,
+         result.rstEdges, result.outsideCs, result.whileBusy, result.early, result.firstCommandMs,
+         result.beginMs, result.totalMs, match, check);
+}
+
+static bool runScenario(const Scenario& scenario) {
+  Result old = runBlocking(scenario.timing);
+  Result now = runSequencer(scenario.timing);
+
+  bool stuck = scenario.timing.resetBusyUs == NEVER;
+  bool inverted = scenario.timing.activeLow;
+  bool match = now.trace == old.trace;
+  bool waitedOutReset = stuck || inverted || now.firstCommandMs * 1000 >= scenario.timing.resetBusyUs;
+  bool busyOk = stuck || (inverted ? now.whileBusy <= old.whileBusy : now.whileBusy == 0);
+  bool ok = match && now.outsideCs == 0 && now.early == 0 && busyOk && waitedOutReset;
+
+  print(scenario.name, "blocking", old, "-", "-");
+  print(scenario.name, "sequencer", now, match ? "yes" : "no", ok ? "ok" : "FAIL");
+  return ok;
+}
+
+int main(int argc, char** argv) {
+  bool verbose = false;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--verbose")) {
+      verbose = true;
+    } else {
+      fprintf(stderr, "usage: %s [--verbose]\n", argv[0]);
+      return 2;
+    }
+  }
+  hostSerialOutput(verbose ? stderr : nullptr);
+
+  const Scenario scenarios[] = {
+    { "typical",    { 20000,  80000, 3000000, 30000, false } },
+    { "no_reset",   { 0,      80000, 3000000, 30000, false } },
+    { "slow_reset", { 300000, 80000, 3000000, 30000, false } },
+    { "stuck",      { NEVER,  0,     0,       0,     false } },
+    { "busy_low",   { 20000,  80000, 3000000, 30000, true  } },
+  };
+
+  printf("scenario,implementation,spi_bytes,rst_edges,outside_cs,while_busy,early,first_command_ms,"
+         "begin_ms,total_ms,bytes_match,check\n");
+  bool ok = true;
+  for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+    ok = runScenario(scenarios[i]) && ok;
+  }
+  return ok ? 0 : 1;
+}
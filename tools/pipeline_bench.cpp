@@ -0,0 +1,403 @@
+// Cost of the sample pipeline per reading, stage by stage, against the call
+// chain it replaced (host program, not part of the firmware).
+//
+// Build against the firmware sources and the host Arduino layer:
+//   g++ -O2 -std=c++11 -Itools/host -Iinclude tools/pipeline_bench.cpp src/SensorPipeline.cpp tools/host/Arduino.cpp -o pipeline_bench
+//
+// Usage:
+//   pipeline_bench [--samples N] [--rounds N]
+//
+// Runs a stream of readings 5 s apart (CO2 swinging through the alarm
+// threshold, one reading in 500 invalid) through:
+//   pipeline   SensorPipeline<validate, filter, aggregate, history, stats,
+//              alarm, display-invalidate>, the stages of main.cpp that
+//              the old loop had counterparts for
+//   calls      the same stage objects called one after the other by hand
+//   virtual    the same stages behind a virtual process(), in an array
+//   old_loop   the loop body before the pipeline: alarm check, change
+//              check and a history point sample every 5 minutes
+// The history, alarm and display-invalidate stages work on copies of the
+// main.cpp state (history rings, buzzer flag, last displayed reading)
+// without the flash, buzzer and display calls behind them. Then each stage
+// is timed by what adding it to the stages before it costs (the loop that
+// feeds readings in is charged to validate), so the stage figures are
+// differences of two measurements and jitter by a nanosecond or so.
+//
+// Options:
+//   --samples N   readings per pass (default: 1000000)
+//   --rounds N    passes per measurement, best one counts (default: 5)
+//
+// Output is CSV: what was measured (a composition or a stage_ row), ns per
+// reading, readings that came out the end, history entries and display
+// refreshes (blank for stages). The compositions must agree on the last two.
+
+#include <chrono>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "SensorPipeline.h"
+
+// As in main.cpp
+static const uint16_t CO2_ALARM_THRESHOLD = 1000;
+static const uint16_t CO2_THRESHOLD = 50;
+static const float TEMP_THRESHOLD = 0.5f;
+static const float HUM_THRESHOLD = 2.0f;
+static const unsigned long HISTORY_INTERVAL = 300000;
+static const int DATA_HISTORY_SIZE = 48;
+
+// As HistoricalData in Display.h, which needs the display library
+struct MiniHistory {
+  uint16_t co2[12];
+  float temp[12];
+  float humidity[12];
+  int index;
+  int count;
+};
+
+// The main.cpp state the application stages touch
+struct AppState {
+  uint16_t co2History[DATA_HISTORY_SIZE];
+  int historyIndex;
+  MiniHistory miniHistory;
+  SensorData currentData;
+  SensorData lastDisplayedData;
+  bool buzzerActive;
+  uint32_t historyEntries;
+  uint32_t refreshes;
+  unsigned long lastHistoryTime;
+
+  AppState() {
+    memset(this, 0, sizeof(*this));
+  }
+
+  bool updateHistory(const SensorData& data) {
+    co2History[historyIndex] = data.co2;
+    historyIndex = (historyIndex + 1) % DATA_HISTORY_SIZE;
+    miniHistory.co2[miniHistory.index] = data.co2;
+    miniHistory.temp[miniHistory.index] = data.temperature;
+    miniHistory.humidity[miniHistory.index] = data.humidity;
+    miniHistory.index = (miniHistory.index + 1) % 12;
+    if (miniHistory.count < 12) {
+      miniHistory.count++;
+    }
+    historyEntries++;
+    return true;
+  }
+
+  void checkAlarm(const SensorData& data) {
+    buzzerActive = data.co2 >= CO2_ALARM_THRESHOLD;
+  }
+
+  bool significantChange() const {
+    return abs((int)currentData.co2 - (int)lastDisplayedData.co2) >= CO2_THRESHOLD ||
+           fabsf(currentData.temperature - lastDisplayedData.temperature) >= TEMP_THRESHOLD ||
+           fabsf(currentData.humidity - lastDisplayedData.humidity) >= HUM_THRESHOLD;
+  }
+
+  // What the refresh leaves behind
+  void refreshed() {
+    lastDisplayedData = currentData;
+    refreshes++;
+  }
+};
+
+static AppState* app = nullptr;
+
+// The main.cpp stages
+struct HistoryStage {
+  bool process(PipelineSample& sample) {
+    if (sample.windowClosed) {
+      sample.historyTick = app->updateHistory(sample.average);
+    }
+    return true;
+  }
+};
+
+struct AlarmStage {
+  bool process(PipelineSample& sample) {
+    app->checkAlarm(sample.data);
+    return true;
+  }
+};
+
+struct DisplayInvalidateStage {
+  bool process(PipelineSample& sample) {
+    app->currentData = sample.data;
+    sample.displayDirty = sample.historyTick || app->significantChange();
+    return true;
+  }
+};
+
+// A complete set of stages, fresh for every pass
+struct Stages {
+  ValidateStage validate;
+  FilterStage filter;
+  AggregateStage aggregate;
+  HistoryStage history;
+  StatsStage stats;
+  AlarmStage alarm;
+  DisplayInvalidateStage invalidate;
+
+  Stages() : filter(1.0f), aggregate(HISTORY_INTERVAL) {}
+};
+
+// Runtime composition, for comparison
+class VirtualStage {
+public:
+  virtual ~VirtualStage() {}
+  virtual bool process(PipelineSample& sample) = 0;
+};
+
+template <typename Stage>
+class VirtualAdapter : public VirtualStage {
+public:
+  VirtualAdapter(Stage& stage) : _stage(stage) {}
+  bool process(PipelineSample& sample) { return _stage.process(sample); }
+
+private:
+  Stage& _stage;
+};
+
+struct Reading {
+  SensorData data;
+  unsigned long time;
+};
+
+static std::vector<Reading> makeReadings(uint32_t count) {
+  std::vector<Reading> readings(count);
+  srand(1);
+  for (uint32_t i = 0; i < count; i++) {
+    Reading& reading = readings[i];
+    memset(&reading.data, 0, sizeof(reading.data));
+    double hours = i * 5.0 / 3600.0;
+    reading.data.co2 = (uint16_t)(850 + 400 * sin(2 * M_PI * hours / 6) + rand() % 40);
+    reading.data.temperature = 18.0f + 3.0f * sin(2 * M_PI * hours / 24) + (rand() % 10) * 0.01f;
+    reading.data.humidity = 50.0f + 10.0f * cos(2 * M_PI * hours / 24) + (rand() % 10) * 0.05f;
+    if (i % 500 == 499) {
+      reading.data.co2 = 0;
+    }
+    reading.time = i * 5000UL;
+  }
+  return readings;
+}
+
+struct Outcome {
+  double ns;
+  uint32_t passed;
+  uint32_t historyEntries;
+  uint32_t refreshes;
+};
+
+// Best of `rounds` passes over all readings
+template <typename Pass>
+static Outcome measure(const std::vector<Reading>& readings, int rounds, Pass pass) {
+  Outcome best = { 1e30, 0, 0, 0 };
+  for (int round = 0; round < rounds; round++) {
+    AppState state;
+    app = &state;
+    auto start = std::chrono::steady_clock::now();
+    uint32_t passed = pass(readings);
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    ns /= readings.size();
+    if (ns < best.ns) {
+      best.ns = ns;
+      best.passed = passed;
+      best.historyEntries = state.historyEntries;
+      best.refreshes = state.refreshes;
+    }
+  }
+  return best;
+}
+
+static uint32_t runPipeline(const std::vector<Reading>& readings) {
+  Stages s;
+  SensorPipeline<ValidateStage, FilterStage, AggregateStage, HistoryStage,
+                 StatsStage, AlarmStage, DisplayInvalidateStage>
+    pipeline(s.validate, s.filter, s.aggregate, s.history, s.stats, s.alarm, s.invalidate);
+  uint32_t passed = 0;
+  for (const Reading& reading : readings) {
+    PipelineSample sample(reading.data, reading.time);
+    if (pipeline.process(sample)) {
+      passed++;
+      if (sample.displayDirty) {
+        app->refreshed();
+      }
+    }
+  }
+  return passed;
+}
+
+static uint32_t runCalls(const std::vector<Reading>& readings) {
+  Stages s;
+  uint32_t passed = 0;
+  for (const Reading& reading : readings) {
+    PipelineSample sample(reading.data, reading.time);
+    if (!s.validate.process(sample)) {
+      continue;
+    }
+    s.filter.process(sample);
+    s.aggregate.process(sample);
+    s.history.process(sample);
+    s.stats.process(sample);
+    s.alarm.process(sample);
+    s.invalidate.process(sample);
+    passed++;
+    if (sample.displayDirty) {
+      app->refreshed();
+    }
+  }
+  return passed;
+}
+
+static uint32_t runVirtual(const std::vector<Reading>& readings) {
+  Stages s;
+  VirtualAdapter<ValidateStage> validate(s.validate);
+  VirtualAdapter<FilterStage> filter(s.filter);
+  VirtualAdapter<AggregateStage> aggregate(s.aggregate);
+  VirtualAdapter<HistoryStage> history(s.history);
+  VirtualAdapter<StatsStage> stats(s.stats);
+  VirtualAdapter<AlarmStage> alarm(s.alarm);
+  VirtualAdapter<DisplayInvalidateStage> invalidate(s.invalidate);
+  VirtualStage* stages[] = { &validate, &filter, &aggregate, &history, &stats, &alarm, &invalidate };
+
+  uint32_t passed = 0;
+  for (const Reading& reading : readings) {
+    PipelineSample sample(reading.data, reading.time);
+    bool ok = true;
+    for (VirtualStage* stage : stages) {
+      if (!stage->process(sample)) {
+        ok = false;
+        break;
+      }
+    }
+    if (ok) {
+      passed++;
+      if (sample.displayDirty) {
+        app->refreshed();
+      }
+    }
+  }
+  return passed;
+}
+
+// The loop body before the pipeline: every reading as it came, the latest
+// one written to history every 5 minutes
+static uint32_t runOldLoop(const std::vector<Reading>& readings) {
+  for (const Reading& reading : readings) {
+    app->currentData = reading.data;
+    app->checkAlarm(app->currentData);
+    if (app->significantChange()) {
+      app->refreshed();
+    }
+    if (reading.time - app->lastHistoryTime >= HISTORY_INTERVAL) {
+      app->updateHistory(app->currentData);
+      app->lastHistoryTime = reading.time;
+      app->refreshed();
+    }
+  }
+  return readings.size();
+}
+
+// The first stages of the pipeline only; the cost of a stage is what adding
+// it to the ones before it costs
+template <typename... S>
+static uint32_t runPrefix(const std::vector<Reading>& readings, S Stages::*... members) {
+  Stages s;
+  SensorPipeline<S...> pipeline(s.*members...);
+  uint32_t passed = 0;
+  for (const Reading& reading : readings) {
+    PipelineSample sample(reading.data, reading.time);
+    if (pipeline.process(sample)) {
+      passed++;
+    }
+  }
+  return passed;
+}
+
+int main(int argc, char** argv) {
+  uint32_t count = 1000000;
+  int rounds = 5;
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 >= argc) {
+      fprintf(stderr, "%s needs a value\n", argv[i]);
+      return 2;
+    }
+    if (!strcmp(argv[i], "--samples")) {
+      count = (uint32_t)atol(argv[++i]);
+    } else if (!strcmp(argv[i], "--rounds")) {
+      rounds = atoi(argv[++i]);
+    } else {
+      fprintf(stderr, "unknown option %s\n", argv[i]);
+      return 2;
+    }
+  }
+  if (count == 0 || rounds <= 0) {
+    fprintf(stderr, "All options must be positive\n");
+    return 2;
+  }
+
+  std::vector<Reading> readings = makeReadings(count);
+
+  printf("measured,ns_per_reading,passed,history_entries,refreshes\n");
+  struct Composition {
+    const char* name;
+    uint32_t (*run)(const std::vector<Reading>&);
+  };
+  const Composition compositions[] = {
+    { "pipeline", runPipeline },
+    { "calls", runCalls },
+    { "virtual", runVirtual },
+    { "old_loop", runOldLoop },
+  };
+  Outcome reference = { 0, 0, 0, 0 };
+  bool agree = true;
+  for (size_t i = 0; i < sizeof(compositions) / sizeof(compositions[0]); i++) {
+    Outcome outcome = measure(readings, rounds, compositions[i].run);
+    printf("%s,%.2f,%u,%u,%u\n", compositions[i].name, outcome.ns, outcome.passed,
+           outcome.historyEntries, outcome.refreshes);
+    if (i == 0) {
+      reference = outcome;
+    } else if (compositions[i].run != runOldLoop &&
+               (outcome.historyEntries != reference.historyEntries || outcome.refreshes != reference.refreshes)) {
+      agree = false;
+    }
+  }
+
+  // Stage by stage
+  typedef Stages St;
+  Outcome prefixes[] = {
+    measure(readings, rounds, [](const std::vector<Reading>& r) {
+      return runPrefix(r, &St::validate); }),
+    measure(readings, rounds, [](const std::vector<Reading>& r) {
+      return runPrefix(r, &St::validate, &St::filter); }),
+    measure(readings, rounds, [](const std::vector<Reading>& r) {
+      return runPrefix(r, &St::validate, &St::filter, &St::aggregate); }),
+    measure(readings, rounds, [](const std::vector<Reading>& r) {
+      return runPrefix(r, &St::validate, &St::filter, &St::aggregate, &St::history); }),
+    measure(readings, rounds, [](const std::vector<Reading>& r) {
+      return runPrefix(r, &St::validate, &St::filter, &St::aggregate, &St::history, &St::stats); }),
+    measure(readings, rounds, [](const std::vector<Reading>& r) {
+      return runPrefix(r, &St::validate, &St::filter, &St::aggregate, &St::history, &St::stats,
+                       &St::alarm); }),
+    measure(readings, rounds, [](const std::vector<Reading>& r) {
+      return runPrefix(r, &St::validate, &St::filter, &St::aggregate, &St::history, &St::stats,
+                       &St::alarm, &St::invalidate); }),
+  };
+  const char* names[] = { "validate", "filter", "aggregate", "history", "stats", "alarm", "display_invalidate" };
+  double before = 0;
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    printf("stage_%s,%.2f,%u,%u,\n", names[i], prefixes[i].ns - before, prefixes[i].passed,
+           prefixes[i].historyEntries);
+    before = prefixes[i].ns;
+  }
+
+  if (!agree) {
+    fprintf(stderr, "Compositions disagree\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,545 @@
+// Load test for the live push feed (Linux host program, not part of the
+// firmware).
+//
+// Build against the firmware sources:
+//   g++ -O2 -std=c++11 -pthread -Iinclude tools/push_loadtest.cpp src/LiveFeed.cpp -o push_loadtest
+//
+// Usage:
+//   push_loadtest [--clients N,N,...] [--stalled N] [--rate HZ] [--seconds S] [--tick-every N]
+//
+// Serves LiveFeed over a minimal WebSocket server on 127.0.0.1, the way
+// LiveServer does on the device, and connects local subscribers to it, one
+// thread each. The server publishes synthetic readings at a fixed rate (far
+// above the device's one every 30 s, to load it) and a history tick every
+// few samples. Subscribers decode every frame, check it against what was
+// published and measure the publish-to-receive latency.
+//
+// Stalled subscribers complete the handshake and then never read, to show
+// that their queues stay bounded and the others are not held up: their
+// samples are dropped once the socket buffers are full.
+//
+// Options:
+//   --clients N,...   subscriber counts to run, one row each (default: 1,10,100,400)
+//   --stalled N       of which stalled (default: 0)
+//   --rate HZ         samples published per second (default: 1000)
+//   --seconds S       length of each run (default: 3)
+//   --tick-every N    samples per history tick (default: 10)
+//
+// Output is CSV: subscriber count, samples and frames, latency percentiles,
+// server CPU time per sample and per sample and subscriber, dropped samples
+// and sequence gaps seen by the live subscribers.
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <math.h>
+#include <memory>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "LiveFeed.h"
+
+// Bytes a subscriber may have waiting in user space before it counts as
+// unable to take more; the rest is up to the socket buffers
+static const size_t OUT_LIMIT = 256;
+
+// Socket buffers about the size of lwIP's on the ESP32 (TCP_SND_BUF), so a
+// stalled subscriber backs up after a few hundred frames as it would there
+static const int SOCKET_BUFFER = 5744;
+
+typedef std::chrono::steady_clock Clock;
+
+static int64_t nowNs(Clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+}
+
+// ---- SHA-1 and base64, for the handshake only ----
+
+static void sha1(const uint8_t* data, size_t length, uint8_t digest[20]) {
+  uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+  std::vector<uint8_t> message(data, data + length);
+  message.push_back(0x80);
+  while (message.size() % 64 != 56) {
+    message.push_back(0);
+  }
+  uint64_t bits = (uint64_t)length * 8;
+  for (int i = 7; i >= 0; i--) {
+    message.push_back((uint8_t)(bits >> (i * 8)));
+  }
+
+  for (size_t chunk = 0; chunk < message.size(); chunk += 64) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++) {
+      const uint8_t* p = &message[chunk + i * 4];
+      w[i] = (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+    }
+    for (int i = 16; i < 80; i++) {
+      uint32_t x = w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16];
+      w[i] = x << 1 | x >> 31;
+    }
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; i++) {
+      uint32_t f, k;
+      if (i < 20) {
+        f = (b & c) | (~b & d);
+        k = 0x5A827999;
+      } else if (i < 40) {
+        f = b ^ c ^ d;
+        k = 0x6ED9EBA1;
+      } else if (i < 60) {
+        f = (b & c) | (b & d) | (c & d);
+        k = 0x8F1BBCDC;
+      } else {
+        f = b ^ c ^ d;
+        k = 0xCA62C1D6;
+      }
+      uint32_t temp = (a << 5 | a >> 27) + f + e + k + w[i];
+      e = d;
+      d = c;
+      c = b << 30 | b >> 2;
+      b = a;
+      a = temp;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+  }
+  for (int i = 0; i < 20; i++) {
+    digest[i] = (uint8_t)(h[i / 4] >> (24 - (i % 4) * 8));
+  }
+}
+
+static std::string base64(const uint8_t* data, size_t length) {
+  static const char* ALPHABET = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string out;
+  for (size_t i = 0; i < length; i += 3) {
+    uint32_t v = data[i] << 16;
+    if (i + 1 < length) v |= data[i + 1] << 8;
+    if (i + 2 < length) v |= data[i + 2];
+    out += ALPHABET[(v >> 18) & 63];
+    out += ALPHABET[(v >> 12) & 63];
+    out += i + 1 < length ? ALPHABET[(v >> 6) & 63] : '=';
+    out += i + 2 < length ? ALPHABET[v & 63] : '=';
+  }
+  return out;
+}
+
+static std::string acceptKey(const std::string& key) {
+  std::string text = key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+  uint8_t digest[20];
+  sha1((const uint8_t*)text.data(), text.size(), digest);
+  return base64(digest, sizeof(digest));
+}
+
+// ---- Synthetic readings ----
+
+// Reading number seq; subscribers recompute it to check what they decoded
+static LiveSample expectedSample(uint32_t seq, LiveFrameType type) {
+  LiveSample s;
+  s.sequence = seq;
+  s.time = type == LIVE_TICK ? seq * 300000 : seq * 30000;
+  s.co2 = (uint16_t)(800 + 300 * sin(seq / 40.0) + seq % 5);
+  s.temperature = (int16_t)(2100 + 150 * sin(seq / 90.0));
+  s.humidity = (uint16_t)(4500 + 400 * cos(seq / 70.0));
+  return s;
+}
+
+static bool sameSample(const LiveSample& a, const LiveSample& b) {
+  return a.sequence == b.sequence && a.time == b.time && a.co2 == b.co2 &&
+         a.temperature == b.temperature && a.humidity == b.humidity;
+}
+
+// ---- Server ----
+
+struct Connection {
+  int fd;
+  bool open;             // Handshake done
+  std::string in;
+  std::string out;
+};
+
+class Server : public LiveTransport {
+public:
+  Server(uint16_t maxClients) : _feed(maxClients), _listener(-1) {}
+
+  ~Server() {
+    for (Connection& c : _connections) {
+      close(c.fd);
+    }
+    if (_listener >= 0) {
+      close(_listener);
+    }
+  }
+
+  uint16_t listen() {
+    _listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(addr);
+    if (_listener < 0 || bind(_listener, (sockaddr*)&addr, sizeof(addr)) != 0 ||
+        ::listen(_listener, 1024) != 0 || getsockname(_listener, (sockaddr*)&addr, &length) != 0) {
+      perror("listen");
+      exit(1);
+    }
+    return ntohs(addr.sin_port);
+  }
+
+  // Serve for the given time, publishing at rate; returns server CPU seconds
+  double run(double rate, double seconds, uint32_t tickEvery, Clock::time_point start,
+             std::atomic<int64_t>* published, uint16_t subscribers) {
+    // Wait for everyone to subscribe before the clock starts
+    while (_feed.getClientCount() < subscribers) {
+      serve(10000000);
+    }
+
+    rusage before;
+    getrusage(RUSAGE_THREAD, &before);
+
+    uint32_t samples = (uint32_t)(rate * seconds);
+    Clock::time_point runStart = Clock::now();
+    for (uint32_t seq = 0; seq < samples; seq++) {
+      Clock::time_point due = runStart + std::chrono::nanoseconds((int64_t)(seq * 1e9 / rate));
+      while (Clock::now() < due) {
+        serve(std::chrono::duration_cast<std::chrono::nanoseconds>(due - Clock::now()).count());
+      }
+
+      published[seq].store(nowNs(start), std::memory_order_release);
+      if (seq % tickEvery == tickEvery - 1) {
+        _feed.publishTick(expectedSample(seq / tickEvery, LIVE_TICK));
+      }
+      _feed.publishSample(expectedSample(seq, LIVE_SAMPLE));
+      _feed.flush(*this);
+      writeAll();
+    }
+    serve(50000000);
+
+    rusage after;
+    getrusage(RUSAGE_THREAD, &after);
+    return (after.ru_utime.tv_sec - before.ru_utime.tv_sec) + (after.ru_stime.tv_sec - before.ru_stime.tv_sec) +
+           ((after.ru_utime.tv_usec - before.ru_utime.tv_usec) + (after.ru_stime.tv_usec - before.ru_stime.tv_usec)) / 1e6;
+  }
+
+  LiveFeedStats getStats() const {
+    return _feed.getStats();
+  }
+
+  bool canSend(uint16_t client) {
+    return client < _connections.size() && _connections[client].open &&
+           _connections[client].out.size() < OUT_LIMIT;
+  }
+
+  bool send(uint16_t client, const uint8_t* data, size_t length) {
+    // Unmasked binary frame; the payload is always under 126 bytes
+    Connection& c = _connections[client];
+    c.out += (char)0x82;
+    c.out += (char)length;
+    c.out.append((const char*)data, length);
+    return true;
+  }
+
+private:
+  LiveFeed _feed;
+  int _listener;
+  std::vector<Connection> _connections;
+
+  void serve(int64_t timeoutNs) {
+    std::vector<pollfd> fds(1 + _connections.size());
+    fds[0].fd = _listener;
+    fds[0].events = POLLIN;
+    for (size_t i = 0; i < _connections.size(); i++) {
+      fds[i + 1].fd = _connections[i].fd;
+      fds[i + 1].events = POLLIN | (_connections[i].out.empty() ? 0 : POLLOUT);
+    }
+    timespec timeout = { 0, 0 };
+    if (timeoutNs > 0) {
+      timeout.tv_sec = timeoutNs / 1000000000;
+      timeout.tv_nsec = timeoutNs % 1000000000;
+    }
+    if (ppoll(fds.data(), fds.size(), &timeout, nullptr) <= 0) {
+      return;
+    }
+
+    if (fds[0].revents & POLLIN) {
+      int fd;
+      while ((fd = accept4(_listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &SOCKET_BUFFER, sizeof(SOCKET_BUFFER));
+        Connection c;
+        c.fd = fd;
+        c.open = false;
+        _connections.push_back(c);
+      }
+    }
+    for (size_t i = 0; i + 1 < fds.size(); i++) {
+      if (fds[i + 1].revents & POLLIN) {
+        readFrom(i);
+      }
+    }
+    _feed.flush(*this);
+    writeAll();
+  }
+
+  void readFrom(size_t id) {
+    Connection& c = _connections[id];
+    char buffer[1024];
+    ssize_t n;
+    while ((n = read(c.fd, buffer, sizeof(buffer))) > 0) {
+      if (!c.open) {
+        c.in.append(buffer, n);
+      }
+    }
+    if (c.open || c.in.find("\r\n\r\n") == std::string::npos) {
+      return;
+    }
+
+    size_t key = c.in.find("Sec-WebSocket-Key: ");
+    if (key == std::string::npos) {
+      return;
+    }
+    key += strlen("Sec-WebSocket-Key: ");
+    c.out = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+            "Sec-WebSocket-Accept: " + acceptKey(c.in.substr(key, c.in.find("\r\n", key) - key)) + "\r\n\r\n";
+    c.in.clear();
+    c.open = true;
+    _feed.addClient(id);
+  }
+
+  void writeAll() {
+    for (Connection& c : _connections) {
+      while (!c.out.empty()) {
+        ssize_t n = write(c.fd, c.out.data(), c.out.size());
+        if (n <= 0) {
+          break;
+        }
+        c.out.erase(0, n);
+      }
+    }
+  }
+};
+
+// ---- Subscribers ----
+
+struct ClientResult {
+  std::vector<int64_t> latencies;   // ns
+  uint32_t gaps;
+  uint32_t errors;
+};
+
+static int connectTo(uint16_t port) {
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &SOCKET_BUFFER, sizeof(SOCKET_BUFFER));
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if (fd < 0 || connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+    perror("connect");
+    exit(1);
+  }
+  return fd;
+}
+
+static void runClient(uint16_t port, bool stalled, Clock::time_point start, const std::atomic<int64_t>* published,
+                      uint32_t samples, const std::atomic<bool>& done, ClientResult& result) {
+  result.gaps = 0;
+  result.errors = 0;
+  int fd = connectTo(port);
+  const char* request = "GET / HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                        "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n";
+  if (write(fd, request, strlen(request)) < 0) {
+    result.errors++;
+  }
+
+  timeval timeout = { 0, 100000 };
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  std::string in;
+  bool open = false;
+  LiveBaseline bases[2];
+  bases[LIVE_SAMPLE].reset();
+  bases[LIVE_TICK].reset();
+  bool seen[2] = { false, false };
+  uint32_t last[2] = { 0, 0 };
+  char buffer[4096];
+
+  while (!done.load()) {
+    if (stalled && open) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      continue;
+    }
+    ssize_t n = read(fd, buffer, sizeof(buffer));
+    if (n <= 0) {
+      continue;
+    }
+    int64_t received = nowNs(start);
+    in.append(buffer, n);
+
+    if (!open) {
+      size_t end = in.find("\r\n\r\n");
+      if (end == std::string::npos) {
+        continue;
+      }
+      if (in.compare(0, 12, "HTTP/1.1 101") != 0 ||
+          in.find("s3pPLMBiTxaQ9kYGzzhZRbK+xOo=") == std::string::npos) {
+        result.errors++;
+      }
+      in.erase(0, end + 4);
+      open = true;
+    }
+
+    size_t position = 0;
+    while (in.size() - position >= 2) {
+      size_t length = (uint8_t)in[position + 1] & 0x7F;
+      size_t header = 2;
+      if (length == 126) {
+        if (in.size() - position < 4) {
+          break;
+        }
+        length = (uint8_t)in[position + 2] << 8 | (uint8_t)in[position + 3];
+        header = 4;
+      }
+      if (in.size() - position < header + length) {
+        break;
+      }
+
+      LiveFrameType type;
+      LiveSample sample;
+      const uint8_t* payload = (const uint8_t*)in.data() + position + header;
+      if (!liveDecode(bases, payload, length, type, sample) ||
+          !sameSample(sample, expectedSample(sample.sequence, type))) {
+        result.errors++;
+      } else {
+        if (seen[type] && sample.sequence != last[type] + 1) {
+          result.gaps++;
+        }
+        seen[type] = true;
+        last[type] = sample.sequence;
+        if (type == LIVE_SAMPLE && sample.sequence < samples) {
+          result.latencies.push_back(received - published[sample.sequence].load(std::memory_order_acquire));
+        }
+      }
+      position += header + length;
+    }
+    in.erase(0, position);
+  }
+  close(fd);
+}
+
+static int64_t percentile(std::vector<int64_t>& values, double p) {
+  if (values.empty()) {
+    return 0;
+  }
+  size_t index = (size_t)(p * (values.size() - 1));
+  std::nth_element(values.begin(), values.begin() + index, values.end());
+  return values[index];
+}
+
+int main(int argc, char** argv) {
+  std::vector<unsigned> counts = { 1, 10, 100, 400 };
+  unsigned stalled = 0;
+  double rate = 1000;
+  double seconds = 3;
+  uint32_t tickEvery = 10;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--clients") == 0 && i + 1 < argc) {
+      counts.clear();
+      for (char* p = strtok(argv[++i], ","); p; p = strtok(nullptr, ",")) {
+        counts.push_back(strtoul(p, nullptr, 10));
+      }
+    } else if (strcmp(argv[i], "--stalled") == 0 && i + 1 < argc) {
+      stalled = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) {
+      rate = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+      seconds = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--tick-every") == 0 && i + 1 < argc) {
+      tickEvery = strtoul(argv[++i], nullptr, 10);
+    } else {
+      fprintf(stderr, "Usage: push_loadtest [--clients N,N,...] [--stalled N] [--rate HZ] [--seconds S] [--tick-every N]\n");
+      return 2;
+    }
+  }
+  if (rate <= 0 || seconds <= 0 || tickEvery == 0 || counts.empty()) {
+    fprintf(stderr, "Rate, seconds, tick interval and client counts must be positive\n");
+    return 2;
+  }
+
+  printf("clients,stalled,samples,frames,bytes_per_frame,p50_us,p99_us,max_us,"
+         "cpu_us_per_sample,cpu_ns_per_subscriber,samples_dropped,gaps,errors\n");
+  int failures = 0;
+
+  for (unsigned clients : counts) {
+    if (clients == 0 || clients > 0xFFFF) {
+      continue;
+    }
+    unsigned stalledHere = stalled < clients ? stalled : clients - 1;
+    uint32_t samples = (uint32_t)(rate * seconds);
+    std::unique_ptr<std::atomic<int64_t>[]> published(new std::atomic<int64_t>[samples]);
+    for (uint32_t i = 0; i < samples; i++) {
+      published[i].store(0);
+    }
+
+    Server server(clients);
+    uint16_t port = server.listen();
+    Clock::time_point start = Clock::now();
+    std::atomic<bool> done(false);
+    std::vector<ClientResult> results(clients);
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < clients; i++) {
+      threads.emplace_back(runClient, port, i < stalledHere, start, published.get(), samples,
+                           std::cref(done), std::ref(results[i]));
+    }
+
+    double cpu = server.run(rate, seconds, tickEvery, start, published.get(), clients);
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    done.store(true);
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+
+    // Latency and gaps of the subscribers that keep up
+    std::vector<int64_t> latencies;
+    uint32_t gaps = 0;
+    uint32_t errors = 0;
+    for (unsigned i = 0; i < clients; i++) {
+      errors += results[i].errors;
+      if (i >= stalledHere) {
+        gaps += results[i].gaps;
+        latencies.insert(latencies.end(), results[i].latencies.begin(), results[i].latencies.end());
+      }
+    }
+    LiveFeedStats stats = server.getStats();
+    int64_t p50 = percentile(latencies, 0.5);
+    int64_t p99 = percentile(latencies, 0.99);
+    int64_t worst = latencies.empty() ? 0 : *std::max_element(latencies.begin(), latencies.end());
+
+    printf("%u,%u,%u,%u,%.2f,%.1f,%.1f,%.1f,%.2f,%.1f,%u,%u,%u\n", clients, stalledHere, samples,
+           stats.framesSent, stats.framesSent ? (double)stats.bytesSent / stats.framesSent : 0.0,
+           p50 / 1e3, p99 / 1e3, worst / 1e3, cpu * 1e6 / samples, cpu * 1e9 / samples / clients,
+           stats.samplesDropped, gaps, errors);
+    fflush(stdout);
+    if (errors) {
+      failures++;
+    }
+  }
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,213 @@
+// Checks every raster kernel implementation the CPU supports against the
+// scalar one, bit for bit (host program, not part of the firmware).
+//
+// Build against the kernels alone:
+//   g++ -O2 -std=c++11 -Iinclude tools/raster_check.cpp src/RasterKernels.cpp -o raster_check
+//
+// Usage:
+//   raster_check [--cases N] [--seed N]
+//
+// Every case runs once on the scalar kernels and once on the implementation
+// under test, on copies of the same random row. Rows have guard bytes on
+// both sides, so a write past the span shows up as a difference too.
+//   fill_span      rasterFillSpan over random spans, and over spans whose
+//                  ends sit on, just before and just after byte and 16/32
+//                  byte vector boundaries
+//   blit_row       rasterBlitRow of random source rows at every bit offset,
+//                  with widths around the same boundaries, white and black
+//   count_changed  rasterCountChanged of two random buffers at unaligned
+//                  addresses, lengths 0 to 300 and random
+// --cases sets the random cases per kernel (default: 100000).
+//
+// Output is CSV: implementation, kernel, cases, mismatches and the result;
+// implementations the CPU lacks are listed as skipped. Exits with 1 when any
+// implementation differs from scalar.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "RasterKernels.h"
+
+static const char* const KERNELS[] = { "sse2", "avx2" };
+
+// A row of the widest panel buffer the kernels see, with guards
+static const int ROW_BYTES = 128;
+static const int GUARD = 40;
+static const int BUFFER = GUARD + ROW_BYTES + GUARD;
+
+// Span ends and widths around byte and vector boundaries
+static const int16_t EDGES[] = { 0, 1, 7, 8, 9, 15, 16, 17, 127, 128, 129, 135, 136, 137, 255, 256,
+                                 257, 263, 264, 265, 511, 512, 513, 1016, 1023, 1024 };
+static const int EDGE_COUNT = sizeof(EDGES) / sizeof(EDGES[0]);
+
+// xorshift32, so a seed gives the same cases everywhere
+static uint32_t rngState = 1;
+
+static uint32_t rng() {
+  rngState ^= rngState << 13;
+  rngState ^= rngState >> 17;
+  rngState ^= rngState << 5;
+  return rngState;
+}
+
+static void randomBytes(uint8_t* data, int length) {
+  for (int i = 0; i < length; i++) {
+    data[i] = (uint8_t)rng();
+  }
+}
+
+struct Tally {
+  uint32_t cases;
+  uint32_t mismatches;
+};
+
+static void checkFill(const char* kernel, int16_t x0, int16_t x1, bool white, Tally& tally) {
+  uint8_t expected[BUFFER];
+  uint8_t actual[BUFFER];
+  randomBytes(expected, BUFFER);
+  memcpy(actual, expected, BUFFER);
+
+  rasterUseKernel("scalar");
+  rasterFillSpan(expected + GUARD, x0, x1, white);
+  rasterUseKernel(kernel);
+  rasterFillSpan(actual + GUARD, x0, x1, white);
+
+  tally.cases++;
+  if (memcmp(expected, actual, BUFFER) != 0) {
+    tally.mismatches++;
+  }
+}
+
+static void checkBlit(const char* kernel, int16_t x, uint16_t width, bool white, Tally& tally) {
+  uint8_t bits[ROW_BYTES];
+  uint8_t expected[BUFFER];
+  uint8_t actual[BUFFER];
+  randomBytes(bits, ROW_BYTES);
+  randomBytes(expected, BUFFER);
+  memcpy(actual, expected, BUFFER);
+
+  rasterUseKernel("scalar");
+  rasterBlitRow(expected + GUARD, x, bits, width, white);
+  rasterUseKernel(kernel);
+  rasterBlitRow(actual + GUARD, x, bits, width, white);
+
+  tally.cases++;
+  if (memcmp(expected, actual, BUFFER) != 0) {
+    tally.mismatches++;
+  }
+}
+
+static void checkCount(const char* kernel, uint32_t length, Tally& tally) {
+  static uint8_t a[4096 + 64];
+  static uint8_t b[4096 + 64];
+  randomBytes(a, sizeof(a));
+  memcpy(b, a, sizeof(b));
+  // Sparse changes as well as dense ones
+  int flips = rng() % 2 ? (int)(rng() % 8) : (int)sizeof(b);
+  for (int i = 0; i < flips; i++) {
+    b[rng() % sizeof(b)] ^= (uint8_t)rng();
+  }
+  const uint8_t* pa = a + rng() % 32;
+  const uint8_t* pb = b + rng() % 32;
+
+  rasterUseKernel("scalar");
+  uint32_t expected = rasterCountChanged(pa, pb, length);
+  rasterUseKernel(kernel);
+  uint32_t actual = rasterCountChanged(pa, pb, length);
+
+  tally.cases++;
+  if (expected != actual) {
+    tally.mismatches++;
+  }
+}
+
+static bool report(const char* kernel, const char* name, const Tally& tally) {
+  printf("%s,%s,%u,%u,%s\n", kernel, name, tally.cases, tally.mismatches,
+         tally.mismatches ? "FAIL" : "ok");
+  return tally.mismatches == 0;
+}
+
+static bool checkKernel(const char* kernel, uint32_t cases) {
+  const int16_t pixels = ROW_BYTES * 8;
+
+  Tally fill = { 0, 0 };
+  for (int i = 0; i < EDGE_COUNT; i++) {
+    for (int j = 0; j < EDGE_COUNT; j++) {
+      checkFill(kernel, EDGES[i], EDGES[j], true, fill);
+      checkFill(kernel, EDGES[i], EDGES[j], false, fill);
+    }
+  }
+  for (uint32_t i = 0; i < cases; i++) {
+    int16_t x0 = rng() % (pixels + 1);
+    int16_t x1 = x0 + rng() % (pixels - x0 + 1);
+    checkFill(kernel, x0, x1, rng() % 2, fill);
+  }
+
+  Tally blit = { 0, 0 };
+  for (int16_t x = 0; x < 8; x++) {
+    for (int i = 0; i < EDGE_COUNT; i++) {
+      if (EDGES[i] + x <= pixels) {
+        checkBlit(kernel, x, EDGES[i], true, blit);
+        checkBlit(kernel, x, EDGES[i], false, blit);
+      }
+    }
+  }
+  for (uint32_t i = 0; i < cases; i++) {
+    uint16_t width = rng() % (pixels + 1);
+    int16_t x = rng() % (pixels - width + 1);
+    checkBlit(kernel, x, width, rng() % 2, blit);
+  }
+
+  Tally count = { 0, 0 };
+  for (uint32_t length = 0; length <= 300; length++) {
+    checkCount(kernel, length, count);
+  }
+  for (uint32_t i = 0; i < cases; i++) {
+    checkCount(kernel, rng() % 4097, count);
+  }
+
+  bool ok = report(kernel, "fill_span", fill);
+  ok = report(kernel, "blit_row", blit) && ok;
+  ok = report(kernel, "count_changed", count) && ok;
+  return ok;
+}
+
+int main(int argc, char** argv) {
+  long cases = 100000;
+  long seed = 1;
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 >= argc) {
+      fprintf(stderr, "%s needs a value\n", argv[i]);
+      return 2;
+    }
+    if (!strcmp(argv[i], "--cases")) {
+      cases = atol(argv[++i]);
+    } else if (!strcmp(argv[i], "--seed")) {
+      seed = atol(argv[++i]);
+    } else {
+      fprintf(stderr, "unknown option %s\n", argv[i]);
+      return 2;
+    }
+  }
+  if (cases <= 0 || seed <= 0) {
+    fprintf(stderr, "All options must be positive\n");
+    return 2;
+  }
+  rngState = (uint32_t)seed;
+
+  fprintf(stderr, "Selected implementation: %s\n", rasterKernelName());
+  printf("implementation,kernel,cases,mismatches,result\n");
+  bool pass = true;
+  for (size_t i = 0; i < sizeof(KERNELS) / sizeof(KERNELS[0]); i++) {
+    if (!rasterUseKernel(KERNELS[i])) {
+      printf("%s,,,,skipped\n", KERNELS[i]);
+      continue;
+    }
+    pass = checkKernel(KERNELS[i], (uint32_t)cases) && pass;
+  }
+
+  printf("%s\n", pass ? "PASS" : "FAIL");
+  return pass ? 0 : 1;
+}
@@ -0,0 +1,503 @@
+// Renders the monitor screen of many devices from their sample and history
+// snapshots, in parallel, with the firmware's own Display raster core (host
+// program, not part of the firmware).
+//
+// Build against the firmware sources, the host Arduino layer and the GFX
+// library PlatformIO downloads:
+//   GFX=".pio/libdeps/lilygo-t5-v241/Adafruit GFX Library"
+//   g++ -O2 -std=gnu++11 -pthread -DARDUINO=100 -Itools/host -Iinclude -I"$GFX" tools/render_service.cpp src/Display.cpp src/EPaperPanel.cpp src/FrameCache.cpp src/FrameCodec.cpp src/GlyphCache.cpp src/PackedFont.cpp src/RasterKernels.cpp src/LogHistogram.cpp tools/host/Arduino.cpp tools/host/SPI.cpp "$GFX/Adafruit_GFX.cpp" -o render_service
+//
+// Usage:
+//   render_service [--snapshots FILE] [--devices N] [--frames N]
+//                  [--threads N] [--out DIR] [--format pbm|png]
+//
+// Snapshots are one device per line (lines starting with # are skipped):
+//   <device>,<co2>,<temperature>,<humidity>,<history>
+// where history is the device's 30-minute CO2 averages, oldest first and
+// separated by spaces, up to 48 of them. Without --snapshots, --devices
+// synthetic devices are made up.
+//
+// Frames are rendered on a work-stealing pool: every worker owns a Display
+// and a queue of snapshots, takes work from the back of its own queue and,
+// once that is empty, steals from the front of the others'. The benchmark
+// renders --frames frames (cycling over the snapshots) with 1, 2, ... up to
+// --threads workers and compares every frame with a render of its snapshot
+// made up front, so each thread count must give the same frames bit for
+// bit. Then, with --out, each device's frame is written to DIR/<device>.pbm
+// or .png.
+//
+// Options:
+//   --snapshots FILE   device snapshots (default: synthetic devices)
+//   --devices N        synthetic devices (default: 64)
+//   --frames N         frames per measurement (default: 256)
+//   --threads N        most workers to try (default: all cores)
+//   --out DIR          write the frames of all devices to DIR
+//   --format F         pbm or png (default: pbm)
+//
+// Output is CSV: workers, frames, seconds, frames per second, speedup over
+// one worker, the number of steals, and the frames and pixels that differ
+// from the renders made up front. Exits with 1 when any differ.
+//
+// The firmware's event, latency and CPU clock tracers are single-threaded
+// bookkeeping for one device; they are replaced by no-ops below rather
+// than linked.
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <math.h>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Display.h"
+#include "CpuClock.h"
+#include "EventTracer.h"
+#include "LatencyTracer.h"
+#include "RasterKernels.h"
+
+// As in main.cpp
+static const int CO2_ALARM_THRESHOLD = 1000;
+static const uint8_t DATA_HISTORY_SIZE = 48;
+static const uint32_t HISTORY_INTERVAL_MS = 1800000;
+
+// ---------------------------------------------------------------------------
+// Tracers, as no-ops
+
+EventTracer eventTracer;
+LatencyTracer latencyTracer;
+CpuClock cpuClock;
+
+EventTracer::EventTracer() : _next(0), _total(0) {}
+void EventTracer::begin(TraceEvent, uint16_t) {}
+void EventTracer::end(TraceEvent, uint16_t) {}
+void EventTracer::instant(TraceEvent, uint16_t) {}
+
+LatencyTracer::LatencyTracer() : _nextId(1) {}
+void LatencyTracer::mark(uint32_t, TraceStage) {}
+
+CpuClock::CpuClock() {}
+void CpuClock::acquire() {}
+void CpuClock::release() {}
+void CpuClock::recordRender(uint32_t) {}
+
+// ---------------------------------------------------------------------------
+// Snapshots
+
+struct Snapshot {
+  std::string device;
+  SensorData data;
+  uint16_t history[DATA_HISTORY_SIZE];
+  int historyIndex;
+  HistoricalData mini;
+  ExposureSummary day;
+};
+
+// Fill in what Display takes besides the reading from the history
+static void prepare(Snapshot& snapshot, const std::vector<uint16_t>& history) {
+  memset(snapshot.history, 0, sizeof(snapshot.history));
+  size_t first = history.size() > DATA_HISTORY_SIZE ? history.size() - DATA_HISTORY_SIZE : 0;
+  int count = 0;
+  for (size_t i = first; i < history.size(); i++) {
+    snapshot.history[count++ % DATA_HISTORY_SIZE] = history[i];
+  }
+  snapshot.historyIndex = count % DATA_HISTORY_SIZE;
+
+  // Mini charts: the last 12 entries, at the current temperature and humidity
+  memset(&snapshot.mini, 0, sizeof(snapshot.mini));
+  size_t miniFirst = history.size() > 12 ? history.size() - 12 : 0;
+  for (size_t i = miniFirst; i < history.size(); i++) {
+    int slot = snapshot.mini.index;
+    snapshot.mini.co2[slot] = history[i];
+    snapshot.mini.temp[slot] = snapshot.data.temperature;
+    snapshot.mini.humidity[slot] = snapshot.data.humidity;
+    snapshot.mini.index = (slot + 1) % 12;
+    snapshot.mini.count++;
+  }
+
+  // Exposure over the day the history covers
+  memset(&snapshot.day, 0, sizeof(snapshot.day));
+  for (size_t i = first; i < history.size(); i++) {
+    snapshot.day.ms[classifyAirQuality(history[i])] += HISTORY_INTERVAL_MS;
+  }
+}
+
+static bool parseSnapshot(const char* line, Snapshot& snapshot) {
+  char device[64];
+  float co2;
+  int consumed = 0;
+  memset(&snapshot.data, 0, sizeof(snapshot.data));
+  if (sscanf(line, " %63[^,],%f,%f,%f,%n", device, &co2, &snapshot.data.temperature,
+             &snapshot.data.humidity, &consumed) < 4 || consumed == 0) {
+    return false;
+  }
+  snapshot.device = device;
+  snapshot.data.co2 = (uint16_t)co2;
+
+  std::vector<uint16_t> history;
+  const char* p = line + consumed;
+  char* end;
+  for (long value = strtol(p, &end, 10); end != p; value = strtol(p, &end, 10)) {
+    history.push_back((uint16_t)value);
+    p = end;
+  }
+  prepare(snapshot, history);
+  return true;
+}
+
+static bool readSnapshots(const char* path, std::vector<Snapshot>& snapshots) {
+  FILE* file = fopen(path, "r");
+  if (!file) {
+    perror(path);
+    return false;
+  }
+  char line[1024];
+  int number = 0;
+  while (fgets(line, sizeof(line), file)) {
+    number++;
+    if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0') {
+      continue;
+    }
+    Snapshot snapshot;
+    if (!parseSnapshot(line, snapshot)) {
+      fprintf(stderr, "%s:%d: not a snapshot\n", path, number);
+      fclose(file);
+      return false;
+    }
+    snapshots.push_back(snapshot);
+  }
+  fclose(file);
+  return true;
+}
+
+// Garages with their own daily rhythm and alarm spells
+static void makeSnapshots(int count, std::vector<Snapshot>& snapshots) {
+  for (int d = 0; d < count; d++) {
+    Snapshot snapshot;
+    char name[16];
+    snprintf(name, sizeof(name), "unit%03d", d);
+    snapshot.device = name;
+
+    std::vector<uint16_t> history;
+    for (int i = 0; i < DATA_HISTORY_SIZE; i++) {
+      double phase = 2 * M_PI * (i + d * 5) / DATA_HISTORY_SIZE;
+      history.push_back((uint16_t)(650 + 300 * sin(phase) + (d % 7) * 90 + ((i * 13 + d) % 40)));
+    }
+    memset(&snapshot.data, 0, sizeof(snapshot.data));
+    snapshot.data.co2 = history.back();
+    snapshot.data.temperature = 12.0f + (d % 15);
+    snapshot.data.humidity = 40.0f + (d % 30);
+    prepare(snapshot, history);
+    snapshots.push_back(snapshot);
+  }
+}
+
+// ---------------------------------------------------------------------------
+// Output
+
+class FilePrint : public Print {
+public:
+  FilePrint(FILE* file) : _file(file) {}
+  size_t write(uint8_t c) { return fputc(c, _file) == EOF ? 0 : 1; }
+  size_t write(const uint8_t* buffer, size_t size) { return fwrite(buffer, 1, size, _file); }
+  using Print::write;
+
+private:
+  FILE* _file;
+};
+
+static uint32_t crc32(uint32_t crc, const uint8_t* data, size_t size) {
+  crc = ~crc;
+  for (size_t i = 0; i < size; i++) {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+  }
+  return ~crc;
+}
+
+static void putBig32(std::vector<uint8_t>& out, uint32_t value) {
+  out.push_back(value >> 24);
+  out.push_back(value >> 16);
+  out.push_back(value >> 8);
+  out.push_back(value);
+}
+
+static void writeChunk(FILE* file, const char* type, const std::vector<uint8_t>& data) {
+  std::vector<uint8_t> chunk;
+  putBig32(chunk, data.size());
+  chunk.insert(chunk.end(), type, type + 4);
+  chunk.insert(chunk.end(), data.begin(), data.end());
+  putBig32(chunk, crc32(0, &chunk[4], chunk.size() - 4));
+  fwrite(chunk.data(), 1, chunk.size(), file);
+}
+
+// 1-bit grayscale PNG of the frame. The buffer already has 1 for white and
+// whole bytes per row, so rows go in as they are, in stored (uncompressed)
+// deflate blocks; a dashboard's web server compresses better anyway.
+static void writePNG(const Display& display, FILE* file) {
+  static const uint8_t SIGNATURE[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+  fwrite(SIGNATURE, 1, sizeof(SIGNATURE), file);
+
+  std::vector<uint8_t> header;
+  putBig32(header, display.width());
+  putBig32(header, display.height());
+  const uint8_t rest[] = { 1, 0, 0, 0, 0 };  // 1 bit gray, deflate, no filter, no interlace
+  header.insert(header.end(), rest, rest + sizeof(rest));
+  writeChunk(file, "IHDR", header);
+
+  const uint16_t stride = display.width() / 8;
+  std::vector<uint8_t> raw;
+  for (int16_t y = 0; y < display.height(); y++) {
+    raw.push_back(0);  // Filter: none
+    const uint8_t* row = display.getBuffer() + (uint32_t)y * stride;
+    raw.insert(raw.end(), row, row + stride);
+  }
+
+  std::vector<uint8_t> zlib;
+  zlib.push_back(0x78);
+  zlib.push_back(0x01);
+  uint32_t a = 1, b = 0;
+  for (size_t i = 0; i < raw.size(); i++) {
+    a = (a + raw[i]) % 65521;
+    b = (b + a) % 65521;
+  }
+  for (size_t offset = 0; offset < raw.size(); offset += 65535) {
+    size_t length = raw.size() - offset < 65535 ? raw.size() - offset : 65535;
+    zlib.push_back(offset + length == raw.size() ? 1 : 0);
+    zlib.push_back(length & 0xFF);
+    zlib.push_back(length >> 8);
+    zlib.push_back(~length & 0xFF);
+    zlib.push_back((~length >> 8) & 0xFF);
+    zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + length);
+  }
+  putBig32(zlib, (b << 16) | a);
+  writeChunk(file, "IDAT", zlib);
+  writeChunk(file, "IEND", std::vector<uint8_t>());
+}
+
+// ---------------------------------------------------------------------------
+// Work-stealing pool
+
+static void render(Display& display, const Snapshot& snapshot) {
+  display.updateFull(snapshot.data, snapshot.history, snapshot.historyIndex, snapshot.mini, true,
+                     &snapshot.day);
+}
+
+class RenderPool {
+public:
+  // Frame i shows snapshots[i % snapshots.size()] and is compared with
+  // the frame at i % snapshots.size() in references; when outDir is set
+  // each frame is also written there under its device's name
+  RenderPool(const std::vector<Snapshot>& snapshots, const std::vector<uint8_t>& references,
+             const char* outDir, bool png)
+    : _snapshots(snapshots), _references(references), _outDir(outDir), _png(png), _steals(0),
+      _differing(0), _changedPixels(0), _failed(false) {}
+
+  // Render frames 0..frames-1 on workers threads
+  void run(unsigned workers, uint32_t frames) {
+    _queues = std::vector<Queue>(workers);
+    for (uint32_t i = 0; i < frames; i++) {
+      // Contiguous runs, so stealing only happens once a worker runs dry
+      _queues[(uint64_t)i * workers / frames].jobs.push_back(i);
+    }
+    _steals = 0;
+    _differing = 0;
+    _changedPixels = 0;
+
+    std::vector<std::thread> threads;
+    for (unsigned w = 0; w < workers; w++) {
+      threads.push_back(std::thread(&RenderPool::work, this, w));
+    }
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+  }
+
+  uint32_t getSteals() const { return _steals; }
+  uint32_t getDiffering() const { return _differing; }
+  uint64_t getChangedPixels() const { return _changedPixels; }
+  bool failed() const { return _failed; }
+
+private:
+  struct Queue {
+    std::mutex lock;
+    std::deque<uint32_t> jobs;
+  };
+
+  const std::vector<Snapshot>& _snapshots;
+  const std::vector<uint8_t>& _references;
+  const char* _outDir;
+  bool _png;
+  std::vector<Queue> _queues;
+  std::atomic<uint32_t> _steals;
+  std::atomic<uint32_t> _differing;
+  std::atomic<uint64_t> _changedPixels;
+  std::atomic<bool> _failed;
+
+  bool take(unsigned worker, uint32_t& job) {
+    {
+      Queue& own = _queues[worker];
+      std::lock_guard<std::mutex> guard(own.lock);
+      if (!own.jobs.empty()) {
+        job = own.jobs.back();
+        own.jobs.pop_back();
+        return true;
+      }
+    }
+    for (size_t i = 1; i < _queues.size(); i++) {
+      Queue& victim = _queues[(worker + i) % _queues.size()];
+      std::lock_guard<std::mutex> guard(victim.lock);
+      if (!victim.jobs.empty()) {
+        job = victim.jobs.front();
+        victim.jobs.pop_front();
+        _steals++;
+        return true;
+      }
+    }
+    // Nothing is ever queued during a run, so empty queues mean done
+    return false;
+  }
+
+  void work(unsigned worker) {
+    Display display(CO2_ALARM_THRESHOLD, DATA_HISTORY_SIZE);
+    uint32_t job;
+    while (take(worker, job)) {
+      size_t index = job % _snapshots.size();
+      const Snapshot& snapshot = _snapshots[index];
+      render(display, snapshot);
+
+      uint32_t size = display.getBufferSize();
+      uint32_t changed = rasterCountChanged(display.getBuffer(), &_references[index * size], size);
+      if (changed) {
+        _differing++;
+        _changedPixels += changed;
+      }
+
+      if (_outDir && !save(display, snapshot.device)) {
+        _failed = true;
+      }
+    }
+  }
+
+  bool save(const Display& display, const std::string& device) {
+    std::string path = std::string(_outDir) + "/" + device + (_png ? ".png" : ".pbm");
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) {
+      perror(path.c_str());
+      return false;
+    }
+    if (_png) {
+      writePNG(display, file);
+    } else {
+      FilePrint out(file);
+      display.writePBM(out);
+    }
+    return fclose(file) == 0;
+  }
+};
+
+int main(int argc, char** argv) {
+  const char* snapshotPath = nullptr;
+  const char* outDir = nullptr;
+  int devices = 64;
+  uint32_t frames = 256;
+  unsigned maxThreads = std::thread::hardware_concurrency();
+  bool png = false;
+  if (maxThreads == 0) {
+    maxThreads = 1;
+  }
+
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 >= argc) {
+      fprintf(stderr, "%s needs a value\n", argv[i]);
+      return 2;
+    }
+    if (!strcmp(argv[i], "--snapshots")) {
+      snapshotPath = argv[++i];
+    } else if (!strcmp(argv[i], "--devices")) {
+      devices = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--frames")) {
+      frames = (uint32_t)atol(argv[++i]);
+    } else if (!strcmp(argv[i], "--threads")) {
+      maxThreads = (unsigned)atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--out")) {
+      outDir = argv[++i];
+    } else if (!strcmp(argv[i], "--format")) {
+      const char* format = argv[++i];
+      if (strcmp(format, "pbm") && strcmp(format, "png")) {
+        fprintf(stderr, "unknown format %s\n", format);
+        return 2;
+      }
+      png = !strcmp(format, "png");
+    } else {
+      fprintf(stderr, "unknown option %s\n", argv[i]);
+      return 2;
+    }
+  }
+  if (devices <= 0 || frames == 0 || maxThreads == 0) {
+    fprintf(stderr, "All options must be positive\n");
+    return 2;
+  }
+
+  std::vector<Snapshot> snapshots;
+  if (snapshotPath) {
+    if (!readSnapshots(snapshotPath, snapshots)) {
+      return 1;
+    }
+    if (snapshots.empty()) {
+      fprintf(stderr, "%s has no snapshots\n", snapshotPath);
+      return 1;
+    }
+  } else {
+    makeSnapshots(devices, snapshots);
+  }
+
+  // Every snapshot rendered once, on one Display, before any timing
+  std::vector<uint8_t> references;
+  {
+    Display display(CO2_ALARM_THRESHOLD, DATA_HISTORY_SIZE);
+    for (const Snapshot& snapshot : snapshots) {
+      render(display, snapshot);
+      references.insert(references.end(), display.getBuffer(),
+                        display.getBuffer() + display.getBufferSize());
+    }
+  }
+
+  printf("workers,frames,seconds,fps,speedup,steals,differing,changed_pixels\n");
+  RenderPool pool(snapshots, references, nullptr, png);
+  double single = 0;
+  bool agree = true;
+  for (unsigned workers = 1; workers <= maxThreads; workers++) {
+    auto start = std::chrono::steady_clock::now();
+    pool.run(workers, frames);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (workers == 1) {
+      single = seconds;
+    }
+    agree = agree && pool.getDiffering() == 0;
+    printf("%u,%u,%.3f,%.1f,%.2f,%u,%u,%llu\n", workers, frames, seconds, frames / seconds,
+           single / seconds, pool.getSteals(), pool.getDiffering(),
+           (unsigned long long)pool.getChangedPixels());
+    fflush(stdout);
+  }
+
+  if (outDir) {
+    RenderPool writer(snapshots, references, outDir, png);
+    writer.run(maxThreads, snapshots.size());
+    if (writer.failed()) {
+      return 1;
+    }
+  }
+
+  if (!agree) {
+    fprintf(stderr, "Frames differ from a single render of their snapshot\n");
+    return 1;
+  }
+  return 0;
+}
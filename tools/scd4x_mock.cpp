@@ -0,0 +1,442 @@
+// SCD4x measurement schedules against a mock sensor that enforces the
+// datasheet's command rules (host program, not part of the firmware).
+//
+// Build against the firmware sources:
+//   g++ -O2 -std=c++11 -Iinclude tools/scd4x_mock.cpp src/Scd4xSchedule.cpp -o scd4x_mock
+//
+// Usage:
+//   scd4x_mock [--hours H] [--poll S] [--co2 S] [--rht S] [--runs N] [--seed N]
+//
+// Drives Scd4xSchedule the way the bus scheduler does (send a command, wait
+// its execution time, read the response) against a mock SCD41 that NACKs
+// and counts as a violation:
+//   - any command sent while the previous one still executes (1 ms for
+//     reads and data ready, 5 s for a single shot, 50 ms for an RHT only
+//     shot, 500 ms after stop_periodic_measurement)
+//   - single shot commands during periodic measurement
+//   - read_measurement with no new measurement in the buffer
+// RHT only measurements read back with a CO2 of 0, as on the sensor.
+//
+// First compares the measurement modes over --hours of a garage whose
+// temperature and humidity swing with the door and the sun, with the
+// firmware polling the newest reading every --poll seconds: periodic (5 s),
+// low power periodic (30 s), CO2 single shots every --co2 seconds alone
+// and with RHT only shots every --rht seconds. Then checks --runs random
+// schedules (short and odd intervals, interval changes and restarts at
+// random times) for violations; the exit status is 1 if there were any.
+//
+// Sensor current is modelled from the SCD41 datasheet at 3.3 V: 15 mA in
+// periodic and 3.2 mA in low power periodic measurement, 0.2 mA idle and
+// 75 mA*s per single shot (0.45 mA average at one shot per 5 min). The RHT
+// only shot is taken as 50 ms at 18 mA, 0.9 mA*s; the datasheet gives its
+// duration, not its charge.
+//
+// Options:
+//   --hours H   simulated time per mode (default: 24)
+//   --poll S    seconds between firmware polls (default: 60)
+//   --co2 S     seconds between CO2 single shots (default: 120)
+//   --rht S     seconds between RHT only shots (default: 60)
+//   --runs N    random schedules to check (default: 2000)
+//   --seed N    random seed (default: 1)
+//
+// Output is CSV. Modes: per mode, commands sent, violations, CO2 and
+// temperature/humidity measurements per hour, the mean and largest age of
+// the CO2 and of the temperature/humidity the polls saw (s), the mean
+// temperature error at the polls (C) and the average sensor current (mA).
+// Check: runs, commands, violations and stretches without a CO2 shot
+// longer than twice its interval.
+
+#include <math.h>
+#include <random>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Scd4xSchedule.h"
+
+// Charge model, mA and mA*s
+static const double PERIODIC_MA = 15.0;
+static const double LOW_POWER_MA = 3.2;
+static const double IDLE_MA = 0.2;
+static const double SINGLE_SHOT_MAS = 75.0;
+static const double RHT_ONLY_MAS = 0.9;
+
+// Bus time of one transaction at 100 kHz
+static const unsigned long TRANSACTION_US = 300;
+
+struct Options {
+  double hours = 24;
+  uint32_t pollMs = 60000;
+  uint32_t co2Ms = 120000;
+  uint32_t rhtMs = 60000;
+  int runs = 2000;
+  unsigned seed = 1;
+};
+
+// Garage climate: a daily swing, and the door opening for 10 min every
+// 3 hours lets in cold, damp air
+static double trueTemperature(double s) {
+  double t = 16 + 4 * sin(s * 2 * M_PI / 86400);
+  double door = fmod(s, 10800);
+  if (door > 3600 && door < 4200) {
+    t -= 6 * (1 - exp(-(door - 3600) / 120));
+  } else if (door >= 4200) {
+    t -= 6 * (1 - exp(-600.0 / 120)) * exp(-(door - 4200) / 900);
+  }
+  return t;
+}
+
+static double trueHumidity(double s) {
+  return 55 + 15 * (16 - trueTemperature(s)) / 10;
+}
+
+static uint16_t ticks(double value, double offset, double scale) {
+  double t = (value + offset) * 65535 / scale;
+  return (uint16_t)(t < 0 ? 0 : t > 65535 ? 65535 : t + 0.5);
+}
+
+// The sensor side of the bus
+class MockScd41 {
+public:
+  enum Mode { IDLE, PERIODIC, LOW_POWER };
+
+  MockScd41() : _mode(IDLE), _busyUntil(0), _started(0), _lastData(0), _hasData(false),
+                _rhtOnly(false), _measuredAt(0), _commands(0), _violations(0), _shots(0), _rhtShots(0) {}
+
+  void startPeriodic(unsigned long now, bool lowPower) {
+    _mode = lowPower ? LOW_POWER : PERIODIC;
+    _started = now;
+    _lastData = now;
+    _busyUntil = now + Scd4xSchedule::COMMAND_US;
+  }
+
+  // A command write; false is a NACK
+  bool command(uint16_t code, unsigned long now) {
+    _commands++;
+    refresh(now);
+    if ((long)(now - _busyUntil) < 0) {
+      return violation("command while executing", code, now);
+    }
+    unsigned long exec = Scd4xSchedule::COMMAND_US;
+    switch (code) {
+      case SCD4X_GET_DATA_READY:
+      case SCD4X_READ_MEASUREMENT:
+        break;
+      case SCD4X_STOP_PERIODIC:
+        _mode = IDLE;
+        exec = 500000;
+        break;
+      case SCD4X_MEASURE_SINGLE_SHOT:
+      case SCD4X_MEASURE_SINGLE_SHOT_RHT_ONLY:
+        if (_mode != IDLE) {
+          return violation("single shot during periodic measurement", code, now);
+        }
+        _rhtOnly = code == SCD4X_MEASURE_SINGLE_SHOT_RHT_ONLY;
+        exec = _rhtOnly ? Scd4xSchedule::RHT_ONLY_US : Scd4xSchedule::SINGLE_SHOT_US;
+        _hasData = true;
+        _measuredAt = now + exec;
+        if (_rhtOnly) {
+          _rhtShots++;
+        } else {
+          _shots++;
+        }
+        break;
+      default:
+        return violation("unknown command", code, now);
+    }
+    _busyUntil = now + exec;
+    _last = code;
+    return true;
+  }
+
+  // The read after a command; false is a NACK
+  bool read(uint16_t* words, uint8_t count, unsigned long now) {
+    refresh(now);
+    if ((long)(now - _busyUntil) < 0) {
+      return violation("read while executing", _last, now);
+    }
+    if (_last == SCD4X_GET_DATA_READY && count == 1) {
+      words[0] = _hasData ? 0x8006 : 0x8000;
+      return true;
+    }
+    if (_last != SCD4X_READ_MEASUREMENT || count != 3) {
+      return violation("read without a command that answers", _last, now);
+    }
+    if (!_hasData) {
+      return violation("read_measurement without new data", _last, now);
+    }
+    double s = _measuredAt / 1e6;
+    words[0] = _rhtOnly ? 0 : 800;
+    words[1] = ticks(trueTemperature(s), 45, 175);
+    words[2] = ticks(trueHumidity(s), 0, 100);
+    _hasData = false;
+    _rhtOnly = false;
+    return true;
+  }
+
+  // Time the newest measurement was taken
+  unsigned long measuredAt() const { return _measuredAt; }
+
+  uint32_t getCommands() const { return _commands; }
+  uint32_t getViolations() const { return _violations; }
+  uint32_t getShots() const { return _shots; }
+  uint32_t getRhtShots() const { return _rhtShots; }
+
+  bool quiet = false;
+
+private:
+  Mode _mode;
+  unsigned long _busyUntil;
+  unsigned long _started;
+  unsigned long _lastData;
+  bool _hasData;
+  bool _rhtOnly;
+  unsigned long _measuredAt;
+  uint16_t _last = 0;
+  uint32_t _commands;
+  uint32_t _violations;
+  uint32_t _shots;
+  uint32_t _rhtShots;
+
+  // Periodic measurements land in the buffer on their own
+  void refresh(unsigned long now) {
+    if (_mode == IDLE) {
+      return;
+    }
+    unsigned long period = _mode == LOW_POWER ? 30000000UL : 5000000UL;
+    while (now - _lastData >= period) {
+      _lastData += period;
+      _measuredAt = _lastData;
+      _hasData = true;
+      _rhtOnly = false;
+      _shots++;
+    }
+  }
+
+  bool violation(const char* what, uint16_t code, unsigned long now) {
+    _violations++;
+    if (!quiet && _violations <= 5) {
+      fprintf(stderr, "violation at %.3f s: %s (0x%04X)\n", now / 1e6, what, code);
+    }
+    return false;
+  }
+};
+
+// The bus scheduler's side: one command in flight, its response read once
+// it has executed
+struct Driver {
+  Scd4xSchedule schedule;
+  MockScd41 sensor;
+  unsigned long now = 0;
+  bool busy = false;
+  unsigned long readyAt = 0;
+  Scd4xStep step;
+  bool failed = false;
+
+  // CO2 and temperature/humidity last read, and when they were measured
+  double temperature = 0;
+  unsigned long co2At = 0;
+  unsigned long rhtAt = 0;
+  uint32_t co2Readings = 0;
+  uint32_t rhtReadings = 0;
+
+  unsigned long nextEvent() const {
+    return busy ? readyAt : schedule.getDueTime();
+  }
+
+  // Run the bus up to `until`
+  void run(unsigned long until) {
+    while ((long)(until - nextEvent()) >= 0 && !failed) {
+      // Due times may lie in the past, the clock doesn't go back
+      if ((long)(nextEvent() - now) > 0) {
+        now = nextEvent();
+      }
+      if (busy) {
+        finish();
+      } else if (schedule.next(now, step)) {
+        start();
+      }
+    }
+    if ((long)(until - now) > 0) {
+      now = until;
+    }
+  }
+
+  void start() {
+    if (!sensor.command(step.code, now)) {
+      failed = true;
+      return;
+    }
+    now += TRANSACTION_US;
+    busy = true;
+    readyAt = now + step.execMicros;
+  }
+
+  void finish() {
+    busy = false;
+    uint16_t words[3] = { 0, 0, 0 };
+    if (step.rxWords > 0) {
+      if (!sensor.read(words, step.rxWords, now)) {
+        failed = true;
+        return;
+      }
+      now += TRANSACTION_US;
+    }
+    switch (schedule.complete(words, now)) {
+      case SCD4X_CO2_READING:
+        co2Readings++;
+        co2At = sensor.measuredAt();
+        rhtAt = co2At;
+        temperature = -45.0 + 175.0 * words[1] / 65535.0;
+        break;
+      case SCD4X_RHT_READING:
+        rhtReadings++;
+        rhtAt = sensor.measuredAt();
+        temperature = -45.0 + 175.0 * words[1] / 65535.0;
+        break;
+      default:
+        break;
+    }
+  }
+};
+
+enum ModeKind { MODE_PERIODIC, MODE_LOW_POWER, MODE_SINGLE_SHOT, MODE_SINGLE_SHOT_RHT };
+
+static void compareMode(const Options& options, ModeKind kind, const char* name) {
+  Driver driver;
+  bool singleShot = kind == MODE_SINGLE_SHOT || kind == MODE_SINGLE_SHOT_RHT;
+  if (singleShot) {
+    driver.schedule.setSingleShot(options.co2Ms, kind == MODE_SINGLE_SHOT_RHT ? options.rhtMs : 0);
+  } else {
+    driver.sensor.startPeriodic(0, kind == MODE_LOW_POWER);
+    driver.schedule.setPeriodic();
+  }
+  driver.schedule.restart(Scd4xSchedule::COMMAND_US);
+
+  unsigned long end = (unsigned long)(options.hours * 3600e6);
+  unsigned long poll = (unsigned long)options.pollMs * 1000;
+  double co2Age = 0, co2AgeMax = 0, rhtAge = 0, rhtAgeMax = 0, error = 0;
+  uint32_t polls = 0;
+  for (unsigned long t = poll; t <= end && !driver.failed; t += poll) {
+    driver.run(t);
+    if (driver.co2Readings == 0) {
+      continue;  // Warming up
+    }
+    double a = (t - driver.co2At) / 1e6;
+    double b = (t - driver.rhtAt) / 1e6;
+    co2Age += a;
+    rhtAge += b;
+    co2AgeMax = a > co2AgeMax ? a : co2AgeMax;
+    rhtAgeMax = b > rhtAgeMax ? b : rhtAgeMax;
+    error += fabs(driver.temperature - trueTemperature(t / 1e6));
+    polls++;
+  }
+
+  double hours = options.hours;
+  double current;
+  switch (kind) {
+    case MODE_PERIODIC:
+      current = PERIODIC_MA;
+      break;
+    case MODE_LOW_POWER:
+      current = LOW_POWER_MA;
+      break;
+    default:
+      current = IDLE_MA + (driver.sensor.getShots() * SINGLE_SHOT_MAS +
+                           driver.sensor.getRhtShots() * RHT_ONLY_MAS) / (hours * 3600);
+      break;
+  }
+  double co2PerHour = (singleShot ? driver.sensor.getShots() : driver.co2Readings) / hours;
+
+  polls = polls ? polls : 1;
+  printf("%s,%u,%u,%.1f,%.1f,%.1f,%.0f,%.1f,%.0f,%.3f,%.2f\n", name,
+         driver.sensor.getCommands(), driver.sensor.getViolations(),
+         co2PerHour, driver.rhtReadings / hours,
+         co2Age / polls, co2AgeMax, rhtAge / polls, rhtAgeMax, error / polls, current);
+}
+
+// Random intervals, interval changes and restarts; every run must get
+// through without a NACK and take each CO2 shot on time
+static bool checkSchedules(const Options& options) {
+  std::mt19937 random(options.seed);
+  std::uniform_int_distribution<uint32_t> co2Ms(1000, 600000);
+  std::uniform_int_distribution<uint32_t> rhtMs(1, 120000);
+  std::uniform_int_distribution<int> event(0, 9);
+  std::uniform_int_distribution<unsigned long> gap(1000, 900000000UL);
+  uint32_t commands = 0, violations = 0, late = 0;
+
+  for (int run = 0; run < options.runs; run++) {
+    Driver driver;
+    driver.sensor.quiet = violations > 0;
+    uint32_t co2 = co2Ms(random);
+    driver.schedule.setSingleShot(co2, event(random) < 2 ? 0 : rhtMs(random));
+    driver.schedule.restart(0);
+
+    for (int step = 0; step < 40 && !driver.failed; step++) {
+      unsigned long from = driver.now;
+      uint32_t before = driver.sensor.getShots();
+      driver.run(from + gap(random));
+
+      // A shot is due at least every CO2 interval, plus the 5 s it and the
+      // RHT shot before it can take
+      unsigned long window = (unsigned long)co2 * 1000 + Scd4xSchedule::SINGLE_SHOT_US +
+                             Scd4xSchedule::RHT_ONLY_US + 4 * TRANSACTION_US;
+      if (driver.now - from >= 2 * window && driver.sensor.getShots() == before) {
+        late++;
+      }
+
+      int e = event(random);
+      if (e < 3) {
+        co2 = co2Ms(random);
+        driver.schedule.setIntervals(co2, e == 0 ? 0 : rhtMs(random));
+      } else if (e == 3) {
+        // What CO2Sensor does under a hold: the command in flight is
+        // finished first, then the cycle starts over
+        if (driver.busy) {
+          driver.now = (long)(driver.readyAt - driver.now) > 0 ? driver.readyAt : driver.now;
+          driver.finish();
+        }
+        driver.schedule.restart(driver.now);
+      }
+    }
+    commands += driver.sensor.getCommands();
+    violations += driver.sensor.getViolations();
+  }
+  printf("check,%d,%u,%u,%u\n", options.runs, commands, violations, late);
+  return violations == 0 && late == 0;
+}
+
+int main(int argc, char** argv) {
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (!strcmp(argv[i], "--hours") && value) {
+      options.hours = atof(value);
+    } else if (!strcmp(argv[i], "--poll") && value) {
+      options.pollMs = (uint32_t)(atof(value) * 1000);
+    } else if (!strcmp(argv[i], "--co2") && value) {
+      options.co2Ms = (uint32_t)(atof(value) * 1000);
+    } else if (!strcmp(argv[i], "--rht") && value) {
+      options.rhtMs = (uint32_t)(atof(value) * 1000);
+    } else if (!strcmp(argv[i], "--runs") && value) {
+      options.runs = atoi(value);
+    } else if (!strcmp(argv[i], "--seed") && value) {
+      options.seed = (unsigned)atoi(value);
+    } else {
+      fprintf(stderr, "usage: %s [--hours H] [--poll S] [--co2 S] [--rht S] [--runs N] [--seed N]\n", argv[0]);
+      return 2;
+    }
+    i++;
+  }
+
+  printf("mode,commands,violations,co2_per_h,rht_per_h,co2_age_mean_s,co2_age_max_s,"
+         "rht_age_mean_s,rht_age_max_s,temp_error_c,sensor_ma\n");
+  compareMode(options, MODE_PERIODIC, "periodic");
+  compareMode(options, MODE_LOW_POWER, "low_power");
+  compareMode(options, MODE_SINGLE_SHOT, "single_shot");
+  compareMode(options, MODE_SINGLE_SHOT_RHT, "single_shot_rht");
+
+  printf("\ncheck,runs,commands,violations,late\n");
+  return checkSchedules(options) ? 0 : 1;
+}
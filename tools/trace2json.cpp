@@ -0,0 +1,264 @@
+// Converts an event trace dumped by the firmware into Chrome trace-event JSON.
+//
+// Build on the host (not part of the firmware):
+//   g++ -O2 -std=c++11 tools/trace2json.cpp -o trace2json
+//
+// Usage:
+//   trace2json [log file] > trace.json
+//
+// Reads a serial capture (or stdin) holding one or more dumps, as printed by
+// EventTracer::dump() when TRACE_DUMP_COMMAND is sent, and converts the last
+// one. Lines may carry the "HH:MM:SS.mmm > " prefix added by the PlatformIO
+// `time` monitor filter. Open the result in https://ui.perfetto.dev or
+// chrome://tracing: the loop task and the panel controller are separate
+// tracks, spans show as slices and instants as markers.
+//
+// Timestamps are micros() from the device, unwrapped past 32 bits. Spans cut
+// in half by the ring overwriting their begin are left out; spans still
+// running at the dump are closed at the dump time.
+
+#include <map>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+struct TraceEntry {
+  uint64_t time;
+  char phase;
+  uint8_t event;
+  uint16_t arg;
+};
+
+struct EventName {
+  std::string name;
+  int track;
+};
+
+struct Trace {
+  uint64_t now;
+  std::map<int, std::string> tracks;
+  std::map<int, EventName> names;
+  std::vector<TraceEntry> entries;
+};
+
+static const char* DUMP_START = "=== Event trace v1: ";
+static const char* DUMP_END = "=== End of event trace ===";
+
+// Strip the monitor's time prefix and the line ending
+static const char* stripLine(char* line) {
+  line[strcspn(line, "\r\n")] = '\0';
+  const char* marker = strstr(line, " > ");
+  if (marker && marker - line <= 16) {
+    return marker + 3;
+  }
+  return line;
+}
+
+static int hexValue(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+static bool parseEvents(const char* hex, std::vector<TraceEntry>& entries, uint32_t& lastTime,
+                        uint64_t& epoch) {
+  size_t length = strlen(hex);
+  if (length % 16 != 0) {
+    return false;
+  }
+  for (size_t i = 0; i < length; i += 16) {
+    uint8_t bytes[8];
+    for (int j = 0; j < 8; j++) {
+      int high = hexValue(hex[i + 2 * j]);
+      int low = hexValue(hex[i + 2 * j + 1]);
+      if (high < 0 || low < 0) {
+        return false;
+      }
+      bytes[j] = (uint8_t)(high << 4 | low);
+    }
+
+    uint32_t time = bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+    if (!entries.empty() && time < lastTime) {
+      epoch += 1ULL << 32;  // micros() wrapped, every 71 minutes
+    }
+    lastTime = time;
+
+    TraceEntry entry;
+    entry.time = epoch + time;
+    entry.phase = (char)bytes[4];
+    entry.event = bytes[5];
+    entry.arg = bytes[6] | bytes[7] << 8;
+    entries.push_back(entry);
+  }
+  return true;
+}
+
+// Events missing from the name table go on the loop track by number
+static EventName lookupName(const Trace& trace, uint8_t event) {
+  auto known = trace.names.find(event);
+  if (known != trace.names.end()) {
+    return known->second;
+  }
+  EventName name;
+  name.name = "event " + std::to_string(event);
+  name.track = 1;
+  return name;
+}
+
+static void writeString(FILE* out, const std::string& text) {
+  fputc('"', out);
+  for (char c : text) {
+    if (c == '"' || c == '\\') {
+      fputc('\\', out);
+    }
+    fputc(c, out);
+  }
+  fputc('"', out);
+}
+
+static void writeEvent(FILE* out, bool& first, const EventName& name, char phase, uint64_t time,
+                       const uint16_t* arg) {
+  fprintf(out, "%s\n{\"name\":", first ? "" : ",");
+  first = false;
+  writeString(out, name.name);
+  fprintf(out, ",\"ph\":\"%c\",\"ts\":%llu,\"pid\":1,\"tid\":%d", phase, (unsigned long long)time, name.track);
+  if (phase == 'i') {
+    fprintf(out, ",\"s\":\"t\"");
+  }
+  if (arg) {
+    fprintf(out, ",\"args\":{\"arg\":%u}", *arg);
+  }
+  fputc('}', out);
+}
+
+int main(int argc, char** argv) {
+  if (argc > 2) {
+    fprintf(stderr, "Usage: trace2json [log file] > trace.json\n");
+    return 2;
+  }
+  FILE* in = argc == 2 ? fopen(argv[1], "r") : stdin;
+  if (!in) {
+    fprintf(stderr, "Could not open %s\n", argv[1]);
+    return 1;
+  }
+
+  // Keep the last dump that was seen in full
+  Trace trace;
+  Trace current;
+  bool inDump = false;
+  bool found = false;
+  uint32_t lastTime = 0;
+  uint64_t epoch = 0;
+  char buffer[512];
+
+  while (fgets(buffer, sizeof(buffer), in)) {
+    const char* line = stripLine(buffer);
+
+    if (strncmp(line, DUMP_START, strlen(DUMP_START)) == 0) {
+      const char* now = strstr(line, ", now ");
+      current = Trace();
+      current.now = now ? strtoull(now + 6, nullptr, 10) : 0;
+      inDump = true;
+      lastTime = 0;
+      epoch = 0;
+    } else if (!inDump) {
+      continue;
+    } else if (strcmp(line, DUMP_END) == 0) {
+      trace = current;
+      found = true;
+      inDump = false;
+    } else if (strncmp(line, "TT ", 3) == 0) {
+      int track;
+      int offset;
+      if (sscanf(line + 3, "%d %n", &track, &offset) == 1) {
+        current.tracks[track] = line + 3 + offset;
+      }
+    } else if (strncmp(line, "TN ", 3) == 0) {
+      int id;
+      int track;
+      int offset;
+      if (sscanf(line + 3, "%d %d %n", &id, &track, &offset) == 2) {
+        EventName name;
+        name.name = line + 3 + offset;
+        name.track = track;
+        current.names[id] = name;
+      }
+    } else if (strncmp(line, "TE ", 3) == 0) {
+      if (!parseEvents(line + 3, current.entries, lastTime, epoch)) {
+        fprintf(stderr, "Skipping malformed dump\n");
+        inDump = false;
+      }
+    } else {
+      // Other output got mixed into the dump
+      inDump = false;
+    }
+  }
+  if (in != stdin) {
+    fclose(in);
+  }
+  if (!found) {
+    fprintf(stderr, "No complete event trace in the input\n");
+    return 1;
+  }
+
+  // The dump time is in the same 32-bit clock as the last event
+  uint64_t end = trace.entries.empty() ? 0 : trace.entries.back().time;
+  uint32_t now32 = (uint32_t)trace.now;
+  end += (uint32_t)(now32 - (uint32_t)end);
+
+  // Per-event stack depth, to drop ends whose begin was overwritten
+  std::map<int, int> open;
+  FILE* out = stdout;
+  bool first = true;
+  fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+  for (const auto& track : trace.tracks) {
+    fprintf(out, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":",
+            first ? "" : ",", track.first);
+    writeString(out, track.second);
+    fprintf(out, "}}");
+    first = false;
+  }
+
+  int dropped = 0;
+  for (const TraceEntry& entry : trace.entries) {
+    EventName name = lookupName(trace, entry.event);
+
+    switch (entry.phase) {
+      case 'B':
+        open[entry.event]++;
+        writeEvent(out, first, name, 'B', entry.time, entry.arg ? &entry.arg : nullptr);
+        break;
+      case 'E':
+        if (open[entry.event] == 0) {
+          dropped++;
+          break;
+        }
+        open[entry.event]--;
+        writeEvent(out, first, name, 'E', entry.time, nullptr);
+        break;
+      case 'I':
+        writeEvent(out, first, name, 'i', entry.time, &entry.arg);
+        break;
+      default:
+        dropped++;
+        break;
+    }
+  }
+
+  // Close what was still running, innermost first
+  for (auto it = trace.entries.rbegin(); it != trace.entries.rend(); ++it) {
+    if (it->phase == 'B' && open[it->event] > 0) {
+      open[it->event]--;
+      writeEvent(out, first, lookupName(trace, it->event), 'E', end, nullptr);
+    }
+  }
+
+  fprintf(out, "\n]}\n");
+  fprintf(stderr, "%zu events converted, %d without a begin left out\n", trace.entries.size(), dropped);
+  return 0;
+}
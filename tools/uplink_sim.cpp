@@ -0,0 +1,391 @@
+// Radio duty cycle of the burst uplink against a simulated network (host
+// program, not part of the firmware).
+//
+// Build against the firmware sources:
+//   g++ -O2 -std=c++11 -Iinclude tools/uplink_sim.cpp src/NetworkUplink.cpp -o uplink_sim
+//
+// Usage:
+//   uplink_sim [--days N] [--sample S] [--interval M] [--alarms N] [--fail P]
+//              [--ap-move D] [--radio-ma MA] [--seed N]
+//
+// Runs NetworkUplink on a simulated clock, the way the firmware loop drives
+// it (every second, every 20 ms while a burst runs), with a reading every
+// sample period and alarms at random times. The network behind it has the
+// latencies of a typical home access point: a full join scans every channel
+// and waits for DHCP, a join with the cached association does neither, and
+// the collector connection is slow to open and limited in bandwidth, so
+// lines go out in pieces. Joins fail now and then, and the access point
+// changes channel every few days, which leaves the cache stale.
+//
+// Three setups are compared: the radio always on with every reading sent
+// when taken, bursts with a full join every time, and bursts with the
+// cached association. The collector side parses what arrives per connection
+// (a line cut off by a failed burst is discarded, as collector.cpp does) and
+// checks that every reading arrives exactly once and with the time it was
+// taken.
+//
+// Options:
+//   --days N        simulated days (default: 7)
+//   --sample S      seconds between readings (default: 30)
+//   --interval M    minutes between bursts (default: 60)
+//   --alarms N      alarms per day, each asks for a burst (default: 2)
+//   --fail P        probability that a join fails (default: 0.03)
+//   --ap-move D     days between access point channel changes (default: 3)
+//   --radio-ma MA   radio current while on, for the charge column (default: 110)
+//   --seed N        random seed (default: 1)
+//
+// Output is CSV: setup, radio seconds and charge per day, bursts, fast
+// joins, failed bursts, readings sent, lost and duplicated, and the delay
+// from taking a reading to its arrival (mean and max).
+
+#include <math.h>
+#include <random>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "NetworkUplink.h"
+
+// Network latencies (ms)
+static const unsigned long SCAN_MS = 2200;        // Active scan of all channels
+static const unsigned long ASSOCIATE_MS = 250;    // Authenticate, associate, 4-way handshake
+static const unsigned long DHCP_MS = 900;
+static const unsigned long CONNECT_MS = 60;       // TCP handshake to the collector
+static const double BYTES_PER_MS = 40;            // Upload bandwidth
+static const size_t SEND_BUFFER = 5744;           // lwIP TCP_SND_BUF
+
+static const unsigned long POLL_MS = 20;          // UPLINK_POLL_INTERVAL
+static const unsigned long IDLE_MS = 1000;        // Longest loop sleep
+
+struct Options {
+  int days = 7;
+  unsigned long sampleMs = 30000;
+  unsigned long intervalMs = 3600000;
+  double alarmsPerDay = 2;
+  double failRate = 0.03;
+  double apMoveDays = 3;
+  double radioMa = 110;
+  unsigned seed = 1;
+};
+
+// What arrived at the collector: one count per reading, and the delay
+struct Collector {
+  std::vector<int> received;        // By reading index
+  std::vector<long> takenAt;        // When each reading was taken (ms)
+  uint32_t badTimes = 0;
+  double delaySum = 0;
+  double delayMax = 0;
+  uint32_t delayCount = 0;
+
+  // A reading's index is in its CO2 value, which cycles through 30000
+  // values; the taken time tells the cycles apart
+  void line(const std::string& text, unsigned long now) {
+    unsigned co2;
+    unsigned long age;
+    const char* suffix = strstr(text.c_str(), "age: ");
+    if (sscanf(text.c_str(), "CO2: %u ppm", &co2) != 1 || !suffix || sscanf(suffix, "age: %lu ms", &age) != 1) {
+      return;
+    }
+    long taken = (long)(now - age);
+    size_t index = co2 - 400;
+    while (index < takenAt.size() && labs(takenAt[index] - taken) > 15000) {
+      index += 30000;
+    }
+    if (index >= takenAt.size()) {
+      badTimes++;
+      return;
+    }
+    // The age is taken when the line is formatted; it may arrive a little later
+    if (labs(takenAt[index] - taken) > (long)NetworkUplink::SEND_TIMEOUT_MS) {
+      badTimes++;
+    }
+    received[index]++;
+    double delay = (double)(now - takenAt[index]) / 1000.0;
+    delaySum += delay;
+    delayMax = delay > delayMax ? delay : delayMax;
+    delayCount++;
+  }
+};
+
+// The access point and the collector, on the simulated clock
+class SimNetwork : public NetworkStack {
+public:
+  SimNetwork(const unsigned long& now, Collector& collector, std::mt19937& random, double failRate)
+    : _now(now), _collector(collector), _random(random), _failRate(failRate), _channel(6),
+      _on(false), _joinAt(0), _joinFails(false), _connectAt(0), _open(false),
+      _budget(0), _lastWrite(0), _onSince(0), _radioMs(0) {
+  }
+
+  void begin(const UplinkCache* cache) {
+    _on = true;
+    _onSince = _now;
+    _open = false;
+    _connectAt = 0;
+    std::uniform_real_distribution<double> chance(0, 1);
+    _joinFails = chance(_random) < _failRate;
+    if (cache) {
+      // Straight to the cached BSSID and channel with the old address; only
+      // works while the access point is still there
+      _joinFails = _joinFails || cache->channel != _channel;
+      _joinAt = _now + ASSOCIATE_MS;
+    } else {
+      _joinAt = _now + SCAN_MS + ASSOCIATE_MS + DHCP_MS;
+    }
+  }
+
+  bool isJoined() {
+    return _on && !_joinFails && (long)(_now - _joinAt) >= 0;
+  }
+
+  bool getCache(UplinkCache& cache) {
+    memset(&cache, 0, sizeof(cache));
+    cache.channel = _channel;
+    cache.ip = 0x0A01A8C0;
+    cache.valid = true;
+    return true;
+  }
+
+  bool connect() {
+    if (!isJoined()) {
+      return false;
+    }
+    if (!_connectAt) {
+      _connectAt = _now + CONNECT_MS;
+    }
+    if ((long)(_now - _connectAt) < 0) {
+      return false;
+    }
+    if (!_open) {
+      _open = true;
+      _budget = SEND_BUFFER;
+      _lastWrite = _now;
+      _partial.clear();
+    }
+    return true;
+  }
+
+  size_t write(const uint8_t* data, size_t length) {
+    if (!_open) {
+      return 0;
+    }
+    _budget += (_now - _lastWrite) * BYTES_PER_MS;
+    _budget = _budget > SEND_BUFFER ? SEND_BUFFER : _budget;
+    _lastWrite = _now;
+    size_t taken = length < (size_t)_budget ? length : (size_t)_budget;
+    _budget -= taken;
+    for (size_t i = 0; i < taken; i++) {
+      if (data[i] == '\n') {
+        _collector.line(_partial, _now);
+        _partial.clear();
+      } else {
+        _partial += (char)data[i];
+      }
+    }
+    return taken;
+  }
+
+  void end() {
+    // An unfinished line is dropped with the connection
+    _partial.clear();
+    _open = false;
+    if (_on) {
+      _radioMs += _now - _onSince;
+    }
+    _on = false;
+  }
+
+  void moveAccessPoint() {
+    _channel = _channel == 6 ? 11 : 6;
+  }
+
+  unsigned long getRadioMs() const {
+    return _radioMs + (_on ? _now - _onSince : 0);
+  }
+
+private:
+  const unsigned long& _now;
+  Collector& _collector;
+  std::mt19937& _random;
+  double _failRate;
+  uint8_t _channel;
+  bool _on;
+  unsigned long _joinAt;
+  bool _joinFails;
+  unsigned long _connectAt;
+  bool _open;
+  double _budget;
+  unsigned long _lastWrite;
+  std::string _partial;
+  unsigned long _onSince;
+  unsigned long _radioMs;
+};
+
+enum Setup { ALWAYS_ON, BURST, BURST_CACHED };
+
+static const char* setupName(Setup setup) {
+  switch (setup) {
+    case ALWAYS_ON:    return "always-on";
+    case BURST:        return "burst";
+    case BURST_CACHED: return "burst-cached";
+  }
+  return "";
+}
+
+static LiveSample makeSample(uint32_t index, unsigned long now, std::mt19937& random) {
+  std::normal_distribution<double> noise(0, 50);
+  LiveSample sample;
+  sample.sequence = index;
+  sample.time = (uint32_t)now;
+  sample.co2 = (uint16_t)(400 + index % 30000);
+  sample.temperature = (int16_t)(1500 + noise(random) - 600 * (index % 7 == 0));
+  sample.humidity = (uint16_t)(5000 + noise(random));
+  return sample;
+}
+
+static void run(Setup setup, const Options& options) {
+  std::mt19937 random(options.seed);
+  std::mt19937 sampleRandom(options.seed + 1);
+  std::exponential_distribution<double> alarmGap(options.alarmsPerDay / 86400000.0);
+  std::exponential_distribution<double> moveGap(1.0 / (options.apMoveDays * 86400000.0));
+
+  unsigned long now = 0;
+  Collector collector;
+  SimNetwork network(now, collector, random, options.failRate);
+  NetworkUplink uplink(network, "sim", options.intervalMs);
+  uplink.setFastReconnect(setup == BURST_CACHED);
+
+  unsigned long end = (unsigned long)options.days * 86400000UL;
+  unsigned long nextSample = options.sampleMs;
+  unsigned long nextAlarm = options.alarmsPerDay > 0 ? (unsigned long)alarmGap(random) : end + 1;
+  unsigned long nextMove = options.apMoveDays > 0 ? (unsigned long)moveGap(random) : end + 1;
+  uint32_t count = 0;
+  uint32_t failures = 0;
+  bool joined = false;
+  unsigned long joinStart = 0;
+
+  // Always on: join once (again after a failed join), then every reading
+  // goes out when it is taken
+  if (setup == ALWAYS_ON) {
+    network.begin(nullptr);
+  }
+
+  while (now < end) {
+    if (now >= nextMove) {
+      network.moveAccessPoint();
+      nextMove = now + (unsigned long)moveGap(random) + 1;
+    }
+
+    bool active;
+    if (setup == ALWAYS_ON) {
+      if (!joined && network.connect()) {
+        network.write((const uint8_t*)"device sim\n", 11);
+        joined = true;
+      } else if (!joined && now - joinStart >= NetworkUplink::JOIN_TIMEOUT_MS) {
+        network.end();
+        network.begin(nullptr);
+        joinStart = now;
+      }
+      active = !joined;
+    } else {
+      active = uplink.update(now);
+    }
+
+    if (now >= nextSample) {
+      LiveSample sample = makeSample(count, now, sampleRandom);
+      collector.takenAt.push_back(now);
+      collector.received.push_back(0);
+      count++;
+      if (setup == ALWAYS_ON) {
+        char line[96];
+        int length = snprintf(line, sizeof(line), "CO2: %u ppm, Temp: %d.%02d C, Humidity: %u.%02u%%, age: 0 ms\n",
+                              sample.co2, sample.temperature / 100, sample.temperature % 100,
+                              sample.humidity / 100, sample.humidity % 100);
+        if (!joined || network.write((const uint8_t*)line, length) != (size_t)length) {
+          failures++;
+        }
+      } else {
+        uplink.add(sample);
+      }
+      nextSample += options.sampleMs;
+    }
+    if (now >= nextAlarm) {
+      uplink.requestBurst();
+      nextAlarm = now + (unsigned long)alarmGap(random) + 1;
+    }
+
+    // The loop sleeps until the next reading, at most a second, and polls
+    // a burst in progress
+    unsigned long step = active ? POLL_MS : IDLE_MS;
+    now += step;
+  }
+
+  // A final burst so everything still buffered is counted
+  unsigned long deadline = now + 120000;
+  uplink.requestBurst();
+  while (setup != ALWAYS_ON && (uplink.getBacklog() > 0 || uplink.getState() != UPLINK_IDLE) && now < deadline) {
+    uplink.update(now);
+    now += POLL_MS;
+  }
+  network.end();
+
+  uint32_t lost = 0, duplicated = 0;
+  for (size_t i = 0; i < collector.received.size(); i++) {
+    lost += collector.received[i] == 0;
+    duplicated += collector.received[i] > 1 ? collector.received[i] - 1 : 0;
+  }
+
+  const UplinkStats& stats = uplink.getStats();
+  double radioPerDay = network.getRadioMs() / 1000.0 / options.days;
+  printf("%s,%.1f,%.2f,%u,%u,%u,%u,%u,%u,%u,%.1f,%.1f\n",
+         setupName(setup), radioPerDay, radioPerDay * options.radioMa / 3600.0,
+         setup == ALWAYS_ON ? 0 : stats.bursts, stats.fastJoins,
+         setup == ALWAYS_ON ? failures : stats.failures, collector.delayCount,
+         lost, duplicated, collector.badTimes,
+         collector.delayCount ? collector.delaySum / collector.delayCount : 0.0, collector.delayMax);
+}
+
+int main(int argc, char** argv) {
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (!value) {
+      fprintf(stderr, "uplink_sim: %s needs a value\n", arg);
+      return 2;
+    }
+    if (!strcmp(arg, "--days")) {
+      options.days = atoi(value);
+    } else if (!strcmp(arg, "--sample")) {
+      options.sampleMs = (unsigned long)(atof(value) * 1000);
+    } else if (!strcmp(arg, "--interval")) {
+      options.intervalMs = (unsigned long)(atof(value) * 60000);
+    } else if (!strcmp(arg, "--alarms")) {
+      options.alarmsPerDay = atof(value);
+    } else if (!strcmp(arg, "--fail")) {
+      options.failRate = atof(value);
+    } else if (!strcmp(arg, "--ap-move")) {
+      options.apMoveDays = atof(value);
+    } else if (!strcmp(arg, "--radio-ma")) {
+      options.radioMa = atof(value);
+    } else if (!strcmp(arg, "--seed")) {
+      options.seed = (unsigned)atoi(value);
+    } else {
+      fprintf(stderr, "uplink_sim: unknown option %s\n", arg);
+      return 2;
+    }
+    i++;
+  }
+  if (options.days <= 0 || options.sampleMs == 0 || options.intervalMs == 0) {
+    fprintf(stderr, "uplink_sim: --days, --sample and --interval must be positive\n");
+    return 2;
+  }
+
+  printf("setup,radio_s_per_day,radio_mah_per_day,bursts,fast_joins,failures,received,lost,duplicated,bad_times,delay_mean_s,delay_max_s\n");
+  run(ALWAYS_ON, options);
+  run(BURST, options);
+  run(BURST_CACHED, options);
+  return 0;
+}
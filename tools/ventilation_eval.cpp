@@ -0,0 +1,257 @@
+// Accuracy of the ventilation estimator on synthetic and recorded CO2
+// (host program, not part of the firmware).
+//
+// Build against the firmware sources:
+//   g++ -O2 -std=c++11 -Iinclude tools/ventilation_eval.cpp src/VentilationEstimator.cpp -o ventilation_eval
+//
+// Usage:
+//   ventilation_eval [--ach A,A,...] [--runs N] [--interval S] [--noise PPM] [--outdoor PPM] [--seed N]
+//   ventilation_eval [--interval S] [--outdoor PPM] <log files...>
+//
+// Without files, simulates a closed garage filling up with CO2 and then
+// aired at a known rate, many times per rate with sensor noise, and feeds
+// the readings to VentilationEstimator the way the firmware does. Each run
+// is a well mixed single zone: CO2 builds up from a source at a background
+// rate of 0.3 air changes per hour, the door opens for up to three time
+// constants at the given rate, then closes and the source comes back. The
+// outdoor level the simulation uses can be offset from the one the
+// estimator assumes, to see the bias that causes.
+//
+// With files, replays serial captures (lines "CO2: X ppm, ..." with or
+// without the "HH:MM:SS.mmm > " prefix of the PlatformIO time filter;
+// without it, readings are one interval apart) and lists every decay that
+// gave an estimate.
+//
+// Options:
+//   --ach A,...     air change rates to simulate (default: 0.5,1,2,4,8,15)
+//   --runs N        runs per rate (default: 200)
+//   --interval S    seconds between readings (default: 30)
+//   --noise PPM     sensor noise, standard deviation (default: 10, plus 1% of the reading)
+//   --outdoor PPM   real outdoor level; the estimator assumes 420 (default: 420)
+//   --seed N        random seed (default: 1)
+//
+// Output is CSV. Simulated: per rate, runs, the share with an estimate
+// during the airing, the median and 90th percentile of the relative error,
+// the median error the estimator reported, the share within twice the
+// reported error, and estimates at other times (false). Replayed: per
+// decay, file, end time (s), length, readings, ACH, R^2 and reported error.
+
+#include <algorithm>
+#include <math.h>
+#include <random>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "VentilationEstimator.h"
+
+static const uint16_t ASSUMED_OUTDOOR = 420;
+
+struct Options {
+  std::vector<double> rates = { 0.5, 1, 2, 4, 8, 15 };
+  int runs = 200;
+  uint32_t intervalMs = 30000;
+  double noise = 10;
+  double outdoor = 420;
+  unsigned seed = 1;
+  std::vector<const char*> files;
+};
+
+static double percentile(std::vector<double> values, double p) {
+  if (values.empty()) {
+    return NAN;
+  }
+  std::sort(values.begin(), values.end());
+  return values[(size_t)(p * (values.size() - 1) + 0.5)];
+}
+
+// One run: closed build-up, airing at `ach`, closed build-up again
+static void simulateRun(double ach, const Options& options, std::mt19937& random,
+                        std::vector<double>& errors, std::vector<double>& reported,
+                        int& detected, int& within, int& falseEstimates) {
+  std::uniform_real_distribution<double> uniform(0, 1);
+  std::normal_distribution<double> gauss(0, 1);
+
+  const double background = 0.3;                  // Air changes per hour, door closed
+  double source = 300 + 900 * uniform(random);    // ppm per hour at steady state rate
+  double buildUp = (1 + 3 * uniform(random)) * 3600;   // s
+  double airing = std::min(3.0 / ach, 4.0) * 3600;     // s
+  double after = 3600;
+  double dt = options.intervalMs / 1000.0;
+
+  VentilationEstimator estimator(ASSUMED_OUTDOOR);
+  double excess = 20 * uniform(random);
+  double time = 0;
+  unsigned long now = (unsigned long)(uniform(random) * 1e6);
+  bool found = false;
+  double best = 0;
+  double bestError = 0;
+
+  auto step = [&](double rate, double generation) {
+    // Exact solution of d(excess)/dt = generation - rate * excess over dt
+    double decay = exp(-rate * dt / 3600);
+    excess = excess * decay + generation / rate * (1 - decay);
+    time += dt;
+    now += options.intervalMs;
+    double reading = options.outdoor + excess;
+    reading += gauss(random) * (options.noise + 0.01 * reading);
+    uint16_t co2 = (uint16_t)std::max(0.0, std::min(40000.0, reading + 0.5));
+    return estimator.addSample(co2, now);
+  };
+
+  while (time < buildUp) {
+    if (step(background, source) || estimator.getEstimate().valid) {
+      falseEstimates++;
+      return;
+    }
+  }
+  double airingEnd = time + airing;
+  while (time < airingEnd) {
+    step(ach, 0);
+    if (estimator.isInDecay() && estimator.getEstimate().valid) {
+      found = true;
+      best = estimator.getEstimate().ach;
+      bestError = estimator.getEstimate().error;
+    }
+  }
+  // The decay ends when the door closes and CO2 rises again
+  double afterEnd = time + after;
+  while (time < afterEnd) {
+    bool ended = step(background, source);
+    if (ended && !found) {
+      found = true;
+      best = estimator.getEstimate().ach;
+      bestError = estimator.getEstimate().error;
+    }
+  }
+
+  if (found) {
+    detected++;
+    double error = fabs(best - ach) / ach;
+    errors.push_back(error);
+    reported.push_back(bestError);
+    within += error <= 2 * bestError;
+  }
+}
+
+static void simulate(const Options& options) {
+  std::mt19937 random(options.seed);
+  printf("ach,runs,detected,error_p50,error_p90,reported_p50,within_2x_reported,false_estimates\n");
+  for (double ach : options.rates) {
+    std::vector<double> errors, reported;
+    int detected = 0, within = 0, falseEstimates = 0;
+    for (int i = 0; i < options.runs; i++) {
+      simulateRun(ach, options, random, errors, reported, detected, within, falseEstimates);
+    }
+    printf("%g,%d,%.3f,%.3f,%.3f,%.3f,%.3f,%d\n", ach, options.runs, (double)detected / options.runs,
+           percentile(errors, 0.5), percentile(errors, 0.9), percentile(reported, 0.5),
+           detected ? (double)within / detected : 0.0, falseEstimates);
+  }
+}
+
+// "HH:MM:SS.mmm > " prefix, as ms since midnight, or -1
+static long parseTimePrefix(const char* line) {
+  int h, m, s, ms;
+  if (strlen(line) > 15 && line[2] == ':' && line[13] == '>' &&
+      sscanf(line, "%2d:%2d:%2d.%3d", &h, &m, &s, &ms) == 4) {
+    return ((h * 60L + m) * 60 + s) * 1000 + ms;
+  }
+  return -1;
+}
+
+static int replay(const Options& options) {
+  printf("file,end_s,duration_s,points,ach,r2,error\n");
+  for (const char* path : options.files) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+      fprintf(stderr, "ventilation_eval: cannot open %s\n", path);
+      return 1;
+    }
+
+    VentilationEstimator estimator(ASSUMED_OUTDOOR);
+    char line[512];
+    unsigned long now = 0;
+    long lastOfDay = -1;
+    while (fgets(line, sizeof(line), file)) {
+      const char* text = line;
+      long ofDay = parseTimePrefix(line);
+      if (ofDay >= 0) {
+        text += 15;
+      }
+      unsigned co2;
+      if (sscanf(text, "CO2: %u ppm", &co2) != 1 || co2 == 0 || co2 > 40000) {
+        continue;
+      }
+      if (ofDay >= 0) {
+        // Time of day only; a step back is midnight
+        long delta = lastOfDay < 0 ? 0 : ofDay - lastOfDay;
+        now += delta < 0 ? delta + 86400000L : delta;
+        lastOfDay = ofDay;
+      } else {
+        now += options.intervalMs;
+      }
+      if (estimator.addSample((uint16_t)co2, now)) {
+        const VentilationEstimate& estimate = estimator.getEstimate();
+        printf("%s,%lu,%u,%u,%.2f,%.3f,%.3f\n", path, now / 1000, estimate.duration, estimate.points,
+               estimate.ach, estimate.r2, estimate.error);
+      }
+    }
+    fclose(file);
+  }
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    if (arg[0] != '-') {
+      options.files.push_back(arg);
+      continue;
+    }
+    const char* value = i + 1 < argc ? argv[++i] : nullptr;
+    if (!value) {
+      fprintf(stderr, "ventilation_eval: %s needs a value\n", arg);
+      return 2;
+    }
+    if (!strcmp(arg, "--ach")) {
+      options.rates.clear();
+      for (const char* p = value; *p; ) {
+        options.rates.push_back(atof(p));
+        p = strchr(p, ',');
+        p = p ? p + 1 : "";
+      }
+    } else if (!strcmp(arg, "--runs")) {
+      options.runs = atoi(value);
+    } else if (!strcmp(arg, "--interval")) {
+      options.intervalMs = (uint32_t)(atof(value) * 1000);
+    } else if (!strcmp(arg, "--noise")) {
+      options.noise = atof(value);
+    } else if (!strcmp(arg, "--outdoor")) {
+      options.outdoor = atof(value);
+    } else if (!strcmp(arg, "--seed")) {
+      options.seed = (unsigned)atoi(value);
+    } else {
+      fprintf(stderr, "ventilation_eval: unknown option %s\n", arg);
+      return 2;
+    }
+  }
+  if (options.intervalMs == 0 || options.runs <= 0) {
+    fprintf(stderr, "ventilation_eval: --interval and --runs must be positive\n");
+    return 2;
+  }
+  for (double ach : options.rates) {
+    if (!(ach > 0)) {
+      fprintf(stderr, "ventilation_eval: --ach rates must be positive\n");
+      return 2;
+    }
+  }
+
+  if (!options.files.empty()) {
+    return replay(options);
+  }
+  simulate(options);
+  return 0;
+}
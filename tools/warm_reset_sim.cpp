@@ -0,0 +1,397 @@
+// Warm resets of the whole firmware against the RTC checkpoint (host
+// program, not part of the firmware).
+//
+// Build against all firmware sources, the host Arduino layer and the GFX
+// library PlatformIO downloads:
+//   GFX=".pio/libdeps/lilygo-t5-v241/Adafruit GFX Library"
+//   g++ -O2 -std=gnu++11 -DARDUINO=100 -Itools/host -Iinclude -I"$GFX" tools/warm_reset_sim.cpp src/*.cpp tools/host/*.cpp "$GFX/Adafruit_GFX.cpp" -o warm_reset_sim
+//
+// Usage:
+//   warm_reset_sim [--hours H] [--trace FILE] [--verbose 1]
+//
+// Every boot runs setup() and loop() in a new process, so all globals start
+// from their initializers as they do after a reset, with an SCD41 model on
+// the bus and the panel on SPI. A boot ends without any shutdown, like a
+// panic or a watchdog reset, after H simulated hours (default: 2). The
+// flash partitions and RTC memory are image files in a scratch directory:
+// keeping the RTC image is a warm reset, deleting it a power cycle.
+//
+// Boots, in order:
+//   power_on    first boot, nothing in RTC memory: cold start
+//   panic       RTC image kept: resumes the state the last boot ended with,
+//               without the loading screen or a first refresh
+//   corrupt     a byte of the checkpoint flipped: the CRC rejects it, cold
+//               start
+//   power_cycle RTC image deleted: cold start
+//   watchdog    RTC image kept: resumes again
+//
+// --trace FILE keeps the serial output of every boot in FILE, each ending
+// with the event trace dump TRACE_DUMP_COMMAND prints, so the last events
+// before a reset can be opened with tools/trace2json.cpp. --verbose 1 sends
+// the serial output to stderr instead.
+//
+// Output is CSV: boot, how it started (warm or cold), setup time (ms),
+// bytes sent to the panel during setup, and the history index and CO2 shown
+// at the end of setup and at the end of the boot. After the table comes the
+// sample-to-glass latency of each boot: the summary the firmware logs every
+// history tick, then the non-empty buckets of each stage's histogram and of
+// the end-to-end one. Exits with 1 when a boot starts the wrong way or a
+// warm start does not resume the state of the boot before it.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <string>
+
+#include <Arduino.h>
+#include <SPI.h>
+#include <Wire.h>
+#include "CO2Sensor.h"
+#include "EventTracer.h"
+#include "LatencyTracer.h"
+
+// From main.cpp
+static const int DATA_HISTORY_SIZE = 48;
+extern SensorData lastDisplayedData;
+extern uint16_t co2History[];
+extern int historyIndex;
+void setup();
+void loop();
+
+// One plane of the 648x480 panel
+static const uint32_t FRAME_BYTES = 648 * 480 / 8;
+
+static uint8_t crc8(const uint8_t* data) {
+  uint8_t crc = 0xFF;
+  for (int i = 0; i < 2; i++) {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x80) ? (crc << 1) ^ 0x31 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+static void putWord(uint8_t* data, uint16_t word) {
+  data[0] = word >> 8;
+  data[1] = word & 0xFF;
+  data[2] = crc8(data);
+}
+
+// SCD41 with a measurement every 5 s. CO2 follows the time since the first
+// boot, so it carries on across resets.
+class Scd41 : public I2CTarget {
+public:
+  explicit Scd41(unsigned long startSeconds)
+    : _startSeconds(startSeconds), _readyAt(5000000), _responseLength(0) {}
+
+  uint8_t write(const uint8_t* data, size_t length) {
+    if (length < 2) {
+      return 0;
+    }
+    uint16_t command = (data[0] << 8) | data[1];
+    unsigned long now = micros();
+    _responseLength = 0;
+    switch (command) {
+      case 0xE4B8:  // get_data_ready_status
+        putWord(_response, (long)(now - _readyAt) >= 0 ? 0x8006 : 0x8000);
+        _responseLength = 3;
+        break;
+      case 0xEC05: {  // read_measurement
+        unsigned long seconds = _startSeconds + now / 1000000;
+        uint16_t co2 = (uint16_t)(700 + 300 * sin(seconds * 2 * M_PI / 7200.0));
+        putWord(_response, co2);
+        putWord(_response + 3, 0x6667);    // 20 degrees
+        putWord(_response + 6, 0x8000);    // 50 %
+        _responseLength = 9;
+        _readyAt = now + 5000000;
+        break;
+      }
+      case 0x3682:  // get_serial_number
+        putWord(_response, 0x1234);
+        putWord(_response + 3, 0x5678);
+        putWord(_response + 6, 0x9ABC);
+        _responseLength = 9;
+        break;
+      case 0x219D:  // measure_single_shot
+        _readyAt = now + 5000000;
+        break;
+      case 0x2196:  // measure_single_shot_rht_only
+        _readyAt = now + 50000;
+        break;
+      default:
+        break;
+    }
+    return 0;
+  }
+
+  size_t read(uint8_t* data, size_t length) {
+    size_t n = length < _responseLength ? length : _responseLength;
+    memcpy(data, _response, n);
+    _responseLength = 0;
+    return n;
+  }
+
+private:
+  unsigned long _startSeconds;
+  unsigned long _readyAt;
+  uint8_t _response[9];
+  size_t _responseLength;
+};
+
+// What a boot reports back to the parent
+struct BootState {
+  bool warm;
+  unsigned long setupMs;
+  uint32_t setupBytes;
+  int historyIndex;
+  uint16_t history[DATA_HISTORY_SIZE];
+  uint16_t shownCo2;
+};
+
+struct BootReport {
+  BootState afterSetup;
+  BootState atEnd;
+  char latency[4096];      // Latency summary and histograms, as text
+};
+
+// One line of the histogram's non-empty buckets, e.g. "[512,1024) 3"
+static void printBuckets(Print& out, const char* name, const LogHistogram& histogram) {
+  out.print(name);
+  out.print(" buckets (us):");
+  for (uint8_t i = 0; i < LogHistogram::BUCKETS; i++) {
+    if (!histogram.counts[i]) {
+      continue;
+    }
+    out.print(" [");
+    out.print(i ? 1UL << (i - 1) : 0UL);
+    out.print(",");
+    out.print(i ? (unsigned long)(1ULL << i) : 1UL);
+    out.print(") ");
+    out.print(histogram.counts[i]);
+  }
+  out.println();
+}
+
+static void printLatency(Print& out) {
+  latencyTracer.printSummary(out);
+  for (int i = STAGE_SAMPLE_READ; i < STAGE_COUNT; i++) {
+    printBuckets(out, LatencyTracer::getStageName((TraceStage)i),
+                 latencyTracer.getStageHistogram((TraceStage)i));
+  }
+  printBuckets(out, "end-to-end", latencyTracer.getEndToEndHistogram());
+}
+
+static bool readAll(int fd, void* data, size_t size) {
+  uint8_t* p = (uint8_t*)data;
+  while (size > 0) {
+    ssize_t got = read(fd, p, size);
+    if (got <= 0) {
+      return false;
+    }
+    p += got;
+    size -= got;
+  }
+  return true;
+}
+
+static void capture(BootState& state, bool warm) {
+  state.warm = warm;
+  state.setupMs = 0;
+  state.setupBytes = 0;
+  state.historyIndex = historyIndex;
+  memcpy(state.history, co2History, sizeof(state.history));
+  state.shownCo2 = lastDisplayedData.co2;
+}
+
+// Run one boot in a child process; false when it didn't report
+static bool boot(unsigned long startSeconds, double hours, FILE* serialLog, bool traceDump, BootReport& report) {
+  int fds[2];
+  if (pipe(fds) != 0) {
+    perror("pipe");
+    return false;
+  }
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    return false;
+  }
+  if (pid == 0) {
+    close(fds[0]);
+    Scd41 sensor(startSeconds);
+    Wire.attach(0x62, &sensor);
+
+    // Whether setup() resumed is what it logs
+    char* log = nullptr;
+    size_t logSize = 0;
+    FILE* serial = open_memstream(&log, &logSize);
+    hostSerialOutput(serial);
+    setup();
+    fflush(serial);
+    bool warm = strstr(log, "resuming from RTC checkpoint") != nullptr;
+    hostSerialOutput(serialLog);
+    if (serialLog) {
+      fputs(log, serialLog);
+    }
+
+    BootReport out;
+    capture(out.afterSetup, warm);
+    out.afterSetup.setupMs = millis();
+    out.afterSetup.setupBytes = SPI.getByteCount();
+
+    while (millis() < hours * 3600000.0) {
+      loop();
+    }
+    capture(out.atEnd, warm);
+
+    // What the firmware prints for TRACE_DUMP_COMMAND
+    if (traceDump) {
+      eventTracer.dump(Serial);
+    }
+    if (serialLog) {
+      fflush(serialLog);
+    }
+
+    memset(out.latency, 0, sizeof(out.latency));
+    FILE* latency = fmemopen(out.latency, sizeof(out.latency) - 1, "w");
+    hostSerialOutput(latency);
+    printLatency(Serial);
+    fclose(latency);
+
+    // Ends here with no shutdown, as a panic would
+    ssize_t written = write(fds[1], &out, sizeof(out));
+    _exit(written == (ssize_t)sizeof(out) ? 0 : 1);
+  }
+
+  close(fds[1]);
+  bool got = readAll(fds[0], &report, sizeof(report));
+  close(fds[0]);
+  int status = 0;
+  waitpid(pid, &status, 0);
+  return got && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static bool sameState(const BootState& resumed, const BootState& before) {
+  return resumed.historyIndex == before.historyIndex && resumed.shownCo2 == before.shownCo2 &&
+         memcmp(resumed.history, before.history, sizeof(resumed.history)) == 0;
+}
+
+int main(int argc, char** argv) {
+  double hours = 2;
+  bool verbose = false;
+  const char* tracePath = nullptr;
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 >= argc) {
+      fprintf(stderr, "%s needs a value\n", argv[i]);
+      return 2;
+    }
+    if (!strcmp(argv[i], "--hours")) {
+      hours = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--trace")) {
+      tracePath = argv[++i];
+    } else if (!strcmp(argv[i], "--verbose")) {
+      verbose = atoi(argv[++i]) != 0;
+    } else {
+      fprintf(stderr, "unknown option %s\n", argv[i]);
+      return 2;
+    }
+  }
+  if (hours <= 0) {
+    fprintf(stderr, "All options must be positive\n");
+    return 2;
+  }
+
+  FILE* serialLog = verbose ? stderr : nullptr;
+  if (tracePath) {
+    serialLog = fopen(tracePath, "w");
+    if (!serialLog) {
+      perror(tracePath);
+      return 2;
+    }
+  }
+
+  // The firmware's flash and RTC images go into a scratch directory
+  char dir[] = "/tmp/warm_reset_sim.XXXXXX";
+  if (!mkdtemp(dir) || chdir(dir) != 0) {
+    perror("scratch directory");
+    return 2;
+  }
+
+  enum Action { KEEP, CORRUPT, DELETE };
+  struct Boot {
+    const char* name;
+    Action action;
+    bool expectWarm;
+  };
+  const Boot boots[] = {
+    { "power_on", DELETE, false },
+    { "panic", KEEP, true },
+    { "corrupt", CORRUPT, false },
+    { "power_cycle", DELETE, false },
+    { "watchdog", KEEP, true },
+  };
+
+  printf("boot,start,setup_ms,setup_bytes,setup_index,setup_co2,end_index,end_co2,result\n");
+  bool pass = true;
+  BootReport previous;
+  memset(&previous, 0, sizeof(previous));
+  std::string latency;
+  unsigned long startSeconds = 0;
+  for (size_t i = 0; i < sizeof(boots) / sizeof(boots[0]); i++) {
+    if (boots[i].action == DELETE) {
+      unlink("rtc");
+    } else if (boots[i].action == CORRUPT) {
+      // A byte in the middle of the checkpoint data
+      FILE* image = fopen("rtc", "r+b");
+      if (image) {
+        fseek(image, 16 + 100, SEEK_SET);
+        int c = fgetc(image);
+        fseek(image, 16 + 100, SEEK_SET);
+        fputc(c ^ 0x5A, image);
+        fclose(image);
+      }
+    }
+
+    BootReport report;
+    if (!boot(startSeconds, hours, serialLog, tracePath != nullptr, report)) {
+      printf("%s,,,,,,,,crashed\n", boots[i].name);
+      pass = false;
+      break;
+    }
+    startSeconds += (unsigned long)(hours * 3600);
+
+    // A warm start resumes exactly where the last boot ended and leaves the
+    // panel alone; a cold start shows the loading screen and a first frame
+    const BootState& s = report.afterSetup;
+    bool ok = s.warm == boots[i].expectWarm;
+    if (boots[i].expectWarm) {
+      ok = ok && sameState(s, previous.atEnd) && s.setupBytes < FRAME_BYTES;
+    } else {
+      ok = ok && s.setupBytes >= 2 * FRAME_BYTES;
+    }
+    printf("%s,%s,%lu,%u,%d,%u,%d,%u,%s\n", boots[i].name, s.warm ? "warm" : "cold", s.setupMs,
+           s.setupBytes, s.historyIndex, s.shownCo2, report.atEnd.historyIndex, report.atEnd.shownCo2,
+           ok ? "ok" : "wrong");
+    pass = pass && ok;
+    previous = report;
+    latency += std::string("\nlatency ") + boots[i].name + "\n" + report.latency;
+  }
+  fputs(latency.c_str(), stdout);
+
+  if (tracePath) {
+    fclose(serialLog);
+  }
+  unlink("rtc");
+  unlink("history");
+  unlink("frame");
+  if (chdir("/") != 0 || rmdir(dir) != 0) {
+    fprintf(stderr, "left %s behind\n", dir);
+  }
+
+  printf("%s\n", pass ? "PASS" : "FAIL");
+  return pass ? 0 : 1;
+}
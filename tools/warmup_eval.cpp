@@ -0,0 +1,304 @@
+// Time to the first trustworthy history entry after a cold start, with the
+// warmup detector and with the fixed wait and reading count it replaced
+// (host program, not part of the firmware).
+//
+// Build against the firmware sources:
+//   g++ -O2 -std=c++11 -Iinclude tools/warmup_eval.cpp src/WarmupDetector.cpp -o warmup_eval
+//
+// Usage:
+//   warmup_eval [--runs N] [--offset PPM] [--tau S] [--noise PPM] [--interval S] [--tolerance PPM,PCT] [--max S] [--seed N]
+//   warmup_eval [--interval S] [--tolerance PPM,PCT] [--max S] <log files...>
+//
+// Without files, simulates cold starts: the sensor's readings start off the
+// real level by a random offset (up to --offset either way, mostly high)
+// that decays with a random time constant (up to --tau), plus sensor noise.
+// In a third of the runs CO2 is really changing meanwhile, at up to
+// 5 ppm/min. Both ways of deciding when history may start see the same
+// readings, the way the firmware gets them:
+//   fixed     waits 7 s, then polls every 30 s and trusts the third reading;
+//             the first history entry is the 5 min window average at 300 s
+//   detector  takes every reading while warming up; the level the readings
+//             settled at is the first history entry, written right away
+//   unscaled  the detector without the interval: a window of 12 readings
+//             and the time out meant for a reading every 5 s
+// --interval sets the time between readings: 5 s periodic measurement (the
+// default), 30 s low power periodic measurement, or the CO2 shot interval
+// of single shot mode, e.g. 120 s. The detector and unscaled only differ
+// beyond 5 s.
+//
+// With files, replays serial captures that start at boot (lines "CO2: X
+// ppm" with or without the "HH:MM:SS.mmm > " prefix of the PlatformIO time
+// filter; without it, readings are 5 s apart) and shows when each would
+// have been ready and at what level, against the median of the readings
+// 10 to 15 min in. Without the prefix readings are --interval apart.
+//
+// Options:
+//   --runs N            cold starts to simulate (default: 2000)
+//   --offset PPM        largest initial offset of the readings (default: 300)
+//   --tau S             largest time constant of the offset (default: 120)
+//   --noise PPM         sensor noise, standard deviation (default: 5, plus 0.5% of the reading)
+//   --interval S        time between readings (default: 5)
+//   --tolerance P,PCT   detector tolerance, ppm plus percent of the reading (default: 20,2)
+//   --max S             longest warmup at 5 s readings, stretched for longer
+//                       intervals (default: 180)
+//   --seed N            random seed (default: 1)
+//
+// Output is CSV. Simulated: per method, runs, the median and 90th
+// percentile of the time to the first history entry (s) and of its error
+// against the real level (ppm), the share off by more than the tolerance,
+// and for the detectors the share that timed out. Replayed: per file,
+// ready time (s), whether it timed out, the settled level, the reference
+// and the difference.
+
+#include <algorithm>
+#include <math.h>
+#include <random>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "WarmupDetector.h"
+
+// Firmware timing: the sensor measures every --interval from the start of
+// the measurement, 1.5 s after boot
+static const double START_S = 1.5;
+static const double FIXED_WAIT_S = 7;
+static const double FIXED_POLL_S = 30;
+static const uint8_t FIXED_READINGS = 3;
+static const double HISTORY_WINDOW_S = 300;
+
+struct Options {
+  int runs = 2000;
+  double offset = 300;
+  double tau = 120;
+  double noise = 5;
+  double interval = 5;
+  uint16_t tolerancePpm = 20;
+  uint8_t tolerancePercent = 2;
+  uint32_t maxMs = 180000;
+  unsigned seed = 1;
+  std::vector<const char*> files;
+};
+
+static double percentile(std::vector<double> values, double p) {
+  if (values.empty()) {
+    return NAN;
+  }
+  std::sort(values.begin(), values.end());
+  return values[(size_t)(p * (values.size() - 1) + 0.5)];
+}
+
+struct Result {
+  std::vector<double> times;
+  std::vector<double> errors;
+  int off = 0;
+  int timedOut = 0;
+};
+
+static void simulate(const Options& options) {
+  std::mt19937 random(options.seed);
+  std::uniform_real_distribution<double> uniform(0, 1);
+  std::normal_distribution<double> gauss(0, 1);
+  Result fixed, detector, unscaled;
+
+  // Readings until the scaled detector has surely timed out
+  WarmupDetector scaled(options.tolerancePpm, options.tolerancePercent, options.maxMs);
+  scaled.setInterval((unsigned long)(options.interval * 1000));
+  double horizon = std::max(360.0, scaled.getMaxWarmup() / 1000.0 + 2 * options.interval);
+
+  for (int run = 0; run < options.runs; run++) {
+    double level = 420 + 1080 * uniform(random);
+    double rate = uniform(random) < 1.0 / 3 ? (uniform(random) * 2 - 1) * 5 / 60 : 0;  // ppm/s
+    double offset = options.offset * (uniform(random) * 1.33 - 0.33);
+    double tau = 5 + (options.tau - 5) * uniform(random);
+
+    // Readings for the first 6 min of measurement or longer, at boot time t
+    std::vector<double> times, readings;
+    for (double t = START_S + options.interval; t <= horizon; t += options.interval) {
+      double real = level + rate * t;
+      double reading = real + offset * exp(-(t - START_S) / tau);
+      reading += gauss(random) * (options.noise + 0.005 * reading);
+      times.push_back(t);
+      readings.push_back(std::max(0.0, reading));
+    }
+    auto real = [&](double t) { return level + rate * t; };
+    auto tolerance = [&](double co2) { return options.tolerancePpm + co2 * options.tolerancePercent / 100.0; };
+
+    // Fixed: polls at 30 s steps take the newest reading; the window average
+    // at 300 s is the first entry once three readings were taken
+    double sum = 0;
+    int polls = 0;
+    for (double poll = FIXED_POLL_S; poll <= HISTORY_WINDOW_S; poll += FIXED_POLL_S) {
+      size_t newest = 0;
+      while (newest + 1 < times.size() && times[newest + 1] <= poll) {
+        newest++;
+      }
+      if (poll >= FIXED_WAIT_S + START_S) {
+        sum += readings[newest];
+        polls++;
+      }
+    }
+    if (polls >= FIXED_READINGS) {
+      double error = fabs(sum / polls - real(HISTORY_WINDOW_S / 2));
+      fixed.times.push_back(HISTORY_WINDOW_S);
+      fixed.errors.push_back(error);
+      fixed.off += error > tolerance(real(HISTORY_WINDOW_S));
+    }
+
+    // Detectors: every reading; the level they settled at is the entry
+    for (int scale = 0; scale < 2; scale++) {
+      Result& result = scale ? detector : unscaled;
+      WarmupDetector warmup(options.tolerancePpm, options.tolerancePercent, options.maxMs);
+      if (scale) {
+        warmup.setInterval((unsigned long)(options.interval * 1000));
+      }
+      warmup.restart((unsigned long)(START_S * 1000));
+      for (size_t i = 0; i < times.size(); i++) {
+        if (warmup.addReading((uint16_t)(readings[i] + 0.5), (unsigned long)(times[i] * 1000))) {
+          double error = fabs(warmup.getSettledCo2() - real(times[i]));
+          result.times.push_back(times[i]);
+          result.errors.push_back(error);
+          result.off += error > tolerance(real(times[i]));
+          result.timedOut += warmup.isTimedOut();
+          break;
+        }
+      }
+    }
+  }
+
+  printf("method,runs,first_entry_p50_s,first_entry_p90_s,error_p50,error_p90,off_tolerance,timed_out\n");
+  const Result* results[] = { &fixed, &detector, &unscaled };
+  const char* names[] = { "fixed", "detector", "unscaled" };
+  for (int i = 0; i < 3; i++) {
+    const Result& r = *results[i];
+    size_t n = r.times.empty() ? 1 : r.times.size();
+    printf("%s,%d,%.0f,%.0f,%.1f,%.1f,%.3f,%.3f\n", names[i], options.runs,
+           percentile(r.times, 0.5), percentile(r.times, 0.9),
+           percentile(r.errors, 0.5), percentile(r.errors, 0.9),
+           (double)r.off / n, (double)r.timedOut / n);
+  }
+}
+
+// "HH:MM:SS.mmm > " prefix, as ms since midnight, or -1
+static long parseTimePrefix(const char* line) {
+  int h, m, s, ms;
+  if (strlen(line) > 15 && line[2] == ':' && line[13] == '>' &&
+      sscanf(line, "%2d:%2d:%2d.%3d", &h, &m, &s, &ms) == 4) {
+    return ((h * 60L + m) * 60 + s) * 1000 + ms;
+  }
+  return -1;
+}
+
+static int replay(const Options& options) {
+  printf("file,ready_s,timed_out,settled,reference,difference\n");
+  for (const char* path : options.files) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+      fprintf(stderr, "warmup_eval: cannot open %s\n", path);
+      return 1;
+    }
+
+    // The capture starts at boot; measurement starts shortly after
+    WarmupDetector warmup(options.tolerancePpm, options.tolerancePercent, options.maxMs);
+    warmup.setInterval((unsigned long)(options.interval * 1000));
+    warmup.restart(0);
+    char line[512];
+    unsigned long now = 0;
+    long lastOfDay = -1;
+    long readyAt = -1;
+    unsigned settled = 0;
+    std::vector<double> reference;
+    while (fgets(line, sizeof(line), file)) {
+      const char* text = line;
+      long ofDay = parseTimePrefix(line);
+      if (ofDay >= 0) {
+        text += 15;
+      }
+      if (ofDay >= 0) {
+        // Time of day only; a step back is midnight. Every line counts,
+        // so the clock starts at the first line after boot.
+        long delta = lastOfDay < 0 ? 0 : ofDay - lastOfDay;
+        now += delta < 0 ? delta + 86400000L : delta;
+        lastOfDay = ofDay;
+      }
+      unsigned co2;
+      if (sscanf(text, "CO2: %u ppm", &co2) != 1 || co2 == 0 || co2 > 40000) {
+        continue;
+      }
+      if (ofDay < 0) {
+        now += (unsigned long)(options.interval * 1000);
+      }
+      if (warmup.addReading((uint16_t)co2, now)) {
+        readyAt = now;
+        settled = warmup.getSettledCo2();
+      }
+      if (now >= 600000 && now <= 900000) {
+        reference.push_back(co2);
+      }
+    }
+    fclose(file);
+
+    if (readyAt < 0) {
+      printf("%s,,,,,\n", path);
+      continue;
+    }
+    double median = percentile(reference, 0.5);
+    printf("%s,%.0f,%d,%u,%.0f,%.0f\n", path, readyAt / 1000.0, warmup.isTimedOut(), settled,
+           median, reference.empty() ? NAN : settled - median);
+  }
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    if (arg[0] != '-') {
+      options.files.push_back(arg);
+      continue;
+    }
+    const char* value = i + 1 < argc ? argv[++i] : nullptr;
+    if (!value) {
+      fprintf(stderr, "warmup_eval: %s needs a value\n", arg);
+      return 2;
+    }
+    if (!strcmp(arg, "--runs")) {
+      options.runs = atoi(value);
+    } else if (!strcmp(arg, "--offset")) {
+      options.offset = atof(value);
+    } else if (!strcmp(arg, "--tau")) {
+      options.tau = atof(value);
+    } else if (!strcmp(arg, "--noise")) {
+      options.noise = atof(value);
+    } else if (!strcmp(arg, "--interval")) {
+      options.interval = atof(value);
+    } else if (!strcmp(arg, "--tolerance")) {
+      unsigned ppm = 0, percent = 0;
+      if (sscanf(value, "%u,%u", &ppm, &percent) < 1) {
+        fprintf(stderr, "warmup_eval: --tolerance takes PPM,PCT\n");
+        return 2;
+      }
+      options.tolerancePpm = (uint16_t)ppm;
+      options.tolerancePercent = (uint8_t)percent;
+    } else if (!strcmp(arg, "--max")) {
+      options.maxMs = (uint32_t)(atof(value) * 1000);
+    } else if (!strcmp(arg, "--seed")) {
+      options.seed = (unsigned)atoi(value);
+    } else {
+      fprintf(stderr, "warmup_eval: unknown option %s\n", arg);
+      return 2;
+    }
+  }
+  if (options.runs <= 0 || !(options.tau > 5) || !(options.interval >= 1)) {
+    fprintf(stderr, "warmup_eval: --runs must be positive, --tau above 5 and --interval at least 1\n");
+    return 2;
+  }
+
+  if (!options.files.empty()) {
+    return replay(options);
+  }
+  simulate(options);
+  return 0;
+}